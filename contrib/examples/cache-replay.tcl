@@ -0,0 +1,126 @@
+#
+# Replay a trace of cache keys against ns_cache with the available
+# eviction policies and report the hit rates.
+#
+# A trace is a text file with one key per line, e.g. the URLs from an
+# access log (awk '{print $7}' access.log > trace.txt) or keys
+# recorded by an application around its ns_cache_eval calls. Traces
+# are read from the directory "logs/traces" below the home directory
+# of the server and are limited to 10MB. When no trace is given, a
+# synthetic trace is generated, where requests for a set of popular
+# keys are interleaved with scans over keys used only once.
+#
+# The replay uses the caches "replay:<policy>:<shards>", which are
+# flushed and have their statistics reset after every replay.
+#
+# Query parameters:
+#
+#    trace      name of the trace file (default: synthetic trace)
+#    size       size of the cache (default 1MB)
+#    valuesize  size of a cached value in bytes (default 1000, max. 1MB)
+#    shards     number of shards of the cache, 1, 2, 4, 8 or 16 (default 1)
+#
+
+set tracedir     [file join [ns_info home] logs traces]
+set maxtracesize 10MB
+
+set trace     [ns_queryget trace ""]
+set size      [ns_queryget size 1MB]
+set valuesize [ns_queryget valuesize 1000]
+set shards    [ns_queryget shards 1]
+
+if {![string is integer -strict $valuesize] || $valuesize < 0 || $valuesize > 1048576
+    || $shards ni {1 2 4 8 16}
+    || [catch {ns_baseunit -size $size}]
+} {
+    ns_return 400 text/plain "invalid query parameters"
+    return
+}
+
+if {$trace ne ""} {
+    set path [file join $tracedir $trace]
+    if {[file tail $trace] ne $trace || $trace in {. ..}
+        || ![file isfile $path] || ![file readable $path]
+    } {
+        ns_return 404 text/plain "trace file '$trace' is not readable"
+        return
+    }
+    if {[file size $path] > [ns_baseunit -size $maxtracesize]} {
+        ns_return 413 text/plain "trace file '$trace' is larger than $maxtracesize"
+        return
+    }
+    set fd [open $path]
+    set keys [split [string trim [read $fd [ns_baseunit -size $maxtracesize]]] \n]
+    close $fd
+    set source "trace file <code>[ns_quotehtml $trace]</code>"
+} else {
+    #
+    # Synthetic trace: 80% of the requests go to 200 popular keys (with
+    # skewed popularity), every 5000 requests a scan requests 1000 keys
+    # only once.
+    #
+    expr {srand(4711)}
+    set keys {}
+    set scan 0
+    for {set i 0} {$i < 100000} {incr i} {
+        if {rand() < 0.8} {
+            lappend keys hot[expr {int(200 * rand() * rand())}]
+        } else {
+            lappend keys cold[expr {int(100000 * rand())}]
+        }
+        if {$i % 5000 == 4999} {
+            for {set j 0} {$j < 1000} {incr j} {
+                lappend keys scan$scan-$j
+            }
+            incr scan
+        }
+    }
+    set source "synthetic trace"
+}
+
+set value [string repeat x $valuesize]
+
+append data "<h2>Cache Replay</h2>" \
+    "Replayed $source with [llength $keys] requests " \
+    "against caches of size $size with $shards shard(s).<p>" \
+    "<table border='1' cellpadding='4'>" \
+    "<tr><th>policy</th><th>hit rate</th><th>misses</th>" \
+    "<th>pruned</th><th>rejected</th><th>time</th></tr>"
+
+foreach policy {lru tinylfu} {
+    set cache replay:$policy:$shards
+    if {![ns_cache_create -policy $policy -shards $shards -- $cache $size]} {
+        ns_cache_flush $cache
+        ns_cache_configure $cache -maxsize $size
+    }
+
+    set ::misses 0
+    set start [clock microseconds]
+    foreach key $keys {
+        ns_cache_eval -- $cache $key {incr ::misses; set value}
+    }
+    set ms [expr {([clock microseconds] - $start) / 1000.0}]
+
+    set stats [ns_cache_stats -reset -- $cache]
+    ns_cache_flush $cache
+
+    append data "<tr><td>$policy</td>" \
+        "<td>[format %.2f [expr {100.0 * ([llength $keys] - $::misses) / [llength $keys]}]]%</td>" \
+        "<td>$::misses</td>" \
+        "<td>[dict get $stats pruned]</td>" \
+        "<td>[dict get $stats rejected]</td>" \
+        "<td>[format %.1f $ms] ms</td></tr>"
+}
+append data "</table><p>" \
+    "Use the query parameters <code>trace</code>, <code>size</code>, " \
+    "<code>valuesize</code> and <code>shards</code> to change the setup.<p>" \
+    "Back to <a href='.'>example page</a>.<br>"
+
+ns_return 200 text/html $data
+
+#
+# Local variables:
+#    mode: tcl
+#    tcl-indent-level: 4
+#    indent-tabs-mode: nil
+# End:
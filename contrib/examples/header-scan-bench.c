@@ -0,0 +1,234 @@
+/*
+ * The contents of this file are subject to the Mozilla Public License
+ * Version 1.1 (the "License"); you may not use this file except in
+ * compliance with the License. You may obtain a copy of the License at
+ * http://mozilla.org/.
+ *
+ * Software distributed under the License is distributed on an "AS IS"
+ * basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See
+ * the License for the specific language governing rights and limitations
+ * under the License.
+ *
+ * Alternatively, the contents of this file may be used under the terms
+ * of the GNU General Public License (the "GPL"), in which case the
+ * provisions of GPL are applicable instead of those above.  If you wish
+ * to allow use of your version of this file only under the terms of the
+ * GPL and not to allow others to use your version of this file under the
+ * License, indicate your decision by deleting the provisions above and
+ * replace them with the notice and other provisions required by the GPL.
+ * If you do not delete the provisions above, a recipient may use your
+ * version of this file under either the License or the GPL.
+ */
+
+/*
+ * header-scan-bench.c --
+ *
+ *      Micro benchmark of the header scan of the driver. A request with
+ *      the given size and number of header fields is received in segments
+ *      of the given size, like in SockParse(). Two variants are measured:
+ *
+ *      rescan: every read scans for the line end from the begin of the
+ *              current line, and the line is split with Ns_ParseHeader(),
+ *              which determines the length of the line again.
+ *
+ *      resume: the scan continues after the data scanned by the previous
+ *              read, and the line is split with NsParseHeaderLine() using
+ *              the known length (current driver).
+ *
+ *      Both variants copy the request to the receive buffer and add the
+ *      fields to an Ns_Set. The result is reported in ns per request.
+ *
+ * Build (with NaviServer installed in /usr/local/ns):
+ *
+ *      cc -O2 -DHAVE_CONFIG_H -I/usr/local/ns/include -I/usr/include/tcl8.6 \
+ *          -o header-scan-bench header-scan-bench.c \
+ *          -L/usr/local/ns/lib -Wl,-rpath,/usr/local/ns/lib \
+ *          -lnsd -lnsthread -ltcl8.6
+ *
+ * usage: header-scan-bench ?size? ?fields? ?segment? ?iterations?
+ *
+ *      size        approximate size of the request in bytes (default 4096)
+ *      fields      number of header fields (default 40)
+ *      segment     bytes per read, 0 for the whole request (default 0)
+ *      iterations  number of parsed requests per round (default 100000)
+ */
+
+#include "ns.h"
+
+/*
+ * Internal function of libnsd (see nsd/nsd.h).
+ */
+extern Ns_ReturnCode NsParseHeaderLine(Ns_Set *set, char *line, size_t lineLength,
+                                       Ns_HeaderCaseDisposition disp, bool slice,
+                                       size_t *fieldNumberPtr);
+
+static double ParseRequests(const char *request, size_t length, size_t segment,
+                            long iterations, bool resume, size_t *fieldsPtr);
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * ParseRequests --
+ *
+ *      Receive and parse the request the given number of times.
+ *
+ * Results:
+ *      Elapsed time in ns per request. The number of fields of the last
+ *      request is returned in fieldsPtr.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static double
+ParseRequests(const char *request, size_t length, size_t segment,
+              long iterations, bool resume, size_t *fieldsPtr)
+{
+    Ns_Set  *set = Ns_SetCreate("headers");
+    char    *buffer = ns_malloc(length + 1u);
+    Ns_Time  start, end, diff;
+    long     i;
+
+    Ns_GetTime(&start);
+    for (i = 0; i < iterations; i++) {
+        size_t roff = 0u, received = 0u, scanoff = 0u;
+        bool   firstLine = NS_TRUE;
+
+        Ns_SetTrunc(set, 0u);
+        while (received < length) {
+            size_t n = (segment == 0u || received + segment > length)
+                ? length - received : segment;
+
+            /*
+             * Receive the next segment, then consume all complete lines.
+             */
+            memcpy(buffer + received, request + received, n);
+            received += n;
+            buffer[received] = '\0';
+
+            for (;;) {
+                char   *s = buffer + roff, *e;
+                size_t  avail = received - roff, cnt;
+
+                if (resume) {
+                    e = memchr(s + scanoff, INTCHAR('\n'), avail - scanoff);
+                } else {
+                    e = memchr(s, INTCHAR('\n'), avail);
+                }
+                if (e == NULL) {
+                    scanoff = avail;
+                    break;
+                }
+                scanoff = 0u;
+                cnt = (size_t)(e - s) + 1u;
+                if (e > s && *(e-1) == '\r') {
+                    --e;
+                }
+                if (e == s) {
+                    /*
+                     * End of the headers.
+                     */
+                    roff += cnt;
+                    break;
+                }
+                *e = '\0';
+                if (firstLine) {
+                    firstLine = NS_FALSE;
+                } else if (resume) {
+                    (void) NsParseHeaderLine(set, s, (size_t)(e - s), Preserve, NS_FALSE, NULL);
+                } else {
+                    (void) Ns_ParseHeader(set, s, NULL, Preserve, NULL);
+                }
+                roff += cnt;
+            }
+        }
+    }
+    Ns_GetTime(&end);
+    (void) Ns_DiffTime(&end, &start, &diff);
+
+    *fieldsPtr = Ns_SetSize(set);
+    Ns_SetFree(set);
+    ns_free(buffer);
+
+    return ((double)diff.sec * 1e9 + (double)diff.usec * 1e3) / (double)iterations;
+}
+
+int
+main(int argc, char *argv[])
+{
+    Tcl_DString ds;
+    size_t      size = 4096u, fields = 40u, segment = 0u, valueLength, parsed, i, j;
+    long        iterations = 100000;
+    int         round;
+    double      rescan, resume;
+
+    if (argc > 1) {
+        size = (size_t)strtoul(argv[1], NULL, 10);
+    }
+    if (argc > 2) {
+        fields = (size_t)strtoul(argv[2], NULL, 10);
+    }
+    if (argc > 3) {
+        segment = (size_t)strtoul(argv[3], NULL, 10);
+    }
+    if (argc > 4) {
+        iterations = strtol(argv[4], NULL, 10);
+    }
+    if (fields == 0u || iterations <= 0) {
+        fprintf(stderr, "usage: %s ?size? ?fields? ?segment? ?iterations?\n", argv[0]);
+        return 1;
+    }
+    Nsd_LibInit();
+
+    /*
+     * Build the request with fields of equal length.
+     */
+    Tcl_DStringInit(&ds);
+    Tcl_DStringAppend(&ds, "GET /index.html HTTP/1.1\r\n", -1);
+    valueLength = size > (size_t)ds.length + fields * 24u + 2u
+        ? (size - (size_t)ds.length - 2u) / fields - 22u : 1u;
+    for (i = 0u; i < fields; i++) {
+        Ns_DStringPrintf(&ds, "X-Header-Field-%04lu: ", (unsigned long)i);
+        for (j = 0u; j < valueLength; j++) {
+            Tcl_DStringAppend(&ds, "abcdefghijklmnopqrstuvwxyz" + (j % 26u), 1);
+        }
+        Tcl_DStringAppend(&ds, "\r\n", 2);
+    }
+    Tcl_DStringAppend(&ds, "\r\n", 2);
+
+    /*
+     * Alternate the variants and report the best of 5 rounds to reduce
+     * the noise.
+     */
+    rescan = resume = 0.0;
+    for (round = 0; round < 5; round++) {
+        double t;
+
+        t = ParseRequests(ds.string, (size_t)ds.length, segment, iterations, NS_FALSE, &parsed);
+        if (round == 0 || t < rescan) {
+            rescan = t;
+        }
+        t = ParseRequests(ds.string, (size_t)ds.length, segment, iterations, NS_TRUE, &parsed);
+        if (round == 0 || t < resume) {
+            resume = t;
+        }
+    }
+
+    printf("size %d fields %lu segment %lu: rescan %.0f ns resume %.0f ns per request\n",
+           ds.length, (unsigned long)parsed, (unsigned long)segment, rescan, resume);
+    Tcl_DStringFree(&ds);
+
+    return 0;
+}
+
+/*
+ * Local Variables:
+ * mode: c
+ * c-basic-offset: 4
+ * fill-column: 78
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -268,9 +268,16 @@ typedef enum {
  * Typedefs of variables
  */
 
+typedef enum {
+    NS_CACHE_POLICY_LRU,
+    NS_CACHE_POLICY_TINYLFU
+} Ns_CachePolicy;
+
 typedef struct Ns_CacheSearch {
-    Ns_Time        now;
-    Tcl_HashSearch hsearch;
+    Ns_Time          now;
+    Tcl_HashSearch   hsearch;
+    struct Ns_Cache *cache;
+    int              shardIdx;
 } Ns_CacheSearch;
 
 typedef struct Ns_Cache         Ns_Cache;
@@ -431,6 +438,11 @@ typedef struct Ns_Set {
     Tcl_DString  data;
 #endif
     Ns_SetField *fields;
+#ifndef NS_SET_DSTRING
+    const char  *sliceStart;   /* Memory region of strings not owned by the set, */
+    const char  *sliceEnd;     /* e.g. request headers in the request buffer */
+#endif
+    struct Ns_SetIndex *index; /* Hash index over the keys, maintained for large sets */
 } Ns_Set;
 
 /*
@@ -831,6 +843,15 @@ Ns_CacheCreateEx(const char *name, int keys, time_t ttl, size_t maxSize,
                  Ns_FreeProc *freeProc)
     NS_GNUC_NONNULL(1);
 
+NS_EXTERN Ns_Cache *
+Ns_CacheCreateSharded(const char *name, int keys, size_t maxSize, Ns_FreeProc *freeProc,
+                      int nshards)
+    NS_GNUC_NONNULL(1);
+
+NS_EXTERN Ns_Cache *
+Ns_CacheGetShard(Ns_Cache *cache, const char *key)
+    NS_GNUC_NONNULL(1) NS_GNUC_NONNULL(2) NS_GNUC_RETURNS_NONNULL;
+
 NS_EXTERN void
 Ns_CacheDestroy(Ns_Cache *cache)
     NS_GNUC_NONNULL(1);
@@ -843,6 +864,10 @@ NS_EXTERN Ns_Entry *
 Ns_CacheFindEntryT(Ns_Cache *cache, const char *key, const Ns_CacheTransactionStack *transactionStackPtr)
     NS_GNUC_NONNULL(1) NS_GNUC_NONNULL(2);
 
+NS_EXTERN Ns_Entry *
+Ns_CacheLookupEntry(Ns_Cache *cache, const char *key)
+    NS_GNUC_NONNULL(1) NS_GNUC_NONNULL(2);
+
 NS_EXTERN Ns_Entry *
 Ns_CacheCreateEntry(Ns_Cache *cache, const char *key, int *newPtr)
     NS_GNUC_NONNULL(1) NS_GNUC_NONNULL(2) NS_GNUC_NONNULL(3);
@@ -857,6 +882,12 @@ Ns_CacheWaitCreateEntryT(Ns_Cache *cache, const char *key, int *newPtr,
                         const Ns_Time *timeoutPtr, const Ns_CacheTransactionStack *transactionStackPtr)
     NS_GNUC_NONNULL(1) NS_GNUC_NONNULL(2) NS_GNUC_NONNULL(3);
 
+NS_EXTERN Ns_Entry *
+Ns_CacheWaitCreateEntryStaleT(Ns_Cache *cache, const char *key, int *newPtr,
+                              const Ns_Time *timeoutPtr, const Ns_Time *staleTimePtr,
+                              const Ns_CacheTransactionStack *transactionStackPtr)
+    NS_GNUC_NONNULL(1) NS_GNUC_NONNULL(2) NS_GNUC_NONNULL(3);
+
 NS_EXTERN const char *
 Ns_CacheName(const Ns_Cache *cache)
     NS_GNUC_NONNULL(1) NS_GNUC_PURE;
@@ -869,6 +900,10 @@ NS_EXTERN void *
 Ns_CacheGetValue(const Ns_Entry *entry)
     NS_GNUC_NONNULL(1) NS_GNUC_PURE;
 
+NS_EXTERN void *
+Ns_CacheGetStaleValue(const Ns_Entry *entry)
+    NS_GNUC_NONNULL(1) NS_GNUC_PURE;
+
 NS_EXTERN size_t
 Ns_CacheGetReuse(const Ns_Entry *entry)
     NS_GNUC_NONNULL(1) NS_GNUC_PURE;
@@ -885,6 +920,10 @@ NS_EXTERN uintptr_t
 Ns_CacheGetTransactionEpoch(const Ns_Entry *entry)
     NS_GNUC_NONNULL(1) NS_GNUC_PURE;
 
+NS_EXTERN int
+Ns_CacheGetCost(const Ns_Entry *entry)
+    NS_GNUC_NONNULL(1) NS_GNUC_PURE;
+
 NS_EXTERN unsigned long
 Ns_CacheCommitEntries(Ns_Cache *cache, uintptr_t epoch)
     NS_GNUC_NONNULL(1);
@@ -987,6 +1026,14 @@ NS_EXTERN void
 Ns_CacheSetMaxSize(Ns_Cache *cache, size_t maxSize)
     NS_GNUC_NONNULL(1);
 
+NS_EXTERN Ns_CachePolicy
+Ns_CacheGetPolicy(const Ns_Cache *cache)
+    NS_GNUC_NONNULL(1) NS_GNUC_PURE;
+
+NS_EXTERN void
+Ns_CacheSetPolicy(Ns_Cache *cache, Ns_CachePolicy policy)
+    NS_GNUC_NONNULL(1);
+
 NS_EXTERN int
 Ns_CacheGetNrUncommittedEntries(const Ns_Cache *cache)
     NS_GNUC_NONNULL(1) NS_GNUC_PURE;
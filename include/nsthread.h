@@ -504,6 +504,7 @@ typedef int ns_sockerrno_t;
 # define ns_read                    read
 # define ns_write                   write
 # define ns_lseek                   lseek
+# define ns_pread                   pread
 
 # if __GNUC__
 #  if defined(__x86_64__) || defined(__ppc64__)
@@ -1137,6 +1138,7 @@ NS_EXTERN const char *Ns_ThreadGetName(void)       NS_GNUC_RETURNS_NONNULL;
 NS_EXTERN const char *Ns_ThreadGetParent(void)     NS_GNUC_RETURNS_NONNULL;
 NS_EXTERN ssize_t Ns_ThreadStackSize(ssize_t size);
 NS_EXTERN void Ns_ThreadList(Tcl_DString *dsPtr, Ns_ThreadArgProc *proc) NS_GNUC_NONNULL(1);
+NS_EXTERN Ns_ReturnCode Ns_ThreadSetAffinity(const char *cpus) NS_GNUC_NONNULL(1);
 NS_EXTERN void Ns_ThreadGetThreadInfo(size_t *maxStackSize, size_t *estimatedSize)
   NS_GNUC_NONNULL(1) NS_GNUC_NONNULL(2);
 extern void  *NsThreadResult(void *arg);
@@ -1188,6 +1190,7 @@ NS_EXTERN int     ns_close(int fildes);
 NS_EXTERN ssize_t ns_write(int fildes, const void *buf, size_t nbyte);
 NS_EXTERN ssize_t ns_read(int fildes, void *buf, size_t nbyte);
 NS_EXTERN off_t   ns_lseek(int fildes, off_t offset, int whence);
+NS_EXTERN ssize_t ns_pread(int fildes, void *buf, size_t nbyte, off_t offset);
 NS_EXTERN ssize_t ns_recv(NS_SOCKET socket, void *buffer, size_t length, int flags);
 NS_EXTERN ssize_t ns_send(NS_SOCKET socket, const void *buffer, size_t length, int flags);
 NS_EXTERN int     ns_snprintf(char *buf, size_t len, const char *fmt, ...);
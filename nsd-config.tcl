@@ -87,6 +87,9 @@ ns_section ns/parameters {
 
     #ns_param   progressminsize     1MB      ;# default: 0
     #ns_param   listenbacklog       256      ;# default: 32; backlog for ns_socket commands
+    #ns_param   filewatch           true     ;# default: false; watch page files via inotify instead of stat() per request
+    #ns_param   filewatchinterval   1m       ;# default: 1m; repeat stat() of watched files after this time
+    #ns_param   filewatchpaths      {/nfs/pages/} ;# default: all; path prefixes of watched files
 
     # Reject output operations on already closed or detached connections (e.g. subsequent ns_return statements)
     #ns_param   rejectalreadyclosedconn false;# default: true
@@ -158,6 +161,7 @@ ns_section ns/fastpath {
     #ns_param   cachemaxsize        10MB       ;# default: 10MB
     #ns_param   cachemaxentry       8kB        ;# default: 8kB
     #ns_param   mmap                false      ;# default: false
+    #ns_param   fdcachesize         0          ;# number of cached open files; default: 0 (off)
     ns_param    gzip_static         true       ;# check for static gzip; default: false
     ns_param    gzip_refresh        true       ;# refresh stale .gz files on the fly using ::ns_gzipfile
     ns_param    gzip_cmd            "/usr/bin/gzip -9"  ;# use for re-compressing
@@ -204,6 +208,7 @@ if {[info exists httpport] && $httpport ne ""} {
         ns_param recvwait	$max_file_upload_duration  ;# 30s, timeout for receive operations
         #ns_param keepalivemaxuploadsize   0.5MB           ;# 0, don't allow keep-alive for upload content larger than this
         #ns_param keepalivemaxdownloadsize 1MB             ;# 0, don't allow keep-alive for download content larger than this
+        #ns_param keepalivebufsize         64KB            ;# 64KB, release request buffers larger than this after a request
 
         #
         # Spooling Threads
@@ -215,6 +220,7 @@ if {[info exists httpport] && $httpport ne ""} {
 
         #ns_param spoolerthreads  1		;# default: 0; number of upload spooler threads
         #ns_param driverthreads   2		;# default: 1, number of driver threads (requires support of SO_REUSEPORT)
+        #ns_param cpuaffinity     {0-7 8-15} ;# default: "", CPU sets of the driver threads (Linux only)
 
         #
         # TCP tuning
@@ -276,6 +282,7 @@ if {[info exists httpsport] && $httpsport ne ""} {
         ns_param recvwait	$max_file_upload_duration  ;# 30s, timeout for receive operations
         #ns_param keepalivemaxuploadsize   0.5MB           ;# 0, don't allow keep-alive for upload content larger than this
         #ns_param keepalivemaxdownloadsize 1MB             ;# 0, don't allow keep-alive for download content larger than this
+        #ns_param keepalivebufsize         64KB            ;# 64KB, release request buffers larger than this after a request
 
         #
         # Spooling Threads
@@ -287,6 +294,7 @@ if {[info exists httpsport] && $httpsport ne ""} {
 
         #ns_param spoolerthreads  1		;# default: 0; number of upload spooler threads
         #ns_param driverthreads   2		;# default: 1, number of driver threads (requires support of SO_REUSEPORT)
+        #ns_param cpuaffinity     {0-7 8-15} ;# default: "", CPU sets of the driver threads (Linux only)
 
         #
         # TCP tuning
@@ -348,7 +356,14 @@ ns_section ns/server/default {
     ns_param    maxthreads          100   ;# default: 10; maximal number of connection threads
     #ns_param    maxconnections     100   ;# default: 100; number of allocated connection structures
     ns_param    rejectoverrun       true  ;# default: false; send 503 when thread pool queue overruns
+    #ns_param   queuedelaytarget    50ms  ;# default: 0s; send 503 when the minimum queue delay is above this value
+    #ns_param   queuedelayinterval  100ms ;# default: 100ms; interval for measuring the minimum queue delay
+    #ns_param   fairqueuekey        peeraddr ;# default: ""; serve waiting requests round-robin per peer address or header field
+    #ns_param   fairqueueweights    {10.0.0.* 4} ;# default: ""; key patterns with number of requests served in a row
+    #ns_param   cpuaffinity         driver ;# default: ""; CPU set (e.g. 0-7) of the connection threads or "driver"
     #ns_param   threadtimeout       2m    ;# default: 2m; timeout for idle connection threads
+    #ns_param   autoscaletarget     20ms  ;# default: 0s; size the pool for this p95 queue delay
+    #ns_param   autoscaleinterval   1s    ;# default: 1s; interval for measuring the queue delays
     #ns_param   concurrentcreatethreshold 100 ;# default: 80; perform concurrent creates when queue is fully beyond this percentage
     ;# 100 is a conservative value, disabling concurrent creates
     #ns_param    connectionratelimit 200  ;# 0; limit rate per connection to this amount (KB/s); 0 means unlimited
@@ -388,15 +403,21 @@ ns_section ns/server/default/adp {
     #ns_param   enabledebug         true     ;# default: false
     #ns_param   enabletclpages      true     ;# default: false
     #ns_param   singlescript        false    ;# default: false; collapse Tcl blocks to a single Tcl script
+    #ns_param   compile             false    ;# default: false; run pages as a single compiled procedure body
     #ns_param   cache               false    ;# default: false; enable ADP caching
     #ns_param   cachesize           5MB
     #ns_param   bufsize             1MB
+    #ns_param   streamsize          16KB     ;# default: 0; chunk size of streamed ADP output
 }
 
 ns_section ns/server/default/tcl {
     ns_param    nsvbuckets          16       ;# default: 8
     ns_param    nsvrwlocks          false    ;# default: true
     ns_param    library             modules/tcl
+    #ns_param   deltalogsize        100      ;# default: 100; number of blueprint deltas for incremental updates
+    #ns_param   lazyprocs           true     ;# default: false; compile procs in interps on first call
+    #ns_param   cachesnapshot       cache.snapshot ;# default: none; save caches at shutdown, load at startup
+    #ns_param   cachesnapshotcaches "*"      ;# default: *; patterns of caches in the snapshot
     #
     # Example for initcmds (to be executed, when this server is fully initialized).
     #
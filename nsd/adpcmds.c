@@ -53,7 +53,9 @@ static int GetInterp(Tcl_Interp *interp, NsInterp **itPtrPtr) NS_GNUC_NONNULL(1)
 static int AdpFlushObjCmd(ClientData clientData, Tcl_Interp *interp, int objc,
                           Tcl_Obj *const* objv, bool doStream);
 
-static Tcl_ObjCmdProc AdpCtlBufSizeObjCmd;
+static int AdpCtlSizeObjCmd(Tcl_Interp *interp, int objc, Tcl_Obj *const* objv,
+                            size_t *sizePtr, int minSize)
+    NS_GNUC_NONNULL(1) NS_GNUC_NONNULL(4);
 
 
 /*
@@ -105,7 +107,8 @@ NsAdpAppend(NsInterp *itPtr, const char *buf, int len)
     } else {
         Ns_DStringNAppend(bufPtr, buf, len);
         if (
-            ((itPtr->adp.flags & ADP_STREAM) != 0u
+            (((itPtr->adp.flags & ADP_STREAM) != 0u
+              && (size_t)bufPtr->length >= itPtr->adp.streamsize)
              || (size_t)bufPtr->length > itPtr->adp.bufsize
              )
             && NsAdpFlush(itPtr, NS_TRUE) != TCL_OK) {
@@ -221,13 +224,13 @@ NsTclAdpIdentObjCmd(ClientData clientData, Tcl_Interp *interp, int objc, Tcl_Obj
  */
 
 static int
-AdpCtlBufSizeObjCmd(ClientData clientData, Tcl_Interp *interp, int objc, Tcl_Obj *const* objv)
+AdpCtlSizeObjCmd(Tcl_Interp *interp, int objc, Tcl_Obj *const* objv,
+                 size_t *sizePtr, int minSize)
 {
     int               intVal = -1, result = TCL_OK;
-    NsInterp         *itPtr = clientData;
-    Ns_ObjvValueRange bufsizeRange = {1, INT_MAX};
+    Ns_ObjvValueRange sizeRange = {minSize, INT_MAX};
     Ns_ObjvSpec args[] = {
-        {"?size", Ns_ObjvInt,  &intVal, &bufsizeRange},
+        {"?size", Ns_ObjvInt,  &intVal, &sizeRange},
         {NULL, NULL, NULL, NULL}
     };
 
@@ -235,9 +238,9 @@ AdpCtlBufSizeObjCmd(ClientData clientData, Tcl_Interp *interp, int objc, Tcl_Obj
         result = TCL_ERROR;
     } else {
         if (intVal > -1) {
-            itPtr->adp.bufsize = (size_t)intVal;
+            *sizePtr = (size_t)intVal;
         }
-        Tcl_SetObjResult(interp, Tcl_NewWideIntObj((Tcl_WideInt)itPtr->adp.bufsize));
+        Tcl_SetObjResult(interp, Tcl_NewWideIntObj((Tcl_WideInt)*sizePtr));
     }
     return result;
 }
@@ -251,8 +254,9 @@ NsTclAdpCtlObjCmd(ClientData clientData, Tcl_Interp *interp, int objc, Tcl_Obj *
     unsigned int flag, oldFlag;
 
     enum {
-        CBufSizeIdx = ADP_OPTIONMAX + 1u,
-        CChanIdx    = ADP_OPTIONMAX + 2u
+        CBufSizeIdx    = ADP_OPTIONMAX + 1u,
+        CChanIdx       = ADP_OPTIONMAX + 2u,
+        CStreamSizeIdx = ADP_OPTIONMAX + 3u
     };
 
     static const struct {
@@ -261,8 +265,10 @@ NsTclAdpCtlObjCmd(ClientData clientData, Tcl_Interp *interp, int objc, Tcl_Obj *
     } adpCtlOpts[] = {
         { "bufsize",      (unsigned)CBufSizeIdx },
         { "channel",      (unsigned)CChanIdx },
+        { "streamsize",   (unsigned)CStreamSizeIdx },
         { "autoabort",    ADP_AUTOABORT },
         { "cache",        ADP_CACHE },
+        { "compile",      ADP_COMPILE },
         { "detailerror",  ADP_DETAIL },
         { "displayerror", ADP_DISPLAY },
         { "expire",       ADP_EXPIRE },
@@ -290,7 +296,11 @@ NsTclAdpCtlObjCmd(ClientData clientData, Tcl_Interp *interp, int objc, Tcl_Obj *
         switch (flag) {
 
         case CBufSizeIdx:
-            result = AdpCtlBufSizeObjCmd(clientData, interp, objc, objv);
+            result = AdpCtlSizeObjCmd(interp, objc, objv, &itPtr->adp.bufsize, 1);
+            break;
+
+        case CStreamSizeIdx:
+            result = AdpCtlSizeObjCmd(interp, objc, objv, &itPtr->adp.streamsize, 0);
             break;
 
         case CChanIdx:
@@ -125,6 +125,9 @@ static void FreeObjs(Objs *objsPtr)
 static void AdpTrace(const NsInterp *itPtr, const char *ptr, int len)
     NS_GNUC_NONNULL(1) NS_GNUC_NONNULL(2);
 
+static int CompiledErrorLine(Tcl_Interp *interp)
+    NS_GNUC_NONNULL(1);
+
 static Ns_Callback FreeInterpPage;
 static Ns_ServerInitProc ConfigServerAdp;
 
@@ -186,6 +189,8 @@ ConfigServerAdp(const char *server)
                                                            1000 * 1024, INT_MAX);
     servPtr->adp.bufsize   = (size_t)Ns_ConfigMemUnitRange(path, "bufsize",  "1MB",  1024 * 1000,
                                                            100 * 1024, INT_MAX);
+    servPtr->adp.streamsize = (size_t)Ns_ConfigMemUnitRange(path, "streamsize", "0", 0,
+                                                            0, INT_MAX);
     servPtr->adp.defaultExtension = ns_strcopy(Ns_ConfigString(path, "defaultextension", NULL));
 
     servPtr->adp.flags = 0u;
@@ -195,6 +200,7 @@ ConfigServerAdp(const char *server)
     (void) Ns_ConfigFlag(path, "enabledebug",  ADP_DEBUG,     0, &servPtr->adp.flags);
     (void) Ns_ConfigFlag(path, "safeeval",     ADP_SAFE,      0, &servPtr->adp.flags);
     (void) Ns_ConfigFlag(path, "singlescript", ADP_SINGLE,    0, &servPtr->adp.flags);
+    (void) Ns_ConfigFlag(path, "compile",      ADP_COMPILE,   0, &servPtr->adp.flags);
     (void) Ns_ConfigFlag(path, "trace",        ADP_TRACE,     0, &servPtr->adp.flags);
     (void) Ns_ConfigFlag(path, "detailerror",  ADP_DETAIL,    1, &servPtr->adp.flags);
     (void) Ns_ConfigFlag(path, "stricterror",  ADP_STRICT,    0, &servPtr->adp.flags);
@@ -399,9 +405,11 @@ NsAdpReset(NsInterp *itPtr)
     itPtr->adp.conn = NULL;
     if (itPtr->servPtr != NULL) {
         itPtr->adp.bufsize = itPtr->servPtr->adp.bufsize;
+        itPtr->adp.streamsize = itPtr->servPtr->adp.streamsize;
         itPtr->adp.flags = itPtr->servPtr->adp.flags;
     } else {
         itPtr->adp.bufsize = 1024u * 1000u;
+        itPtr->adp.streamsize = 0u;
         itPtr->adp.flags = 0u;
     }
     Tcl_DStringSetLength(&itPtr->adp.output, 0);
@@ -503,7 +511,7 @@ AdpSource(NsInterp *itPtr, int objc, Tcl_Obj *const* objv, const char *file,
      * Verify the file is an existing, ordinary file and get page code.
      */
 
-    if (stat(file, &st) != 0) {
+    if (!NsFileWatchStat(file, &st)) {
         Ns_TclPrintfResult(interp, "could not stat \"%s\": %s",
                            file, Tcl_PosixError(interp));
     } else if (!S_ISREG(st.st_mode)) {
@@ -1136,6 +1144,35 @@ AdpExec(NsInterp *itPtr, int objc, Tcl_Obj *const* objv, const char *file,
                 result = AdpDebug(itPtr, ptr, len, nscript);
             } else if (objsPtr == NULL) {
                 result = Tcl_EvalEx(interp, ptr, len, 0);
+            } else if ((itPtr->adp.flags & (ADP_COMPILE|ADP_TCLFILE)) == ADP_COMPILE) {
+                /*
+                 * Compiled page: evaluate the body as a lambda, which is
+                 * compiled once per interp into a procedure body.
+                 */
+                assert(nscript < objsPtr->nobjs);
+                objPtr = objsPtr->objs[nscript];
+                if (objPtr == NULL) {
+                    Tcl_Obj *lambdaObjv[2], *cmdObjv[2];
+
+                    lambdaObjv[0] = Tcl_NewObj();
+                    lambdaObjv[1] = Tcl_NewStringObj(ptr, len);
+                    cmdObjv[0] = Tcl_NewStringObj("::apply", 7);
+                    cmdObjv[1] = Tcl_NewListObj(2, lambdaObjv);
+                    objPtr = Tcl_NewListObj(2, cmdObjv);
+                    Tcl_IncrRefCount(objPtr);
+                    objsPtr->objs[nscript] = objPtr;
+                }
+                result = Tcl_EvalObjEx(interp, objPtr, 0);
+                if (result == TCL_ERROR && itPtr->adp.exception == ADP_OK) {
+                    /*
+                     * The error line of the interp refers to the apply
+                     * command; use the line of the body, excluding the
+                     * header line (lines of the frame start with 0).
+                     */
+                    int line = CompiledErrorLine(interp) - 2;
+
+                    frame.line = (unsigned short)MAX(line, 0);
+                }
             } else {
                 assert(nscript < objsPtr->nobjs);
                 objPtr = objsPtr->objs[nscript];
@@ -1210,7 +1247,52 @@ AdpExec(NsInterp *itPtr, int objc, Tcl_Obj *const* objv, const char *file,
     return result;
 }
 
+
+
 
+/*
+ *----------------------------------------------------------------------
+ *
+ * CompiledErrorLine --
+ *
+ *      Determine the line of an error in the body of a compiled page.
+ *      The "-errorline" of the error in the body is passed by the
+ *      "try" command around the body as return option "-adpline" (see
+ *      COMPILE_TRAILER in adpparse.c).
+ *
+ * Results:
+ *      Line in the body, or 0 when not available.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+CompiledErrorLine(Tcl_Interp *interp)
+{
+    Tcl_Obj *optionsObj, *keyObj, *lineObj = NULL;
+    int      line = 0;
+
+    NS_NONNULL_ASSERT(interp != NULL);
+
+    optionsObj = Tcl_GetReturnOptions(interp, TCL_ERROR);
+    Tcl_IncrRefCount(optionsObj);
+    keyObj = Tcl_NewStringObj("-adpline", 8);
+    Tcl_IncrRefCount(keyObj);
+    if (Tcl_DictObjGet(NULL, optionsObj, keyObj, &lineObj) != TCL_OK
+        || lineObj == NULL
+        || Tcl_GetIntFromObj(NULL, lineObj, &line) != TCL_OK) {
+        line = 0;
+    }
+    Tcl_DecrRefCount(keyObj);
+    Tcl_DecrRefCount(optionsObj);
+
+    return line;
+}
+
+
 /*
  *----------------------------------------------------------------------
  *
@@ -47,6 +47,20 @@
 #define APPEND      "ns_adp_append "
 #define APPEND_LEN  (sizeof(APPEND) - 1u)
 
+/*
+ * Header and trailer of compiled ADP pages. The page is evaluated in a
+ * "try" command, which passes the "-errorline" of an error in the body
+ * as return option "-adpline" to the caller (see AdpExec() in
+ * adpeval.c). The "-errorline" of the lambda term is reset to the line
+ * of the caller when the lambda returns.
+ */
+#define COMPILE_HEADER      "::try {\n"
+#define COMPILE_HEADER_LEN  (sizeof(COMPILE_HEADER) - 1u)
+#define COMPILE_TRAILER     "\n} on error {__adp_msg __adp_opts} {" \
+    "dict set __adp_opts -adpline [dict get $__adp_opts -errorline]; " \
+    "return -options $__adp_opts $__adp_msg}"
+#define COMPILE_TRAILER_LEN (sizeof(COMPILE_TRAILER) - 1u)
+
 #define LENGTH_SIZE       ((int)(sizeof(int)))
 
 typedef enum {
@@ -78,6 +92,7 @@ typedef struct Parse {
     int            line;    /* Current line number while parsing. */
     Tcl_DString    lengths;    /* Length of text or script block. */
     Tcl_DString    lines;   /* Line number of block for debug messages. */
+    int            pendingLines; /* Compiled pages: lines added by separators. */
 } Parse;
 
 /*
@@ -87,6 +102,9 @@ typedef struct Parse {
 static void AppendBlock(Parse *parsePtr, const char *s, char *e, char type, unsigned int flags)
     NS_GNUC_NONNULL(1) NS_GNUC_NONNULL(2) NS_GNUC_NONNULL(3);
 
+static void AppendCompiled(Parse *parsePtr, const char *s, const char *e, char type)
+    NS_GNUC_NONNULL(1) NS_GNUC_NONNULL(2) NS_GNUC_NONNULL(3);
+
 static void AppendTag(Parse *parsePtr, const Tag *tagPtr, char *as, const char *ae, char *se, unsigned int flags)
     NS_GNUC_NONNULL(1) NS_GNUC_NONNULL(2) NS_GNUC_NONNULL(3)  NS_GNUC_NONNULL(4);
 
@@ -545,11 +563,16 @@ AdpParseAdp(AdpCode *codePtr, NsServer *servPtr, char *adp, unsigned int flags)
      */
     parse.codePtr = codePtr;
     parse.line = 0;
+    parse.pendingLines = 0;
 
     Tcl_DStringInit(&tag);
     Tcl_DStringInit(&parse.lengths);
     Tcl_DStringInit(&parse.lines);
 
+    if ((flags & ADP_COMPILE) != 0u) {
+        Tcl_DStringAppend(&codePtr->text, COMPILE_HEADER, (int)COMPILE_HEADER_LEN);
+    }
+
     /*
      * Parse ADP one tag at a time.
      */
@@ -816,7 +839,7 @@ AdpParseAdp(AdpCode *codePtr, NsServer *servPtr, char *adp, unsigned int flags)
      * and complete the parse code structure.
      */
 
-    if ((flags & ADP_SINGLE) != 0u) {
+    if ((flags & (ADP_SINGLE|ADP_COMPILE)) != 0u) {
         /*
          * The cast of "text.length" to "int" is dangerous (for really big
          * strings).
@@ -824,7 +847,12 @@ AdpParseAdp(AdpCode *codePtr, NsServer *servPtr, char *adp, unsigned int flags)
          * See also: AdpParseTclFile(), and AdpExec() in adpeval.c
          */
 
-        int line = 0, len = -(int)codePtr->text.length;
+        int line = 0, len;
+
+        if ((flags & ADP_COMPILE) != 0u) {
+            Tcl_DStringAppend(&codePtr->text, COMPILE_TRAILER, (int)COMPILE_TRAILER_LEN);
+        }
+        len = -(int)codePtr->text.length;
         codePtr->nscripts = codePtr->nblocks = 1;
         AppendLengths(codePtr, &len, &line);
     } else {
@@ -941,7 +969,10 @@ AppendBlock(Parse *parsePtr, const char *s, char *e, char type, unsigned int fla
 
         codePtr = parsePtr->codePtr;
 
-        if ((flags & ADP_SINGLE) != 0u) {
+        if ((flags & ADP_COMPILE) != 0u) {
+            AppendCompiled(parsePtr, s, e, type);
+
+        } else if ((flags & ADP_SINGLE) != 0u) {
             char save;
 
             switch (type) {
@@ -990,6 +1021,97 @@ AppendBlock(Parse *parsePtr, const char *s, char *e, char type, unsigned int fla
     }
 }
 
+
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * AppendCompiled --
+ *
+ *      Add a text or script block to the body of a compiled page. Text
+ *      blocks are turned into "ns_adp_append" commands with a quoted
+ *      literal, in which all newlines are kept, such that the lines of
+ *      the body correspond to the lines of the page. Blocks are
+ *      separated by semicolons, except for script blocks with a "#" in
+ *      their last line (potentially a comment), which are terminated by
+ *      a newline. The additional line is compensated by the next newline
+ *      in a text block, which is added as a backslash sequence.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+AppendCompiled(Parse *parsePtr, const char *s, const char *e, char type)
+{
+    Tcl_DString *textPtr;
+
+    NS_NONNULL_ASSERT(parsePtr != NULL);
+    NS_NONNULL_ASSERT(s != NULL);
+    NS_NONNULL_ASSERT(e != NULL);
+
+    textPtr = &parsePtr->codePtr->text;
+
+    if (type == 't') {
+        const char *p, *run = s;
+
+        Tcl_DStringAppend(textPtr, APPEND "\"", (int)APPEND_LEN + 1);
+        for (p = s; p < e; p++) {
+            switch (*p) {
+            case '\n':
+                if (parsePtr->pendingLines > 0) {
+                    Tcl_DStringAppend(textPtr, run, (int)(p - run));
+                    Tcl_DStringAppend(textPtr, "\\n", 2);
+                    run = p + 1;
+                    parsePtr->pendingLines--;
+                }
+                break;
+
+            case '\\': NS_FALL_THROUGH; /* fall through */
+            case '"':  NS_FALL_THROUGH; /* fall through */
+            case '$':  NS_FALL_THROUGH; /* fall through */
+            case '[':  NS_FALL_THROUGH; /* fall through */
+            case ']':  NS_FALL_THROUGH; /* fall through */
+            case '{':  NS_FALL_THROUGH; /* fall through */
+            case '}':
+                Tcl_DStringAppend(textPtr, run, (int)(p - run));
+                Tcl_DStringAppend(textPtr, "\\", 1);
+                run = p;
+                break;
+
+            default:
+                break;
+            }
+        }
+        Tcl_DStringAppend(textPtr, run, (int)(p - run));
+        Tcl_DStringAppend(textPtr, "\";", 2);
+
+    } else {
+        const char *lastLine = e;
+
+        if (type == 'S') {
+            Tcl_DStringAppend(textPtr, APPEND, (int)APPEND_LEN);
+        }
+        Tcl_DStringAppend(textPtr, s, (int)(e - s));
+
+        while (lastLine > s && *(lastLine - 1) != '\n') {
+            lastLine--;
+        }
+        if (memchr(lastLine, INTCHAR('#'), (size_t)(e - lastLine)) != NULL) {
+            Tcl_DStringAppend(textPtr, "\n", 1);
+            parsePtr->pendingLines++;
+        } else {
+            Tcl_DStringAppend(textPtr, ";", 1);
+        }
+    }
+}
+
 
 /*
  *----------------------------------------------------------------------
@@ -71,6 +71,7 @@ static Ns_ObjvTable adpOpts[] = {
     {"displayerror", ADP_DISPLAY},
     {"expire",       ADP_EXPIRE},
     {"cache",        ADP_CACHE},
+    {"compile",      ADP_COMPILE},
     {"safe",         ADP_SAFE},
     {"singlescript", ADP_SINGLE},
     {"stricterror",  ADP_STRICT},
@@ -556,7 +557,9 @@ NsAdpFlush(NsInterp *itPtr, bool doStream)
      * is the final flush call.
      *
      * Special case when has been sent via Writer thread, we just need to
-     * reset ADP output and do not send anything
+     * reset ADP output and do not send anything. This does not apply to
+     * output streamed via the writer thread, which is appended to the
+     * stream.
      */
 
     Tcl_ResetResult(interp);
@@ -564,7 +567,9 @@ NsAdpFlush(NsInterp *itPtr, bool doStream)
     if (itPtr->adp.exception == ADP_ABORT) {
         Ns_TclPrintfResult(interp, "ADP flush disabled: ADP aborted");
 
-    } else if ((conn->flags & NS_CONN_SENT_VIA_WRITER) != 0u || (len == 0 && doStream)) {
+    } else if (((conn->flags & NS_CONN_SENT_VIA_WRITER) != 0u
+                && ((const Conn *)conn)->strWriter == NULL)
+               || (len == 0 && doStream)) {
         result = TCL_OK;
 
     } else {
@@ -597,6 +602,15 @@ NsAdpFlush(NsInterp *itPtr, bool doStream)
                     len = 0;
                 }
 
+                /*
+                 * Partial output is handed to the writer thread (when
+                 * configured for streaming) as it is flushed, such that
+                 * the connection thread does not wait for the client.
+                 */
+                if (doStream) {
+                    ((Conn *)itPtr->conn)->streamViaWriter = NS_TRUE;
+                }
+
                 sbuf.iov_base = buf;
                 sbuf.iov_len  = (size_t)len;
                 if (Ns_ConnWriteVChars(itPtr->conn, &sbuf, 1,
@@ -38,6 +38,41 @@
 
 struct Cache;
 
+/*
+ * The LRU lists of a cache. Caches with the LRU policy keep all entries
+ * in the window segment. With the TinyLFU policy, new entries enter the
+ * (small) window segment; entries leaving the window are only admitted
+ * to the main area (probation and protected segments) when they are
+ * estimated to be accessed more frequently than the eviction victim of
+ * the main area. Entries accessed again while on probation are promoted
+ * to the protected segment.
+ */
+
+typedef enum {
+    CACHE_SEGMENT_WINDOW,
+    CACHE_SEGMENT_PROBATION,
+    CACHE_SEGMENT_PROTECTED
+} CacheSegment;
+
+#define CACHE_SEGMENTS          3
+#define CACHE_WINDOW_PERCENT    1u   /* Share of maxSize for the window. */
+#define CACHE_PROTECTED_PERCENT 80u  /* Share of the main area for protected. */
+
+/*
+ * Frequency sketch for TinyLFU: a count-min sketch with SKETCH_DEPTH rows
+ * of saturating counters (max SKETCH_MAX_COUNT). All counters are halved
+ * after SKETCH_SAMPLE_FACTOR * width increments, such that the sketch
+ * follows changes in the popularity of keys.
+ */
+
+#define SKETCH_DEPTH         4u
+#define SKETCH_MAX_COUNT     15u
+#define SKETCH_SAMPLE_FACTOR 10u
+#define SKETCH_MIN_WIDTH     256u
+#define SKETCH_MAX_WIDTH     (1u << 22)
+
+#define ENTRY_OVERHEAD       (sizeof(Entry) + sizeof(Tcl_HashEntry))
+
 /*
  * An Entry is a node in a linked list as well as being a
  * hash table entry. The linked list is there to keep track of
@@ -52,10 +87,14 @@ typedef struct Entry {
     Ns_Time         expires;          /* Absolute TTL timeout. */
     size_t          size;
     int             cost;             /* cost to compute a single entry */
+    CacheSegment    segment;          /* LRU list containing this entry */
     size_t          count;            /* reuse count of this entry */
     void           *value;            /* Will appear NULL for concurrent updates. */
     void           *uncommittedValue; /* Used for transactional mode */
     uintptr_t       transactionEpoch; /* Used for identifying transaction */
+    void           *staleValue;       /* Expired value served during a refresh */
+    Ns_Time         staleUntil;       /* Absolute end of the stale period */
+    Ns_Time         refreshStart;     /* Start time of a running refresh */
 } Entry;
 
 /*
@@ -63,8 +102,17 @@ typedef struct Entry {
  */
 
 typedef struct Cache {
-    Entry         *firstEntryPtr;
-    Entry         *lastEntryPtr;
+    struct {
+        Entry     *firstEntryPtr;
+        Entry     *lastEntryPtr;
+        size_t     size;       /* Accumulated size of the entries. */
+    } segments[CACHE_SEGMENTS];
+    Ns_CachePolicy policy;
+    struct {
+        unsigned char *counters;  /* SKETCH_DEPTH rows of "width" counters. */
+        size_t         width;     /* Power of two. */
+        size_t         additions; /* Increments since last aging. */
+    } sketch;
     int            keys;
     size_t         maxSize;
     size_t         currentSize;
@@ -74,6 +122,9 @@ typedef struct Cache {
     Tcl_HashTable  entriesTable;
     uintptr_t      transactionEpoch;
     Tcl_HashTable  uncommittedTable;
+    int            nshards;    /* Number of shards, 0 for unsharded caches. */
+    struct Cache **shards;     /* Shards of a sharded cache. */
+    struct Cache  *parentPtr;  /* Sharded cache, this cache is a shard of. */
     struct {
         unsigned long   nhit;      /* Successful gets. */
         unsigned long   nmiss;     /* Unsuccessful gets. */
@@ -82,6 +133,10 @@ typedef struct Cache {
         unsigned long   npruned;   /* Evictions due to size constraint. */
         unsigned long   ncommit;   /* number of commits. */
         unsigned long   nrollback; /* number of rollback operations. */
+        unsigned long   nrejected; /* Entries not admitted by TinyLFU. */
+        unsigned long   nrefresh;  /* Completed refreshes of stale entries. */
+        Ns_Time         refreshTime; /* Accumulated duration of refreshes. */
+        Ns_Time         refreshMax;  /* Longest refresh. */
     } stats;
 
     char name[1];
@@ -102,6 +157,46 @@ static void Remove(Entry *ePtr)
 static void Push(Entry *ePtr)
     NS_GNUC_NONNULL(1);
 
+static void Append(Entry *ePtr)
+    NS_GNUC_NONNULL(1);
+
+static void Access(Entry *ePtr, const char *key)
+    NS_GNUC_NONNULL(1) NS_GNUC_NONNULL(2);
+
+static void Prune(Cache *cachePtr, const Entry *currentPtr, size_t maxSize)
+    NS_GNUC_NONNULL(1) NS_GNUC_NONNULL(2);
+
+static void MoveEntry(Entry *ePtr, CacheSegment segment)
+    NS_GNUC_NONNULL(1);
+
+static bool Prunable(const Entry *ePtr, const Entry *currentPtr)
+    NS_GNUC_NONNULL(2) NS_GNUC_PURE;
+
+static uint32_t HashKey(int keys, const char *key)
+    NS_GNUC_NONNULL(2) NS_GNUC_PURE;
+
+static void SketchIncrement(Cache *cachePtr, uint32_t hash)
+    NS_GNUC_NONNULL(1);
+
+static unsigned int SketchFrequency(const Cache *cachePtr, const Entry *ePtr)
+    NS_GNUC_NONNULL(1) NS_GNUC_NONNULL(2);
+
+static void SketchUpdate(Cache *cachePtr, uint32_t hash, unsigned int count)
+    NS_GNUC_NONNULL(1);
+
+static unsigned int SketchEstimate(const unsigned char *counters, size_t width, uint32_t hash)
+    NS_GNUC_NONNULL(1) NS_GNUC_PURE;
+
+static size_t SketchIndex(size_t width, uint32_t hash, size_t row)
+    NS_GNUC_CONST;
+
+static Cache *GetShard(Cache *cachePtr, const char *key)
+    NS_GNUC_NONNULL(1) NS_GNUC_NONNULL(2) NS_GNUC_RETURNS_NONNULL;
+
+static Ns_Entry *SearchEntries(Ns_CacheSearch *search, const Tcl_HashEntry *hPtr,
+                               const Ns_CacheTransactionStack *transactionStackPtr)
+    NS_GNUC_NONNULL(1);
+
 static unsigned long
 CacheTransaction(Cache *cachePtr, uintptr_t epoch, bool commit)
     NS_GNUC_NONNULL(1);
@@ -147,6 +242,9 @@ Ns_CacheCreateSz(const char *name, int keys, size_t maxSize, Ns_FreeProc *freePr
     cachePtr->stats.npruned   = 0u;
     cachePtr->stats.ncommit   = 0u;
     cachePtr->stats.nrollback = 0u;
+    cachePtr->stats.nrejected = 0u;
+    cachePtr->stats.nrefresh  = 0u;
+    cachePtr->policy          = NS_CACHE_POLICY_LRU;
 
     Ns_MutexInit(&cachePtr->lock);
     Ns_MutexSetName2(&cachePtr->lock, "ns:cache", name);
@@ -156,6 +254,92 @@ Ns_CacheCreateSz(const char *name, int keys, size_t maxSize, Ns_FreeProc *freePr
     return (Ns_Cache *) cachePtr;
 }
 
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * Ns_CacheCreateSharded --
+ *
+ *      Create a new size limited cache, where the keys are partitioned
+ *      over "nshards" independent shards. Every shard has its own lock,
+ *      LRU list and size budget (maxSize / nshards). Operations on
+ *      single entries have to be performed with the shard of the key
+ *      locked (see Ns_CacheGetShard()); locking the sharded cache itself
+ *      locks all shards and permits operations on the cache as a whole,
+ *      such as iterating, flushing, statistics or finishing
+ *      transactions.
+ *
+ * Results:
+ *      A pointer to the new cache.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+Ns_Cache *
+Ns_CacheCreateSharded(const char *name, int keys, size_t maxSize, Ns_FreeProc *freeProc,
+                      int nshards)
+{
+    Cache *cachePtr;
+
+    NS_NONNULL_ASSERT(name != NULL);
+
+    cachePtr = (Cache *)Ns_CacheCreateSz(name, keys, maxSize, freeProc);
+
+    if (nshards > 1) {
+        Tcl_DString ds;
+        int         i;
+
+        Tcl_DStringInit(&ds);
+        cachePtr->nshards = nshards;
+        cachePtr->shards = ns_calloc((size_t)nshards, sizeof(Cache *));
+        for (i = 0; i < nshards; i++) {
+            Cache *shardPtr;
+
+            shardPtr = (Cache *)Ns_CacheCreateSz(name, keys,
+                                                 (maxSize + (size_t)nshards - 1u) / (size_t)nshards,
+                                                 freeProc);
+            Tcl_DStringSetLength(&ds, 0);
+            Ns_DStringPrintf(&ds, "%s:%d", name, i);
+            Ns_MutexSetName2(&shardPtr->lock, "ns:cache", ds.string);
+            shardPtr->parentPtr = cachePtr;
+            cachePtr->shards[i] = shardPtr;
+        }
+        Tcl_DStringFree(&ds);
+    }
+
+    return (Ns_Cache *) cachePtr;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * Ns_CacheGetShard --
+ *
+ *      Return the shard responsible for the given key. For unsharded
+ *      caches, the cache itself is returned.
+ *
+ * Results:
+ *      A pointer to the cache to be locked for operations on the key.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+Ns_Cache *
+Ns_CacheGetShard(Ns_Cache *cache, const char *key)
+{
+    NS_NONNULL_ASSERT(cache != NULL);
+    NS_NONNULL_ASSERT(key != NULL);
+
+    return (Ns_Cache *)GetShard((Cache *)cache, key);
+}
+
 
 /*
  *----------------------------------------------------------------------
@@ -181,6 +365,17 @@ Ns_CacheDestroy(Ns_Cache *cache)
     NS_NONNULL_ASSERT(cache != NULL);
 
     (void) Ns_CacheFlush(cache);
+    if (cachePtr->nshards > 0) {
+        int i;
+
+        for (i = 0; i < cachePtr->nshards; i++) {
+            Ns_CacheDestroy((Ns_Cache *)cachePtr->shards[i]);
+        }
+        ns_free(cachePtr->shards);
+    }
+    if (cachePtr->sketch.counters != NULL) {
+        ns_free(cachePtr->sketch.counters);
+    }
     Ns_MutexDestroy(&cachePtr->lock);
     Ns_CondDestroy(&cachePtr->cond);
     Tcl_DeleteHashTable(&cachePtr->entriesTable);
@@ -221,6 +416,7 @@ Ns_CacheFindEntryT(Ns_Cache *cache, const char *key, const Ns_CacheTransactionSt
     NS_NONNULL_ASSERT(cache != NULL);
     NS_NONNULL_ASSERT(key != NULL);
 
+    cachePtr = GetShard(cachePtr, key);
     hPtr = Tcl_FindHashEntry(&cachePtr->entriesTable, key);
     if (unlikely(hPtr == NULL)) {
         /*
@@ -262,9 +458,8 @@ Ns_CacheFindEntryT(Ns_Cache *cache, const char *key, const Ns_CacheTransactionSt
                  * Entry is valid.
                  */
                 ++cachePtr->stats.nhit;
-                Remove(ePtr);
                 ePtr->count ++;
-                Push(ePtr);
+                Access(ePtr, key);
                 result = (Ns_Entry *) ePtr;
             }
         }
@@ -272,6 +467,43 @@ Ns_CacheFindEntryT(Ns_Cache *cache, const char *key, const Ns_CacheTransactionSt
     return result;
 }
 
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * Ns_CacheLookupEntry --
+ *
+ *      Look up the entry with the given key without treating the
+ *      lookup as an access. In contrast to Ns_CacheFindEntry(), the
+ *      entry is returned regardless of its value and expiry time. This
+ *      is used for internal housekeeping (e.g. background refreshes),
+ *      which must not influence the statistics and the eviction
+ *      policy.
+ *
+ * Results:
+ *      A pointer to an Ns_Entry cache entry, or NULL if the key does
+ *      not exist.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------
+ */
+Ns_Entry *
+Ns_CacheLookupEntry(Ns_Cache *cache, const char *key)
+{
+    Cache               *cachePtr;
+    const Tcl_HashEntry *hPtr;
+
+    NS_NONNULL_ASSERT(cache != NULL);
+    NS_NONNULL_ASSERT(key != NULL);
+
+    cachePtr = GetShard((Cache *)cache, key);
+    hPtr = Tcl_FindHashEntry(&cachePtr->entriesTable, key);
+
+    return hPtr != NULL ? Tcl_GetHashValue(hPtr) : NULL;
+}
+
 
 /*
  *----------------------------------------------------------------------
@@ -302,6 +534,7 @@ Ns_CacheCreateEntry(Ns_Cache *cache, const char *key, int *newPtr)
     NS_NONNULL_ASSERT(key != NULL);
     NS_NONNULL_ASSERT(newPtr != NULL);
 
+    cachePtr = GetShard(cachePtr, key);
     hPtr = Tcl_CreateHashEntry(&cachePtr->entriesTable, key, &isNew);
     if (isNew != 0) {
         ePtr = ns_calloc(1u, sizeof(Entry));
@@ -310,6 +543,11 @@ Ns_CacheCreateEntry(Ns_Cache *cache, const char *key, int *newPtr)
         Tcl_SetHashValue(hPtr, ePtr);
         cachePtr->currentSize += (sizeof(Entry) + sizeof(Tcl_HashEntry) + strlen(key));
         ++cachePtr->stats.nmiss;
+        ePtr->segment = CACHE_SEGMENT_WINDOW;
+        Push(ePtr);
+        if (cachePtr->policy == NS_CACHE_POLICY_TINYLFU) {
+            SketchIncrement(cachePtr, HashKey(cachePtr->keys, key));
+        }
     } else {
         ePtr = Tcl_GetHashValue(hPtr);
         if (Expired(ePtr, NULL)) {
@@ -320,9 +558,8 @@ Ns_CacheCreateEntry(Ns_Cache *cache, const char *key, int *newPtr)
             ePtr->count ++;
             ++cachePtr->stats.nhit;
         }
-        Remove(ePtr);
+        Access(ePtr, key);
     }
-    Push(ePtr);
     *newPtr = isNew;
 
     return (Ns_Entry *) ePtr;
@@ -365,6 +602,10 @@ Ns_CacheWaitCreateEntryT(Ns_Cache *cache, const char *key, int *newPtr,
     NS_NONNULL_ASSERT(key != NULL);
     NS_NONNULL_ASSERT(newPtr != NULL);
 
+    /*
+     * Wait on the condition of the shard of the key.
+     */
+    cache = (Ns_Cache *)GetShard((Cache *)cache, key);
     entry = Ns_CacheCreateEntry(cache, key, &isNew);
 
     if (isNew == 0 && Ns_CacheGetValueT(entry, transactionStackPtr) == NULL) {
@@ -396,6 +637,90 @@ Ns_CacheWaitCreateEntryT(Ns_Cache *cache, const char *key, int *newPtr,
     return status == NS_OK ? entry : NULL;
 }
 
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * Ns_CacheWaitCreateEntryStaleT --
+ *
+ *      Like Ns_CacheWaitCreateEntryT(), but implements
+ *      stale-while-revalidate: when the committed value of an entry
+ *      has expired less than "staleTimePtr" ago, the first caller gets
+ *      the entry reported as new and has to refresh it, while the
+ *      expired value is kept. Concurrent callers get the entry
+ *      reported as existing and can obtain the expired value via
+ *      Ns_CacheGetStaleValue() instead of waiting for the refresh.
+ *      Inside cache transactions, no stale values are served.
+ *
+ * Results:
+ *      A pointer to a cache entry, or NULL on timeout.
+ *
+ * Side effects:
+ *      Cache lock may be released and re-acquired.
+ *
+ *----------------------------------------------------------------------
+ */
+Ns_Entry *
+Ns_CacheWaitCreateEntryStaleT(Ns_Cache *cache, const char *key, int *newPtr,
+                              const Ns_Time *timeoutPtr, const Ns_Time *staleTimePtr,
+                              const Ns_CacheTransactionStack *transactionStackPtr)
+{
+    Ns_Entry *result = NULL;
+
+    NS_NONNULL_ASSERT(cache != NULL);
+    NS_NONNULL_ASSERT(key != NULL);
+    NS_NONNULL_ASSERT(newPtr != NULL);
+
+    if (staleTimePtr != NULL
+        && (transactionStackPtr == NULL || transactionStackPtr->depth == 0u)) {
+        Cache               *cachePtr = GetShard((Cache *)cache, key);
+        const Tcl_HashEntry *hPtr = Tcl_FindHashEntry(&cachePtr->entriesTable, key);
+
+        if (hPtr != NULL) {
+            Entry   *ePtr = Tcl_GetHashValue(hPtr);
+            Ns_Time  now;
+
+            Ns_GetTime(&now);
+            if (ePtr->value != NULL && Expired(ePtr, &now)) {
+                Ns_Time staleUntil = ePtr->expires;
+
+                Ns_IncrTime(&staleUntil, staleTimePtr->sec, staleTimePtr->usec);
+                if (Ns_DiffTime(&staleUntil, &now, NULL) > 0) {
+                    /*
+                     * Keep the expired value (and its size) as stale
+                     * value, the caller has to refresh the entry.
+                     */
+                    ePtr->staleValue = ePtr->value;
+                    ePtr->value = NULL;
+                    ePtr->expires.sec = ePtr->expires.usec = 0;
+                    ePtr->staleUntil = staleUntil;
+                    ePtr->refreshStart = now;
+                    ++cachePtr->stats.nexpired;
+                    Access(ePtr, key);
+                    *newPtr = 1;
+                    result = (Ns_Entry *)ePtr;
+                }
+            } else if (ePtr->value == NULL
+                       && ePtr->staleValue != NULL
+                       && Ns_DiffTime(&ePtr->staleUntil, &now, NULL) > 0) {
+                /*
+                 * A refresh is running, serve the stale value.
+                 */
+                ePtr->count ++;
+                ++cachePtr->stats.nhit;
+                Access(ePtr, key);
+                *newPtr = 0;
+                result = (Ns_Entry *)ePtr;
+            }
+        }
+    }
+    if (result == NULL) {
+        result = Ns_CacheWaitCreateEntryT(cache, key, newPtr, timeoutPtr, transactionStackPtr);
+    }
+
+    return result;
+}
+
 
 /*
  *----------------------------------------------------------------------
@@ -452,8 +777,9 @@ Ns_CacheKey(const Ns_Entry *entry)
 /*
  *----------------------------------------------------------------------
  *
- * Ns_CacheGetValue, Ns_CacheGetSize, Ns_CacheGetExpirey,
- * Ns_CacheGetTransactionEpoch, Ns_CacheGetReuse --
+ * Ns_CacheGetValue, Ns_CacheGetStaleValue, Ns_CacheGetSize,
+ * Ns_CacheGetExpirey, Ns_CacheGetTransactionEpoch, Ns_CacheGetReuse,
+ * Ns_CacheGetCost --
  *
  *      Get the bare components of a cache entry via API.
  *
@@ -494,6 +820,13 @@ Ns_CacheGetTransactionEpoch(const Ns_Entry *entry)
     return ((const Entry *) entry)->transactionEpoch;
 }
 
+int
+Ns_CacheGetCost(const Ns_Entry *entry)
+{
+    NS_NONNULL_ASSERT(entry != NULL);
+    return ((const Entry *) entry)->cost;
+}
+
 void *
 Ns_CacheGetValue(const Ns_Entry *entry)
 {
@@ -501,6 +834,13 @@ Ns_CacheGetValue(const Ns_Entry *entry)
     return ((const Entry *) entry)->value;
 }
 
+void *
+Ns_CacheGetStaleValue(const Ns_Entry *entry)
+{
+    NS_NONNULL_ASSERT(entry != NULL);
+    return ((const Entry *) entry)->staleValue;
+}
+
 
 /*
  *----------------------------------------------------------------------
@@ -581,6 +921,14 @@ Ns_CacheGetNrUncommittedEntries(const Ns_Cache *cache)
     NS_NONNULL_ASSERT(cache != NULL);
 
     cachePtr = (const Cache *)cache;
+    if (cachePtr->nshards > 0) {
+        int i, result = 0;
+
+        for (i = 0; i < cachePtr->nshards; i++) {
+            result += cachePtr->shards[i]->uncommittedTable.numEntries;
+        }
+        return result;
+    }
     return cachePtr->uncommittedTable.numEntries;
 }
 
@@ -633,6 +981,22 @@ Ns_CacheSetValueExpires(Ns_Entry *entry, void *value, size_t size,
     ePtr = (Entry *) entry;
     cachePtr = ePtr->cachePtr;
 
+    if (ePtr->refreshStart.sec != 0 || ePtr->refreshStart.usec != 0) {
+        Ns_Time now, diff;
+
+        /*
+         * The entry was refreshed while serving a stale value.
+         */
+        Ns_GetTime(&now);
+        (void) Ns_DiffTime(&now, &ePtr->refreshStart, &diff);
+        ++cachePtr->stats.nrefresh;
+        Ns_IncrTime(&cachePtr->stats.refreshTime, diff.sec, diff.usec);
+        if (Ns_DiffTime(&diff, &cachePtr->stats.refreshMax, NULL) > 0) {
+            cachePtr->stats.refreshMax = diff;
+        }
+        ePtr->refreshStart.sec = ePtr->refreshStart.usec = 0;
+    }
+
     Ns_CacheUnsetValue(entry);
 
     if (transactionEpoch == 0u) {
@@ -660,6 +1024,17 @@ Ns_CacheSetValueExpires(Ns_Entry *entry, void *value, size_t size,
         ePtr->expires = *timeoutPtr;
     }
     cachePtr->currentSize += size;
+    cachePtr->segments[ePtr->segment].size += size;
+
+    if (maxSize != 0u && cachePtr->parentPtr != NULL) {
+        /*
+         * The provided maxSize refers to the sharded cache, every shard
+         * gets its share.
+         */
+        size_t nshards = (size_t)cachePtr->parentPtr->nshards;
+
+        maxSize = (maxSize + nshards - 1u) / nshards;
+    }
 
     if (maxSize == 0u) {
         /*
@@ -673,21 +1048,9 @@ Ns_CacheSetValueExpires(Ns_Entry *entry, void *value, size_t size,
         cachePtr->maxSize = maxSize;
     }
 
-    if (maxSize > 0u) {
-        /*
-         * Make space for the new entry, but don't delete the current
-         * entry, and don't delete other newborn entries (with a value
-         * of NULL) of some other threads which are concurrently
-         * created.  There might be concurrent updates, since
-         * e.g. nscache_eval releases its mutex.
-         */
-        while (cachePtr->currentSize > maxSize
-               && cachePtr->lastEntryPtr != ePtr
-               && cachePtr->lastEntryPtr->value != NULL
-               ) {
-            Ns_CacheDeleteEntry((Ns_Entry *) cachePtr->lastEntryPtr);
-            ++cachePtr->stats.npruned;
-        }
+    if (maxSize > 0u
+        && (cachePtr->currentSize > maxSize || cachePtr->policy != NS_CACHE_POLICY_LRU)) {
+        Prune(cachePtr, ePtr, maxSize);
     }
     return result;
 }
@@ -719,7 +1082,7 @@ Ns_CacheUnsetValue(Ns_Entry *entry)
 
     ePtr = (Entry *) entry;
 
-    if (ePtr->value != NULL || ePtr->uncommittedValue != NULL) {
+    if (ePtr->value != NULL || ePtr->uncommittedValue != NULL || ePtr->staleValue != NULL) {
         Cache *cachePtr;
         void  *value;
 
@@ -734,13 +1097,17 @@ Ns_CacheUnsetValue(Ns_Entry *entry)
         if (likely(ePtr->value != NULL)) {
             value = ePtr->value;
             ePtr->value = NULL;
-        } else {
+        } else if (ePtr->uncommittedValue != NULL) {
             value = ePtr->uncommittedValue;
             ePtr->uncommittedValue = NULL;
+        } else {
+            value = ePtr->staleValue;
+            ePtr->staleValue = NULL;
         }
 
         cachePtr = ePtr->cachePtr;
         cachePtr->currentSize -= ePtr->size;
+        cachePtr->segments[ePtr->segment].size -= ePtr->size;
         ePtr->size = 0u;
         ePtr->expires.sec = ePtr->expires.usec = 0;
 
@@ -872,27 +1239,19 @@ Ns_CacheFirstEntryT(Ns_Cache *cache, Ns_CacheSearch *search, const Ns_CacheTrans
 {
     Cache               *cachePtr = (Cache *) cache;
     const Tcl_HashEntry *hPtr;
-    Ns_Entry            *result = NULL;
 
     NS_NONNULL_ASSERT(cache != NULL);
     NS_NONNULL_ASSERT(search != NULL);
 
     Ns_GetTime(&search->now);
+    search->cache = cache;
+    search->shardIdx = 0;
+    if (cachePtr->nshards > 0) {
+        cachePtr = cachePtr->shards[0];
+    }
     hPtr = Tcl_FirstHashEntry(&cachePtr->entriesTable, &search->hsearch);
-    while (hPtr != NULL) {
-        Ns_Entry  *entry = Tcl_GetHashValue(hPtr);
 
-        if (Ns_CacheGetValueT(entry, transactionStackPtr) != NULL) {
-            if (!Expired((Entry *) entry, &search->now)) {
-                result = entry;
-                break;
-            }
-            ++cachePtr->stats.nexpired;
-            Ns_CacheDeleteEntry(entry);
-        }
-        hPtr = Tcl_NextHashEntry(&search->hsearch);
-    }
-    return result;
+    return SearchEntries(search, hPtr, transactionStackPtr);
 }
 
 
@@ -921,8 +1280,17 @@ Ns_CacheCommitEntries(Ns_Cache *cache, uintptr_t epoch)
     NS_NONNULL_ASSERT(cache != NULL);
 
     cachePtr = (Cache *) cache;
-    result = CacheTransaction(cachePtr, epoch, NS_TRUE);
-    cachePtr->stats.ncommit += result;
+    if (cachePtr->nshards > 0) {
+        int i;
+
+        result = 0u;
+        for (i = 0; i < cachePtr->nshards; i++) {
+            result += Ns_CacheCommitEntries((Ns_Cache *)cachePtr->shards[i], epoch);
+        }
+    } else {
+        result = CacheTransaction(cachePtr, epoch, NS_TRUE);
+        cachePtr->stats.ncommit += result;
+    }
 
     return result;
 }
@@ -952,8 +1320,17 @@ Ns_CacheRollbackEntries(Ns_Cache *cache, uintptr_t epoch)
     NS_NONNULL_ASSERT(cache != NULL);
 
     cachePtr = (Cache *) cache;
-    result = CacheTransaction(cachePtr, epoch, NS_FALSE);
-    cachePtr->stats.nrollback += result;
+    if (cachePtr->nshards > 0) {
+        int i;
+
+        result = 0u;
+        for (i = 0; i < cachePtr->nshards; i++) {
+            result += Ns_CacheRollbackEntries((Ns_Cache *)cachePtr->shards[i], epoch);
+        }
+    } else {
+        result = CacheTransaction(cachePtr, epoch, NS_FALSE);
+        cachePtr->stats.nrollback += result;
+    }
 
     return result;
 }
@@ -1036,24 +1413,59 @@ Ns_CacheNextEntry(Ns_CacheSearch *search)
 Ns_Entry *
 Ns_CacheNextEntryT(Ns_CacheSearch *search, const Ns_CacheTransactionStack *transactionStackPtr)
 {
-    const Tcl_HashEntry  *hPtr;
-    Ns_Entry             *result = NULL;
+    NS_NONNULL_ASSERT(search != NULL);
+
+    return SearchEntries(search, Tcl_NextHashEntry(&search->hsearch), transactionStackPtr);
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * SearchEntries --
+ *
+ *      Helper for Ns_CacheFirstEntryT() and Ns_CacheNextEntryT(): return
+ *      the first valid entry starting with the provided hash entry,
+ *      continuing with the following shards of a sharded cache.
+ *
+ * Results:
+ *      Pointer to next valid entry, or NULL when all entries visited.
+ *
+ * Side effects:
+ *      Expired entries are flushed, concurrent updates skipped.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static Ns_Entry *
+SearchEntries(Ns_CacheSearch *search, const Tcl_HashEntry *hPtr,
+              const Ns_CacheTransactionStack *transactionStackPtr)
+{
+    const Cache *cachePtr;
+    Ns_Entry    *result = NULL;
 
     NS_NONNULL_ASSERT(search != NULL);
 
-    hPtr = Tcl_NextHashEntry(&search->hsearch);
-    while (hPtr != NULL) {
-        Ns_Entry *entry = Tcl_GetHashValue(hPtr);
+    cachePtr = (const Cache *)search->cache;
+    for (;;) {
+        while (hPtr != NULL) {
+            Ns_Entry *entry = Tcl_GetHashValue(hPtr);
 
-        if (Ns_CacheGetValueT(entry, transactionStackPtr) != NULL) {
-            if (!Expired((Entry *) entry, &search->now)) {
-                result = entry;
-                break;
+            if (Ns_CacheGetValueT(entry, transactionStackPtr) != NULL) {
+                if (!Expired((Entry *) entry, &search->now)) {
+                    result = entry;
+                    break;
+                }
+                ((Entry *) entry)->cachePtr->stats.nexpired++;
+                Ns_CacheDeleteEntry(entry);
             }
-            ((Entry *) entry)->cachePtr->stats.nexpired++;
-            Ns_CacheDeleteEntry(entry);
+            hPtr = Tcl_NextHashEntry(&search->hsearch);
         }
-        hPtr = Tcl_NextHashEntry(&search->hsearch);
+        if (result != NULL || ++search->shardIdx >= cachePtr->nshards) {
+            break;
+        }
+        hPtr = Tcl_FirstHashEntry(&cachePtr->shards[search->shardIdx]->entriesTable,
+                                  &search->hsearch);
     }
     return result;
 }
@@ -1064,7 +1476,7 @@ Ns_CacheNextEntryT(Ns_CacheSearch *search, const Ns_CacheTransactionStack *trans
  *
  * Ns_CacheLock --
  *
- *      Lock the cache.
+ *      Lock the cache. Locking a sharded cache locks all shards.
  *
  * Results:
  *      None.
@@ -1082,6 +1494,13 @@ Ns_CacheLock(Ns_Cache *cache)
 
     NS_NONNULL_ASSERT(cache != NULL);
     Ns_MutexLock(&cachePtr->lock);
+    if (cachePtr->nshards > 0) {
+        int i;
+
+        for (i = 0; i < cachePtr->nshards; i++) {
+            Ns_MutexLock(&cachePtr->shards[i]->lock);
+        }
+    }
 }
 
 
@@ -1104,10 +1523,26 @@ Ns_CacheLock(Ns_Cache *cache)
 Ns_ReturnCode
 Ns_CacheTryLock(Ns_Cache *cache)
 {
-    Cache *cachePtr = (Cache *) cache;
+    Cache        *cachePtr = (Cache *) cache;
+    Ns_ReturnCode status;
 
     NS_NONNULL_ASSERT(cache != NULL);
-    return Ns_MutexTryLock(&cachePtr->lock);
+    status = Ns_MutexTryLock(&cachePtr->lock);
+    if (status == NS_OK && cachePtr->nshards > 0) {
+        int i;
+
+        for (i = 0; i < cachePtr->nshards; i++) {
+            status = Ns_MutexTryLock(&cachePtr->shards[i]->lock);
+            if (status != NS_OK) {
+                while (i-- > 0) {
+                    Ns_MutexUnlock(&cachePtr->shards[i]->lock);
+                }
+                Ns_MutexUnlock(&cachePtr->lock);
+                break;
+            }
+        }
+    }
+    return status;
 }
 
 
@@ -1133,6 +1568,13 @@ Ns_CacheUnlock(Ns_Cache *cache)
     Cache *cachePtr = (Cache *) cache;
 
     NS_NONNULL_ASSERT(cache != NULL);
+    if (cachePtr->nshards > 0) {
+        int i;
+
+        for (i = cachePtr->nshards - 1; i >= 0; i--) {
+            Ns_MutexUnlock(&cachePtr->shards[i]->lock);
+        }
+    }
     Ns_MutexUnlock(&cachePtr->lock);
 }
 
@@ -1225,6 +1667,13 @@ Ns_CacheBroadcast(Ns_Cache *cache)
 
     NS_NONNULL_ASSERT(cache != NULL);
     Ns_CondBroadcast(&cachePtr->cond);
+    if (cachePtr->nshards > 0) {
+        int i;
+
+        for (i = 0; i < cachePtr->nshards; i++) {
+            Ns_CondBroadcast(&cachePtr->shards[i]->cond);
+        }
+    }
 }
 
 
@@ -1252,13 +1701,64 @@ Ns_CacheStats(Ns_Cache *cache, Ns_DString *dest)
     const Entry    *ePtr;
     Ns_CacheSearch  search;
     double          savedCost = 0.0, hitrate;
+    size_t          currentSize;
+    int             nEntries;
+    unsigned long   nhit, nmiss, nexpired, nflushed, npruned, ncommit, nrollback, nrejected;
+    unsigned long   nrefresh;
+    Ns_Time         refreshTime, refreshMax;
+    double          refreshAvg;
 
     NS_NONNULL_ASSERT(cache != NULL);
     NS_NONNULL_ASSERT(dest != NULL);
 
-    cachePtr = (Cache *)cache;
-    count = cachePtr->stats.nhit + cachePtr->stats.nmiss;
-    hitrate = ((count != 0u) ? ((double)cachePtr->stats.nhit * 100.0) / (double)count : 0.0);
+    cachePtr    = (Cache *)cache;
+    currentSize = cachePtr->currentSize;
+    nEntries    = cachePtr->entriesTable.numEntries;
+    nhit        = cachePtr->stats.nhit;
+    nmiss       = cachePtr->stats.nmiss;
+    nexpired    = cachePtr->stats.nexpired;
+    nflushed    = cachePtr->stats.nflushed;
+    npruned     = cachePtr->stats.npruned;
+    ncommit     = cachePtr->stats.ncommit;
+    nrollback   = cachePtr->stats.nrollback;
+    nrejected   = cachePtr->stats.nrejected;
+    nrefresh    = cachePtr->stats.nrefresh;
+    refreshTime = cachePtr->stats.refreshTime;
+    refreshMax  = cachePtr->stats.refreshMax;
+
+    if (cachePtr->nshards > 0) {
+        int i;
+
+        /*
+         * Aggregate the statistics of the shards.
+         */
+        for (i = 0; i < cachePtr->nshards; i++) {
+            const Cache *shardPtr = cachePtr->shards[i];
+
+            currentSize += shardPtr->currentSize;
+            nEntries    += shardPtr->entriesTable.numEntries;
+            nhit        += shardPtr->stats.nhit;
+            nmiss       += shardPtr->stats.nmiss;
+            nexpired    += shardPtr->stats.nexpired;
+            nflushed    += shardPtr->stats.nflushed;
+            npruned     += shardPtr->stats.npruned;
+            ncommit     += shardPtr->stats.ncommit;
+            nrollback   += shardPtr->stats.nrollback;
+            nrejected   += shardPtr->stats.nrejected;
+            nrefresh    += shardPtr->stats.nrefresh;
+            Ns_IncrTime(&refreshTime, shardPtr->stats.refreshTime.sec,
+                        shardPtr->stats.refreshTime.usec);
+            if (Ns_DiffTime(&shardPtr->stats.refreshMax, &refreshMax, NULL) > 0) {
+                refreshMax = shardPtr->stats.refreshMax;
+            }
+        }
+    }
+
+    count = nhit + nmiss;
+    hitrate = ((count != 0u) ? ((double)nhit * 100.0) / (double)count : 0.0);
+    refreshAvg = ((nrefresh != 0u)
+                  ? ((double)refreshTime.sec + (double)refreshTime.usec / 1000000.0) / (double)nrefresh
+                  : 0.0);
 
     ePtr = (Entry *)Ns_CacheFirstEntry(cache, &search);
     while (ePtr != NULL) {
@@ -1268,14 +1768,17 @@ Ns_CacheStats(Ns_Cache *cache, Ns_DString *dest)
 
     return Ns_DStringPrintf(dest, "maxsize %lu size %lu entries %d "
                "flushed %lu hits %lu missed %lu hitrate %.2f "
-               "expired %lu pruned %lu commit %lu rollback %lu saved %.6f",
+               "expired %lu pruned %lu rejected %lu commit %lu rollback %lu saved %.6f "
+               "refreshed %lu refreshavg %.6f refreshmax " NS_TIME_FMT,
                (unsigned long) cachePtr->maxSize,
-               (unsigned long) cachePtr->currentSize,
-               cachePtr->entriesTable.numEntries, cachePtr->stats.nflushed,
-               cachePtr->stats.nhit, cachePtr->stats.nmiss, hitrate,
-                            cachePtr->stats.nexpired, cachePtr->stats.npruned,
-                            cachePtr->stats.ncommit, cachePtr->stats.nrollback,
-                            savedCost);
+               (unsigned long) currentSize,
+               nEntries, nflushed,
+               nhit, nmiss, hitrate,
+               nexpired, npruned, nrejected,
+               ncommit, nrollback,
+               savedCost,
+               nrefresh, refreshAvg,
+               (int64_t)refreshMax.sec, refreshMax.usec);
 }
 
 
@@ -1302,6 +1805,13 @@ Ns_CacheResetStats(Ns_Cache *cache)
 
     NS_NONNULL_ASSERT(cache != NULL);
     memset(&cachePtr->stats, 0, sizeof(cachePtr->stats));
+    if (cachePtr->nshards > 0) {
+        int i;
+
+        for (i = 0; i < cachePtr->nshards; i++) {
+            memset(&cachePtr->shards[i]->stats, 0, sizeof(cachePtr->stats));
+        }
+    }
 }
 
 
@@ -1310,7 +1820,8 @@ Ns_CacheResetStats(Ns_Cache *cache)
  *
  * Ns_CacheSetMaxSize, Ns_CacheGetMaxSize --
  *
- *      Set/get maxsize of the specified cache
+ *      Set/get maxsize of the specified cache. The size of a sharded
+ *      cache is split evenly among the shards.
  *
  * Results:
  *      Ns_CacheGetMaxSize() returns the maxsize.
@@ -1324,9 +1835,19 @@ Ns_CacheResetStats(Ns_Cache *cache)
 void
 Ns_CacheSetMaxSize(Ns_Cache *cache, size_t maxSize)
 {
+    Cache *cachePtr = (Cache *) cache;
+
     NS_NONNULL_ASSERT(cache != NULL);
 
-    ((Cache *) cache)->maxSize = maxSize;
+    cachePtr->maxSize = maxSize;
+    if (cachePtr->nshards > 0) {
+        int i;
+
+        for (i = 0; i < cachePtr->nshards; i++) {
+            cachePtr->shards[i]->maxSize =
+                (maxSize + (size_t)cachePtr->nshards - 1u) / (size_t)cachePtr->nshards;
+        }
+    }
 }
 
 size_t
@@ -1337,7 +1858,69 @@ Ns_CacheGetMaxSize(const Ns_Cache *cache)
     return ((const Cache *) cache)->maxSize;
 }
 
-
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * Ns_CacheSetPolicy, Ns_CacheGetPolicy --
+ *
+ *      Set/get the eviction policy of the specified cache. The policy
+ *      can be changed at any time while the cache is locked; when
+ *      switching to LRU, the entries of the main area are appended to
+ *      the LRU list, the protected entries first.
+ *
+ * Results:
+ *      Ns_CacheGetPolicy() returns the policy.
+ *
+ * Side effects:
+ *      Ns_CacheSetPolicy() changes the policy of all shards.
+ *
+ *----------------------------------------------------------------------
+ */
+
+void
+Ns_CacheSetPolicy(Ns_Cache *cache, Ns_CachePolicy policy)
+{
+    Cache *cachePtr = (Cache *) cache;
+
+    NS_NONNULL_ASSERT(cache != NULL);
+
+    if (cachePtr->nshards > 0) {
+        int i;
+
+        for (i = 0; i < cachePtr->nshards; i++) {
+            Ns_CacheSetPolicy((Ns_Cache *)cachePtr->shards[i], policy);
+        }
+    }
+    if (policy == NS_CACHE_POLICY_LRU && cachePtr->policy != NS_CACHE_POLICY_LRU) {
+        CacheSegment segment;
+
+        for (segment = CACHE_SEGMENT_PROTECTED; segment > CACHE_SEGMENT_WINDOW; segment--) {
+            Entry *ePtr;
+
+            while ((ePtr = cachePtr->segments[segment].firstEntryPtr) != NULL) {
+                Remove(ePtr);
+                ePtr->segment = CACHE_SEGMENT_WINDOW;
+                Append(ePtr);
+            }
+        }
+        if (cachePtr->sketch.counters != NULL) {
+            ns_free(cachePtr->sketch.counters);
+            cachePtr->sketch.counters = NULL;
+        }
+    }
+    cachePtr->policy = policy;
+}
+
+Ns_CachePolicy
+Ns_CacheGetPolicy(const Ns_Cache *cache)
+{
+    NS_NONNULL_ASSERT(cache != NULL);
+
+    return ((const Cache *) cache)->policy;
+}
+
+
 
 /*
  *----------------------------------------------------------------------
@@ -1397,29 +1980,34 @@ Expired(const Entry *ePtr, const Ns_Time *nowPtr)
 static void
 Remove(Entry *ePtr)
 {
+    Cache *cachePtr;
+
     NS_NONNULL_ASSERT(ePtr != NULL);
 
+    cachePtr = ePtr->cachePtr;
     if (ePtr->prevPtr != NULL) {
         ePtr->prevPtr->nextPtr = ePtr->nextPtr;
     } else {
-        ePtr->cachePtr->firstEntryPtr = ePtr->nextPtr;
+        cachePtr->segments[ePtr->segment].firstEntryPtr = ePtr->nextPtr;
     }
     if (ePtr->nextPtr != NULL) {
         ePtr->nextPtr->prevPtr = ePtr->prevPtr;
     } else {
-        ePtr->cachePtr->lastEntryPtr = ePtr->prevPtr;
+        cachePtr->segments[ePtr->segment].lastEntryPtr = ePtr->prevPtr;
     }
     ePtr->prevPtr = ePtr->nextPtr = NULL;
+    cachePtr->segments[ePtr->segment].size -= (ePtr->size + ENTRY_OVERHEAD);
 }
 
 
 /*
  *----------------------------------------------------------------------
  *
- * Push --
+ * Push, Append --
  *
- *      Push an entry to the top of the linked list of entries, making
- *      it the Most Recently Used
+ *      Push an entry to the top of the linked list of its segment,
+ *      making it the Most Recently Used, or append it to the end of
+ *      the list, making it the Least Recently Used.
  *
  * Results:
  *      None.
@@ -1433,17 +2021,514 @@ Remove(Entry *ePtr)
 static void
 Push(Entry *ePtr)
 {
+    Cache *cachePtr;
+
     NS_NONNULL_ASSERT(ePtr != NULL);
 
-    if (likely(ePtr->cachePtr->firstEntryPtr != NULL)) {
-        ePtr->cachePtr->firstEntryPtr->prevPtr = ePtr;
+    cachePtr = ePtr->cachePtr;
+    if (likely(cachePtr->segments[ePtr->segment].firstEntryPtr != NULL)) {
+        cachePtr->segments[ePtr->segment].firstEntryPtr->prevPtr = ePtr;
     }
     ePtr->prevPtr = NULL;
-    ePtr->nextPtr = ePtr->cachePtr->firstEntryPtr;
-    ePtr->cachePtr->firstEntryPtr = ePtr;
-    if (unlikely(ePtr->cachePtr->lastEntryPtr == NULL)) {
-        ePtr->cachePtr->lastEntryPtr = ePtr;
+    ePtr->nextPtr = cachePtr->segments[ePtr->segment].firstEntryPtr;
+    cachePtr->segments[ePtr->segment].firstEntryPtr = ePtr;
+    if (unlikely(cachePtr->segments[ePtr->segment].lastEntryPtr == NULL)) {
+        cachePtr->segments[ePtr->segment].lastEntryPtr = ePtr;
+    }
+    cachePtr->segments[ePtr->segment].size += (ePtr->size + ENTRY_OVERHEAD);
+}
+
+static void
+Append(Entry *ePtr)
+{
+    Cache *cachePtr;
+
+    NS_NONNULL_ASSERT(ePtr != NULL);
+
+    cachePtr = ePtr->cachePtr;
+    if (likely(cachePtr->segments[ePtr->segment].lastEntryPtr != NULL)) {
+        cachePtr->segments[ePtr->segment].lastEntryPtr->nextPtr = ePtr;
+    }
+    ePtr->nextPtr = NULL;
+    ePtr->prevPtr = cachePtr->segments[ePtr->segment].lastEntryPtr;
+    cachePtr->segments[ePtr->segment].lastEntryPtr = ePtr;
+    if (unlikely(cachePtr->segments[ePtr->segment].firstEntryPtr == NULL)) {
+        cachePtr->segments[ePtr->segment].firstEntryPtr = ePtr;
+    }
+    cachePtr->segments[ePtr->segment].size += (ePtr->size + ENTRY_OVERHEAD);
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * MoveEntry --
+ *
+ *      Move an entry to the top of the list of the specified segment.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+MoveEntry(Entry *ePtr, CacheSegment segment)
+{
+    NS_NONNULL_ASSERT(ePtr != NULL);
+
+    Remove(ePtr);
+    ePtr->segment = segment;
+    Push(ePtr);
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * Access --
+ *
+ *      Record an access to an existing entry. For the LRU policy, the
+ *      entry becomes the Most Recently Used. For TinyLFU, the access is
+ *      counted in the frequency sketch and entries on probation are
+ *      promoted to the protected segment. When the protected segment
+ *      exceeds its share, its Least Recently Used entries are demoted
+ *      back to probation.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      Entries might be moved between segments.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+Access(Entry *ePtr, const char *key)
+{
+    Cache *cachePtr;
+
+    NS_NONNULL_ASSERT(ePtr != NULL);
+    NS_NONNULL_ASSERT(key != NULL);
+
+    cachePtr = ePtr->cachePtr;
+    if (cachePtr->policy == NS_CACHE_POLICY_LRU) {
+        Remove(ePtr);
+        Push(ePtr);
+
+    } else {
+        if (ePtr->value != NULL || ePtr->uncommittedValue != NULL || ePtr->staleValue != NULL) {
+            /*
+             * Don't count lookups of entries, which are just being
+             * computed (e.g. the re-fetch in ns_cache_eval), such that
+             * a key requested once is counted once.
+             */
+            SketchIncrement(cachePtr, HashKey(cachePtr->keys, key));
+        }
+
+        if (ePtr->segment == CACHE_SEGMENT_WINDOW) {
+            MoveEntry(ePtr, CACHE_SEGMENT_WINDOW);
+        } else {
+            MoveEntry(ePtr, CACHE_SEGMENT_PROTECTED);
+
+            if (cachePtr->maxSize > 0u) {
+                size_t windowMax = cachePtr->maxSize * CACHE_WINDOW_PERCENT / 100u;
+                size_t protectedMax = (cachePtr->maxSize - windowMax) * CACHE_PROTECTED_PERCENT / 100u;
+
+                while (cachePtr->segments[CACHE_SEGMENT_PROTECTED].size > protectedMax
+                       && cachePtr->segments[CACHE_SEGMENT_PROTECTED].lastEntryPtr != ePtr) {
+                    MoveEntry(cachePtr->segments[CACHE_SEGMENT_PROTECTED].lastEntryPtr,
+                              CACHE_SEGMENT_PROBATION);
+                }
+            }
+        }
+    }
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * Prunable --
+ *
+ *      Check, whether the provided entry can be evicted. Neither the
+ *      current entry nor newborn entries (with a value of NULL) of
+ *      other threads which are concurrently created can be evicted.
+ *      There might be concurrent updates, since e.g. ns_cache_eval
+ *      releases its mutex.
+ *
+ * Results:
+ *      Boolean value.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static bool
+Prunable(const Entry *ePtr, const Entry *currentPtr)
+{
+    NS_NONNULL_ASSERT(currentPtr != NULL);
+
+    return (ePtr != NULL && ePtr != currentPtr && ePtr->value != NULL);
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * Prune --
+ *
+ *      Evict entries until the cache fits into maxSize.
+ *
+ *      With the LRU policy, the Least Recently Used entries are evicted.
+ *      With TinyLFU, entries leaving the window segment (candidates)
+ *      compete with the LRU entry of the main area (victim): the entry
+ *      with the lower estimated access frequency is evicted, rejected
+ *      candidates are counted in the statistics. This prevents that a
+ *      scan over many keys used only once flushes frequently used
+ *      entries from the cache.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      Entries are deleted from the cache.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+Prune(Cache *cachePtr, const Entry *currentPtr, size_t maxSize)
+{
+    NS_NONNULL_ASSERT(cachePtr != NULL);
+    NS_NONNULL_ASSERT(currentPtr != NULL);
+
+    if (cachePtr->policy == NS_CACHE_POLICY_LRU) {
+        while (cachePtr->currentSize > maxSize
+               && Prunable(cachePtr->segments[CACHE_SEGMENT_WINDOW].lastEntryPtr, currentPtr)
+               ) {
+            Ns_CacheDeleteEntry((Ns_Entry *) cachePtr->segments[CACHE_SEGMENT_WINDOW].lastEntryPtr);
+            ++cachePtr->stats.npruned;
+        }
+
+    } else {
+        size_t windowMax = maxSize * CACHE_WINDOW_PERCENT / 100u;
+        Entry *candidatePtr = NULL;
+
+        /*
+         * Move the entries exceeding the share of the window to the top
+         * of the probation segment. The first moved entry is the first
+         * candidate; further candidates are the entries moved after it.
+         */
+        while (cachePtr->segments[CACHE_SEGMENT_WINDOW].size > windowMax
+               && Prunable(cachePtr->segments[CACHE_SEGMENT_WINDOW].lastEntryPtr, currentPtr)) {
+            Entry *ePtr = cachePtr->segments[CACHE_SEGMENT_WINDOW].lastEntryPtr;
+
+            MoveEntry(ePtr, CACHE_SEGMENT_PROBATION);
+            if (candidatePtr == NULL) {
+                candidatePtr = ePtr;
+            }
+        }
+
+        while (cachePtr->currentSize > maxSize) {
+            Entry *victimPtr;
+
+            while (candidatePtr != NULL && !Prunable(candidatePtr, currentPtr)) {
+                candidatePtr = candidatePtr->prevPtr;
+            }
+
+            /*
+             * The victim is the LRU entry of the main area, preferably
+             * from probation.
+             */
+            victimPtr = cachePtr->segments[CACHE_SEGMENT_PROBATION].lastEntryPtr;
+            if (!Prunable(victimPtr, currentPtr)) {
+                victimPtr = cachePtr->segments[CACHE_SEGMENT_PROTECTED].lastEntryPtr;
+                if (!Prunable(victimPtr, currentPtr)) {
+                    victimPtr = NULL;
+                }
+            }
+
+            if (victimPtr != NULL && candidatePtr != NULL && candidatePtr != victimPtr) {
+                Entry *nextCandidatePtr = candidatePtr->prevPtr;
+
+                if (SketchFrequency(cachePtr, candidatePtr) > SketchFrequency(cachePtr, victimPtr)) {
+                    Ns_CacheDeleteEntry((Ns_Entry *) victimPtr);
+                } else {
+                    Ns_CacheDeleteEntry((Ns_Entry *) candidatePtr);
+                    ++cachePtr->stats.nrejected;
+                }
+                candidatePtr = nextCandidatePtr;
+
+            } else if (victimPtr != NULL) {
+                if (candidatePtr == victimPtr) {
+                    candidatePtr = NULL;
+                }
+                Ns_CacheDeleteEntry((Ns_Entry *) victimPtr);
+
+            } else if (Prunable(cachePtr->segments[CACHE_SEGMENT_WINDOW].lastEntryPtr, currentPtr)) {
+                Ns_CacheDeleteEntry((Ns_Entry *) cachePtr->segments[CACHE_SEGMENT_WINDOW].lastEntryPtr);
+
+            } else {
+                break;
+            }
+            ++cachePtr->stats.npruned;
+        }
+    }
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * HashKey --
+ *
+ *      Compute an FNV-1a hash of a cache key.
+ *
+ * Results:
+ *      Hash value.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static uint32_t
+HashKey(int keys, const char *key)
+{
+    uint32_t hash = 2166136261u;
+
+    NS_NONNULL_ASSERT(key != NULL);
+
+    if (keys == TCL_STRING_KEYS) {
+        const unsigned char *p;
+
+        for (p = (const unsigned char *)key; *p != 0u; p++) {
+            hash = (hash ^ *p) * 16777619u;
+        }
+    } else if (keys == TCL_ONE_WORD_KEYS) {
+        uintptr_t word = (uintptr_t)key;
+        size_t    i;
+
+        for (i = 0u; i < sizeof(word); i++) {
+            hash = (hash ^ (uint32_t)(word & 0xffu)) * 16777619u;
+            word >>= 8;
+        }
+    } else {
+        const unsigned char *p = (const unsigned char *)key;
+        size_t               i, length = (size_t)keys * sizeof(int);
+
+        for (i = 0u; i < length; i++) {
+            hash = (hash ^ p[i]) * 16777619u;
+        }
+    }
+    return hash;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * SketchIncrement, SketchFrequency --
+ *
+ *      Count an access in the frequency sketch of the cache, or return
+ *      the estimated access frequency of an entry. The sketch grows
+ *      with the number of entries in the cache (resetting the
+ *      counters); all counters are halved periodically.
+ *
+ * Results:
+ *      SketchFrequency() returns the estimated frequency.
+ *
+ * Side effects:
+ *      SketchIncrement() might allocate or resize the sketch.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+SketchIncrement(Cache *cachePtr, uint32_t hash)
+{
+    size_t needed, i;
+
+    NS_NONNULL_ASSERT(cachePtr != NULL);
+
+    needed = (size_t)cachePtr->entriesTable.numEntries * 2u;
+    if (cachePtr->sketch.counters == NULL
+        || (cachePtr->sketch.width < needed && cachePtr->sketch.width < SKETCH_MAX_WIDTH)) {
+        unsigned char *oldCounters = cachePtr->sketch.counters;
+        size_t         oldWidth = cachePtr->sketch.width, width = SKETCH_MIN_WIDTH;
+
+        while (width < needed && width < SKETCH_MAX_WIDTH) {
+            width <<= 1;
+        }
+        cachePtr->sketch.counters = ns_calloc(SKETCH_DEPTH, width);
+        cachePtr->sketch.width = width;
+        cachePtr->sketch.additions = 0u;
+
+        if (oldCounters != NULL) {
+            Tcl_HashSearch       search;
+            const Tcl_HashEntry *hPtr;
+
+            /*
+             * Carry over the estimated frequencies of the cached entries.
+             */
+            for (hPtr = Tcl_FirstHashEntry(&cachePtr->entriesTable, &search);
+                 hPtr != NULL;
+                 hPtr = Tcl_NextHashEntry(&search)) {
+                uint32_t entryHash = HashKey(cachePtr->keys,
+                                             Tcl_GetHashKey(&cachePtr->entriesTable, hPtr));
+
+                SketchUpdate(cachePtr, entryHash,
+                             SketchEstimate(oldCounters, oldWidth, entryHash));
+            }
+            ns_free(oldCounters);
+        }
+    }
+    SketchUpdate(cachePtr, hash, 1u);
+
+    if (++cachePtr->sketch.additions >= SKETCH_SAMPLE_FACTOR * cachePtr->sketch.width) {
+        /*
+         * Aging: halve all counters.
+         */
+        for (i = 0u; i < SKETCH_DEPTH * cachePtr->sketch.width; i++) {
+            cachePtr->sketch.counters[i] >>= 1;
+        }
+        cachePtr->sketch.additions /= 2u;
+    }
+}
+
+static unsigned int
+SketchFrequency(const Cache *cachePtr, const Entry *ePtr)
+{
+    unsigned int result = 0u;
+
+    NS_NONNULL_ASSERT(cachePtr != NULL);
+    NS_NONNULL_ASSERT(ePtr != NULL);
+
+    if (cachePtr->sketch.counters != NULL) {
+        result = SketchEstimate(cachePtr->sketch.counters, cachePtr->sketch.width,
+                                HashKey(cachePtr->keys, Ns_CacheKey((const Ns_Entry *)ePtr)));
+    }
+    return result;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * SketchUpdate, SketchEstimate, SketchIndex --
+ *
+ *      Add "count" to the estimated frequency of a hash value in the
+ *      sketch of the cache, or return the minimum of the counters of a
+ *      hash value in the provided counter table. SketchIndex() remixes
+ *      the hash value per row, such that keys colliding in one row are
+ *      unlikely to collide in the other rows.
+ *
+ * Results:
+ *      SketchEstimate() returns the estimated frequency, SketchIndex()
+ *      the index of the counter in the table.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+SketchUpdate(Cache *cachePtr, uint32_t hash, unsigned int count)
+{
+    unsigned int value;
+    size_t       i;
+
+    NS_NONNULL_ASSERT(cachePtr != NULL);
+
+    /*
+     * Conservative update: raise only the counters below the new
+     * estimate, which reduces the overestimation due to collisions.
+     */
+    value = SketchEstimate(cachePtr->sketch.counters, cachePtr->sketch.width, hash) + count;
+    if (value > SKETCH_MAX_COUNT) {
+        value = SKETCH_MAX_COUNT;
+    }
+    for (i = 0u; i < SKETCH_DEPTH; i++) {
+        unsigned char *counterPtr = &cachePtr->sketch.counters[SketchIndex(cachePtr->sketch.width, hash, i)];
+
+        if (*counterPtr < value) {
+            *counterPtr = (unsigned char)value;
+        }
+    }
+}
+
+static unsigned int
+SketchEstimate(const unsigned char *counters, size_t width, uint32_t hash)
+{
+    unsigned int result = SKETCH_MAX_COUNT;
+    size_t       i;
+
+    NS_NONNULL_ASSERT(counters != NULL);
+
+    for (i = 0u; i < SKETCH_DEPTH; i++) {
+        unsigned int count = counters[SketchIndex(width, hash, i)];
+
+        if (count < result) {
+            result = count;
+        }
+    }
+    return result;
+}
+
+static size_t
+SketchIndex(size_t width, uint32_t hash, size_t row)
+{
+    uint32_t h = hash + (uint32_t)row * 0x9e3779b9u;
+
+    /*
+     * Finalizer of MurmurHash3.
+     */
+    h ^= h >> 16;
+    h *= 0x85ebca6bu;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35u;
+    h ^= h >> 16;
+
+    return row * width + ((size_t)h & (width - 1u));
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * GetShard --
+ *
+ *      Determine the shard of a sharded cache for the given key via a
+ *      hash of the key.
+ *
+ * Results:
+ *      The shard or the provided cache when it is not sharded.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static Cache *
+GetShard(Cache *cachePtr, const char *key)
+{
+    NS_NONNULL_ASSERT(cachePtr != NULL);
+    NS_NONNULL_ASSERT(key != NULL);
+
+    if (cachePtr->nshards > 0) {
+        cachePtr = cachePtr->shards[HashKey(cachePtr->keys, key) % (uint32_t)cachePtr->nshards];
     }
+    return cachePtr;
 }
 
 
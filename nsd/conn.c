@@ -1246,8 +1246,9 @@ NsConnTimeStatsUpdate(Ns_Conn *conn) {
  *
  *         traceTimeSpan  = now - runDoneTime
  *
- *      In addition, this function updates the statistics and should
- *      be called only once per request.
+ *      In addition, this function updates the statistics and the
+ *      latency histograms of the pool and should be called only once
+ *      per request.
  *
  * Results:
  *      None.
@@ -1279,7 +1280,13 @@ NsConnTimeStatsFinalize(const Ns_Conn *conn) {
     Ns_IncrTime(&poolPtr->stats.filterTime, connPtr->filterTimeSpan.sec, connPtr->filterTimeSpan.usec);
     Ns_IncrTime(&poolPtr->stats.runTime,    connPtr->runTimeSpan.sec,    connPtr->runTimeSpan.usec);
     Ns_IncrTime(&poolPtr->stats.traceTime,  diffTimeSpan.sec,            diffTimeSpan.usec);
+    NsConnThreadsAutoscale(poolPtr, connPtr, &now);
     Ns_MutexUnlock(&poolPtr->threads.lock);
+
+    NsHistogramAdd(&poolPtr->histogram.accept, &connPtr->acceptTimeSpan);
+    NsHistogramAdd(&poolPtr->histogram.queue,  &connPtr->queueTimeSpan);
+    NsHistogramAdd(&poolPtr->histogram.filter, &connPtr->filterTimeSpan);
+    NsHistogramAdd(&poolPtr->histogram.run,    &connPtr->runTimeSpan);
 }
 
 
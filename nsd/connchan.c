@@ -1043,6 +1043,7 @@ ConnChanDetachObjCmd(ClientData clientData, Tcl_Interp *interp, int objc, Tcl_Ob
                connPtr->sockPtr->sock);
 
         connPtr->sockPtr = NULL;
+        NsSetSlicesMaterialize(connPtr->headers);
         /*
          * All commands responding the client via this connection
          * can't work now, since response handling is delegated to the
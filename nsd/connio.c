@@ -707,7 +707,8 @@ Ns_ConnSend(Ns_Conn *conn, struct iovec *bufs, int nbufs)
         sent = 0;
 
     } else if (NsWriterQueue(conn, towrite, NULL, NULL, NS_INVALID_FD,
-                             bufs, nbufs, NULL, 0, NS_FALSE) == NS_OK) {
+                             bufs, nbufs, NULL, 0,
+                             ((const Conn *)conn)->streamViaWriter) == NS_OK) {
         Ns_Log(Debug, "==== writer sent %" PRIuz " bytes\n", towrite);
         sent = (ssize_t)towrite;
 
@@ -821,9 +822,12 @@ Ns_ConnClose(Ns_Conn *conn)
 
         /*
          * Close the connection to the client either here or in the
-         * writer thread.
+         * writer thread. The header fields might still be used e.g. by
+         * trace filters, so keep the request (and its buffer) until
+         * ConnRun() is done with the headers.
          */
         if ((connPtr->flags & NS_CONN_SENT_VIA_WRITER) == 0u) {
+            NsConnRetainRequest(connPtr);
             NsSockClose(connPtr->sockPtr, connPtr->keep);
         }
 
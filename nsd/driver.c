@@ -38,6 +38,10 @@
 #include "nsd.h"
 NS_EXPORT Ns_LogSeverity Ns_LogAccessDebug;
 
+#ifdef HAVE_SYS_EPOLL_H
+#include <sys/epoll.h>
+#endif
+
 /*
  * The following are valid driver state flags.
  */
@@ -109,19 +113,101 @@ static const SpoolerStateMap spoolerStateMap[] = {
 /*
  * The following structure manages polling.  The PollIn macro is
  * used for the common case of checking for readability.
+ *
+ * When an event backend (epoll) is active, sockets passed to SockPoll() are
+ * registered in the kernel in one-shot mode. A socket stays registered until
+ * it is closed, and it is only re-armed after an event was reported for
+ * it, so sockets without activity cost nothing per spin. The events
+ * reported for sockets are stored in the Sock structure (field "revents").
+ * The file descriptors added via PollSet() (trigger pipe, listen sockets)
+ * are registered on first use and have to be the same on every spin.
  */
 
 typedef struct PollData {
-    unsigned int   nfds;       /* Number of fds being monitored. */
-    unsigned int   maxfds;     /* Max fds (will grow as needed). */
+    unsigned int   nfds;        /* Number of fds being monitored. */
+    unsigned int   maxfds;      /* Max fds (will grow as needed). */
     struct pollfd *pfds;        /* Dynamic array of poll structs. */
     Ns_Time        timeout;     /* Min timeout, if any, for next spin. */
+    int            epfd;        /* File descriptor of event backend, or NS_INVALID_FD */
+    struct Sock   *readyPtr;    /* Socks with events reported by the event backend */
+#ifdef HAVE_SYS_EPOLL_H
+    unsigned int        nfixed;      /* Number of pfds registered in the event backend. */
+    int                 maxevents;   /* Size of events array (will grow as needed). */
+    struct epoll_event *events;      /* Dynamic array for reported events. */
+#endif
 } PollData;
 
 #define PollIn(ppd, i)           (((ppd)->pfds[(i)].revents & POLLIN)  == POLLIN )
 #define PollOut(ppd, i)          (((ppd)->pfds[(i)].revents & POLLOUT) == POLLOUT)
 #define PollHup(ppd, i)          (((ppd)->pfds[(i)].revents & POLLHUP) == POLLHUP)
 
+/*
+ * The following structure manages the timeouts of the sockets waiting in
+ * the driver thread (read-ahead, keep-alive and closing sockets) in a hashed
+ * timing wheel. Every slot of the wheel covers SOCK_TIMER_TICK milliseconds
+ * and holds a doubly linked list of the socks expiring in this tick (or in
+ * a later revolution of the wheel). Scheduling and canceling a timeout is
+ * O(1), and on every spin only the slots of the elapsed ticks are
+ * visited. The bitmap "used" marks the non-empty slots to determine the
+ * next timeout quickly.
+ */
+
+#define SOCK_TIMER_SLOTS   4096u
+#define SOCK_TIMER_TICK    10
+
+typedef struct SockTimers {
+    Sock        *slots[SOCK_TIMER_SLOTS];     /* Socks scheduled per slot */
+    uint64_t     used[SOCK_TIMER_SLOTS / 64u]; /* Bitmap of non-empty slots */
+    Tcl_WideInt  lastTick;                    /* Last tick processed */
+    size_t       count;                       /* Number of scheduled socks */
+} SockTimers;
+
+/*
+ * Wait states of the socks managed by the driver thread. Socks in state
+ * SOCK_WAIT_PENDING have data already available (pipelined requests) and
+ * were not polled in the current spin, so no poll results are available
+ * for these.
+ */
+typedef enum {
+    SOCK_WAIT_NONE =           0,
+    SOCK_WAIT_READ =           1,
+    SOCK_WAIT_CLOSE =          2,
+    SOCK_WAIT_PARKED =         3,
+    SOCK_WAIT_PENDING =        4
+} SockWaitState;
+
+#define SockPollIn(ppd, sockPtr)  ((ppd)->epfd != NS_INVALID_FD \
+                                   ? (((sockPtr)->revents & POLLIN)  == POLLIN)  \
+                                   : PollIn((ppd), (sockPtr)->pidx))
+#define SockPollHup(ppd, sockPtr) ((ppd)->epfd != NS_INVALID_FD \
+                                   ? (((sockPtr)->revents & POLLHUP) == POLLHUP) \
+                                   : PollHup((ppd), (sockPtr)->pidx))
+
+/*
+ * Request structures are recycled via a per-thread cache, which is used
+ * without locking by the threads allocating requests (driver, spooler),
+ * and a shared overflow stack, to which all other threads (e.g. connection
+ * threads closing a connection) return their requests. The overflow stack
+ * is lock-free, when the compiler provides atomic builtins: threads push
+ * single requests or whole lists, and the cache of an allocating thread
+ * takes the full stack at once, so no thread ever pops a single element
+ * (which would be subject to the ABA problem). Both lists are bounded;
+ * requests exceeding the limits are freed.
+ */
+
+#define REQUEST_CACHE_SIZE    32  /* Max. requests in the cache of a thread */
+#define REQUEST_POOL_SIZE   1024  /* Max. requests in the overflow stack */
+
+#if defined(__GNUC__) && defined(__ATOMIC_ACQUIRE)
+# define REQUEST_POOL_ATOMIC 1
+#endif
+
+typedef struct RequestCache {
+    Request *firstPtr;    /* Cached requests of this thread */
+    int      nRequests;   /* Number of cached requests */
+    bool     allocating;  /* This thread allocates requests */
+} RequestCache;
+
 /*
  * Collected informationof writer threads for per pool rates, necessary for
  * per pool bandwidth management.
@@ -167,6 +253,7 @@ typedef struct WriterSock {
             size_t             maxsize;
             size_t             bufsize;
             off_t              bufoffset;
+            off_t              offset;               /* read position, -1 when reading sequentially */
             size_t             toRead;
             unsigned char     *buf;
             Ns_FileVec        *bufs;
@@ -246,7 +333,7 @@ static Ns_ReturnCode DriverInit(const char *server, const char *moduleName, cons
                                 const Ns_DriverInitData *init,
                                 NsServer *servPtr, const char *path,
                                 const char *bindaddrs,
-                                const char *defserver)
+                                const char *defserver, const char *cpus)
     NS_GNUC_NONNULL(2) NS_GNUC_NONNULL(3) NS_GNUC_NONNULL(4) NS_GNUC_NONNULL(6)
     NS_GNUC_NONNULL(7);
 static bool DriverModuleInitialized(const char *module)
@@ -286,6 +373,8 @@ static SockState SockParse(Sock *sockPtr)
     NS_GNUC_NONNULL(1);
 static void SockPoll(Sock *sockPtr, short type, PollData *pdata)
     NS_GNUC_NONNULL(1) NS_GNUC_NONNULL(3);
+static void SockPollCancel(Sock *sockPtr, PollData *pdata)
+    NS_GNUC_NONNULL(1) NS_GNUC_NONNULL(2);
 static int  SockSpoolerQueue(Driver *drvPtr, Sock *sockPtr)
     NS_GNUC_NONNULL(1) NS_GNUC_NONNULL(2);
 static void SpoolerQueueStart(SpoolerQueue *queuePtr, Ns_ThreadProc *proc)
@@ -294,14 +383,36 @@ static void SpoolerQueueStop(SpoolerQueue *queuePtr, const Ns_Time *timeoutPtr,
     NS_GNUC_NONNULL(2) NS_GNUC_NONNULL(3);
 static void PollCreate(PollData *pdata)
     NS_GNUC_NONNULL(1);
+static bool PollEventsCreate(PollData *pdata)
+    NS_GNUC_NONNULL(1);
 static void PollFree(PollData *pdata)
     NS_GNUC_NONNULL(1);
 static void PollReset(PollData *pdata)
     NS_GNUC_NONNULL(1);
 static NS_POLL_NFDS_TYPE PollSet(PollData *pdata, NS_SOCKET sock, short type, const Ns_Time *timeoutPtr)
     NS_GNUC_NONNULL(1);
-static int PollWait(const PollData *pdata, int timeout)
+static int PollWait(PollData *pdata, int timeout)
+    NS_GNUC_NONNULL(1);
+#ifdef HAVE_SYS_EPOLL_H
+static int PollEventsWait(PollData *pdata, int timeout)
+    NS_GNUC_NONNULL(1);
+#endif
+static Tcl_WideInt SockTimerTick(const Ns_Time *timePtr, bool roundUp)
     NS_GNUC_NONNULL(1);
+static SockTimers *SockTimersCreate(const Ns_Time *nowPtr)
+    NS_GNUC_NONNULL(1) NS_GNUC_RETURNS_NONNULL;
+static void SockTimerSchedule(SockTimers *timersPtr, Sock *sockPtr)
+    NS_GNUC_NONNULL(1) NS_GNUC_NONNULL(2);
+static void SockTimerCancel(SockTimers *timersPtr, Sock *sockPtr)
+    NS_GNUC_NONNULL(1) NS_GNUC_NONNULL(2);
+static Sock *SockTimersExpire(SockTimers *timersPtr, const Ns_Time *nowPtr)
+    NS_GNUC_NONNULL(1) NS_GNUC_NONNULL(2);
+static int SockTimersNextTimeout(const SockTimers *timersPtr, const Ns_Time *nowPtr)
+    NS_GNUC_NONNULL(1) NS_GNUC_NONNULL(2);
+static Sock *SockTimersNext(const SockTimers *timersPtr, size_t *slotPtr, Sock *sockPtr)
+    NS_GNUC_NONNULL(1) NS_GNUC_NONNULL(2);
+static void SockWait(Sock *sockPtr, SockWaitState state, PollData *pdata, SockTimers *timersPtr)
+    NS_GNUC_NONNULL(1) NS_GNUC_NONNULL(3) NS_GNUC_NONNULL(4);
 static SockState ChunkedDecode(Request *reqPtr, bool update)
     NS_GNUC_NONNULL(1);
 static WriterSock *WriterSockRequire(const Conn *connPtr)
@@ -332,8 +443,20 @@ static size_t EndOfHeader(Sock *sockPtr)
     NS_GNUC_NONNULL(1);
 static  Request *RequestNew(void)
     NS_GNUC_RETURNS_NONNULL;
-static void RequestFree(Sock *sockPtr)
+static size_t RequestFree(Sock *sockPtr)
+    NS_GNUC_NONNULL(1);
+static size_t RequestClean(Request *reqPtr, bool keep, size_t maxBufSize)
     NS_GNUC_NONNULL(1);
+static void RequestRecycle(Request *reqPtr)
+    NS_GNUC_NONNULL(1);
+static void RequestDestroy(Request *reqPtr)
+    NS_GNUC_NONNULL(1);
+static RequestCache *RequestCacheGet(void)
+    NS_GNUC_RETURNS_NONNULL;
+static Ns_TlsCleanup RequestCacheFree;
+static void RequestPoolPush(Request *firstPtr, Request *lastPtr, int nRequests)
+    NS_GNUC_NONNULL(1) NS_GNUC_NONNULL(2);
+static Request *RequestPoolTake(void);
 static void LogBuffer(Ns_LogSeverity severity, const char *msg, const char *buffer, size_t len)
     NS_GNUC_NONNULL(2) NS_GNUC_NONNULL(3);
 
@@ -368,9 +491,14 @@ bool NsWriterBandwidthManagement = NS_FALSE;
 
 static Ns_LogSeverity   WriterDebug;        /* Severity at which to log verbose debugging. */
 static Ns_LogSeverity   DriverDebug;        /* Severity at which to log verbose debugging. */
-static Ns_Mutex         reqLock     = NULL; /* Lock for allocated Request structure pool */
+static Ns_Mutex         reqLock     = NULL; /* Lock for the request pool (without atomics) and the async writer setup */
 static Ns_Mutex         writerlock  = NULL; /* Lock updating streaming information in the writer */
-static Request         *firstReqPtr = NULL; /* Allocated request structures kept in a pool */
+static Ns_Tls           reqTls;             /* Per-thread cache of request structures */
+#if defined(NS_THREAD_LOCAL)
+static NS_THREAD_LOCAL RequestCache *reqCachePtr = NULL;
+#endif
+static Request         *firstReqPtr = NULL; /* Overflow stack of allocated request structures */
+static int              nPoolRequests = 0;  /* Number of requests in the overflow stack */
 static Driver          *firstDrvPtr = NULL; /* First in list of all drivers */
 
 #define Push(x, xs) ((x)->nextPtr = (xs), (xs) = (x))
@@ -479,6 +607,7 @@ NsInitDrivers(void)
     Ns_LogNsSetDebug = Ns_CreateLogSeverity("Debug(nsset)");
     Ns_MutexInit(&reqLock);
     Ns_MutexInit(&writerlock);
+    Ns_TlsAlloc(&reqTls, RequestCacheFree);
     Ns_MutexSetName2(&reqLock, "ns:driver", "requestpool");
     Ns_MutexSetName2(&writerlock, "ns:writer", "stream");
 }
@@ -684,24 +813,42 @@ Ns_DriverInit(const char *server, const char *module, const Ns_DriverInitData *i
         }
 
         /*
-         * The common parameters are determined, create the driver thread(s)
+         * The common parameters are determined, create the driver thread(s).
+         *
+         * The optional parameter "cpuaffinity" is a list of CPU sets (such
+         * as "0-7 8-15"), where driver thread N is pinned to the Nth
+         * element (modulo the list length), together with its spooler and
+         * writer threads.
          */
         {
             size_t      maxModuleNameLength = strlen(module) + (size_t)TCL_INTEGER_SPACE + 1u;
             char       *moduleName = ns_malloc(maxModuleNameLength);
             const char *passedDefserver = defserver != NULL ? ns_strdup(defserver) : NULL;
-            int    i;
+            const char *cpuaffinity = Ns_ConfigString(path, "cpuaffinity", NS_EMPTY_STRING);
+            const char **cpusv = NULL;
+            int         i, cpusc = 0;
+
+            if (Tcl_SplitList(NULL, cpuaffinity, &cpusc, &cpusv) != TCL_OK) {
+                Ns_Log(Warning, "server %s module %s: invalid value for cpuaffinity '%s'",
+                       server, module, cpuaffinity);
+                cpusc = 0;
+                cpusv = NULL;
+            }
 
             for (i = 0; i < nrDrivers; i++) {
                 snprintf(moduleName, maxModuleNameLength, "%s:%d", module, i);
                 status = DriverInit(server, module, moduleName, init,
                                     servPtr, path,
                                     address,
-                                    passedDefserver);
+                                    passedDefserver,
+                                    cpusc > 0 ? cpusv[i % cpusc] : NULL);
                 if (status != NS_OK) {
                     break;
                 }
             }
+            if (cpusv != NULL) {
+                Tcl_Free((char *)cpusv);
+            }
             ns_free(moduleName);
         }
 
@@ -1174,7 +1321,7 @@ static Ns_ReturnCode
 DriverInit(const char *server, const char *moduleName, const char *threadName,
            const Ns_DriverInitData *init,
            NsServer *servPtr, const char *path,
-           const char *bindaddrs, const char *defserver)
+           const char *bindaddrs, const char *defserver, const char *cpus)
 {
     const char     *defproto;
     Driver         *drvPtr;
@@ -1227,6 +1374,7 @@ DriverInit(const char *server, const char *moduleName, const char *threadName,
     drvPtr->type           = init->name;
     drvPtr->moduleName     = ns_strdup(moduleName);
     drvPtr->threadName     = ns_strdup(threadName);
+    drvPtr->cpus           = (cpus != NULL) ? ns_strdup(cpus) : NULL;
     drvPtr->defserver      = defserver;
     drvPtr->listenProc     = init->listenProc;
     drvPtr->acceptProc     = init->acceptProc;
@@ -1271,8 +1419,32 @@ DriverInit(const char *server, const char *moduleName, const char *threadName,
                                                                 "0MB", 0, 0, INT_MAX);
     drvPtr->keepmaxdownloadsize = (size_t)Ns_ConfigMemUnitRange(path, "keepalivemaxdownloadsize",
                                                                 "0MB", 0, 0, INT_MAX);
+    drvPtr->keepbufsize         = (size_t)Ns_ConfigMemUnitRange(path, "keepalivebufsize",
+                                                                "64KB", 65536, 1024, INT_MAX);
     drvPtr->recvTimeout = drvPtr->recvwait;
 
+    /*
+     * The event backend used by the driver thread for read-ahead and closing
+     * sockets. When epoll is not available, we fall back to poll.
+     */
+#ifdef HAVE_SYS_EPOLL_H
+    drvPtr->eventbackend = Ns_ConfigString(path, "eventbackend", "epoll");
+#else
+    drvPtr->eventbackend = Ns_ConfigString(path, "eventbackend", "poll");
+#endif
+    if (STREQ(drvPtr->eventbackend, "epoll")) {
+#ifndef HAVE_SYS_EPOLL_H
+        Ns_Log(Warning,
+               "parameter %s eventbackend epoll was specified, but is not supported by the operating system",
+               path);
+        drvPtr->eventbackend = "poll";
+#endif
+    } else if (!STREQ(drvPtr->eventbackend, "poll")) {
+        Ns_Log(Warning, "parameter %s eventbackend: invalid value '%s' (must be epoll or poll), using poll",
+               path, drvPtr->eventbackend);
+        drvPtr->eventbackend = "poll";
+    }
+
     drvPtr->nextPtr = firstDrvPtr;
     firstDrvPtr = drvPtr;
 
@@ -1368,6 +1540,7 @@ DriverInit(const char *server, const char *moduleName, const char *threadName,
             snprintf(buffer, sizeof(buffer), "ns:driver:spooler:%s:%d", threadName, i);
             Ns_MutexSetName2(&queuePtr->lock, buffer, "queue");
             queuePtr->id = i;
+            queuePtr->cpus = drvPtr->cpus;
             Push(queuePtr, spPtr->firstPtr);
         }
     } else {
@@ -1401,6 +1574,7 @@ DriverInit(const char *server, const char *moduleName, const char *threadName,
             snprintf(buffer, sizeof(buffer), "ns:driver:writer:%s:%d", threadName, i);
             Ns_MutexSetName2(&queuePtr->lock, buffer, "queue");
             queuePtr->id = i;
+            queuePtr->cpus = drvPtr->cpus;
             Push(queuePtr, wrPtr->firstPtr);
         }
     } else {
@@ -1612,6 +1786,9 @@ DriverInfoObjCmd(ClientData UNUSED(clientData), Tcl_Interp *interp, int objc, Tc
                 Tcl_ListObjAppendElement(interp, listObj, Tcl_NewStringObj("recvwait", 8));
                 Tcl_ListObjAppendElement(interp, listObj, Ns_TclNewTimeObj(&drvPtr->sendwait));
 
+                Tcl_ListObjAppendElement(interp, listObj, Tcl_NewStringObj("eventbackend", 12));
+                Tcl_ListObjAppendElement(interp, listObj, Tcl_NewStringObj(drvPtr->eventbackend, -1));
+
                 Tcl_ListObjAppendElement(interp, listObj, Tcl_NewStringObj("extraheaders", 12));
                 if (drvPtr->extraHeaders != NULL) {
                     Tcl_DString ds;
@@ -1690,6 +1867,12 @@ DriverStatsObjCmd(ClientData UNUSED(clientData), Tcl_Interp *interp, int objc, T
             Tcl_ListObjAppendElement(interp, listObj, Tcl_NewStringObj("errors", 6));
             Tcl_ListObjAppendElement(interp, listObj, Tcl_NewWideIntObj(drvPtr->stats.errors));
 
+            Tcl_ListObjAppendElement(interp, listObj, Tcl_NewStringObj("parked", 6));
+            Tcl_ListObjAppendElement(interp, listObj, Tcl_NewWideIntObj(drvPtr->stats.parked));
+
+            Tcl_ListObjAppendElement(interp, listObj, Tcl_NewStringObj("released", 8));
+            Tcl_ListObjAppendElement(interp, listObj, Tcl_NewWideIntObj(drvPtr->stats.released));
+
             Tcl_ListObjAppendElement(interp, resultObj, listObj);
         }
         Tcl_SetObjResult(interp, resultObj);
@@ -1940,7 +2123,7 @@ NsGetRequest(Sock *sockPtr, const Ns_Time *nowPtr)
             if (status != SOCK_READY) {
                 if (sockPtr->reqPtr != NULL) {
                     Ns_Log(DriverDebug, "NsGetRequest calls RequestFree");
-                    RequestFree(sockPtr);
+                    (void)RequestFree(sockPtr);
                 }
                 reqPtr = NULL;
             }
@@ -1979,6 +2162,7 @@ NsSockClose(Sock *sockPtr, int keep)
 {
     Driver *drvPtr;
     bool    trigger = NS_FALSE;
+    size_t  released = 0u;
 
     NS_NONNULL_ASSERT(sockPtr != NULL);
     drvPtr = sockPtr->drvPtr;
@@ -1993,10 +2177,11 @@ NsSockClose(Sock *sockPtr, int keep)
      */
     if (sockPtr->reqPtr != NULL) {
         Ns_Log(DriverDebug, "NsSockClose calls RequestFree");
-        RequestFree(sockPtr);
+        released = RequestFree(sockPtr);
     }
 
     Ns_MutexLock(&drvPtr->lock);
+    drvPtr->stats.released += (Tcl_WideInt)released;
     if (drvPtr->closePtr == NULL) {
         trigger = NS_TRUE;
     }
@@ -2009,6 +2194,103 @@ NsSockClose(Sock *sockPtr, int keep)
     }
 }
 
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * NsConnRetainRequest --
+ *
+ *      Take the request from the socket of a connection, which is about to
+ *      be closed or handed to the writer thread. The header fields of the
+ *      connection are slices of the request buffer and are still used e.g.
+ *      by trace filters, so the request is released via
+ *      NsConnReleaseRequest() when the connection is done with the
+ *      headers. When the request buffer contains already data of a
+ *      pipelined request, the request stays with the socket, and the
+ *      header fields are copied instead.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      The socket might have no request structure anymore.
+ *
+ *----------------------------------------------------------------------
+ */
+
+void
+NsConnRetainRequest(Conn *connPtr)
+{
+    Sock    *sockPtr;
+    Request *reqPtr;
+
+    NS_NONNULL_ASSERT(connPtr != NULL);
+
+    sockPtr = connPtr->sockPtr;
+    reqPtr = (sockPtr != NULL) ? sockPtr->reqPtr : NULL;
+
+    if (connPtr->headers == NULL
+        || connPtr->headers->size == 0u
+        || connPtr->retainedReqPtr != NULL) {
+        /*
+         * Nothing refers to the request buffer, or the request is already
+         * retained.
+         */
+    } else if (reqPtr != NULL
+               && reqPtr == connPtr->reqPtr
+               && reqPtr->avail <= reqPtr->contentLength) {
+        Ns_Log(DriverDebug, "NsConnRetainRequest keeps request %p", (void *)reqPtr);
+        sockPtr->poolPtr = NULL;
+        sockPtr->reqPtr = NULL;
+        connPtr->retainedReqPtr = reqPtr;
+    } else {
+        NsSetSlicesMaterialize(connPtr->headers);
+    }
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * NsConnReleaseRequest --
+ *
+ *      Release the request retained by NsConnRetainRequest(). The header
+ *      fields of the connection must not refer to the request buffer
+ *      anymore.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      Request structure is pushed to the pool for reuse.
+ *
+ *----------------------------------------------------------------------
+ */
+
+void
+NsConnReleaseRequest(Conn *connPtr)
+{
+    Request *reqPtr;
+
+    NS_NONNULL_ASSERT(connPtr != NULL);
+
+    reqPtr = connPtr->retainedReqPtr;
+    if (reqPtr != NULL) {
+        Driver *drvPtr = connPtr->drvPtr;
+        size_t  released;
+
+        connPtr->retainedReqPtr = NULL;
+        released = RequestClean(reqPtr, NS_FALSE, drvPtr->keepbufsize);
+        RequestRecycle(reqPtr);
+
+        if (released > 0u) {
+            Ns_MutexLock(&drvPtr->lock);
+            drvPtr->stats.released += (Tcl_WideInt)released;
+            Ns_MutexUnlock(&drvPtr->lock);
+        }
+    }
+}
+
 
 /*
  *----------------------------------------------------------------------
@@ -2302,13 +2584,17 @@ DriverThread(void *arg)
     Ns_Time        now, diff;
     char           charBuffer[1], drain[1024];
     int            pollTimeout, accepted, nrBindaddrs = 0;
-    bool           stopping;
+    bool           stopping, polled;
     unsigned int   flags;
-    Sock          *sockPtr, *nextPtr, *closePtr = NULL, *waitPtr = NULL, *readPtr = NULL;
+    Sock          *sockPtr, *nextPtr, *waitPtr = NULL, *pendingPtr = NULL;
     PollData       pdata;
+    SockTimers    *timersPtr;
 
     Ns_ThreadSetName("-driver:%s-", drvPtr->threadName);
     Ns_Log(Notice, "starting");
+    if (drvPtr->cpus != NULL && Ns_ThreadSetAffinity(drvPtr->cpus) != NS_OK) {
+        Ns_Log(Warning, "could not set CPU affinity '%s'", drvPtr->cpus);
+    }
 
     flags = DRIVER_STARTED;
 
@@ -2379,11 +2665,15 @@ DriverThread(void *arg)
      */
 
     PollCreate(&pdata);
+    if (STREQ(drvPtr->eventbackend, "epoll") && !PollEventsCreate(&pdata)) {
+        drvPtr->eventbackend = "poll";
+    }
     Ns_GetTime(&now);
+    timersPtr = SockTimersCreate(&now);
     stopping = ((flags & DRIVER_SHUTDOWN) != 0u);
 
     if (!stopping) {
-        Ns_Log(Notice, "driver: accepting connections");
+        Ns_Log(Notice, "driver: accepting connections (event backend %s)", drvPtr->eventbackend);
     }
 
     while (!stopping) {
@@ -2407,34 +2697,30 @@ DriverThread(void *arg)
         }
 
         /*
-         * If there are any closing or read-ahead sockets, set the bits
-         * and determine the minimum relative timeout.
+         * Without an event backend, set the bits for all waiting
+         * (read-ahead, keep-alive and closing) sockets. The timeout is
+         * determined by the next due slot of the timing wheel; sockets
+         * with pending data (pipelined requests) have to be processed
+         * without waiting.
          *
          * TODO: the various poll timeouts should probably be configurable.
          */
+        if (pdata.epfd == NS_INVALID_FD) {
+            size_t slot = 0u;
 
-        if (readPtr == NULL && closePtr == NULL) {
-            pollTimeout = 10 * 1000;
-        } else {
-
-            for (sockPtr = readPtr; sockPtr != NULL; sockPtr = sockPtr->nextPtr) {
-                SockPoll(sockPtr, (short)POLLIN, &pdata);
-            }
-            for (sockPtr = closePtr; sockPtr != NULL; sockPtr = sockPtr->nextPtr) {
+            for (sockPtr = SockTimersNext(timersPtr, &slot, NULL);
+                 sockPtr != NULL;
+                 sockPtr = SockTimersNext(timersPtr, &slot, sockPtr)) {
                 SockPoll(sockPtr, (short)POLLIN, &pdata);
             }
+        }
 
-            if (Ns_DiffTime(&pdata.timeout, &now, &diff) > 0)  {
-                /*
-                 * The resolution of "pollTimeout" is ms, therefore, we round
-                 * up. If we would round down (e.g. 500 microseconds to 0 ms),
-                 * the time comparison later would determine that it is too
-                 * early.
-                 */
-                pollTimeout = (int)Ns_TimeToMilliseconds(&diff) + 1;
-
-            } else {
-                pollTimeout = 0;
+        if (pendingPtr != NULL) {
+            pollTimeout = 0;
+        } else {
+            pollTimeout = SockTimersNextTimeout(timersPtr, &now);
+            if (pollTimeout < 0) {
+                pollTimeout = 10 * 1000;
             }
         }
 
@@ -2482,22 +2768,45 @@ DriverThread(void *arg)
         }
 
         /*
-         * Update the current time and drain and/or release any
-         * closing sockets.
+         * Collect the waiting sockets with events. With an event backend,
+         * these were already collected by PollWait().
+         */
+        if (pdata.epfd == NS_INVALID_FD) {
+            size_t slot = 0u;
+
+            for (sockPtr = SockTimersNext(timersPtr, &slot, NULL);
+                 sockPtr != NULL;
+                 sockPtr = SockTimersNext(timersPtr, &slot, sockPtr)) {
+                if (PollIn(&pdata, sockPtr->pidx) || PollHup(&pdata, sockPtr->pidx)) {
+                    Push(sockPtr, pdata.readyPtr);
+                }
+            }
+        }
+        while ((sockPtr = pendingPtr) != NULL) {
+            pendingPtr = sockPtr->nextPtr;
+            Push(sockPtr, pdata.readyPtr);
+        }
+
+        /*
+         * Update the current time and process the ready sockets: drain
+         * and/or release closing sockets, and perform read-ahead of
+         * new and keep-alive connections.
          */
         Ns_GetTime(&now);
 
-        if (closePtr != NULL) {
-            sockPtr  = closePtr;
-            closePtr = NULL;
-            while (sockPtr != NULL) {
-                nextPtr = sockPtr->nextPtr;
-                if (unlikely(PollHup(&pdata, sockPtr->pidx))) {
+        while ((sockPtr = pdata.readyPtr) != NULL) {
+            pdata.readyPtr = sockPtr->nextPtr;
+            sockPtr->nextPtr = NULL;
+
+            if (sockPtr->waitState == (int)SOCK_WAIT_CLOSE) {
+                SockTimerCancel(timersPtr, sockPtr);
+
+                if (unlikely(SockPollHup(&pdata, sockPtr))) {
                     /*
                      * Peer has closed the connection
                      */
                     SockRelease(sockPtr, SOCK_CLOSE, 0);
-                } else if (likely(PollIn(&pdata, sockPtr->pidx))) {
+                } else {
                     /*
                      * Got some data
                      */
@@ -2507,57 +2816,45 @@ DriverThread(void *arg)
                                sockPtr->sock);
                         SockRelease(sockPtr, SOCK_READERROR, 0);
                     } else {
-                        Push(sockPtr, closePtr);
+                        SockWait(sockPtr, SOCK_WAIT_CLOSE, &pdata, timersPtr);
                     }
-                } else if (Ns_DiffTime(&sockPtr->timeout, &now, &diff) <= 0) {
-                    /* no PollHup, no PollIn, maybe timeout */
-                    Ns_Log(DriverDebug, "poll closewait timeout; sockrelease SOCK_CLOSETIMEOUT (sock %d)",
-                           sockPtr->sock);
-                    SockRelease(sockPtr, SOCK_CLOSETIMEOUT, 0);
-                } else {
-                    /* too early, keep waiting */
-                    Push(sockPtr, closePtr);
                 }
-                sockPtr = nextPtr;
+                continue;
             }
-        }
-
-        /*
-         * Attempt read-ahead of any new connections.
-         */
 
-        sockPtr = readPtr;
-        readPtr = NULL;
-
-        while (likely(sockPtr != NULL)) {
-            nextPtr = sockPtr->nextPtr;
+            SockTimerCancel(timersPtr, sockPtr);
+            if (sockPtr->waitState == (int)SOCK_WAIT_PARKED) {
+                /*
+                 * Data arrived on a parked keep-alive socket; the request
+                 * structure is obtained in SockRead().
+                 */
+                drvPtr->stats.parked--;
+            }
+            polled = (sockPtr->waitState != (int)SOCK_WAIT_PENDING);
+            sockPtr->waitState = (int)SOCK_WAIT_NONE;
 
-            if (unlikely(PollHup(&pdata, sockPtr->pidx))) {
+            if (unlikely(polled && SockPollHup(&pdata, sockPtr))) {
                 /*
                  * Peer has closed the connection
                  */
                 Ns_Log(DriverDebug, "Peer has closed %p", (void*)sockPtr);
                 SockRelease(sockPtr, SOCK_CLOSE, 0);
 
-            } else if (unlikely(!PollIn(&pdata, sockPtr->pidx))
-                       && ((sockPtr->reqPtr == NULL) || (sockPtr->reqPtr->leftover == 0u))) {
-                /*
-                 * Got no data for this sockPtr.
-                 */
-                Ns_Log(DriverDebug, "Got no data for this sockPtr %p", (void*)sockPtr);
-                if (Ns_DiffTime(&sockPtr->timeout, &now, &diff) <= 0) {
-                    SockRelease(sockPtr, SOCK_READTIMEOUT, 0);
-                } else {
-                    Push(sockPtr, readPtr);
-                }
-
             } else {
                 /*
                  * Got some data for this sockPtr.
                  * If enabled, perform read-ahead now.
+                 *
+                 * The sock might be handed over to a spooler or connection
+                 * thread below. When no event was reported (data left over
+                 * from a pipelined request), the sock is still armed, so
+                 * stop monitoring it here.
                  */
                 assert(drvPtr == sockPtr->drvPtr);
                 Ns_Log(DriverDebug, "Got some data for this sockPtr %p", (void*)sockPtr);
+                if (sockPtr->pollArmed) {
+                    SockPollCancel(sockPtr, &pdata);
+                }
 
                 if (likely((drvPtr->opts & NS_DRIVER_ASYNC) != 0u)) {
                     SockState s = SockRead(sockPtr, 0, &now);
@@ -2571,14 +2868,14 @@ DriverThread(void *arg)
                     case SOCK_SPOOL:
                         drvPtr->stats.spooled++;
                         if (SockSpoolerQueue(drvPtr, sockPtr) == 0) {
-                            Push(sockPtr, readPtr);
+                            SockWait(sockPtr, SOCK_WAIT_READ, &pdata, timersPtr);
                         }
                         break;
 
                     case SOCK_MORE:
                         drvPtr->stats.partial++;
                         SockTimeout(sockPtr, &now, &drvPtr->recvwait);
-                        Push(sockPtr, readPtr);
+                        SockWait(sockPtr, SOCK_WAIT_READ, &pdata, timersPtr);
                         break;
 
                     case SOCK_READY:
@@ -2643,7 +2940,29 @@ DriverThread(void *arg)
                     }
                 }
             }
+        }
 
+        /*
+         * Release the waiting sockets with expired timeouts. Only the
+         * sockets of the elapsed slots of the timing wheel are visited.
+         */
+        sockPtr = SockTimersExpire(timersPtr, &now);
+        while (sockPtr != NULL) {
+            nextPtr = sockPtr->nextPtr;
+            if (sockPtr->waitState == (int)SOCK_WAIT_CLOSE) {
+                Ns_Log(DriverDebug, "poll closewait timeout; sockrelease SOCK_CLOSETIMEOUT (sock %d)",
+                       sockPtr->sock);
+                sockPtr->waitState = (int)SOCK_WAIT_NONE;
+                SockRelease(sockPtr, SOCK_CLOSETIMEOUT, 0);
+            } else {
+                Ns_Log(DriverDebug, "read timeout; sockrelease SOCK_READTIMEOUT (sock %d)",
+                       sockPtr->sock);
+                if (sockPtr->waitState == (int)SOCK_WAIT_PARKED) {
+                    drvPtr->stats.parked--;
+                }
+                sockPtr->waitState = (int)SOCK_WAIT_NONE;
+                SockRelease(sockPtr, SOCK_READTIMEOUT, 0);
+            }
             sockPtr = nextPtr;
         }
 
@@ -2697,14 +3016,14 @@ DriverThread(void *arg)
                         case SOCK_SPOOL:
                             drvPtr->stats.spooled++;
                             if (SockSpoolerQueue(drvPtr, sockPtr) == 0) {
-                                Push(sockPtr, readPtr);
+                                SockWait(sockPtr, SOCK_WAIT_READ, &pdata, timersPtr);
                             }
                             break;
 
                         case SOCK_MORE:
                             drvPtr->stats.partial++;
                             SockTimeout(sockPtr, &now, &drvPtr->recvwait);
-                            Push(sockPtr, readPtr);
+                            SockWait(sockPtr, SOCK_WAIT_READ, &pdata, timersPtr);
                             break;
 
                         case SOCK_READY:
@@ -2793,7 +3112,26 @@ DriverThread(void *arg)
                        sockPtr->sock);
 
                 SockTimeout(sockPtr, &now, &drvPtr->keepwait);
-                Push(sockPtr, readPtr);
+                if (sockPtr->reqPtr != NULL && sockPtr->reqPtr->leftover > 0u) {
+                    /*
+                     * Pipelined request, data is already available. The
+                     * sock is not polled, so its poll index and reported
+                     * events from earlier spins must not be used.
+                     */
+                    sockPtr->waitState = (int)SOCK_WAIT_PENDING;
+                    Push(sockPtr, pendingPtr);
+                } else if (sockPtr->reqPtr == NULL) {
+                    /*
+                     * Idle keep-alive connection. The request structure was
+                     * already returned to the pool, so the sock is parked
+                     * with no memory besides the Sock structure until new
+                     * data arrives.
+                     */
+                    drvPtr->stats.parked++;
+                    SockWait(sockPtr, SOCK_WAIT_PARKED, &pdata, timersPtr);
+                } else {
+                    SockWait(sockPtr, SOCK_WAIT_READ, &pdata, timersPtr);
+                }
             } else {
 
                 /*
@@ -2817,7 +3155,7 @@ DriverThread(void *arg)
                     Ns_Log(DriverDebug, "setting closewait " NS_TIME_FMT " for socket %d",
                            (int64_t)drvPtr->closewait.sec,  drvPtr->closewait.usec, sockPtr->sock);
                     SockTimeout(sockPtr, &now, &drvPtr->closewait);
-                    Push(sockPtr, closePtr);
+                    SockWait(sockPtr, SOCK_WAIT_CLOSE, &pdata, timersPtr);
                 }
             }
             sockPtr = nextPtr;
@@ -2853,11 +3191,21 @@ DriverThread(void *arg)
         Tcl_DeleteHashTable(&drvPtr->hosts);
     }
 
-    /*fprintf(stderr, "==== driver exit %p closePtr %p waitPtr %p readPtr %p\n",
-      (void*)drvPtr, (void*)closePtr, (void*)waitPtr, (void*)readPtr);*/
-    for (sockPtr = readPtr; sockPtr != NULL; sockPtr = nextPtr) {
+    /*
+     * Free the sockets still waiting in the timing wheel and the pending
+     * ones.
+     */
+    {
+        size_t slot = 0u;
+
+        while ((sockPtr = SockTimersNext(timersPtr, &slot, NULL)) != NULL) {
+            SockTimerCancel(timersPtr, sockPtr);
+            ns_free(sockPtr);
+        }
+        ns_free(timersPtr);
+    }
+    for (sockPtr = pendingPtr; sockPtr != NULL; sockPtr = nextPtr) {
         nextPtr = sockPtr->nextPtr;
-        /*fprintf(stderr, "==== driver exit read %p \n", (void*)sockPtr);*/
         ns_free(sockPtr);
     }
 
@@ -2874,6 +3222,45 @@ PollCreate(PollData *pdata)
 {
     NS_NONNULL_ASSERT(pdata != NULL);
     memset(pdata, 0, sizeof(PollData));
+    pdata->epfd = NS_INVALID_FD;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * PollEventsCreate --
+ *
+ *      Activate the event backend for the provided PollData. When
+ *      activated, sockets passed to SockPoll() are registered once in the
+ *      kernel instead of being added to the pfds array on every spin.
+ *
+ * Results:
+ *      NS_TRUE when the event backend could be activated.
+ *
+ * Side effects:
+ *      Creates an epoll instance.
+ *
+ *----------------------------------------------------------------------
+ */
+static bool
+PollEventsCreate(PollData *pdata)
+{
+    bool success = NS_FALSE;
+
+    NS_NONNULL_ASSERT(pdata != NULL);
+
+#ifdef HAVE_SYS_EPOLL_H
+    pdata->epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (pdata->epfd == NS_INVALID_FD) {
+        Ns_Log(Warning, "driver: epoll_create1() failed: %s; fall back to poll",
+               strerror(errno));
+    } else {
+        pdata->maxevents = 128;
+        pdata->events = ns_malloc((size_t)pdata->maxevents * sizeof(struct epoll_event));
+        success = NS_TRUE;
+    }
+#endif
+    return success;
 }
 
 static void
@@ -2881,7 +3268,14 @@ PollFree(PollData *pdata)
 {
     NS_NONNULL_ASSERT(pdata != NULL);
     ns_free(pdata->pfds);
+#ifdef HAVE_SYS_EPOLL_H
+    ns_free(pdata->events);
+#endif
+    if (pdata->epfd != NS_INVALID_FD) {
+        (void) ns_close(pdata->epfd);
+    }
     memset(pdata, 0, sizeof(PollData));
+    pdata->epfd = NS_INVALID_FD;
 }
 
 static void
@@ -2925,233 +3319,1008 @@ PollSet(PollData *pdata, NS_SOCKET sock, short type, const Ns_Time *timeoutPtr)
     return pdata->nfds++;
 }
 
-static int
-PollWait(const PollData *pdata, int timeout)
+static int
+PollWait(PollData *pdata, int timeout)
+{
+    int n;
+
+    NS_NONNULL_ASSERT(pdata != NULL);
+
+#ifdef HAVE_SYS_EPOLL_H
+    if (pdata->epfd != NS_INVALID_FD) {
+        n = PollEventsWait(pdata, timeout);
+    } else
+#endif
+    {
+        do {
+            n = ns_poll(pdata->pfds, pdata->nfds, timeout);
+        } while (n < 0  && errno == NS_EINTR);
+
+        if (n < 0) {
+            Ns_Fatal("PollWait: ns_poll() failed: %s", ns_sockstrerror(ns_sockerrno));
+        }
+    }
+    return n;
+}
+
+#ifdef HAVE_SYS_EPOLL_H
+/*
+ *----------------------------------------------------------------------
+ *
+ * PollEventsWait --
+ *
+ *      Wait for events via the event backend. The events for the pfds
+ *      entries are stored in the pfds array, such that PollIn() and friends
+ *      work as usual; the events for sockets registered via SockPoll() are
+ *      stored in the Sock structures, which are added to the ready list of
+ *      the PollData.
+ *
+ *      The pfds entries are registered level-triggered. They are identified
+ *      by odd data values (index * 2 + 1), which cannot collide with the
+ *      aligned addresses of the Sock structures.
+ *
+ * Results:
+ *      Number of reported events, 0 on timeout.
+ *
+ * Side effects:
+ *      Might grow the events array.
+ *
+ *----------------------------------------------------------------------
+ */
+static int
+PollEventsWait(PollData *pdata, int timeout)
+{
+    int n = 0, nevents;
+
+    NS_NONNULL_ASSERT(pdata != NULL);
+
+    for (; pdata->nfixed < pdata->nfds; pdata->nfixed++) {
+        struct epoll_event ev;
+
+        ev.events = (uint32_t)EPOLLIN;
+        ev.data.u64 = ((uint64_t)pdata->nfixed << 1) | 1u;
+        if (epoll_ctl(pdata->epfd, EPOLL_CTL_ADD, pdata->pfds[pdata->nfixed].fd, &ev) != 0) {
+            Ns_Fatal("PollWait: epoll_ctl() failed on fd %d: %s",
+                     pdata->pfds[pdata->nfixed].fd, strerror(errno));
+        }
+    }
+
+    for (;;) {
+        int i;
+
+        do {
+            nevents = epoll_wait(pdata->epfd, pdata->events, pdata->maxevents, timeout);
+        } while (nevents < 0 && errno == NS_EINTR);
+
+        if (nevents < 0) {
+            Ns_Fatal("PollWait: epoll_wait() failed: %s", strerror(errno));
+        }
+
+        for (i = 0; i < nevents; i++) {
+            uint64_t data = pdata->events[i].data.u64;
+            uint32_t events = pdata->events[i].events;
+            short    revents;
+
+            /*
+             * Map EPOLLERR to POLLIN, such that the subsequent read
+             * operation reports the error and the socket is released.
+             */
+            revents = (short)(((events & (EPOLLIN|EPOLLERR)) != 0u ? POLLIN : 0)
+                              | ((events & EPOLLOUT) != 0u ? POLLOUT : 0)
+                              | ((events & EPOLLHUP) != 0u ? POLLHUP : 0));
+
+            if ((data & 1u) != 0u) {
+                pdata->pfds[data >> 1].revents = revents;
+            } else {
+                Sock *sockPtr = (Sock *)(uintptr_t)data;
+
+                sockPtr->revents = revents;
+                sockPtr->pollArmed = NS_FALSE;
+                Push(sockPtr, pdata->readyPtr);
+            }
+        }
+        n += nevents;
+
+        if (nevents < pdata->maxevents) {
+            break;
+        }
+        /*
+         * There might be more events pending. Grow the events array and
+         * collect the remaining events without waiting.
+         */
+        pdata->maxevents *= 2;
+        pdata->events = ns_realloc(pdata->events, (size_t)pdata->maxevents * sizeof(struct epoll_event));
+        timeout = 0;
+    }
+
+    return n;
+}
+#endif
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * RequestNew
+ *
+ *      Allocates or reuses a "Request" struct. The struct might be reused
+ *      from the pool or freshly allocated. Counterpart of RequestFree().
+ *
+ * Results:
+ *      None
+ *
+ * Side effects:
+ *      None
+ *
+ *----------------------------------------------------------------------
+ */
+
+static Request *
+RequestNew(void)
+{
+    Request      *reqPtr;
+    RequestCache *cachePtr = RequestCacheGet();
+
+    /*
+     * Try to get a request from the cache of this thread. When the cache is
+     * empty, refill it from the overflow stack.
+     */
+    cachePtr->allocating = NS_TRUE;
+    if (cachePtr->firstPtr == NULL) {
+        Request *listPtr = RequestPoolTake();
+
+        if (listPtr != NULL) {
+            Request *lastPtr = listPtr;
+            int      n = 1;
+
+            /*
+             * Keep at most REQUEST_CACHE_SIZE requests and return the rest to
+             * the overflow stack for other allocating threads.
+             */
+            while (lastPtr->nextPtr != NULL && n < REQUEST_CACHE_SIZE) {
+                lastPtr = lastPtr->nextPtr;
+                n++;
+            }
+            if (lastPtr->nextPtr != NULL) {
+                Request *restPtr = lastPtr->nextPtr, *restLastPtr = restPtr;
+                int      nRest = 1;
+
+                while (restLastPtr->nextPtr != NULL) {
+                    restLastPtr = restLastPtr->nextPtr;
+                    nRest++;
+                }
+                lastPtr->nextPtr = NULL;
+                RequestPoolPush(restPtr, restLastPtr, nRest);
+            }
+            cachePtr->firstPtr = listPtr;
+            cachePtr->nRequests = n;
+        }
+    }
+
+    reqPtr = cachePtr->firstPtr;
+    if (likely(reqPtr != NULL)) {
+        cachePtr->firstPtr = reqPtr->nextPtr;
+        cachePtr->nRequests--;
+        reqPtr->nextPtr = NULL;
+        Ns_Log(DriverDebug, "RequestNew reuses a Request");
+    }
+
+    /*
+     * In case we failed, allocate a new Request.
+     */
+    if (reqPtr == NULL) {
+        Ns_Log(DriverDebug, "RequestNew gets a fresh Request");
+        reqPtr = ns_calloc(1u, sizeof(Request));
+        Tcl_DStringInit(&reqPtr->buffer);
+        reqPtr->headers = NsHeaderSetGet(10);
+    }
+
+    return reqPtr;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * RequestFree --
+ *
+ *      Free/clean a socket request structure.  This routine is called
+ *      at the end of connection processing or on a socket which
+ *      times out during async read-ahead. Counterpart of RequestNew().
+ *
+ *      Request buffers larger than the "keepalivebufsize" of the driver
+ *      are released, such that neither idle keep-alive connections nor
+ *      the request pool keep the buffer sizes of the largest requests.
+ *
+ * Results:
+ *      Number of bytes of the released buffer.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static size_t
+RequestFree(Sock *sockPtr)
+{
+    Request *reqPtr;
+    bool     keep;
+    size_t   released;
+
+    NS_NONNULL_ASSERT(sockPtr != NULL);
+
+    /*
+     * Clear poolPtr assignment, since this is closely related to the request
+     * info. Otherwise, it might survive for persistent connections, and can
+     * lead to incorrect pool assignments.
+     */
+    sockPtr->poolPtr = NULL;
+
+    /*
+     * Cleanup the request info. When (true) pipelining is active, we have to
+     * perform leftover management for some requests which might be (partly)
+     * already read in.
+     */
+    reqPtr = sockPtr->reqPtr;
+    assert(reqPtr != NULL);
+
+    Ns_Log(DriverDebug, "=== RequestFree cleans %p (avail %" PRIuz
+           " keep %d length %" PRIuz " contentLength %" PRIuz ")",
+           (void *)reqPtr, reqPtr->avail, sockPtr->keep, reqPtr->length, reqPtr->contentLength);
+
+    keep = (sockPtr->keep) && (reqPtr->avail > reqPtr->contentLength);
+    released = RequestClean(reqPtr, keep, sockPtr->drvPtr->keepbufsize);
+
+    if (!keep) {
+        /*
+         * Push the reqPtr to the pool for reuse in other connections.
+         */
+        sockPtr->reqPtr = NULL;
+        RequestRecycle(reqPtr);
+
+    } else {
+        /*
+         * Keep the partly cleaned up reqPtr associated with the connection.
+         */
+        Ns_Log(DriverDebug, "=== KEEP request structure %p in sockPtr (don't push into the pool)",
+               (void*)reqPtr);
+    }
+
+    return released;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * RequestClean --
+ *
+ *      Clean a request structure for reuse. When "keep" is true, the
+ *      leftover of a pipelined request is moved to the begin of the
+ *      buffer. Request buffers larger than maxBufSize are released.
+ *
+ * Results:
+ *      Number of bytes of the released buffer.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static size_t
+RequestClean(Request *reqPtr, bool keep, size_t maxBufSize)
+{
+    size_t released = 0u;
+
+    NS_NONNULL_ASSERT(reqPtr != NULL);
+
+    /*
+     * The headers should be already cleared, except maybe in error cases.
+     * Maybe, this should be moved to the error handling, and the assert
+     * should be established here. Since the header fields might be slices
+     * of the buffer, this has to happen before the buffer is modified.
+     */
+    /*assert(reqPtr->headers->size == 0);*/
+    if (reqPtr->headers->size > 0) {
+#ifdef NS_SET_DSTRING
+        Ns_Log(Warning, "RequestFree must trunc reqPtr->headers %p->%p: size %lu/%lu buffer %d/%d",
+               (void*)reqPtr, (void*)reqPtr->headers,
+               reqPtr->headers->size, reqPtr->headers->maxSize,
+               reqPtr->headers->data.length, reqPtr->headers->data.spaceAvl);
+#endif
+        Ns_SetTrunc(reqPtr->headers, 0u);
+    };
+
+    if (keep) {
+        size_t      leftover = reqPtr->avail - reqPtr->contentLength;
+        const char *offset   = reqPtr->buffer.string + ((size_t)reqPtr->buffer.length - leftover);
+
+        Ns_Log(DriverDebug, "setting leftover to %" PRIuz " bytes", leftover);
+        /*
+         * Here it is safe to move the data in the buffer, although the
+         * reqPtr->content might point to it, since we re-init the content. In
+         * case the terminating null character was written to the end of the
+         * previous buffer, we have to restore the first character.
+         */
+        memmove(reqPtr->buffer.string, offset, leftover);
+        if (reqPtr->savedChar != '\0') {
+            reqPtr->buffer.string[0] = reqPtr->savedChar;
+        }
+        Tcl_DStringSetLength(&reqPtr->buffer, (int)leftover);
+
+        if ((size_t)reqPtr->buffer.spaceAvl > maxBufSize && leftover < maxBufSize) {
+            /*
+             * Compact the buffer to the size of the leftover.
+             */
+            Tcl_DString ds;
+
+            released = (size_t)reqPtr->buffer.spaceAvl;
+            Tcl_DStringInit(&ds);
+            Tcl_DStringAppend(&ds, reqPtr->buffer.string, (int)leftover);
+            Tcl_DStringFree(&reqPtr->buffer);
+            Tcl_DStringAppend(&reqPtr->buffer, ds.string, ds.length);
+            Tcl_DStringFree(&ds);
+            released -= (size_t)reqPtr->buffer.spaceAvl;
+        }
+        LogBuffer(DriverDebug, "KEEP BUFFER", reqPtr->buffer.string, leftover);
+        reqPtr->leftover = leftover;
+    } else {
+        /*
+         * Clean large buffers in order to avoid memory growth on huge
+         * uploads (when maxupload is huge)
+         */
+        /*fprintf(stderr, "=== reuse buffer size %d avail %d dynamic %d\n",
+                reqPtr->buffer.length, reqPtr->buffer.spaceAvl,
+                reqPtr->buffer.string == reqPtr->buffer.staticSpace);*/
+        if ((size_t)reqPtr->buffer.spaceAvl > maxBufSize) {
+            released = (size_t)reqPtr->buffer.spaceAvl;
+            Tcl_DStringFree(&reqPtr->buffer);
+        } else {
+            /*
+             * Reuse buffer, but set length to 0.
+             */
+            Tcl_DStringSetLength(&reqPtr->buffer, 0);
+        }
+        reqPtr->leftover = 0u;
+    }
+
+    reqPtr->next           = NULL;
+    reqPtr->content        = NULL;
+    reqPtr->length         = 0u;
+    reqPtr->contentLength  = 0u;
+
+    reqPtr->expectedLength = 0u;
+    reqPtr->chunkStartOff  = 0u;
+    reqPtr->chunkWriteOff  = 0u;
+
+    reqPtr->roff           = 0u;
+    reqPtr->woff           = 0u;
+    reqPtr->coff           = 0u;
+    reqPtr->scanoff        = 0u;
+    reqPtr->avail          = 0u;
+    reqPtr->savedChar      = '\0';
+
+    if (reqPtr->auth != NULL) {
+        Ns_SetFree(reqPtr->auth);
+        reqPtr->auth = NULL;
+    }
+
+    if (reqPtr->request.line != NULL) {
+        Ns_Log(DriverDebug, "RequestFree calls Ns_ResetRequest on %p", (void*)&reqPtr->request);
+        Ns_ResetRequest(&reqPtr->request);
+    } else {
+        Ns_Log(DriverDebug, "RequestFree does not call Ns_ResetRequest on %p", (void*)&reqPtr->request);
+    }
+
+    return released;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * RequestRecycle --
+ *
+ *      Push a cleaned request structure to the cache of the current thread
+ *      or to the pool for reuse in other connections.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+RequestRecycle(Request *reqPtr)
+{
+    RequestCache *cachePtr = RequestCacheGet();
+
+    NS_NONNULL_ASSERT(reqPtr != NULL);
+
+    if (cachePtr->allocating && cachePtr->nRequests < REQUEST_CACHE_SIZE) {
+        Push(reqPtr, cachePtr->firstPtr);
+        cachePtr->nRequests++;
+    } else {
+        reqPtr->nextPtr = NULL;
+        RequestPoolPush(reqPtr, reqPtr, 1);
+    }
+    Ns_Log(DriverDebug, "=== Push request structure %p in (to pool)",
+           (void*)reqPtr);
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * RequestDestroy --
+ *
+ *      Free a request structure, which is not cached anymore.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      Memory is freed.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+RequestDestroy(Request *reqPtr)
+{
+    Ns_SetFree(reqPtr->headers);
+    Tcl_DStringFree(&reqPtr->buffer);
+    ns_free(reqPtr);
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * RequestCacheGet --
+ *
+ *      Get the per-thread cache of request structures.
+ *
+ * Results:
+ *      Pointer to per-thread struct.
+ *
+ * Side effects:
+ *      Memory for struct is allocated on first call.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static RequestCache *
+RequestCacheGet(void)
+{
+#if defined(NS_THREAD_LOCAL)
+    RequestCache *cachePtr = reqCachePtr;
+
+    if (cachePtr == NULL) {
+        cachePtr = ns_calloc(1u, sizeof(RequestCache));
+        Ns_TlsSet(&reqTls, cachePtr);
+        reqCachePtr = cachePtr;
+    }
+#else
+    RequestCache *cachePtr;
+
+    cachePtr = Ns_TlsGet(&reqTls);
+    if (cachePtr == NULL) {
+        cachePtr = ns_calloc(1u, sizeof(RequestCache));
+        Ns_TlsSet(&reqTls, cachePtr);
+    }
+#endif
+    return cachePtr;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * RequestCacheFree --
+ *
+ *      TLS cleanup callback for exiting threads. The cached requests are
+ *      returned to the overflow stack (as far as it has space).
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      Potentially freeing memory.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+RequestCacheFree(void *arg)
+{
+    RequestCache *cachePtr = arg;
+    Request      *reqPtr = cachePtr->firstPtr;
+
+    while (reqPtr != NULL) {
+        Request *nextPtr = reqPtr->nextPtr;
+
+        reqPtr->nextPtr = NULL;
+        RequestPoolPush(reqPtr, reqPtr, 1);
+        reqPtr = nextPtr;
+    }
+#if defined(NS_THREAD_LOCAL)
+    reqCachePtr = NULL;
+#endif
+    ns_free(cachePtr);
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * RequestPoolPush --
+ *
+ *      Push a list of request structures (linked via nextPtr from firstPtr
+ *      to lastPtr) to the overflow stack. When the stack is full, the
+ *      requests are freed instead.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      Potentially freeing memory.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+RequestPoolPush(Request *firstPtr, Request *lastPtr, int nRequests)
+{
+    bool full;
+
+#ifdef REQUEST_POOL_ATOMIC
+    full = (__atomic_add_fetch(&nPoolRequests, nRequests, __ATOMIC_RELAXED) > REQUEST_POOL_SIZE);
+    if (full) {
+        (void)__atomic_sub_fetch(&nPoolRequests, nRequests, __ATOMIC_RELAXED);
+    } else {
+        Request *headPtr = __atomic_load_n(&firstReqPtr, __ATOMIC_RELAXED);
+
+        do {
+            lastPtr->nextPtr = headPtr;
+        } while (!__atomic_compare_exchange_n(&firstReqPtr, &headPtr, firstPtr, NS_TRUE,
+                                              __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+    }
+#else
+    Ns_MutexLock(&reqLock);
+    full = (nPoolRequests + nRequests > REQUEST_POOL_SIZE);
+    if (!full) {
+        lastPtr->nextPtr = firstReqPtr;
+        firstReqPtr = firstPtr;
+        nPoolRequests += nRequests;
+    }
+    Ns_MutexUnlock(&reqLock);
+#endif
+
+    if (full) {
+        lastPtr->nextPtr = NULL;
+        while (firstPtr != NULL) {
+            Request *nextPtr = firstPtr->nextPtr;
+
+            Ns_Log(DriverDebug, "=== request pool is full, free request structure %p",
+                   (void*)firstPtr);
+            RequestDestroy(firstPtr);
+            firstPtr = nextPtr;
+        }
+    }
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * RequestPoolTake --
+ *
+ *      Take all request structures from the overflow stack.
+ *
+ * Results:
+ *      List of request structures linked via nextPtr or NULL.
+ *
+ * Side effects:
+ *      The overflow stack is empty afterwards.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static Request *
+RequestPoolTake(void)
+{
+    Request *listPtr;
+
+#ifdef REQUEST_POOL_ATOMIC
+    const Request *reqPtr;
+    int            n = 0;
+
+    listPtr = __atomic_exchange_n(&firstReqPtr, NULL, __ATOMIC_ACQUIRE);
+    for (reqPtr = listPtr; reqPtr != NULL; reqPtr = reqPtr->nextPtr) {
+        n++;
+    }
+    if (n > 0) {
+        (void)__atomic_sub_fetch(&nPoolRequests, n, __ATOMIC_RELAXED);
+    }
+#else
+    Ns_MutexLock(&reqLock);
+    listPtr = firstReqPtr;
+    firstReqPtr = NULL;
+    nPoolRequests = 0;
+    Ns_MutexUnlock(&reqLock);
+#endif
+    return listPtr;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * SockQueue --
+ *
+ *      Puts socket into connection queue and handle the NS_ERROR case.
+ *
+ * Results:
+ *      Ns_ReturnCode, potential values NS_TRUE, NS_FALSE, NS_TIMEOUT
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static Ns_ReturnCode
+SockQueue(Sock *sockPtr, const Ns_Time *timePtr)
+{
+    Ns_ReturnCode result;
+
+    NS_NONNULL_ASSERT(sockPtr != NULL);
+    /*
+     *  Verify the conditions. Request struct must exist already.
+     */
+    assert(sockPtr->reqPtr != NULL);
+
+    SockSetServer(sockPtr);
+    assert(sockPtr->servPtr != NULL);
+
+    /*
+     *  Actual queueing. When we receive NS_ERROR or NS_TIMEOUT, the queuing
+     *  did not succeed.
+     */
+    result = NsQueueConn(sockPtr, timePtr);
+    if (result == NS_ERROR) {
+        SockRelease(sockPtr, SOCK_QUEUEFULL, 0);
+    }
+
+    return result;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * SockPoll --
+ *
+ *      Arrange for given Sock to be monitored.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      Sock fd will be monitored for readability on next spin of
+ *      DriverThread.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+SockPoll(Sock *sockPtr, short type, PollData *pdata)
+{
+    NS_NONNULL_ASSERT(sockPtr != NULL);
+    NS_NONNULL_ASSERT(pdata != NULL);
+
+#ifdef HAVE_SYS_EPOLL_H
+    if (pdata->epfd != NS_INVALID_FD) {
+        sockPtr->revents = 0;
+
+        /*
+         * Re-arm the sock only when an event was reported since the last
+         * spin. Like poll(), ignore invalid sockets; these will just run
+         * into their timeout.
+         */
+        if (!sockPtr->pollArmed && sockPtr->sock != NS_INVALID_SOCKET) {
+            struct epoll_event ev;
+            int                op, rc;
+
+            ev.events = (uint32_t)EPOLLONESHOT
+                | ((type & POLLIN) != 0 ? (uint32_t)EPOLLIN : 0u)
+                | ((type & POLLOUT) != 0 ? (uint32_t)EPOLLOUT : 0u);
+            ev.data.u64 = (uint64_t)(uintptr_t)sockPtr;
+
+            op = sockPtr->pollRegistered ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+            rc = epoll_ctl(pdata->epfd, op, sockPtr->sock, &ev);
+            if (rc != 0 && errno == (op == EPOLL_CTL_MOD ? ENOENT : EEXIST)) {
+                rc = epoll_ctl(pdata->epfd, op == EPOLL_CTL_MOD ? EPOLL_CTL_ADD : EPOLL_CTL_MOD,
+                               sockPtr->sock, &ev);
+            }
+            if (rc != 0) {
+                Ns_Log(Warning, "SockPoll: epoll_ctl() failed on sock %d: %s",
+                       sockPtr->sock, strerror(errno));
+            } else {
+                sockPtr->pollRegistered = NS_TRUE;
+                sockPtr->pollArmed = NS_TRUE;
+            }
+        }
+        if (Ns_DiffTime(&sockPtr->timeout, &pdata->timeout, NULL) < 0) {
+            pdata->timeout = sockPtr->timeout;
+        }
+    } else
+#endif
+    {
+        sockPtr->pidx = PollSet(pdata, sockPtr->sock, type, &sockPtr->timeout);
+    }
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * SockPollCancel --
+ *
+ *      Stop monitoring the given Sock. This has to be called, when a sock
+ *      armed via SockPoll() is handed over to a different thread without
+ *      an event being reported for it. There is no need to call this
+ *      before a sock is closed, since closing removes the sock from the
+ *      event backend.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      When an event backend is active, the Sock fd is removed from it.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+SockPollCancel(Sock *sockPtr, PollData *pdata)
+{
+    NS_NONNULL_ASSERT(sockPtr != NULL);
+    NS_NONNULL_ASSERT(pdata != NULL);
+
+#ifdef HAVE_SYS_EPOLL_H
+    if (sockPtr->pollRegistered) {
+        struct epoll_event ev = {0u, {NULL}};
+
+        assert(pdata->epfd != NS_INVALID_FD);
+        if (epoll_ctl(pdata->epfd, EPOLL_CTL_DEL, sockPtr->sock, &ev) != 0) {
+            Ns_Log(Warning, "SockPollCancel: epoll_ctl() failed on sock %d: %s",
+                   sockPtr->sock, strerror(errno));
+        }
+        sockPtr->pollRegistered = NS_FALSE;
+        sockPtr->pollArmed = NS_FALSE;
+    }
+#endif
+    sockPtr->revents = 0;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * SockTimerTick --
+ *
+ *      Convert a time value to a tick of the timing wheel.
+ *
+ * Results:
+ *      Tick number.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static Tcl_WideInt
+SockTimerTick(const Ns_Time *timePtr, bool roundUp)
 {
-    int n;
-
-    NS_NONNULL_ASSERT(pdata != NULL);
+    Tcl_WideInt us;
 
-    do {
-        n = ns_poll(pdata->pfds, pdata->nfds, timeout);
-    } while (n < 0  && errno == NS_EINTR);
+    NS_NONNULL_ASSERT(timePtr != NULL);
 
-    if (n < 0) {
-        Ns_Fatal("PollWait: ns_poll() failed: %s", ns_sockstrerror(ns_sockerrno));
+    us = (Tcl_WideInt)timePtr->sec * 1000000 + (Tcl_WideInt)timePtr->usec;
+    if (roundUp) {
+        us += (SOCK_TIMER_TICK * 1000) - 1;
     }
-    return n;
+    return us / (SOCK_TIMER_TICK * 1000);
 }
 
 /*
  *----------------------------------------------------------------------
  *
- * RequestNew
+ * SockTimersCreate --
  *
- *      Allocates or reuses a "Request" struct. The struct might be reused
- *      from the pool or freshly allocated. Counterpart of RequestFree().
+ *      Create the timing wheel for the timeouts of the socks waiting in a
+ *      driver thread.
  *
  * Results:
- *      None
+ *      Timers structure, to be freed with ns_free().
  *
  * Side effects:
- *      None
+ *      Memory allocation.
  *
  *----------------------------------------------------------------------
  */
 
-static Request *
-RequestNew(void)
+static SockTimers *
+SockTimersCreate(const Ns_Time *nowPtr)
 {
-    Request *reqPtr;
-    bool     reuseRequest = NS_TRUE;
-
-    /*
-     * Try to get a request from the pool of allocated Requests.
-     */
-    Ns_MutexLock(&reqLock);
-    reqPtr = firstReqPtr;
-    if (likely(reqPtr != NULL)) {
-        firstReqPtr = reqPtr->nextPtr;
-    } else {
-        reuseRequest = NS_FALSE;
-    }
-    Ns_MutexUnlock(&reqLock);
+    SockTimers *timersPtr;
 
-    if (reuseRequest) {
-        Ns_Log(DriverDebug, "RequestNew reuses a Request");
-    }
+    NS_NONNULL_ASSERT(nowPtr != NULL);
 
-    /*
-     * In case we failed, allocate a new Request.
-     */
-    if (reqPtr == NULL) {
-        Ns_Log(DriverDebug, "RequestNew gets a fresh Request");
-        reqPtr = ns_calloc(1u, sizeof(Request));
-        Tcl_DStringInit(&reqPtr->buffer);
-        reqPtr->headers = NsHeaderSetGet(10);
-    }
+    timersPtr = ns_calloc(1u, sizeof(SockTimers));
+    timersPtr->lastTick = SockTimerTick(nowPtr, NS_FALSE);
 
-    return reqPtr;
+    return timersPtr;
 }
 
-
 /*
  *----------------------------------------------------------------------
  *
- * RequestFree --
+ * SockTimerSchedule, SockTimerCancel --
  *
- *      Free/clean a socket request structure.  This routine is called
- *      at the end of connection processing or on a socket which
- *      times out during async read-ahead. Counterpart of RequestNew().
+ *      Schedule the timeout of the sock (as set via SockTimeout()) in the
+ *      timing wheel, or cancel a scheduled timeout. Scheduling an already
+ *      scheduled sock reschedules it. Both operations are O(1).
  *
  * Results:
  *      None.
  *
  * Side effects:
- *      None.
+ *      Updates the slot lists of the timing wheel.
  *
  *----------------------------------------------------------------------
  */
 
 static void
-RequestFree(Sock *sockPtr)
+SockTimerSchedule(SockTimers *timersPtr, Sock *sockPtr)
 {
-    Request *reqPtr;
-    bool     keep;
+    Tcl_WideInt tick;
+    size_t      slot;
 
+    NS_NONNULL_ASSERT(timersPtr != NULL);
     NS_NONNULL_ASSERT(sockPtr != NULL);
 
-    /*
-     * Clear poolPtr assignment, since this is closely related to the request
-     * info. Otherwise, it might survive for persistent connections, and can
-     * lead to incorrect pool assignments.
-     */
-    sockPtr->poolPtr = NULL;
+    SockTimerCancel(timersPtr, sockPtr);
 
     /*
-     * Cleanup the request info. When (true) pipelining is active, we have to
-     * perform leftover management for some requests which might be (partly)
-     * already read in.
+     * Round up, such that the timeout fires never too early. Timeouts in
+     * the past fire on the next processed tick.
      */
-    reqPtr = sockPtr->reqPtr;
-    assert(reqPtr != NULL);
+    tick = SockTimerTick(&sockPtr->timeout, NS_TRUE);
+    if (tick <= timersPtr->lastTick) {
+        tick = timersPtr->lastTick + 1;
+    }
+    slot = (size_t)tick & (SOCK_TIMER_SLOTS - 1u);
 
-    Ns_Log(DriverDebug, "=== RequestFree cleans %p (avail %" PRIuz
-           " keep %d length %" PRIuz " contentLength %" PRIuz ")",
-           (void *)reqPtr, reqPtr->avail, sockPtr->keep, reqPtr->length, reqPtr->contentLength);
+    sockPtr->timerTick = tick;
+    sockPtr->timerPrevPtr = NULL;
+    sockPtr->timerNextPtr = timersPtr->slots[slot];
+    if (sockPtr->timerNextPtr != NULL) {
+        sockPtr->timerNextPtr->timerPrevPtr = sockPtr;
+    }
+    timersPtr->slots[slot] = sockPtr;
+    timersPtr->used[slot / 64u] |= ((uint64_t)1u << (slot % 64u));
+    timersPtr->count ++;
+}
 
-    keep = (sockPtr->keep) && (reqPtr->avail > reqPtr->contentLength);
-    if (keep) {
-        size_t      leftover = reqPtr->avail - reqPtr->contentLength;
-        const char *offset   = reqPtr->buffer.string + ((size_t)reqPtr->buffer.length - leftover);
+static void
+SockTimerCancel(SockTimers *timersPtr, Sock *sockPtr)
+{
+    NS_NONNULL_ASSERT(timersPtr != NULL);
+    NS_NONNULL_ASSERT(sockPtr != NULL);
 
-        Ns_Log(DriverDebug, "setting leftover to %" PRIuz " bytes", leftover);
-        /*
-         * Here it is safe to move the data in the buffer, although the
-         * reqPtr->content might point to it, since we re-init the content. In
-         * case the terminating null character was written to the end of the
-         * previous buffer, we have to restore the first character.
-         */
-        memmove(reqPtr->buffer.string, offset, leftover);
-        if (reqPtr->savedChar != '\0') {
-            reqPtr->buffer.string[0] = reqPtr->savedChar;
-        }
-        Tcl_DStringSetLength(&reqPtr->buffer, (int)leftover);
-        LogBuffer(DriverDebug, "KEEP BUFFER", reqPtr->buffer.string, leftover);
-        reqPtr->leftover = leftover;
-    } else {
-        /*
-         * Clean large buffers in order to avoid memory growth on huge
-         * uploads (when maxupload is huge)
-         */
-        /*fprintf(stderr, "=== reuse buffer size %d avail %d dynamic %d\n",
-                reqPtr->buffer.length, reqPtr->buffer.spaceAvl,
-                reqPtr->buffer.string == reqPtr->buffer.staticSpace);*/
-        if (Tcl_DStringLength(&reqPtr->buffer) > 65536) {
-            Tcl_DStringFree(&reqPtr->buffer);
+    if (sockPtr->timerTick != 0) {
+        size_t slot = (size_t)sockPtr->timerTick & (SOCK_TIMER_SLOTS - 1u);
+
+        if (sockPtr->timerPrevPtr != NULL) {
+            sockPtr->timerPrevPtr->timerNextPtr = sockPtr->timerNextPtr;
         } else {
-            /*
-             * Reuse buffer, but set length to 0.
-             */
-            Tcl_DStringSetLength(&reqPtr->buffer, 0);
+            timersPtr->slots[slot] = sockPtr->timerNextPtr;
         }
-        reqPtr->leftover = 0u;
+        if (sockPtr->timerNextPtr != NULL) {
+            sockPtr->timerNextPtr->timerPrevPtr = sockPtr->timerPrevPtr;
+        }
+        if (timersPtr->slots[slot] == NULL) {
+            timersPtr->used[slot / 64u] &= ~((uint64_t)1u << (slot % 64u));
+        }
+        sockPtr->timerNextPtr = NULL;
+        sockPtr->timerPrevPtr = NULL;
+        sockPtr->timerTick = 0;
+        timersPtr->count --;
     }
+}
 
-    reqPtr->next           = NULL;
-    reqPtr->content        = NULL;
-    reqPtr->length         = 0u;
-    reqPtr->contentLength  = 0u;
-
-    reqPtr->expectedLength = 0u;
-    reqPtr->chunkStartOff  = 0u;
-    reqPtr->chunkWriteOff  = 0u;
-
-    reqPtr->roff           = 0u;
-    reqPtr->woff           = 0u;
-    reqPtr->coff           = 0u;
-    reqPtr->avail          = 0u;
-    reqPtr->savedChar      = '\0';
+/*
+ *----------------------------------------------------------------------
+ *
+ * SockTimersExpire --
+ *
+ *      Remove all socks from the timing wheel, whose timeout has
+ *      expired. Only the slots of the ticks elapsed since the last call
+ *      are visited.
+ *
+ * Results:
+ *      List of expired socks linked via nextPtr, or NULL.
+ *
+ * Side effects:
+ *      Updates the slot lists of the timing wheel.
+ *
+ *----------------------------------------------------------------------
+ */
 
-    /*
-     * The headers should be already cleared, except maybe in error cases.
-     * Maybe, this should be moved to the error handling, and the assert
-     * should be established here.
-     */
-    /*assert(reqPtr->headers->size == 0);*/
-    if (reqPtr->headers->size > 0) {
-#ifdef NS_SET_DSTRING
-        Ns_Log(Warning, "RequestFree must trunc reqPtr->headers %p->%p: size %lu/%lu buffer %d/%d",
-               (void*)reqPtr, (void*)reqPtr->headers,
-               reqPtr->headers->size, reqPtr->headers->maxSize,
-               reqPtr->headers->data.length, reqPtr->headers->data.spaceAvl);
-#endif
-        Ns_SetTrunc(reqPtr->headers, 0u);
-    };
+static Sock *
+SockTimersExpire(SockTimers *timersPtr, const Ns_Time *nowPtr)
+{
+    Sock        *expiredPtr = NULL;
+    Tcl_WideInt  nowTick, tick;
 
-    if (reqPtr->auth != NULL) {
-        Ns_SetFree(reqPtr->auth);
-        reqPtr->auth = NULL;
-    }
+    NS_NONNULL_ASSERT(timersPtr != NULL);
+    NS_NONNULL_ASSERT(nowPtr != NULL);
 
-    if (reqPtr->request.line != NULL) {
-        Ns_Log(DriverDebug, "RequestFree calls Ns_ResetRequest on %p", (void*)&reqPtr->request);
-        Ns_ResetRequest(&reqPtr->request);
-    } else {
-        Ns_Log(DriverDebug, "RequestFree does not call Ns_ResetRequest on %p", (void*)&reqPtr->request);
-    }
+    nowTick = SockTimerTick(nowPtr, NS_FALSE);
 
-    if (!keep) {
+    if (nowTick < timersPtr->lastTick) {
         /*
-         * Push the reqPtr to the pool for reuse in other connections.
+         * The clock was set back.
          */
-        sockPtr->reqPtr = NULL;
+        timersPtr->lastTick = nowTick;
 
-        Ns_MutexLock(&reqLock);
-        reqPtr->nextPtr = firstReqPtr;
-        firstReqPtr = reqPtr;
-        Ns_MutexUnlock(&reqLock);
-        Ns_Log(DriverDebug, "=== Push request structure %p in (to pool)",
-               (void*)reqPtr);
-
-    } else {
+    } else if (nowTick > timersPtr->lastTick) {
         /*
-         * Keep the partly cleaned up reqPtr associated with the connection.
+         * Visit every slot at most once.
          */
-        Ns_Log(DriverDebug, "=== KEEP request structure %p in sockPtr (don't push into the pool)",
-               (void*)reqPtr);
+        tick = timersPtr->lastTick + 1;
+        if (nowTick - timersPtr->lastTick > (Tcl_WideInt)SOCK_TIMER_SLOTS) {
+            tick = nowTick - (Tcl_WideInt)SOCK_TIMER_SLOTS + 1;
+        }
+        for (; tick <= nowTick; tick++) {
+            size_t slot = (size_t)tick & (SOCK_TIMER_SLOTS - 1u);
+
+            if ((timersPtr->used[slot / 64u] & ((uint64_t)1u << (slot % 64u))) != 0u) {
+                Sock *sockPtr, *nextPtr;
+
+                for (sockPtr = timersPtr->slots[slot]; sockPtr != NULL; sockPtr = nextPtr) {
+                    nextPtr = sockPtr->timerNextPtr;
+                    /*
+                     * Socks of later revolutions stay in the slot.
+                     */
+                    if (sockPtr->timerTick <= nowTick) {
+                        SockTimerCancel(timersPtr, sockPtr);
+                        Push(sockPtr, expiredPtr);
+                    }
+                }
+            }
+        }
+        timersPtr->lastTick = nowTick;
     }
+
+    return expiredPtr;
 }
 
 /*
  *----------------------------------------------------------------------
  *
- * SockQueue --
+ * SockTimersNextTimeout --
  *
- *      Puts socket into connection queue and handle the NS_ERROR case.
+ *      Determine the time until the next non-empty slot of the timing wheel
+ *      is due.
  *
  * Results:
- *      Ns_ReturnCode, potential values NS_TRUE, NS_FALSE, NS_TIMEOUT
+ *      Timeout in milliseconds, or -1, when no sock is scheduled.
  *
  * Side effects:
  *      None.
@@ -3159,57 +4328,112 @@ RequestFree(Sock *sockPtr)
  *----------------------------------------------------------------------
  */
 
-static Ns_ReturnCode
-SockQueue(Sock *sockPtr, const Ns_Time *timePtr)
+static int
+SockTimersNextTimeout(const SockTimers *timersPtr, const Ns_Time *nowPtr)
 {
-    Ns_ReturnCode result;
+    int result = -1;
 
-    NS_NONNULL_ASSERT(sockPtr != NULL);
-    /*
-     *  Verify the conditions. Request struct must exist already.
-     */
-    assert(sockPtr->reqPtr != NULL);
+    NS_NONNULL_ASSERT(timersPtr != NULL);
+    NS_NONNULL_ASSERT(nowPtr != NULL);
 
-    SockSetServer(sockPtr);
-    assert(sockPtr->servPtr != NULL);
+    if (timersPtr->count > 0u) {
+        Tcl_WideInt tick = timersPtr->lastTick + 1, lastTick = tick + (Tcl_WideInt)SOCK_TIMER_SLOTS;
 
-    /*
-     *  Actual queueing. When we receive NS_ERROR or NS_TIMEOUT, the queuing
-     *  did not succeed.
-     */
-    result = NsQueueConn(sockPtr, timePtr);
-    if (result == NS_ERROR) {
-        SockRelease(sockPtr, SOCK_QUEUEFULL, 0);
-    }
+        while (tick < lastTick) {
+            size_t   slot = (size_t)tick & (SOCK_TIMER_SLOTS - 1u);
+            uint64_t word = timersPtr->used[slot / 64u] >> (slot % 64u);
+
+            if (word == 0u) {
+                /*
+                 * No more used slots in this word; skip to the next word.
+                 */
+                tick += (Tcl_WideInt)(64u - (slot % 64u));
+            } else if ((word & 1u) == 0u) {
+                tick ++;
+            } else {
+                Tcl_WideInt us = tick * (SOCK_TIMER_TICK * 1000)
+                    - ((Tcl_WideInt)nowPtr->sec * 1000000 + (Tcl_WideInt)nowPtr->usec);
 
+                /*
+                 * Round up to ms to avoid waking up too early.
+                 */
+                result = (us <= 0) ? 0 : (int)((us + 999) / 1000);
+                break;
+            }
+        }
+    }
     return result;
 }
 
-
 /*
  *----------------------------------------------------------------------
  *
- * SockPoll --
+ * SockTimersNext --
  *
- *      Arrange for given Sock to be monitored.
+ *      Iterate over all socks scheduled in the timing wheel. When called
+ *      with sockPtr NULL, the iteration starts at slot *slotPtr.
+ *
+ * Results:
+ *      Next scheduled sock or NULL.
+ *
+ * Side effects:
+ *      Updates *slotPtr.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static Sock *
+SockTimersNext(const SockTimers *timersPtr, size_t *slotPtr, Sock *sockPtr)
+{
+    NS_NONNULL_ASSERT(timersPtr != NULL);
+    NS_NONNULL_ASSERT(slotPtr != NULL);
+
+    if (sockPtr != NULL) {
+        sockPtr = sockPtr->timerNextPtr;
+        if (sockPtr == NULL) {
+            (*slotPtr) ++;
+        }
+    }
+    for (; sockPtr == NULL && *slotPtr < SOCK_TIMER_SLOTS; (*slotPtr) ++) {
+        sockPtr = timersPtr->slots[*slotPtr];
+        if (sockPtr != NULL) {
+            break;
+        }
+    }
+    return sockPtr;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * SockWait --
+ *
+ *      Let the driver thread wait for data on the given sock (read-ahead
+ *      and keep-alive socks) or for the peer to close it (closing socks)
+ *      until the timeout of the sock expires.
  *
  * Results:
  *      None.
  *
  * Side effects:
- *      Sock fd will be monitored for readability on next spin of
- *      DriverThread.
+ *      Sock is scheduled in the timing wheel and, when an event backend
+ *      is active, armed.
  *
  *----------------------------------------------------------------------
  */
 
 static void
-SockPoll(Sock *sockPtr, short type, PollData *pdata)
+SockWait(Sock *sockPtr, SockWaitState state, PollData *pdata, SockTimers *timersPtr)
 {
     NS_NONNULL_ASSERT(sockPtr != NULL);
     NS_NONNULL_ASSERT(pdata != NULL);
+    NS_NONNULL_ASSERT(timersPtr != NULL);
 
-    sockPtr->pidx = PollSet(pdata, sockPtr->sock, type, &sockPtr->timeout);
+    sockPtr->waitState = (int)state;
+    SockTimerSchedule(timersPtr, sockPtr);
+    if (pdata->epfd != NS_INVALID_FD) {
+        SockPoll(sockPtr, (short)POLLIN, pdata);
+    }
 }
 
 /*
@@ -3388,6 +4612,12 @@ SockNew(Driver *drvPtr)
         sockPtr->poolPtr = NULL;
         sockPtr->recvSockState = NS_SOCK_NONE;
         sockPtr->recvErrno = 0u;
+        /*
+         * The socket of a recycled Sock was closed, which removed it from
+         * the event backend.
+         */
+        sockPtr->pollRegistered = NS_FALSE;
+        sockPtr->pollArmed = NS_FALSE;
     }
     return sockPtr;
 }
@@ -3449,7 +4679,7 @@ SockRelease(Sock *sockPtr, SockState reason, int err)
 
     if (sockPtr->reqPtr != NULL) {
         Ns_Log(DriverDebug, "SockRelease calls RequestFree");
-        RequestFree(sockPtr);
+        (void)RequestFree(sockPtr);
     }
 
     Ns_MutexLock(&drvPtr->lock);
@@ -4030,6 +5260,11 @@ SockRead(Sock *sockPtr, int spooler, const Ns_Time *timePtr)
         buf.iov_len = MIN(nread, sizeof(tbuf));
     } else {
         Tcl_DStringSetLength(bufPtr, (int)(buflen + nread));
+        /*
+         * The header fields are slices of the buffer, which might have been
+         * reallocated.
+         */
+        NsSetSliceRegion(reqPtr->headers, bufPtr->string, (size_t)bufPtr->spaceAvl);
         buf.iov_base = bufPtr->string + reqPtr->woff;
         buf.iov_len = nread;
     }
@@ -4398,17 +5633,22 @@ SockParse(Sock *sockPtr)
         size_t cnt;
 
         /*
-         * Find the next header line.
+         * Find the next header line. When the line was not complete in an
+         * earlier call, continue the scan at the end of the previously
+         * received data instead of scanning the partial line again. The
+         * scan uses memchr(), which is vectorized by the C library.
          */
         s = bufPtr->string + reqPtr->roff;
-        e = memchr(s, INTCHAR('\n'), reqPtr->avail);
+        e = memchr(s + reqPtr->scanoff, INTCHAR('\n'), reqPtr->avail - reqPtr->scanoff);
 
         if (unlikely(e == NULL)) {
             /*
              * Input not yet newline terminated - request more data.
              */
+            reqPtr->scanoff = reqPtr->avail;
             return SOCK_MORE;
         }
+        reqPtr->scanoff = 0u;
 
         /*
          * Check for max single line overflows.
@@ -4530,6 +5770,7 @@ SockParse(Sock *sockPtr)
                      */
                     return SOCK_BADREQUEST;
                 }
+                *e = save;
 
                 /*
                  * HTTP 0.9 did not have an HTTP-version number or request headers
@@ -4543,9 +5784,10 @@ SockParse(Sock *sockPtr)
                     Ns_Log(Notice, "pre-HTTP/1.0 request <%s>", reqPtr->request.line);
                 }
 
-            } else if (Ns_ParseHeader(reqPtr->headers, s, NULL, Preserve, NULL) != NS_OK) {
+            } else if (NsParseHeaderLine(reqPtr->headers, s, (size_t)(e - s), Preserve, NS_TRUE, NULL) != NS_OK) {
                 /*
-                 * Invalid header.
+                 * Invalid header. The header fields are added as slices of
+                 * the buffer, so the line terminator is kept overwritten.
                  */
                 return SOCK_BADHEADER;
 
@@ -4559,8 +5801,6 @@ SockParse(Sock *sockPtr)
                     return SOCK_TOOMANYHEADERS;
                 }
             }
-
-            *e = save;
         }
     }
 
@@ -5015,6 +6255,9 @@ SpoolerThread(void *arg)
 
     Ns_ThreadSetName("-spooler%d-", queuePtr->id);
     queuePtr->threadName = Ns_ThreadGetName();
+    if (queuePtr->cpus != NULL && Ns_ThreadSetAffinity(queuePtr->cpus) != NS_OK) {
+        Ns_Log(Warning, "could not set CPU affinity '%s'", queuePtr->cpus);
+    }
 
     /*
      * Loop forever until signaled to shut down and all
@@ -5607,9 +6850,19 @@ WriterReadFromSpool(WriterSock *curPtr) {
 
         if (curPtr->c.file.nbufs == 0) {
             /*
-             * Working on a single fd.
+             * Working on a single fd. Unless we are streaming, read with an
+             * explicit position, such that the fd might be shared with
+             * other connections (e.g. via the fastpath fd cache) without
+             * relying on the file pointer.
              */
-            n = ns_read(curPtr->fd, bufPtr, toRead);
+            if (curPtr->c.file.offset >= 0) {
+                n = ns_pread(curPtr->fd, bufPtr, toRead, curPtr->c.file.offset);
+                if (n > 0) {
+                    curPtr->c.file.offset += (off_t)n;
+                }
+            } else {
+                n = ns_read(curPtr->fd, bufPtr, toRead);
+            }
 
         } else {
             /*
@@ -5619,7 +6872,7 @@ WriterReadFromSpool(WriterSock *curPtr) {
             size_t wantRead = curPtr->c.file.bufs[currentbuf].length;
             size_t segSize = (wantRead > toRead ? toRead : wantRead);
 
-            n = ns_read(curPtr->fd, bufPtr, segSize);
+            n = ns_pread(curPtr->fd, bufPtr, segSize, curPtr->c.file.offset);
 
             Ns_Log(DriverDebug, "### WriterReadFromSpool [%d] (nbufs %d): read from fd %d want %lu got %ld (remain %lu)",
                    currentbuf, curPtr->c.file.nbufs, curPtr->fd,  segSize, n, wantRead);
@@ -5630,6 +6883,7 @@ WriterReadFromSpool(WriterSock *curPtr) {
                  * next iteration.
                  */
                 curPtr->c.file.bufs[currentbuf].length -= (size_t)n;
+                curPtr->c.file.offset += (off_t)n;
 
                 if ((size_t)n < wantRead) {
                     /*
@@ -5648,6 +6902,7 @@ WriterReadFromSpool(WriterSock *curPtr) {
 
                     curPtr->c.file.currentbuf ++;
                     curPtr->fd = curPtr->c.file.bufs[curPtr->c.file.currentbuf].fd;
+                    curPtr->c.file.offset = curPtr->c.file.bufs[curPtr->c.file.currentbuf].offset;
 
                     Ns_Log(DriverDebug, "### WriterReadFromSpool switch to [%d] fd %d",
                            curPtr->c.file.currentbuf, curPtr->fd);
@@ -6019,6 +7274,9 @@ WriterThread(void *arg)
     Tcl_HashTable   pools;     /* used for accumulating bandwidth per pool */
 
     Ns_ThreadSetName("-writer%d-", queuePtr->id);
+    if (queuePtr->cpus != NULL && Ns_ThreadSetAffinity(queuePtr->cpus) != NS_OK) {
+        Ns_Log(Warning, "could not set CPU affinity '%s'", queuePtr->cpus);
+    }
     queuePtr->threadName = Ns_ThreadGetName();
 
     Tcl_InitHashTable(&pools, TCL_ONE_WORD_KEYS);
@@ -6557,6 +7815,7 @@ NsWriterQueue(Ns_Conn *conn, size_t nsend,
     Ns_ReturnCode  status = NS_OK;
     Ns_FileVec    *fbufs = NULL;
     int            nfbufs = 0;
+    bool           streaming = NS_FALSE;
 
     NS_NONNULL_ASSERT(conn != NULL);
     connPtr = (Conn *)conn;
@@ -6621,6 +7880,7 @@ NsWriterQueue(Ns_Conn *conn, size_t nsend,
          * set.
          */
         assert(fd != NS_INVALID_FD);
+        streaming = NS_TRUE;
 
     } else {
         if (fp != NULL) {
@@ -6772,6 +8032,20 @@ NsWriterQueue(Ns_Conn *conn, size_t nsend,
         wrSockPtr->c.file.bufoffset = 0;
         wrSockPtr->c.file.toRead = nsend;
 
+        /*
+         * Determine the read position. Streaming mode reads sequentially
+         * from the spool file; Ns_FileVec segments carry their offsets; a
+         * plain fd is read from its current position onwards. A negative
+         * value (e.g. for pipes) falls back to sequential reads.
+         */
+        if (streaming) {
+            wrSockPtr->c.file.offset = -1;
+        } else if (fbufs != NULL) {
+            wrSockPtr->c.file.offset = fbufs[0].offset;
+        } else {
+            wrSockPtr->c.file.offset = ns_lseek(fd, 0, SEEK_CUR);
+        }
+
     } else if (bufs != NULL) {
         int   i, j, headerbufs = (headerSize > 0u ? 1 : 0);
 
@@ -6862,6 +8136,13 @@ NsWriterQueue(Ns_Conn *conn, size_t nsend,
 
     connPtr->flags |= NS_CONN_SENT_VIA_WRITER;
     wrSockPtr->keep = (connPtr->keep > 0);
+
+    /*
+     * The writer thread frees the request when it is done, but the header
+     * fields still refer to the request buffer; keep the request with the
+     * connection.
+     */
+    NsConnRetainRequest(connPtr);
     wrSockPtr->size = nsend;
     Ns_Log(DriverDebug, "NsWriterQueue NS_CONN_SENT_VIA_WRITER connPtr %p",
            (void*)connPtr);
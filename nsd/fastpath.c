@@ -49,6 +49,20 @@ typedef struct {
     char   bytes[1];  /* Grown to actual file size. */
 } File;
 
+/*
+ * The following structure defines an open file descriptor stored in
+ * the fd cache. The fd is closed, when the last reference is gone.
+ */
+
+typedef struct {
+    time_t mtime;
+    size_t size;
+    dev_t  dev;
+    ino_t  ino;
+    int    refcnt;
+    int    fd;
+} OpenFile;
+
 
 /*
  * Local functions defined in this file
@@ -57,6 +71,12 @@ typedef struct {
 static void DecrEntry(File *filePtr)
     NS_GNUC_NONNULL(1);
 
+static OpenFile *GetOpenFile(const char *fileName, const struct stat *stPtr)
+    NS_GNUC_NONNULL(1) NS_GNUC_NONNULL(2);
+
+static void DecrOpenFile(OpenFile *ofPtr)
+    NS_GNUC_NONNULL(1);
+
 static bool UrlIs(const char *server, const char *url, bool isDir)
     NS_GNUC_NONNULL(1) NS_GNUC_NONNULL(2);
 
@@ -72,6 +92,9 @@ static int  CompressExternalFile(Tcl_Interp *interp, const char *cmdName, const
 static void NormalizePath(const char **pathPtr)
     NS_GNUC_NONNULL(1);
 
+static bool PageStat(const char *path, struct stat *stPtr)
+    NS_GNUC_NONNULL(1) NS_GNUC_NONNULL(2);
+
 static const char *
 CheckStaticCompressedDelivery(
     Ns_Conn *conn,
@@ -85,6 +108,7 @@ CheckStaticCompressedDelivery(
 
 
 static Ns_Callback FreeEntry;
+static Ns_Callback FreeOpenFile;
 static Ns_ServerInitProc ConfigServerFastpath;
 
 
@@ -93,6 +117,7 @@ static Ns_ServerInitProc ConfigServerFastpath;
  */
 
 static Ns_Cache *cache = NULL;                /* Global cache of pages for all virtual servers.     */
+static Ns_Cache *fdCache = NULL;              /* Global cache of open file descriptors.             */
 static int       maxentry;                    /* Maximum size of an individual entry in the cache.  */
 static bool      useMmap = NS_FALSE;          /* Use the mmap() system call to read data from disk. */
 static bool      useGzip = NS_FALSE;          /* Use gzip delivery if possible                      */
@@ -122,6 +147,7 @@ void
 NsConfigFastpath(void)
 {
     const char *path;
+    int         fdCacheSize;
 
     path    = Ns_ConfigSectionPath(NULL, NULL, NULL, "fastpath", (char *)0L);
     useMmap = Ns_ConfigBool(path, "mmap", NS_FALSE);
@@ -136,6 +162,18 @@ NsConfigFastpath(void)
         cache = Ns_CacheCreateSz("ns:fastpath", TCL_STRING_KEYS, size, FreeEntry);
         maxentry = (int)Ns_ConfigMemUnitRange(path, "cachemaxentry", "8KB", 8192, 8, INT_MAX);
     }
+
+    /*
+     * The fd cache keeps up to "fdcachesize" files open for the direct
+     * delivery of files not served from the page cache above. Every
+     * entry accounts for a size of 1.
+     */
+    fdCacheSize = Ns_ConfigIntRange(path, "fdcachesize", 0, 0, INT_MAX);
+    if (fdCacheSize > 0) {
+        fdCache = Ns_CacheCreateSz("ns:fastpath:fd", TCL_STRING_KEYS,
+                                   (size_t)fdCacheSize, FreeOpenFile);
+    }
+
     /*
      * Register the fastpath initialization for every server.
      */
@@ -341,7 +379,7 @@ Ns_FastPathProc(const void *UNUSED(arg), Ns_Conn *conn)
     Ns_DStringInit(&ds);
 
     if ((NsUrlToFile(&ds, servPtr, url) != NS_OK)
-        || (Ns_Stat(ds.string, &connPtr->fileInfo) == NS_FALSE)) {
+        || (PageStat(ds.string, &connPtr->fileInfo) == NS_FALSE)) {
         goto notfound;
     }
 
@@ -368,7 +406,7 @@ Ns_FastPathProc(const void *UNUSED(arg), Ns_Conn *conn)
             }
             Ns_DStringVarAppend(&ds, "/", servPtr->fastpath.dirv[i], (char *)0L);
 
-            if ((stat(ds.string, &connPtr->fileInfo) == 0)
+            if (NsFileWatchStat(ds.string, &connPtr->fileInfo)
                 && S_ISREG(connPtr->fileInfo.st_mode)
                 ) {
                 Ns_Log(Debug, "FastPathProc checks [%d] '%s' -> found", i, ds.string);
@@ -786,6 +824,24 @@ FastReturn(Ns_Conn *conn, int statusCode, const char *mimeType, const char *file
             }
             connPtr->fmap.addr = NULL;
 
+        } else if (fdCache != NULL) {
+            OpenFile *ofPtr;
+
+            /*
+             * Deliver from a shared, cached fd. The writer thread makes
+             * its own dup() of the fd, so the reference can be released
+             * as soon as the content is queued or sent.
+             */
+            ofPtr = GetOpenFile(fileName, &connPtr->fileInfo);
+            if (ofPtr == NULL) {
+                goto notfound;
+            }
+            status = Ns_ConnReturnOpenFd(conn, statusCode, mimeType, ofPtr->fd,
+                                         (size_t)connPtr->fileInfo.st_size);
+            Ns_CacheLock(fdCache);
+            DecrOpenFile(ofPtr);
+            Ns_CacheUnlock(fdCache);
+
         } else {
             fd = ns_open(fileName, O_RDONLY | O_BINARY | O_CLOEXEC, 0);
             if (fd < 0) {
@@ -894,6 +950,125 @@ FastReturn(Ns_Conn *conn, int statusCode, const char *mimeType, const char *file
     return Ns_ConnReturnNotFound(conn);
 }
 
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * GetOpenFile --
+ *
+ *      Return an open file descriptor for the given file from the fd
+ *      cache. Cached entries are validated against the mtime, size and
+ *      inode of the provided stat buffer, such that a file changed on
+ *      disk (as detected via stat() or the file watcher) replaces its
+ *      stale entry.
+ *
+ * Results:
+ *      OpenFile structure with a reference for the caller, which has to
+ *      be released via DecrOpenFile(), or NULL when the file cannot be
+ *      opened.
+ *
+ * Side effects:
+ *      Might open a file and evict other entries from the fd cache.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static OpenFile *
+GetOpenFile(const char *fileName, const struct stat *stPtr)
+{
+    Ns_Entry *entry;
+    OpenFile *ofPtr = NULL;
+
+    NS_NONNULL_ASSERT(fileName != NULL);
+    NS_NONNULL_ASSERT(stPtr != NULL);
+
+    Ns_CacheLock(fdCache);
+    entry = Ns_CacheFindEntry(fdCache, fileName);
+    if (entry != NULL) {
+        ofPtr = Ns_CacheGetValue(entry);
+        if (ofPtr != NULL
+            && (ofPtr->mtime != stPtr->st_mtime
+                || ofPtr->size != (size_t)stPtr->st_size
+                || ofPtr->dev  != (dev_t)stPtr->st_dev
+                || ofPtr->ino  != stPtr->st_ino)
+            ) {
+            Ns_CacheFlushEntry(entry);
+            ofPtr = NULL;
+        }
+    }
+    if (ofPtr != NULL) {
+        ++ofPtr->refcnt;
+    }
+    Ns_CacheUnlock(fdCache);
+
+    if (ofPtr == NULL) {
+        int fd = ns_open(fileName, O_RDONLY | O_BINARY | O_CLOEXEC, 0);
+
+        if (fd < 0) {
+            Ns_Log(Warning, "fastpath: ns_open(%s) failed: '%s'",
+                   fileName, strerror(errno));
+        } else {
+            int isNew;
+
+            ofPtr = ns_malloc(sizeof(OpenFile));
+            ofPtr->refcnt = 2; /* one for the cache, one for the caller */
+            ofPtr->fd     = fd;
+            ofPtr->size   = (size_t)stPtr->st_size;
+            ofPtr->mtime  = stPtr->st_mtime;
+            ofPtr->dev    = stPtr->st_dev;
+            ofPtr->ino    = stPtr->st_ino;
+
+            /*
+             * A concurrent request might have added an entry in the
+             * meantime, which is simply replaced.
+             */
+            Ns_CacheLock(fdCache);
+            entry = Ns_CacheCreateEntry(fdCache, fileName, &isNew);
+            Ns_CacheSetValueSz(entry, ofPtr, 1u);
+            Ns_CacheUnlock(fdCache);
+        }
+    }
+
+    return ofPtr;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * DecrOpenFile, FreeOpenFile --
+ *
+ *      Release a reference of an fd cache entry. The fd is closed when
+ *      the last reference is gone. Called with the fd cache locked.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      Might close the file descriptor.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+DecrOpenFile(OpenFile *ofPtr)
+{
+    NS_NONNULL_ASSERT(ofPtr != NULL);
+
+    if (--ofPtr->refcnt == 0) {
+        (void) ns_close(ofPtr->fd);
+        ns_free(ofPtr);
+    }
+}
+
+static void
+FreeOpenFile(void *arg)
+{
+    OpenFile *ofPtr = arg;
+
+    DecrOpenFile(ofPtr);
+}
+
 
 /*
  *----------------------------------------------------------------------
@@ -929,6 +1104,41 @@ Ns_Stat(const char *path, struct stat *stPtr)
     return success;
 }
 
+/*
+ *----------------------------------------------------------------------
+ *
+ * PageStat --
+ *
+ *      Stat a page file like Ns_Stat(), but take the result from the
+ *      file watcher when it is active.
+ *
+ * Results:
+ *      NS_TRUE if stat() was successful, NS_FALSE otherwise.
+ *
+ * Side effects:
+ *      See NsFileWatchStat().
+ *
+ *----------------------------------------------------------------------
+ */
+
+static bool
+PageStat(const char *path, struct stat *stPtr)
+{
+    bool success = NS_TRUE;
+
+    NS_NONNULL_ASSERT(path != NULL);
+    NS_NONNULL_ASSERT(stPtr != NULL);
+
+    if (!NsFileWatchStat(path, stPtr)) {
+        if (errno != ENOENT && errno != EACCES && errno != ENOTDIR) {
+            Ns_Log(Error, "fastpath: stat(%s) failed: %s",
+                   path, strerror(errno));
+        }
+        success = NS_FALSE;
+    }
+    return success;
+}
+
 
 /*
  *----------------------------------------------------------------------
@@ -0,0 +1,826 @@
+/*
+ * The contents of this file are subject to the Mozilla Public License
+ * Version 1.1 (the "License"); you may not use this file except in
+ * compliance with the License. You may obtain a copy of the License at
+ * http://mozilla.org/.
+ *
+ * Software distributed under the License is distributed on an "AS IS"
+ * basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See
+ * the License for the specific language governing rights and limitations
+ * under the License.
+ *
+ * The Original Code is AOLserver Code and related documentation
+ * distributed by AOL.
+ *
+ * The Initial Developer of the Original Code is America Online,
+ * Inc. Portions created by AOL are Copyright (C) 1999 America Online,
+ * Inc. All Rights Reserved.
+ *
+ * Alternatively, the contents of this file may be used under the terms
+ * of the GNU General Public License (the "GPL"), in which case the
+ * provisions of GPL are applicable instead of those above.  If you wish
+ * to allow use of your version of this file only under the terms of the
+ * GPL and not to allow others to use your version of this file under the
+ * License, indicate your decision by deleting the provisions above and
+ * replace them with the notice and other provisions required by the GPL.
+ * If you do not delete the provisions above, a recipient may use your
+ * version of this file under either the License or the GPL.
+ */
+
+
+/*
+ * filewatch.c --
+ *
+ *      Cache of stat() results of page files, which is kept up to date
+ *      by watching the directories of the files with inotify (Linux
+ *      only). Changes invisible to inotify (e.g., changes on other hosts
+ *      of a network file system or changes of targets of symbolic links)
+ *      are caught by repeating the stat() after a configurable interval.
+ */
+
+#include "nsd.h"
+
+#if defined(__linux__)
+# include <sys/inotify.h>
+# include <poll.h>
+# define NS_HAVE_INOTIFY 1
+#endif
+
+#ifdef NS_HAVE_INOTIFY
+
+#define WATCH_MASK (IN_ATTRIB | IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_MODIFY \
+                    | IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF)
+
+/*
+ * The following structure keeps the stat() result of a file.
+ */
+
+typedef struct FileEntry {
+    struct stat st;
+    Ns_Time     expires;   /* Time, when the stat() has to be repeated */
+} FileEntry;
+
+/*
+ * The following structure defines a name of a watched directory. The
+ * same directory might be accessed under several names (e.g. via
+ * symbolic links), which share the watch. The stat() results are kept
+ * per directory name, such that an event touches only the entries of
+ * the directory.
+ */
+
+typedef struct DirName {
+    Tcl_HashEntry   *hPtr;      /* Entry in the directory table */
+    struct DirWatch *watchPtr;  /* Watch of the directory */
+    struct DirName  *nextPtr;   /* Next name of the same directory */
+    Tcl_HashTable    files;     /* file name -> FileEntry */
+} DirName;
+
+/*
+ * The following structure defines a watched directory.
+ */
+
+typedef struct DirWatch {
+    int      wd;
+    DirName *namesPtr;          /* All names of the directory */
+} DirWatch;
+
+/*
+ * Local functions defined in this file
+ */
+
+static Ns_ThreadProc WatchThread;
+static Ns_ShutdownProc FileWatchShutdown;
+
+static DirName *GetDirName(const char *dir)
+    NS_GNUC_NONNULL(1);
+
+static void FlushFiles(DirName *namePtr)
+    NS_GNUC_NONNULL(1);
+
+static void ForgetDirName(DirName *namePtr, bool removeWatch)
+    NS_GNUC_NONNULL(1);
+
+static void ForgetDirs(const char *dir)
+    NS_GNUC_NONNULL(1);
+
+static void ProcessEvents(const char *buffer, ssize_t length)
+    NS_GNUC_NONNULL(1);
+
+static bool WatchedPath(const char *path)
+    NS_GNUC_NONNULL(1) NS_GNUC_PURE;
+
+/*
+ * Static variables defined in this file.
+ */
+
+static int           watchFd = NS_INVALID_FD;
+static NS_SOCKET     trigPipe[2];
+static Ns_Thread     watchThread;
+static bool          shutdownPending = NS_FALSE;
+static Ns_Time       interval;
+static const char  **watchPaths = NULL;  /* Watched path prefixes, NULL for all */
+static Ns_RWLock     lock;
+static Tcl_HashTable dirs;     /* directory -> DirName */
+static Tcl_HashTable watches;  /* watch descriptor -> DirWatch */
+static unsigned long changes;  /* Number of processed events; a stat() result
+                                * racing with an event is not cached */
+static unsigned long hits;     /* Number of stat() calls answered from the cache */
+
+#endif
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * NsConfigFileWatch --
+ *
+ *      Initialize the file watcher, when activated via the "filewatch"
+ *      parameter.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      Creates the inotify instance, starts the watcher thread and
+ *      registers its shutdown.
+ *
+ *----------------------------------------------------------------------
+ */
+
+void
+NsConfigFileWatch(void)
+{
+    const char *path = NS_GLOBAL_CONFIG_PARAMETERS;
+
+    if (Ns_ConfigBool(path, "filewatch", NS_FALSE)) {
+#ifdef NS_HAVE_INOTIFY
+        const char *paths;
+
+        Ns_ConfigTimeUnitRange(path, "filewatchinterval", "1m", 1, 0, INT_MAX, 0, &interval);
+        paths = Ns_ConfigString(path, "filewatchpaths", NULL);
+        if (paths != NULL) {
+            int n;
+
+            if (Tcl_SplitList(NULL, paths, &n, &watchPaths) != TCL_OK) {
+                Ns_Log(Error, "config: filewatchpaths is not a list: %s", paths);
+                watchPaths = NULL;
+            }
+        }
+
+        watchFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (watchFd == NS_INVALID_FD) {
+            Ns_Log(Warning, "filewatch: inotify_init1 failed: %s", strerror(errno));
+
+        } else if (ns_sockpair(trigPipe) != 0) {
+            Ns_Log(Warning, "filewatch: ns_sockpair failed: %s", strerror(errno));
+            (void) ns_close(watchFd);
+            watchFd = NS_INVALID_FD;
+
+        } else {
+            Ns_RWLockInit(&lock);
+            Ns_RWLockSetName2(&lock, "ns:filewatch", NULL);
+            Tcl_InitHashTable(&dirs, TCL_STRING_KEYS);
+            Tcl_InitHashTable(&watches, TCL_ONE_WORD_KEYS);
+            Ns_ThreadCreate(WatchThread, NULL, 0, &watchThread);
+            (void) Ns_RegisterAtShutdown(FileWatchShutdown, NULL);
+            Ns_Log(Notice, "filewatch: watching page files, stat interval " NS_TIME_FMT "s",
+                   (int64_t)interval.sec, interval.usec);
+        }
+#else
+        Ns_Log(Warning, "filewatch: not supported on this platform");
+#endif
+    }
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * NsFileWatchStat --
+ *
+ *      Drop-in replacement for stat() for page files. When the file
+ *      watcher is active, the stat() result is taken from the cache
+ *      unless the file was changed or the stat interval has passed.
+ *
+ * Results:
+ *      NS_TRUE when stat() was successful, NS_FALSE otherwise (with
+ *      errno set).
+ *
+ * Side effects:
+ *      May add a directory to the set of watched directories.
+ *
+ *----------------------------------------------------------------------
+ */
+
+bool
+NsFileWatchStat(const char *path, struct stat *stPtr)
+{
+    bool success;
+
+    NS_NONNULL_ASSERT(path != NULL);
+    NS_NONNULL_ASSERT(stPtr != NULL);
+
+#ifdef NS_HAVE_INOTIFY
+    if (watchFd != NS_INVALID_FD && *path == '/' && WatchedPath(path)) {
+        const Tcl_HashEntry *hPtr;
+        const FileEntry     *entryPtr = NULL;
+        const char          *slash = strrchr(path, INTCHAR('/')), *name = slash + 1;
+        Tcl_DString          ds;
+        Ns_Time              now;
+
+        Tcl_DStringInit(&ds);
+        Tcl_DStringAppend(&ds, path, (slash == path) ? 1 : (int)(slash - path));
+
+        Ns_GetTime(&now);
+        Ns_RWLockRdLock(&lock);
+        hPtr = Tcl_FindHashEntry(&dirs, ds.string);
+        if (hPtr != NULL && Tcl_GetHashValue(hPtr) != NULL) {
+            DirName *namePtr = Tcl_GetHashValue(hPtr);
+
+            hPtr = Tcl_FindHashEntry(&namePtr->files, name);
+            if (hPtr != NULL) {
+                entryPtr = Tcl_GetHashValue(hPtr);
+                if (Ns_DiffTime(&entryPtr->expires, &now, NULL) > 0) {
+                    *stPtr = entryPtr->st;
+                    (void)__atomic_add_fetch(&hits, 1u, __ATOMIC_RELAXED);
+                } else {
+                    entryPtr = NULL;
+                }
+            }
+        }
+        Ns_RWLockUnlock(&lock);
+
+        if (entryPtr != NULL) {
+            success = NS_TRUE;
+        } else {
+            DirName       *namePtr;
+            unsigned long  changesBefore;
+
+            /*
+             * Make sure the directory is watched before calling stat(),
+             * such that no change after the stat() is missed.
+             */
+            Ns_RWLockWrLock(&lock);
+            namePtr = GetDirName(ds.string);
+            changesBefore = changes;
+            Ns_RWLockUnlock(&lock);
+
+            success = (stat(path, stPtr) == 0);
+
+            if (success && namePtr != NULL) {
+                Ns_RWLockWrLock(&lock);
+                /*
+                 * Without intermediate events, the directory name is
+                 * still valid.
+                 */
+                if (changes == changesBefore) {
+                    Tcl_HashEntry *newPtr;
+                    FileEntry     *newEntryPtr;
+                    int            isNew;
+
+                    newPtr = Tcl_CreateHashEntry(&namePtr->files, name, &isNew);
+                    if (isNew != 0) {
+                        newEntryPtr = ns_malloc(sizeof(FileEntry));
+                        Tcl_SetHashValue(newPtr, newEntryPtr);
+                    } else {
+                        newEntryPtr = Tcl_GetHashValue(newPtr);
+                    }
+                    newEntryPtr->st = *stPtr;
+                    newEntryPtr->expires = now;
+                    Ns_IncrTime(&newEntryPtr->expires, interval.sec, interval.usec);
+                }
+                Ns_RWLockUnlock(&lock);
+            }
+        }
+        Tcl_DStringFree(&ds);
+    } else {
+        success = (stat(path, stPtr) == 0);
+    }
+#else
+    success = (stat(path, stPtr) == 0);
+#endif
+
+    return success;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * NsGetFileWatchStats --
+ *
+ *      Append the statistics of the file watcher in form of a dict to
+ *      the provided Tcl_DString.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+void
+NsGetFileWatchStats(Tcl_DString *dsPtr)
+{
+    NS_NONNULL_ASSERT(dsPtr != NULL);
+
+#ifdef NS_HAVE_INOTIFY
+    if (watchFd != NS_INVALID_FD) {
+        const Tcl_HashEntry *hPtr;
+        Tcl_HashSearch       search;
+        unsigned long        nfiles = 0u;
+
+        Ns_RWLockRdLock(&lock);
+        for (hPtr = Tcl_FirstHashEntry(&dirs, &search);
+             hPtr != NULL;
+             hPtr = Tcl_NextHashEntry(&search)) {
+            const DirName *namePtr = Tcl_GetHashValue(hPtr);
+
+            if (namePtr != NULL) {
+                nfiles += (unsigned long)namePtr->files.numEntries;
+            }
+        }
+        Ns_DStringPrintf(dsPtr, "enabled 1 dirs %d watches %d files %lu events %lu hits %lu",
+                         dirs.numEntries, watches.numEntries, nfiles, changes, hits);
+        Ns_RWLockUnlock(&lock);
+    } else
+#endif
+    {
+        Tcl_DStringAppend(dsPtr, "enabled 0 dirs 0 watches 0 files 0 events 0 hits 0", -1);
+    }
+}
+
+#ifdef NS_HAVE_INOTIFY
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * WatchedPath --
+ *
+ *      Check, whether the stat() results of a file are cached, i.e.
+ *      whether it starts with one of the prefixes configured via
+ *      "filewatchpaths".
+ *
+ * Results:
+ *      Boolean value.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static bool
+WatchedPath(const char *path)
+{
+    bool success = NS_TRUE;
+
+    NS_NONNULL_ASSERT(path != NULL);
+
+    if (watchPaths != NULL) {
+        const char **prefixPtr;
+
+        success = NS_FALSE;
+        for (prefixPtr = watchPaths; *prefixPtr != NULL; prefixPtr++) {
+            if (strncmp(path, *prefixPtr, strlen(*prefixPtr)) == 0) {
+                success = NS_TRUE;
+                break;
+            }
+        }
+    }
+    return success;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * GetDirName --
+ *
+ *      Return the name entry of a directory, adding the directory to
+ *      the inotify instance when necessary. Must be called with the
+ *      write lock held.
+ *
+ * Results:
+ *      Directory name or NULL, when the directory cannot be watched.
+ *
+ * Side effects:
+ *      May add a watch to the inotify instance.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static DirName *
+GetDirName(const char *dir)
+{
+    Tcl_HashEntry *hPtr;
+    DirName       *namePtr = NULL;
+    int            isNew;
+
+    NS_NONNULL_ASSERT(dir != NULL);
+
+    if (watchFd == NS_INVALID_FD) {
+        /*
+         * The watcher was shut down.
+         */
+        return NULL;
+    }
+
+    hPtr = Tcl_CreateHashEntry(&dirs, dir, &isNew);
+    if (isNew == 0) {
+        namePtr = Tcl_GetHashValue(hPtr);
+    } else {
+        int wd = inotify_add_watch(watchFd, dir, WATCH_MASK);
+
+        if (wd < 0) {
+            /*
+             * Nonexistent directories (e.g., from requests for
+             * nonexistent pages) are not remembered. For other errors
+             * (e.g., the limit of watches is reached), remember that
+             * the directory cannot be watched.
+             */
+            if (errno == ENOENT || errno == ENOTDIR) {
+                Tcl_DeleteHashEntry(hPtr);
+            } else {
+                Ns_Log(Warning, "filewatch: cannot watch directory \"%s\": %s",
+                       dir, strerror(errno));
+                Tcl_SetHashValue(hPtr, NULL);
+            }
+        } else {
+            Tcl_HashEntry *wPtr = Tcl_CreateHashEntry(&watches, INT2PTR(wd), &isNew);
+            DirWatch      *watchPtr;
+
+            if (isNew == 0) {
+                /*
+                 * Same directory under a different name, e.g. via a
+                 * symbolic link. Events are reported for all names.
+                 */
+                watchPtr = Tcl_GetHashValue(wPtr);
+            } else {
+                watchPtr = ns_malloc(sizeof(DirWatch));
+                watchPtr->wd = wd;
+                watchPtr->namesPtr = NULL;
+                Tcl_SetHashValue(wPtr, watchPtr);
+            }
+            namePtr = ns_malloc(sizeof(DirName));
+            namePtr->hPtr = hPtr;
+            namePtr->watchPtr = watchPtr;
+            namePtr->nextPtr = watchPtr->namesPtr;
+            watchPtr->namesPtr = namePtr;
+            Tcl_InitHashTable(&namePtr->files, TCL_STRING_KEYS);
+            Tcl_SetHashValue(hPtr, namePtr);
+            Ns_Log(Debug, "filewatch: watch directory \"%s\" wd %d", dir, wd);
+        }
+    }
+
+    return namePtr;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * FlushFiles --
+ *
+ *      Remove all cached stat() results of the files of a directory
+ *      name. Must be called with the write lock held.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      Next NsFileWatchStat() of these files calls stat().
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+FlushFiles(DirName *namePtr)
+{
+    Tcl_HashEntry  *hPtr;
+    Tcl_HashSearch  search;
+
+    NS_NONNULL_ASSERT(namePtr != NULL);
+
+    for (hPtr = Tcl_FirstHashEntry(&namePtr->files, &search);
+         hPtr != NULL;
+         hPtr = Tcl_NextHashEntry(&search)) {
+        ns_free(Tcl_GetHashValue(hPtr));
+        Tcl_DeleteHashEntry(hPtr);
+    }
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * ForgetDirName --
+ *
+ *      Forget about a directory name together with its cached stat()
+ *      results. When this was the last name of the directory, the
+ *      watch is removed as well. Must be called with the write lock
+ *      held.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      Frees the directory name, might remove the inotify watch.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+ForgetDirName(DirName *namePtr, bool removeWatch)
+{
+    DirWatch  *watchPtr;
+    DirName  **prevPtrPtr;
+
+    NS_NONNULL_ASSERT(namePtr != NULL);
+
+    watchPtr = namePtr->watchPtr;
+    for (prevPtrPtr = &watchPtr->namesPtr; *prevPtrPtr != namePtr; prevPtrPtr = &(*prevPtrPtr)->nextPtr) {
+        ;
+    }
+    *prevPtrPtr = namePtr->nextPtr;
+
+    FlushFiles(namePtr);
+    Tcl_DeleteHashTable(&namePtr->files);
+    Tcl_DeleteHashEntry(namePtr->hPtr);
+    ns_free(namePtr);
+
+    if (watchPtr->namesPtr == NULL) {
+        if (removeWatch) {
+            (void) inotify_rm_watch(watchFd, watchPtr->wd);
+        }
+        Tcl_DeleteHashEntry(Tcl_FindHashEntry(&watches, INT2PTR(watchPtr->wd)));
+        ns_free(watchPtr);
+    }
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * ForgetDirs --
+ *
+ *      Forget about a directory name and all directory names below
+ *      it, e.g. after the directory was renamed or removed. Must be
+ *      called with the write lock held.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      See ForgetDirName().
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+ForgetDirs(const char *dir)
+{
+    Tcl_HashEntry  *hPtr;
+    Tcl_HashSearch  search;
+    size_t          dirLength;
+
+    NS_NONNULL_ASSERT(dir != NULL);
+
+    dirLength = strlen(dir);
+    hPtr = Tcl_FirstHashEntry(&dirs, &search);
+    while (hPtr != NULL) {
+        const char *key = Tcl_GetHashKey(&dirs, hPtr);
+
+        if (strncmp(key, dir, dirLength) == 0
+            && (key[dirLength] == '\0' || key[dirLength] == '/')) {
+            DirName *namePtr = Tcl_GetHashValue(hPtr);
+
+            if (namePtr != NULL) {
+                ForgetDirName(namePtr, NS_TRUE);
+            } else {
+                Tcl_DeleteHashEntry(hPtr);
+            }
+        }
+        hPtr = Tcl_NextHashEntry(&search);
+    }
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * ProcessEvents --
+ *
+ *      Invalidate the cached stat() results for the files named in the
+ *      received inotify events.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      Cached entries are removed, removed directories are forgotten.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+ProcessEvents(const char *buffer, ssize_t length)
+{
+    const char  *p;
+    Tcl_DString  ds;
+
+    NS_NONNULL_ASSERT(buffer != NULL);
+
+    Tcl_DStringInit(&ds);
+    Ns_RWLockWrLock(&lock);
+
+    for (p = buffer; p < buffer + length; ) {
+        const struct inotify_event *eventPtr = (const struct inotify_event *)(const void *)p;
+        const Tcl_HashEntry        *hPtr;
+
+        p += sizeof(struct inotify_event) + eventPtr->len;
+        changes++;
+
+        if ((eventPtr->mask & IN_Q_OVERFLOW) != 0u) {
+            Tcl_HashSearch search;
+
+            Ns_Log(Notice, "filewatch: event queue overflow, flush all entries");
+            for (hPtr = Tcl_FirstHashEntry(&dirs, &search);
+                 hPtr != NULL;
+                 hPtr = Tcl_NextHashEntry(&search)) {
+                if (Tcl_GetHashValue(hPtr) != NULL) {
+                    FlushFiles(Tcl_GetHashValue(hPtr));
+                }
+            }
+            continue;
+        }
+
+        hPtr = Tcl_FindHashEntry(&watches, INT2PTR(eventPtr->wd));
+        if (hPtr == NULL) {
+            continue;
+        }
+
+        if ((eventPtr->mask & (IN_IGNORED | IN_DELETE_SELF | IN_MOVE_SELF)) != 0u) {
+            DirWatch *watchPtr = Tcl_GetHashValue(hPtr);
+
+            /*
+             * The directory itself is gone or moved, forget about all
+             * of its names.
+             */
+            while (watchPtr->namesPtr->nextPtr != NULL) {
+                ForgetDirName(watchPtr->namesPtr, NS_FALSE);
+            }
+            ForgetDirName(watchPtr->namesPtr, (eventPtr->mask & IN_IGNORED) == 0u);
+
+        } else if (eventPtr->len > 0u) {
+            DirName *namePtr;
+
+            /*
+             * Remove the entry of a changed file under every name of
+             * the directory. The names of a changed subdirectory are
+             * collected first, since forgetting them might modify the
+             * list of names.
+             */
+            for (namePtr = ((DirWatch *)Tcl_GetHashValue(hPtr))->namesPtr;
+                 namePtr != NULL;
+                 namePtr = namePtr->nextPtr) {
+                if ((eventPtr->mask & IN_ISDIR) == 0u) {
+                    Tcl_HashEntry *fPtr = Tcl_FindHashEntry(&namePtr->files, eventPtr->name);
+
+                    if (fPtr != NULL) {
+                        ns_free(Tcl_GetHashValue(fPtr));
+                        Tcl_DeleteHashEntry(fPtr);
+                    }
+                } else {
+                    Tcl_DStringAppend(&ds, Tcl_GetHashKey(&dirs, namePtr->hPtr), -1);
+                    if (ds.string[ds.length - 1] != '/') {
+                        Tcl_DStringAppend(&ds, "/", 1);
+                    }
+                    Tcl_DStringAppend(&ds, eventPtr->name, -1);
+                    Tcl_DStringAppend(&ds, "", 1);
+                }
+            }
+
+            if (ds.length > 0) {
+                const char *dir;
+
+                /*
+                 * A subdirectory changed; forget about it and all
+                 * directories below.
+                 */
+                for (dir = ds.string; dir < ds.string + ds.length; dir += strlen(dir) + 1u) {
+                    ForgetDirs(dir);
+                }
+                Tcl_DStringSetLength(&ds, 0);
+            }
+        }
+    }
+
+    Ns_RWLockUnlock(&lock);
+    Tcl_DStringFree(&ds);
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * WatchThread --
+ *
+ *      Thread reading the events of the inotify instance until the
+ *      server shuts down.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      See ProcessEvents().
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+WatchThread(void *UNUSED(arg))
+{
+    union {
+        struct inotify_event event;
+        char                 buffer[16384];
+    } u;
+
+    Ns_ThreadSetName("-filewatch-");
+    Ns_Log(Notice, "filewatch: starting");
+
+    while (!shutdownPending) {
+        struct pollfd pfds[2];
+
+        pfds[0].fd = watchFd;
+        pfds[0].events = POLLIN;
+        pfds[0].revents = 0;
+        pfds[1].fd = trigPipe[0];
+        pfds[1].events = POLLIN;
+        pfds[1].revents = 0;
+
+        if (poll(pfds, 2, -1) > 0 && (pfds[0].revents & POLLIN) != 0) {
+            ssize_t length = read(watchFd, u.buffer, sizeof(u.buffer));
+
+            if (length > 0) {
+                ProcessEvents(u.buffer, length);
+            }
+        }
+    }
+
+    Ns_Log(Notice, "filewatch: exiting");
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * FileWatchShutdown --
+ *
+ *      Shutdown callback of the file watcher. The first call wakes up
+ *      the watcher thread, the second call waits for it and closes the
+ *      inotify instance.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      Further NsFileWatchStat() calls call stat() directly.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+FileWatchShutdown(const Ns_Time *toPtr, void *UNUSED(arg))
+{
+    if (toPtr == NULL) {
+        shutdownPending = NS_TRUE;
+        if (ns_send(trigPipe[1], NS_EMPTY_STRING, 1u, 0) != 1) {
+            Ns_Log(Warning, "filewatch: trigger send failed: %s", ns_sockstrerror(ns_sockerrno));
+        }
+    } else if (watchThread != NULL) {
+        int fd = watchFd;
+
+        Ns_ThreadJoin(&watchThread, NULL);
+        watchThread = NULL;
+
+        Ns_RWLockWrLock(&lock);
+        watchFd = NS_INVALID_FD;
+        Ns_RWLockUnlock(&lock);
+
+        (void) ns_close(fd);
+        ns_sockclose(trigPipe[0]);
+        ns_sockclose(trigPipe[1]);
+    }
+}
+#endif
+
+/*
+ * Local Variables:
+ * mode: c
+ * c-basic-offset: 4
+ * fill-column: 78
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -542,7 +542,7 @@ NsTclInfoObjCmd(ClientData clientData, Tcl_Interp *interp, int objc, Tcl_Obj *co
         "scheduled", "server", "servers",
         "sockcallbacks", "ssl", "tag", "tcllib", "threads", "uptime",
         "version", "winnt", "filters", "traces", "requestprocs",
-        "url2file", "shutdownpending", "started", NULL
+        "url2file", "shutdownpending", "started", "filewatch", NULL
     };
 
     enum {
@@ -554,7 +554,7 @@ NsTclInfoObjCmd(ClientData clientData, Tcl_Interp *interp, int objc, Tcl_Obj *co
         IScheduledIdx, IServerIdx, IServersIdx,
         ISockCallbacksIdx, ISSLIdx, ITagIdx, ITclLibIdx, IThreadsIdx, IUptimeIdx,
         IVersionIdx, IWinntIdx, IFiltersIdx, ITracesIdx, IRequestProcsIdx,
-        IUrl2FileIdx, IShutdownPendingIdx, IStartedIdx
+        IUrl2FileIdx, IShutdownPendingIdx, IStartedIdx, IFileWatchIdx
     };
 
     if (unlikely(objc != 2)) {
@@ -603,6 +603,11 @@ NsTclInfoObjCmd(ClientData clientData, Tcl_Interp *interp, int objc, Tcl_Obj *co
         Tcl_DStringResult(interp, &ds);
         break;
 
+    case IFileWatchIdx:
+        NsGetFileWatchStats(&ds);
+        Tcl_DStringResult(interp, &ds);
+        break;
+
     case IScheduledIdx:
         NsGetScheduled(&ds);
         Tcl_DStringResult(interp, &ds);
@@ -184,6 +184,16 @@ proc __ns_sourcemodule {modname} {
 #     This mode is defined by setting the config option
 #     ns/server/[ns_info server]/tcl/lazyloader to true.
 #
+#     In mode a., the procs can be serialized as small stubs,
+#     which compile the proc on its first call in an interp
+#     from the definition kept in thread-shared variables. This
+#     reduces the memory and the initialization time of interps
+#     calling just a fraction of the procs. The only visible
+#     difference is that [info args|body|default] return the
+#     stub definition until the proc is called for the first
+#     time. This is defined by setting the config option
+#     ns/server/[ns_info server]/tcl/lazyprocs to true.
+#
 
 source [file join [ns_library shared] nstrace.tcl]
 
@@ -490,6 +500,8 @@ if {$use_trace_inits} {
         ns_job create "ns_eval_q:[ns_info server]" 1
     }
 
+    nstrace::config -lazyprocs [ns_config -bool -set $section lazyprocs false]
+
     #
     # ns_eval --
     #
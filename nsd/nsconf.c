@@ -154,6 +154,7 @@ NsConfUpdate(void)
     NsConfigTcl();
     NsConfigLog();
     NsConfigAdp();
+    NsConfigFileWatch();
     NsConfigFastpath();
     NsConfigMimeTypes();
     NsConfigProgress();
@@ -71,6 +71,7 @@ NS_EXTERN const char *NS_EMPTY_STRING;
 #define ADP_ADPFILE                    0x4000u  /* Object to evaluate is a file */
 #define ADP_STREAM                     0x8000u  /* Enable ADP streaming */
 #define ADP_TCLFILE                    0x10000u /* Object to evaluate is a Tcl file */
+#define ADP_COMPILE                    0x20000u /* Compile blocks into a single procedure body */
 #define ADP_OPTIONMAX                  0x1000000u /* watermark for flag values */
 
 typedef enum {
@@ -257,6 +258,7 @@ typedef struct SpoolerQueue {
     int                  id;          /* Queue id */
     int                  queuesize;   /* Number of active sockets in the queue */
     const char          *threadName;  /* Name of the thread working on this queue */
+    const char          *cpus;        /* CPU affinity (of the driver thread), or NULL */
     bool                 stopped;     /* Flag to indicate thread stopped */
     bool                 shutdown;    /* Flag to indicate shutdown */
 } SpoolerQueue;
@@ -357,6 +359,7 @@ typedef struct Request {
     size_t woff;                  /* Next write buffer offset */
     size_t roff;                  /* Next read buffer offset */
     size_t coff;                  /* Content buffer offset */
+    size_t scanoff;               /* Bytes after roff known to contain no line end */
     size_t leftover;              /* Leftover bytes from earlier requests */
     Tcl_DString buffer;           /* Request and content buffer */
     char   savedChar;             /* Character potentially clobbered by null character */
@@ -437,6 +440,7 @@ typedef struct Driver {
     Ns_Time keepwait;                   /* Keepalive timeout */
     size_t keepmaxdownloadsize;         /* When set, allow keepalive only for download requests up to this size */
     size_t keepmaxuploadsize;           /* When set, allow keepalive only for upload requests up to this size */
+    size_t keepbufsize;                 /* Request buffers larger than this are released after a request */
     Ns_Mutex lock;                      /* Lock to protect lists below. */
     NS_SOCKET listenfd[MAX_LISTEN_ADDR_PER_DRIVER];  /* Listening sockets */
     NS_POLL_NFDS_TYPE pidx[MAX_LISTEN_ADDR_PER_DRIVER]; /* poll() index */
@@ -453,6 +457,8 @@ typedef struct Driver {
     int acceptsize;                     /* Number requests to accept at once */
     int sockacceptlog;                  /* Report, when more than this sockets are received in one step */
     int driverthreads;                  /* Number of identical driver threads to be created */
+    const char *cpus;                   /* CPU affinity of the driver thread, or NULL */
+    const char *eventbackend;           /* Name of the event backend ("epoll" or "poll") */
     unsigned int loggingFlags;          /* Logging control flags */
 
     unsigned int flags;                 /* Driver state flags. */
@@ -473,6 +479,8 @@ typedef struct Driver {
         Tcl_WideInt partial;            /* Partial operations */
         Tcl_WideInt received;           /* Received requests */
         Tcl_WideInt errors;             /* Dropped requests due to errors */
+        Tcl_WideInt parked;             /* Idle keep-alive sockets parked without request structure */
+        Tcl_WideInt released;           /* Bytes of request buffers released after requests */
     } stats;
     Ns_DList ports;
     unsigned short port;                /* Port in location */
@@ -511,6 +519,10 @@ typedef struct Sock {
     NS_POLL_NFDS_TYPE   pidx;            /* poll() index */
     unsigned int        flags;           /* State flags used by driver */
     Ns_Time             timeout;
+    struct Sock        *timerNextPtr;    /* Next sock in the same timer slot of the driver */
+    struct Sock        *timerPrevPtr;    /* Previous sock in the same timer slot of the driver */
+    Tcl_WideInt         timerTick;       /* Scheduled tick in the driver timers, 0 when not scheduled */
+    int                 waitState;       /* Wait state of the sock in the driver thread */
     Request            *reqPtr;
 
     Ns_Time             acceptTime;
@@ -521,7 +533,10 @@ typedef struct Sock {
     unsigned long       recvErrno;       /* Last error number in read operation (can fit OpenSSL errors) */
     Ns_SockState        recvSockState;   /* Results from the last recv operation */
     int                 tfd;             /* File descriptor with request contents */
+    short               revents;         /* Events reported by the event backend */
     bool                keep;            /* Keep alive handling */
+    bool                pollRegistered;  /* Sock is registered in the event backend */
+    bool                pollArmed;       /* Sock is armed for the next event in the event backend */
 
     void               *sls[1];          /* Slots for sls storage */
 
@@ -608,6 +623,7 @@ typedef struct Conn {
     char *clientData;
 
     struct Request  *reqPtr;
+    struct Request  *retainedReqPtr; /* Request taken from the closed socket */
     struct ConnPool *poolPtr;
     struct Driver   *drvPtr;
 
@@ -640,6 +656,7 @@ typedef struct Conn {
 
     int fd;
     NsWriterSock *strWriter;
+    bool streamViaWriter;   /* Streamed output goes to the writer regardless of its size */
     int rateLimit;          /* -1 undefined, 0 unlimited, otherwise KB/s */
 
     Ns_CompressStream cStream;
@@ -655,6 +672,69 @@ typedef struct Conn {
 } Conn;
 
 
+/*
+ * The following structure is a bounded multi-producer/multi-consumer
+ * queue of connections, used for the free and the waiting connections
+ * of a pool. The sequence number of a slot tells producers and consumers
+ * whether the slot is free or filled for a certain position, such that
+ * the queue can be operated without a lock (see NsConnRingPush() and
+ * NsConnRingPop()).
+ */
+typedef struct ConnRingSlot {
+    size_t       seq;
+    struct Conn *connPtr;
+} ConnRingSlot;
+
+typedef struct ConnRing {
+    ConnRingSlot *slots;
+    size_t        mask;        /* Number of slots - 1 */
+    size_t        head;        /* Next position to dequeue */
+    size_t        tail;        /* Next position to enqueue */
+    Ns_Mutex      lock;        /* Used only without atomic builtins */
+} ConnRing;
+
+/*
+ * The following structure keeps the state of the latency-driven
+ * autoscaling of the connection threads of a pool. The queue delays of
+ * the finished requests are collected per interval in a histogram with
+ * logarithmic buckets (bucket i holds delays below 16us << i). At the
+ * end of an interval, the number of wanted threads is increased when the
+ * 95th percentile of the queue delay is above the target; it is
+ * decreased step by step only after several calm intervals, such that
+ * threads with their interpreters are not churned.
+ */
+
+#define NS_AUTOSCALE_BUCKETS 24
+
+typedef struct ConnAutoscale {
+    Ns_Time       target;        /* Target p95 queue delay; 0 deactivates autoscaling */
+    Ns_Time       interval;      /* Length of a measuring interval */
+    Ns_Time       intervalEnd;   /* End of the current measuring interval */
+    Ns_Time       busyTime;      /* Cumulated filter and run times in this interval */
+    long          p95;           /* p95 queue delay of the last interval (in us) */
+    unsigned int  count;         /* Number of requests in this interval */
+    unsigned int  buckets[NS_AUTOSCALE_BUCKETS];
+    int           wanted;        /* Number of wanted connection threads */
+    int           calm;          /* Consecutive intervals below half of the target */
+} ConnAutoscale;
+
+/*
+ * The following structure is a log-bucketed (HDR-style) latency
+ * histogram with a resolution in microseconds. Every power of two is
+ * split into 2^NS_HISTOGRAM_SUBBITS linear sub-buckets, giving a relative
+ * error of about 6 percent up to about 38 hours. The counters are updated
+ * with atomic operations when available, otherwise under "lock".
+ */
+
+#define NS_HISTOGRAM_SUBBITS 4
+#define NS_HISTOGRAM_BUCKETS ((38 - NS_HISTOGRAM_SUBBITS) << NS_HISTOGRAM_SUBBITS)
+
+typedef struct NsHistogram {
+    unsigned long max;                            /* Largest value (in us) */
+    unsigned long buckets[NS_HISTOGRAM_BUCKETS];
+    Ns_Mutex      lock;                           /* Used only without atomic builtins */
+} NsHistogram;
+
 /*
  * The following structure is allocated for each connection thread.
  * The connPtr member is used for connecting threads with the request
@@ -689,27 +769,56 @@ typedef struct ConnPool {
     struct NsServer *servPtr;
 
     /*
-     * The following struct maintains the active and waiting connection
-     * queues, the free conn list, the next conn id, and the number
-     * of waiting connects.
+     * The following struct maintains the waiting connection queue, the
+     * free conns, and the number of waiting connects. The queues are
+     * lock-free, "num" is updated atomically.
      */
 
     struct {
-        Conn *freePtr;
+        ConnRing free;
         int maxconns;
 
         struct {
-            Conn *firstPtr;
-            Conn *lastPtr;
-            int   num;
+            ConnRing ring;
+            int      num;
         } wait;
 
+        /*
+         * Optional fair queuing: the waiting connections are classified
+         * by a key (peer address or a request header field) and served
+         * round-robin across the keys, where a key can get several
+         * consecutive turns according to its weight. When active, the
+         * waiting connections are kept in per-key queues protected by
+         * "lock" instead of "wait.ring".
+         */
+        struct {
+            const char         *key;        /* NULL deactivates fair queuing */
+            bool                peer;       /* Key is the peer address */
+            Tcl_HashTable       queues;     /* Key -> struct FairQueue */
+            struct FairQueue   *currentPtr; /* Next queue to be served */
+            int                 nWeights;
+            struct FairWeight  *weights;    /* Key patterns with weights */
+        } fair;
+
         Ns_Cond  cond;
         Ns_Mutex lock;
         int      lowwatermark;
         int      highwatermark;
         Ns_Time  retryafter;
         bool     rejectoverrun;
+
+        /*
+         * Queue-delay-based load shedding: when the minimum queue delay
+         * over an interval exceeds the target, new requests are rejected
+         * while other requests are waiting.
+         */
+        struct {
+            Ns_Time target;        /* Acceptable queue delay; 0 deactivates shedding */
+            Ns_Time interval;      /* Interval for measuring the minimum queue delay */
+            Ns_Time intervalEnd;   /* End of the current measuring interval */
+            Ns_Time minDelay;      /* Minimum queue delay in the current interval */
+            bool    overloaded;    /* Minimum delay of the last interval exceeded target */
+        } delay;
     } wqueue;
 
     /*
@@ -719,6 +828,11 @@ typedef struct ConnPool {
      * threads waiting no more than the timeout for a connection to
      * arrive.  The number of idle threads is maintained for the benefit of
      * the ns_server command.
+     *
+     * Lock order: an idle connection thread takes "lock" while holding
+     * its own ConnThreadArg lock (see ConnThreadIdleExit()). Therefore,
+     * the lock of a ConnThreadArg must never be acquired while holding
+     * "lock".
      */
 
     struct {
@@ -731,6 +845,9 @@ typedef struct ConnPool {
         int       idle;
         int       connsperthread;
         int       creating;
+        int       stopping;            /* Idle threads about to exit */
+        const char *cpus;              /* CPU affinity, "driver", or NULL */
+        ConnAutoscale autoscale;
     } threads;
 
     /*
@@ -755,6 +872,7 @@ typedef struct ConnPool {
         unsigned long spool;
         unsigned long queued;
         unsigned long dropped;
+        unsigned long shed;
         unsigned long connthreads;
         Ns_Time acceptTime;          /* cumulated accept times */
         Ns_Time queueTime;           /* cumulated queue times */
@@ -763,6 +881,17 @@ typedef struct ConnPool {
         Ns_Time traceTime;           /* cumulated trace times */
     } stats;
 
+    /*
+     * Latency histograms of the phases of the requests.
+     */
+
+    struct {
+        NsHistogram accept;          /* accept -> queue */
+        NsHistogram queue;           /* queue -> dequeue */
+        NsHistogram filter;          /* dequeue -> filters done */
+        NsHistogram run;             /* filters done -> run done */
+    } histogram;
+
     struct {
         int defaultConnectionLimit;  /* default rate limit for single connections */
         int poolLimit;               /* rate limit for pool */
@@ -901,12 +1030,17 @@ typedef struct NsServer {
         const char       *script;
         int               length;
         int               epoch;
+        struct BlueprintDelta *deltas;  /* Ring of blueprint deltas indexed by epoch */
+        int               deltalogsize;  /* Capacity of the ring; 0 deactivates deltas */
+        int               ndeltas;       /* Number of consecutive deltas up to epoch */
         Tcl_Obj          *modules;
         Tcl_HashTable     runTable;
         const char      **errorLogHeaders;
         Tcl_HashTable     caches;
         Ns_RWLock         cachelock;
         uintptr_t         transactionEpoch;
+        const char       *cachesnapshot;        /* Snapshot file of the caches */
+        const char      **cachesnapshotcaches;  /* Patterns of caches in the snapshot */
 
         /*
          * The following tracks synchronization
@@ -933,6 +1067,7 @@ typedef struct NsServer {
         unsigned int flags;
         int tracesize;
         size_t bufsize;
+        size_t streamsize;
         size_t cachesize;
 
         const char *errorpage;
@@ -1047,6 +1182,7 @@ typedef struct NsInterp {
 
     struct adp {
         size_t            bufsize;
+        size_t            streamsize;
         unsigned int      flags;
         AdpResult         exception;
         int               refresh;
@@ -1224,7 +1360,11 @@ NS_EXTERN Tcl_ObjCmdProc
     NsTclCacheIncrObjCmd,
     NsTclCacheKeysObjCmd,
     NsTclCacheLappendObjCmd,
+    NsTclCacheMEvalObjCmd,
+    NsTclCacheMGetObjCmd,
+    NsTclCacheMSetObjCmd,
     NsTclCacheNamesObjCmd,
+    NsTclCacheSnapshotObjCmd,
     NsTclCacheStatsObjCmd,
     NsTclCacheTransactionBeginObjCmd,
     NsTclCacheTransactionCommitObjCmd,
@@ -1442,6 +1582,7 @@ NS_EXTERN void NsInitUrl2File(void);
 NS_EXTERN void NsConfigAdp(void);
 NS_EXTERN void NsConfigLog(void);
 NS_EXTERN void NsConfigFastpath(void);
+NS_EXTERN void NsConfigFileWatch(void);
 NS_EXTERN void NsConfigMimeTypes(void);
 NS_EXTERN void NsConfigDNS(void);
 NS_EXTERN void NsConfigRedirects(void);
@@ -1521,6 +1662,18 @@ NS_EXTERN Ns_ReturnCode NsQueueConn(Sock *sockPtr, const Ns_Time *nowPtr)
 NS_EXTERN void NsEnsureRunningConnectionThreads(const NsServer *servPtr, ConnPool *poolPtr)
     NS_GNUC_NONNULL(1);
 
+NS_EXTERN void NsConfigFairQueue(ConnPool *poolPtr, const char *section)
+    NS_GNUC_NONNULL(1) NS_GNUC_NONNULL(2);
+
+NS_EXTERN void NsConnRingInit(ConnRing *ringPtr, int size, const char *name, const char *suffix)
+    NS_GNUC_NONNULL(1) NS_GNUC_NONNULL(3) NS_GNUC_NONNULL(4);
+
+NS_EXTERN bool NsConnRingPush(ConnRing *ringPtr, Conn *connPtr)
+    NS_GNUC_NONNULL(1) NS_GNUC_NONNULL(2);
+
+NS_EXTERN Conn *NsConnRingPop(ConnRing *ringPtr)
+    NS_GNUC_NONNULL(1);
+
 NS_EXTERN void NsMapPool(ConnPool *poolPtr, const char *mapString, unsigned int flags)
     NS_GNUC_NONNULL(1) NS_GNUC_NONNULL(2);
 
@@ -1538,6 +1691,12 @@ NS_EXTERN void NsPoolAddBytesSent(ConnPool *poolPtr, Tcl_WideInt bytesSent)
 NS_EXTERN void NsSockClose(Sock *sockPtr, int keep)
     NS_GNUC_NONNULL(1);
 
+NS_EXTERN void NsConnRetainRequest(Conn *connPtr)
+    NS_GNUC_NONNULL(1);
+
+NS_EXTERN void NsConnReleaseRequest(Conn *connPtr)
+    NS_GNUC_NONNULL(1);
+
 NS_EXTERN const char *
 NsSockSetRecvErrorCode(const Sock *sockPtr, Tcl_Interp *interp)
     NS_GNUC_NONNULL(1) NS_GNUC_NONNULL(2);
@@ -1643,6 +1802,7 @@ NS_EXTERN void NsWaitJobsShutdown(const Ns_Time *toPtr);
 
 NS_EXTERN Tcl_AppInitProc NsTclAppInit;
 NS_EXTERN void NsTclInitServer(const char *server)       NS_GNUC_NONNULL(1);
+NS_EXTERN void NsTclInitCacheSnapshot(NsServer *servPtr)  NS_GNUC_NONNULL(1);
 NS_EXTERN void NsInitStaticModules(const char *server);
 
 NS_EXTERN Tcl_Interp *NsTclCreateInterp(void)            NS_GNUC_RETURNS_NONNULL;
@@ -1675,6 +1835,12 @@ NS_EXTERN void Ns_SetDataPrealloc(Ns_Set *set, int size)
 #endif
 NS_EXTERN void NsSetResize(Ns_Set *set, size_t newSize, int bufferSize)
     NS_GNUC_NONNULL(1);
+NS_EXTERN void NsSetSliceRegion(Ns_Set *set, const char *start, size_t length)
+    NS_GNUC_NONNULL(1) NS_GNUC_NONNULL(2);
+NS_EXTERN size_t NsSetPutSlice(Ns_Set *set, char *key, char *value)
+    NS_GNUC_NONNULL(1) NS_GNUC_NONNULL(2) NS_GNUC_NONNULL(3);
+NS_EXTERN void NsSetSlicesMaterialize(Ns_Set *set)
+    NS_GNUC_NONNULL(1);
 
 NS_EXTERN Ns_Set *NsHeaderSetGet(size_t size);
 
@@ -1711,6 +1877,10 @@ NS_EXTERN int NsConnParseRange(Ns_Conn *conn, const char *type,
 NS_EXTERN const char * NsConnIdStr(const Ns_Conn *conn)
     NS_GNUC_NONNULL(1) NS_GNUC_PURE;
 
+NS_EXTERN void NsHistogramAdd(NsHistogram *histPtr, const Ns_Time *timePtr)
+    NS_GNUC_NONNULL(1) NS_GNUC_NONNULL(2);
+NS_EXTERN void NsConnThreadsAutoscale(ConnPool *poolPtr, const Conn *connPtr, const Ns_Time *nowPtr)
+    NS_GNUC_NONNULL(1) NS_GNUC_NONNULL(2) NS_GNUC_NONNULL(3);
 NS_EXTERN void NsConnTimeStatsUpdate(Ns_Conn *conn)
     NS_GNUC_NONNULL(1);
 
@@ -1725,6 +1895,19 @@ NS_EXTERN Ns_ReturnCode NsConnRequire(Tcl_Interp *interp, unsigned int flags, Ns
  */
 NS_EXTERN void NsParseAcceptEncoding(double version, const char *hdr, bool *gzipAcceptPtr, bool *brotliAcceptPtr)
     NS_GNUC_NONNULL(2) NS_GNUC_NONNULL(3) NS_GNUC_NONNULL(4);
+NS_EXTERN Ns_ReturnCode NsParseHeaderLine(Ns_Set *set, char *line, size_t lineLength,
+                                          Ns_HeaderCaseDisposition disp, bool slice,
+                                          size_t *fieldNumberPtr)
+    NS_GNUC_NONNULL(1) NS_GNUC_NONNULL(2);
+
+/*
+ * filewatch.c
+ */
+
+NS_EXTERN bool NsFileWatchStat(const char *path, struct stat *stPtr)
+    NS_GNUC_NONNULL(1) NS_GNUC_NONNULL(2);
+NS_EXTERN void NsGetFileWatchStats(Tcl_DString *dsPtr)
+    NS_GNUC_NONNULL(1);
 
 /*
  * encoding.c
@@ -1286,7 +1286,7 @@ ns_poll(struct pollfd *fds, NS_POLL_NFDS_TYPE nfds, long timo)
 /*
  *----------------------------------------------------------------------
  *
- * ns_open, ns_close, ns_write, ns_read, ns_lseek  --
+ * ns_open, ns_close, ns_write, ns_read, ns_lseek, ns_pread  --
  *
  *      Elementary operations on file descriptors. The interfaces are the same
  *      as in a Unix environment.
@@ -1335,6 +1335,32 @@ ns_lseek(int fildes, off_t offset, int whence)
     return (off_t)_lseek(fildes, (long)offset, whence);
 }
 
+ssize_t
+ns_pread(int fildes, void *buf, size_t nbyte, off_t offset)
+{
+    HANDLE   fh = (HANDLE)_get_osfhandle(fildes);
+    ssize_t  result;
+
+    if (fh == INVALID_HANDLE_VALUE) {
+        errno = EBADF;
+        result = -1;
+    } else {
+        DWORD      ret, c = (DWORD)nbyte;
+        OVERLAPPED overlapped = { 0u };
+
+        overlapped.Offset = (DWORD)offset;
+        overlapped.OffsetHigh = (DWORD)(((uint64_t)offset) >> 32);
+
+        if (ReadFile(fh, buf, c, &ret, &overlapped) == FALSE) {
+            result = -1;
+        } else {
+            result = (ssize_t)ret;
+        }
+    }
+
+    return result;
+}
+
 /*
  *----------------------------------------------------------------------
  *
@@ -36,6 +36,26 @@
 
 #include "nsd.h"
 
+/*
+ * Per-key queue of waiting connections for fair queuing. The non-empty
+ * queues of a pool form a circular list, which is served round-robin.
+ */
+typedef struct FairQueue {
+    struct FairQueue *nextPtr;
+    struct FairQueue *prevPtr;
+    Tcl_HashEntry    *hPtr;
+    Conn             *firstPtr;
+    Conn             *lastPtr;
+    int               num;
+    int               weight;    /* Consecutive turns per round */
+    int               turns;     /* Remaining turns in the current round */
+} FairQueue;
+
+typedef struct FairWeight {
+    char *pattern;
+    int   weight;
+} FairWeight;
+
 /*
  * Local functions defined in this file
  */
@@ -57,6 +77,42 @@ static bool neededAdditionalConnectionThreads(const ConnPool *poolPtr)
 static void WakeupConnThreads(ConnPool *poolPtr)
     NS_GNUC_NONNULL(1);
 
+static void QueueDelayUpdate(ConnPool *poolPtr, const Conn *connPtr)
+    NS_GNUC_NONNULL(1) NS_GNUC_NONNULL(2);
+
+static void AutoscaleAdjust(ConnPool *poolPtr, const Ns_Time *nowPtr)
+    NS_GNUC_NONNULL(1) NS_GNUC_NONNULL(2);
+
+static bool ConnThreadIdleExit(ConnPool *poolPtr)
+    NS_GNUC_NONNULL(1);
+
+static size_t HistogramIndex(unsigned long value)
+    NS_GNUC_CONST;
+
+static void HistogramAppend(Tcl_DString *dsPtr, NsHistogram *histPtr)
+    NS_GNUC_NONNULL(1) NS_GNUC_NONNULL(2);
+
+static void HistogramReset(NsHistogram *histPtr)
+    NS_GNUC_NONNULL(1);
+
+static int WaitNum(const ConnPool *poolPtr)
+    NS_GNUC_NONNULL(1) NS_GNUC_PURE;
+
+static void WaitNumAdd(ConnPool *poolPtr, int incr)
+    NS_GNUC_NONNULL(1);
+
+static void WaitQueuePush(ConnPool *poolPtr, Conn *connPtr, const Sock *sockPtr)
+    NS_GNUC_NONNULL(1) NS_GNUC_NONNULL(2) NS_GNUC_NONNULL(3);
+
+static Conn *WaitQueuePop(ConnPool *poolPtr)
+    NS_GNUC_NONNULL(1);
+
+static const char *FairQueueKey(const ConnPool *poolPtr, const Sock *sockPtr, char *buffer, size_t size)
+    NS_GNUC_NONNULL(1) NS_GNUC_NONNULL(2) NS_GNUC_NONNULL(3);
+
+static int FairQueueWeight(const ConnPool *poolPtr, const char *key)
+    NS_GNUC_NONNULL(1) NS_GNUC_NONNULL(2);
+
 static Ns_ReturnCode MapspecParse(Tcl_Interp *interp, Tcl_Obj *mapspecObj, char **method, char **url,
                                   NsUrlSpaceContextSpec **specPtr)
     NS_GNUC_NONNULL(2) NS_GNUC_NONNULL(3) NS_GNUC_NONNULL(4) NS_GNUC_NONNULL(5);
@@ -104,6 +160,9 @@ static int ServerListAllCmd(Tcl_DString *dsPtr, Tcl_Interp *interp, int objc, Tc
 static int ServerListQueuedCmd(Tcl_DString *dsPtr, Tcl_Interp *interp, int objc, Tcl_Obj *const* objv,
                                ConnPool *poolPtr, int nargs)
     NS_GNUC_NONNULL(1) NS_GNUC_NONNULL(2) NS_GNUC_NONNULL(4) NS_GNUC_NONNULL(5);
+static int ServerStatsCmd(Tcl_DString *dsPtr, Tcl_Interp *interp, int objc, Tcl_Obj *const* objv,
+                          ConnPool *poolPtr, int nargs)
+    NS_GNUC_NONNULL(1) NS_GNUC_NONNULL(2) NS_GNUC_NONNULL(4) NS_GNUC_NONNULL(5);
 
 static void ServerListActive(Tcl_DString *dsPtr, ConnPool *poolPtr, bool checkforproxy)
     NS_GNUC_NONNULL(1) NS_GNUC_NONNULL(2);
@@ -123,6 +182,14 @@ static Ns_ArgProc WalkCallback;
 static Ns_Tls argtls = NULL;
 static int    poolid = 0;
 
+/*
+ * The connection rings and the connection ids are operated with the
+ * atomic builtins of GCC and clang when available.
+ */
+#if defined(__GNUC__) && defined(__ATOMIC_ACQUIRE)
+# define CONN_RING_ATOMIC 1
+#endif
+
 /*
  * Debugging stuff
  */
@@ -345,93 +412,1066 @@ NsPoolTotalRate(ConnPool *poolPtr, size_t slot, int rate, int *writerThreadCount
     poolPtr->rate.currentRate = (int)totalRate;
     Ns_MutexUnlock(&poolPtr->rate.lock);
 
-    *writerThreadCount = (int)dlPtr->size;
+    *writerThreadCount = (int)dlPtr->size;
+
+    return (int)totalRate;
+}
+
+void
+NsPoolAddBytesSent(ConnPool *poolPtr, Tcl_WideInt bytesSent)
+{
+    Ns_MutexLock(&poolPtr->rate.lock);
+    poolPtr->rate.bytesSent += bytesSent;
+    Ns_MutexUnlock(&poolPtr->rate.lock);
+}
+
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * neededAdditionalConnectionThreads --
+ *
+ *      Compute the number additional connection threads we should
+ *      create. This function has to be called under the lock of the
+ *      threads of the pool (&poolPtr->threads.lock).
+ *
+ * Results:
+ *      Number of needed additional connection threads.
+ *
+ * Side effects:
+ *      None
+ *
+ *----------------------------------------------------------------------
+ */
+static bool
+neededAdditionalConnectionThreads(const ConnPool *poolPtr) {
+    bool wantCreate;
+
+    NS_NONNULL_ASSERT(poolPtr != NULL);
+
+    /*
+     * Create new connection threads, if
+     *
+     * - there is currently no connection thread being created, or
+     *   parallel creates are allowed and there are more than
+     *   highwatermark requests queued,
+     *
+     * - AND there are less idle-threads than min threads (the server
+     *   tries to keep min-threads idle to be ready for short peaks),
+     *   or, with autoscaling, less threads than wanted, or without
+     *   autoscaling more than lowwatermark requests queued,
+     *
+     * - AND there are not yet max-threads running.
+     *
+     */
+    if ( (poolPtr->threads.creating == 0
+          || WaitNum(poolPtr) > poolPtr->wqueue.highwatermark
+          )
+         && (poolPtr->threads.current < poolPtr->threads.min
+             || ((poolPtr->threads.autoscale.target.sec > 0 || poolPtr->threads.autoscale.target.usec > 0)
+                 ? poolPtr->threads.current < poolPtr->threads.autoscale.wanted
+                 : WaitNum(poolPtr) > poolPtr->wqueue.lowwatermark)
+             )
+         && poolPtr->threads.current < poolPtr->threads.max
+         ) {
+
+        Ns_MutexLock(&poolPtr->servPtr->pools.lock);
+        wantCreate = (!poolPtr->servPtr->pools.shutdown);
+        Ns_MutexUnlock(&poolPtr->servPtr->pools.lock);
+
+        /*Ns_Log(Notice, "[%s] wantCreate %d (creating %d current %d idle %d waiting %d)",
+             poolPtr->servPtr->server,
+             wantCreate,
+             poolPtr->threads.creating,
+             poolPtr->threads.current,
+             poolPtr->threads.idle,
+             WaitNum(poolPtr)
+             );*/
+    } else {
+        wantCreate = NS_FALSE;
+
+        /*Ns_Log(Notice, "[%s] do not wantCreate creating %d, idle %d < min %d, current %d < max %d, waiting %d)",
+               poolPtr->servPtr->server,
+               poolPtr->threads.creating,
+               poolPtr->threads.idle,
+               poolPtr->threads.min,
+               poolPtr->threads.current,
+               poolPtr->threads.max,
+               WaitNum(poolPtr));*/
+
+    }
+
+    return wantCreate;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * QueueDelayUpdate --
+ *
+ *      Track the queue delay (time between queuing and dequeuing) of the
+ *      requests of a pool, similar to the CoDel queue management
+ *      algorithm. The minimum delay is measured over an interval. When the
+ *      minimum delay exceeds the target at the end of the interval, the
+ *      queue did not drain during the whole interval, and the pool is
+ *      considered overloaded for the next interval. A short burst does not
+ *      trigger this, since the minimum is only high when every request had
+ *      to wait.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      Updates the overload state used by NsQueueConn().
+ *
+ *----------------------------------------------------------------------
+ */
+static void
+QueueDelayUpdate(ConnPool *poolPtr, const Conn *connPtr)
+{
+    Ns_Time delay;
+
+    NS_NONNULL_ASSERT(poolPtr != NULL);
+    NS_NONNULL_ASSERT(connPtr != NULL);
+
+    (void)Ns_DiffTime(&connPtr->requestDequeueTime, &connPtr->requestQueueTime, &delay);
+
+    Ns_MutexLock(&poolPtr->wqueue.lock);
+    if (Ns_DiffTime(&connPtr->requestDequeueTime, &poolPtr->wqueue.delay.intervalEnd, NULL) >= 0) {
+        bool overloaded = (Ns_DiffTime(&poolPtr->wqueue.delay.minDelay,
+                                       &poolPtr->wqueue.delay.target, NULL) > 0);
+
+        if (overloaded != poolPtr->wqueue.delay.overloaded) {
+            Ns_Log(Notice, "[%s pool %s] queue delay " NS_TIME_FMT " %s target, %s shedding requests",
+                   poolPtr->servPtr->server, poolPtr->pool,
+                   (int64_t)poolPtr->wqueue.delay.minDelay.sec, poolPtr->wqueue.delay.minDelay.usec,
+                   overloaded ? "above" : "below",
+                   overloaded ? "start" : "stop");
+            poolPtr->wqueue.delay.overloaded = overloaded;
+        }
+        poolPtr->wqueue.delay.minDelay = delay;
+        poolPtr->wqueue.delay.intervalEnd = connPtr->requestDequeueTime;
+        Ns_IncrTime(&poolPtr->wqueue.delay.intervalEnd,
+                    poolPtr->wqueue.delay.interval.sec, poolPtr->wqueue.delay.interval.usec);
+
+    } else if (Ns_DiffTime(&delay, &poolPtr->wqueue.delay.minDelay, NULL) < 0) {
+        poolPtr->wqueue.delay.minDelay = delay;
+    }
+    Ns_MutexUnlock(&poolPtr->wqueue.lock);
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * NsConnThreadsAutoscale --
+ *
+ *      Record the queue delay and the busy time (filter and run time) of
+ *      a finished request for the latency-driven autoscaling of the
+ *      connection threads and adjust the number of wanted threads at the
+ *      end of a measuring interval. This function has to be called under
+ *      the lock of the threads of the pool (&poolPtr->threads.lock).
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      Updates the autoscaling histogram of the pool.
+ *
+ *----------------------------------------------------------------------
+ */
+void
+NsConnThreadsAutoscale(ConnPool *poolPtr, const Conn *connPtr, const Ns_Time *nowPtr)
+{
+    ConnAutoscale *autoscalePtr;
+
+    NS_NONNULL_ASSERT(poolPtr != NULL);
+    NS_NONNULL_ASSERT(connPtr != NULL);
+    NS_NONNULL_ASSERT(nowPtr != NULL);
+
+    autoscalePtr = &poolPtr->threads.autoscale;
+    if (autoscalePtr->target.sec > 0 || autoscalePtr->target.usec > 0) {
+        long         delay = (long)connPtr->queueTimeSpan.sec * 1000000 + connPtr->queueTimeSpan.usec;
+        unsigned int i = 0u;
+
+        while (i < NS_AUTOSCALE_BUCKETS - 1 && delay >= (16L << i)) {
+            i++;
+        }
+        autoscalePtr->buckets[i]++;
+        autoscalePtr->count++;
+        Ns_IncrTime(&autoscalePtr->busyTime, connPtr->filterTimeSpan.sec, connPtr->filterTimeSpan.usec);
+        Ns_IncrTime(&autoscalePtr->busyTime, connPtr->runTimeSpan.sec, connPtr->runTimeSpan.usec);
+
+        if (Ns_DiffTime(nowPtr, &autoscalePtr->intervalEnd, NULL) >= 0) {
+            AutoscaleAdjust(poolPtr, nowPtr);
+        }
+    }
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * AutoscaleAdjust --
+ *
+ *      Compute at the end of a measuring interval the number of wanted
+ *      connection threads from the 95th percentile of the queue delay and
+ *      the average number of busy threads. When the percentile is above
+ *      twice the target, the number is doubled, when it is above the
+ *      target, it is increased by a quarter (at least by one). When the
+ *      percentile stays below half of the target for five intervals,
+ *      the number is decreased by one per interval, but not below the
+ *      number of busy threads plus one. Intervals without requests count
+ *      as calm intervals. This function has to be called under the lock
+ *      of the threads of the pool (&poolPtr->threads.lock).
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      Updates the number of wanted threads and starts a new interval.
+ *
+ *----------------------------------------------------------------------
+ */
+static void
+AutoscaleAdjust(ConnPool *poolPtr, const Ns_Time *nowPtr)
+{
+    ConnAutoscale *autoscalePtr;
+    long           p95 = 0, target;
+    time_t         intervalMs;
+    int            wanted, previous, busy;
+    Ns_Time        diff;
+
+    NS_NONNULL_ASSERT(poolPtr != NULL);
+    NS_NONNULL_ASSERT(nowPtr != NULL);
+
+    autoscalePtr = &poolPtr->threads.autoscale;
+    target = (long)autoscalePtr->target.sec * 1000000 + autoscalePtr->target.usec;
+    intervalMs = MAX(Ns_TimeToMilliseconds(&autoscalePtr->interval), 1);
+
+    if (autoscalePtr->count > 0u) {
+        unsigned int threshold, n = 0u, i;
+        long         lower, upper;
+
+        /*
+         * Find the bucket containing the 95th percentile and interpolate
+         * linearly within this bucket.
+         */
+        threshold = (autoscalePtr->count * 95u + 99u) / 100u;
+        for (i = 0u; i < NS_AUTOSCALE_BUCKETS - 1; i++) {
+            if (n + autoscalePtr->buckets[i] >= threshold) {
+                break;
+            }
+            n += autoscalePtr->buckets[i];
+        }
+        lower = (i == 0u) ? 0 : (16L << (i - 1u));
+        upper = 16L << i;
+        p95 = lower + ((upper - lower) * (long)(threshold - n))
+            / (long)MAX(autoscalePtr->buckets[i], 1u);
+    }
+    busy = (int)((Ns_TimeToMilliseconds(&autoscalePtr->busyTime) + intervalMs - 1) / intervalMs);
+
+    previous = MAX(autoscalePtr->wanted, poolPtr->threads.min);
+    wanted = previous;
+    if (p95 > target) {
+        wanted = MAX(wanted, poolPtr->threads.current);
+        wanted += (p95 > 2 * target) ? wanted : MAX(wanted / 4, 1);
+        autoscalePtr->calm = 0;
+
+    } else if (p95 <= target / 2) {
+        /*
+         * Full intervals passed without any request count as calm
+         * intervals as well.
+         */
+        (void)Ns_DiffTime(nowPtr, &autoscalePtr->intervalEnd, &diff);
+        autoscalePtr->calm += 1 + (int)(Ns_TimeToMilliseconds(&diff) / intervalMs);
+        if (autoscalePtr->calm >= 5) {
+            wanted = MAX(wanted - 1, busy + 1);
+        }
+    } else {
+        autoscalePtr->calm = 0;
+    }
+    wanted = MIN(MAX(wanted, poolPtr->threads.min), poolPtr->threads.max);
+
+    if (wanted != previous) {
+        Ns_Log(Notice, "[%s pool %s] autoscale: p95 queue delay %ldus busy %d, wanted threads %d -> %d",
+               poolPtr->servPtr->server, NsPoolName(poolPtr->pool),
+               p95, busy, previous, wanted);
+    }
+    autoscalePtr->wanted = wanted;
+    autoscalePtr->p95 = p95;
+    autoscalePtr->count = 0u;
+    autoscalePtr->busyTime.sec = 0;
+    autoscalePtr->busyTime.usec = 0;
+    memset(autoscalePtr->buckets, 0, sizeof(autoscalePtr->buckets));
+    autoscalePtr->intervalEnd = *nowPtr;
+    Ns_IncrTime(&autoscalePtr->intervalEnd, autoscalePtr->interval.sec, autoscalePtr->interval.usec);
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * ConnThreadIdleExit --
+ *
+ *      Decide whether an idle connection thread, whose timeout has
+ *      expired, can exit. The pool keeps minthreads or, with
+ *      autoscaling, the number of wanted threads running. Since in idle
+ *      pools no requests finish, the number of wanted threads is
+ *      adjusted here as well.
+ *
+ *      Threads created together tend to time out together. To avoid
+ *      that all of them see more threads than wanted and exit, the exit
+ *      is reserved by incrementing the number of stopping threads,
+ *      which is decremented when the thread has finished.
+ *
+ *      The function is called by idle connection threads while holding
+ *      their own lock (argPtr->lock) and takes &poolPtr->threads.lock,
+ *      which defines the lock order: the lock of a connection thread
+ *      must never be acquired while holding &poolPtr->threads.lock.
+ *
+ * Results:
+ *      NS_TRUE, when the thread can exit.
+ *
+ * Side effects:
+ *      Potentially, adjusting the number of wanted threads and
+ *      incrementing the number of stopping threads.
+ *
+ *----------------------------------------------------------------------
+ */
+static bool
+ConnThreadIdleExit(ConnPool *poolPtr)
+{
+    int  wanted;
+    bool result;
+
+    NS_NONNULL_ASSERT(poolPtr != NULL);
+
+    Ns_MutexLock(&poolPtr->threads.lock);
+    wanted = poolPtr->threads.min;
+    if (poolPtr->threads.autoscale.target.sec > 0 || poolPtr->threads.autoscale.target.usec > 0) {
+        Ns_Time now;
+
+        Ns_GetTime(&now);
+        if (Ns_DiffTime(&now, &poolPtr->threads.autoscale.intervalEnd, NULL) >= 0) {
+            AutoscaleAdjust(poolPtr, &now);
+        }
+        wanted = MAX(wanted, poolPtr->threads.autoscale.wanted);
+    }
+    result = (poolPtr->threads.current - poolPtr->threads.stopping > wanted);
+    if (result) {
+        poolPtr->threads.stopping++;
+    }
+    Ns_MutexUnlock(&poolPtr->threads.lock);
+
+    return result;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * NsHistogramAdd --
+ *
+ *      Add a time span to a latency histogram. The bucket is determined
+ *      by the most significant bit of the value (in microseconds) and the
+ *      following NS_HISTOGRAM_SUBBITS bits. The function can be called
+ *      concurrently without locking when atomic builtins are available.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      Updates the histogram.
+ *
+ *----------------------------------------------------------------------
+ */
+void
+NsHistogramAdd(NsHistogram *histPtr, const Ns_Time *timePtr)
+{
+    unsigned long value;
+    size_t        idx;
+
+    NS_NONNULL_ASSERT(histPtr != NULL);
+    NS_NONNULL_ASSERT(timePtr != NULL);
+
+    value = (timePtr->sec < 0 || timePtr->usec < 0)
+        ? 0u
+        : (unsigned long)timePtr->sec * 1000000u + (unsigned long)timePtr->usec;
+    idx = HistogramIndex(value);
+
+#ifdef CONN_RING_ATOMIC
+    {
+        unsigned long max = __atomic_load_n(&histPtr->max, __ATOMIC_RELAXED);
+
+        (void)__atomic_fetch_add(&histPtr->buckets[idx], 1u, __ATOMIC_RELAXED);
+        while (value > max
+               && !__atomic_compare_exchange_n(&histPtr->max, &max, value, NS_TRUE,
+                                               __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+            ;
+        }
+    }
+#else
+    Ns_MutexLock(&histPtr->lock);
+    histPtr->buckets[idx]++;
+    if (value > histPtr->max) {
+        histPtr->max = value;
+    }
+    Ns_MutexUnlock(&histPtr->lock);
+#endif
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * HistogramIndex --
+ *
+ *      Compute the bucket of a value (in microseconds). Values below
+ *      2^NS_HISTOGRAM_SUBBITS have their own buckets, larger values are
+ *      mapped to one of the 2^NS_HISTOGRAM_SUBBITS sub-buckets of their
+ *      power of two.
+ *
+ * Results:
+ *      Index of the bucket.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------
+ */
+static size_t
+HistogramIndex(unsigned long value)
+{
+    size_t idx;
+
+    if (value < (1u << NS_HISTOGRAM_SUBBITS)) {
+        idx = (size_t)value;
+    } else {
+        unsigned int msb;
+
+#if defined(__GNUC__)
+        msb = (unsigned int)(sizeof(unsigned long) * 8u) - 1u - (unsigned int)__builtin_clzl(value);
+#else
+        msb = NS_HISTOGRAM_SUBBITS;
+        while ((value >> (msb + 1u)) != 0u) {
+            msb++;
+        }
+#endif
+        idx = ((size_t)(msb - NS_HISTOGRAM_SUBBITS + 1u) << NS_HISTOGRAM_SUBBITS)
+            + (size_t)((value >> (msb - NS_HISTOGRAM_SUBBITS)) & ((1u << NS_HISTOGRAM_SUBBITS) - 1u));
+        if (idx >= NS_HISTOGRAM_BUCKETS) {
+            idx = NS_HISTOGRAM_BUCKETS - 1;
+        }
+    }
+    return idx;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * HistogramAppend --
+ *
+ *      Append the number of values, the percentiles p50, p90, p99 and
+ *      p999 and the maximum of a histogram as attribute value pairs to
+ *      the DString. A percentile is reported as the upper bound of its
+ *      bucket (but not more than the maximum).
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      Appends to the DString.
+ *
+ *----------------------------------------------------------------------
+ */
+static void
+HistogramAppend(Tcl_DString *dsPtr, NsHistogram *histPtr)
+{
+    static const struct {
+        const char   *name;
+        unsigned long permille;
+    } percentiles[] = {
+        {"p50", 500u}, {"p90", 900u}, {"p99", 990u}, {"p999", 999u}
+    };
+    unsigned long buckets[NS_HISTOGRAM_BUCKETS], count = 0u, max, sum = 0u;
+    size_t        i, idx = 0u;
+    Ns_Time       t;
+
+    NS_NONNULL_ASSERT(dsPtr != NULL);
+    NS_NONNULL_ASSERT(histPtr != NULL);
+
+    /*
+     * Take a snapshot of the counters, which might be updated
+     * concurrently.
+     */
+#ifdef CONN_RING_ATOMIC
+    for (i = 0u; i < NS_HISTOGRAM_BUCKETS; i++) {
+        buckets[i] = __atomic_load_n(&histPtr->buckets[i], __ATOMIC_RELAXED);
+        count += buckets[i];
+    }
+    max = __atomic_load_n(&histPtr->max, __ATOMIC_RELAXED);
+#else
+    Ns_MutexLock(&histPtr->lock);
+    for (i = 0u; i < NS_HISTOGRAM_BUCKETS; i++) {
+        buckets[i] = histPtr->buckets[i];
+        count += buckets[i];
+    }
+    max = histPtr->max;
+    Ns_MutexUnlock(&histPtr->lock);
+#endif
+
+    Ns_DStringPrintf(dsPtr, "count %lu", count);
+    for (i = 0u; i < sizeof(percentiles) / sizeof(percentiles[0]); i++) {
+        unsigned long threshold = (count * percentiles[i].permille + 999u) / 1000u, value = 0u;
+
+        if (count > 0u) {
+            while (idx < NS_HISTOGRAM_BUCKETS - 1 && sum + buckets[idx] < threshold) {
+                sum += buckets[idx];
+                idx++;
+            }
+            if (idx < (1u << NS_HISTOGRAM_SUBBITS)) {
+                value = (unsigned long)idx;
+            } else {
+                unsigned int shift = (unsigned int)(idx >> NS_HISTOGRAM_SUBBITS) - 1u;
+
+                value = ((((unsigned long)idx & ((1u << NS_HISTOGRAM_SUBBITS) - 1u))
+                          + (1u << NS_HISTOGRAM_SUBBITS) + 1u) << shift) - 1u;
+            }
+            value = MIN(value, max);
+        }
+        t.sec = (time_t)(value / 1000000u);
+        t.usec = (long)(value % 1000000u);
+        Ns_DStringPrintf(dsPtr, " %s ", percentiles[i].name);
+        Ns_DStringAppendTime(dsPtr, &t);
+    }
+    t.sec = (time_t)(max / 1000000u);
+    t.usec = (long)(max % 1000000u);
+    Ns_DStringAppend(dsPtr, " max ");
+    Ns_DStringAppendTime(dsPtr, &t);
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * HistogramReset --
+ *
+ *      Clear a histogram. Values added concurrently might survive the
+ *      reset.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      Clears the counters.
+ *
+ *----------------------------------------------------------------------
+ */
+static void
+HistogramReset(NsHistogram *histPtr)
+{
+    size_t i;
+
+    NS_NONNULL_ASSERT(histPtr != NULL);
+
+#ifdef CONN_RING_ATOMIC
+    for (i = 0u; i < NS_HISTOGRAM_BUCKETS; i++) {
+        __atomic_store_n(&histPtr->buckets[i], 0u, __ATOMIC_RELAXED);
+    }
+    __atomic_store_n(&histPtr->max, 0u, __ATOMIC_RELAXED);
+#else
+    Ns_MutexLock(&histPtr->lock);
+    for (i = 0u; i < NS_HISTOGRAM_BUCKETS; i++) {
+        histPtr->buckets[i] = 0u;
+    }
+    histPtr->max = 0u;
+    Ns_MutexUnlock(&histPtr->lock);
+#endif
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * NsConnRingInit --
+ *
+ *      Initialize a ring able to hold at least "size" connections.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      Allocates the slots, which are never freed (like the pools).
+ *
+ *----------------------------------------------------------------------
+ */
+void
+NsConnRingInit(ConnRing *ringPtr, int size, const char *name, const char *suffix)
+{
+    size_t nSlots = 2u, i;
+
+    NS_NONNULL_ASSERT(ringPtr != NULL);
+    NS_NONNULL_ASSERT(name != NULL);
+    NS_NONNULL_ASSERT(suffix != NULL);
+
+    while (nSlots < (size_t)size) {
+        nSlots <<= 1;
+    }
+    ringPtr->slots = ns_calloc(nSlots, sizeof(ConnRingSlot));
+    for (i = 0u; i < nSlots; i++) {
+        ringPtr->slots[i].seq = i;
+    }
+    ringPtr->mask = nSlots - 1u;
+    ringPtr->head = 0u;
+    ringPtr->tail = 0u;
+    Ns_MutexInit(&ringPtr->lock);
+    Ns_MutexSetName2(&ringPtr->lock, name, suffix);
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * WaitNum, WaitNumAdd --
+ *
+ *      Get or update the number of waiting connections of a pool. The
+ *      counter is maintained next to the lock-free waiting queue and
+ *      is used for the decisions about creating connection threads and
+ *      for introspection.
+ *
+ * Results:
+ *      WaitNum() returns the number of waiting connections.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------
+ */
+static int
+WaitNum(const ConnPool *poolPtr)
+{
+    int num;
+
+    NS_NONNULL_ASSERT(poolPtr != NULL);
+
+#ifdef CONN_RING_ATOMIC
+    num = __atomic_load_n(&poolPtr->wqueue.wait.num, __ATOMIC_RELAXED);
+#else
+    num = poolPtr->wqueue.wait.num;
+#endif
+
+    return num;
+}
+
+static void
+WaitNumAdd(ConnPool *poolPtr, int incr)
+{
+    NS_NONNULL_ASSERT(poolPtr != NULL);
+
+#ifdef CONN_RING_ATOMIC
+    (void)__atomic_add_fetch(&poolPtr->wqueue.wait.num, incr, __ATOMIC_RELAXED);
+#else
+    Ns_MutexLock(&poolPtr->wqueue.wait.ring.lock);
+    poolPtr->wqueue.wait.num += incr;
+    Ns_MutexUnlock(&poolPtr->wqueue.wait.ring.lock);
+#endif
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * NsConfigFairQueue --
+ *
+ *      Configure fair queuing for the waiting connections of a pool. The
+ *      parameter "fairqueuekey" is either "peeraddr" (the peer address,
+ *      which is in reverse proxy mode the address of the client as
+ *      provided by the proxy) or the name of a request header field.  The
+ *      optional parameter "fairqueueweights" is a list of key patterns and
+ *      weights, determining how many requests of a matching key are
+ *      served in a row (default 1).
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      Initializes the fair queuing members of the pool.
+ *
+ *----------------------------------------------------------------------
+ */
+void
+NsConfigFairQueue(ConnPool *poolPtr, const char *section)
+{
+    const char *key, *weights;
+
+    NS_NONNULL_ASSERT(poolPtr != NULL);
+    NS_NONNULL_ASSERT(section != NULL);
+
+    key = Ns_ConfigString(section, "fairqueuekey", NS_EMPTY_STRING);
+    weights = Ns_ConfigString(section, "fairqueueweights", NS_EMPTY_STRING);
+
+    if (*key != '\0') {
+        int          argc;
+        const char **argv;
+
+        poolPtr->wqueue.fair.key = key;
+        poolPtr->wqueue.fair.peer = STREQ(key, "peeraddr");
+        Tcl_InitHashTable(&poolPtr->wqueue.fair.queues, TCL_STRING_KEYS);
+
+        if (Tcl_SplitList(NULL, weights, &argc, &argv) != TCL_OK
+            || (argc % 2) != 0) {
+            Ns_Log(Warning, "pool %s: invalid value for fairqueueweights '%s',"
+                   " must be a list of key patterns and weights",
+                   NsPoolName(poolPtr->pool), weights);
+        } else {
+            int i;
+
+            if (argc > 0) {
+                poolPtr->wqueue.fair.weights = ns_calloc((size_t)argc / 2u, sizeof(FairWeight));
+            }
+            for (i = 0; i < argc; i += 2) {
+                FairWeight *weightPtr = &poolPtr->wqueue.fair.weights[poolPtr->wqueue.fair.nWeights];
+                int         weight;
+
+                if (Tcl_GetInt(NULL, argv[i+1], &weight) != TCL_OK || weight < 1) {
+                    Ns_Log(Warning, "pool %s: ignore invalid fair queue weight '%s' for '%s'",
+                           NsPoolName(poolPtr->pool), argv[i+1], argv[i]);
+                    continue;
+                }
+                weightPtr->pattern = ns_strdup(argv[i]);
+                weightPtr->weight = weight;
+                poolPtr->wqueue.fair.nWeights++;
+            }
+            Tcl_Free((char *)argv);
+        }
+        Ns_Log(Notice, "pool %s: fair queuing by %s", NsPoolName(poolPtr->pool), key);
+    }
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * FairQueueKey, FairQueueWeight --
+ *
+ *      Determine the fair queuing key of a request and the weight of a
+ *      key. Requests without the configured header field share the empty
+ *      key.
+ *
+ * Results:
+ *      Key string (might be in the provided buffer) or weight.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------
+ */
+static const char *
+FairQueueKey(const ConnPool *poolPtr, const Sock *sockPtr, char *buffer, size_t size)
+{
+    const char *key = NULL;
+
+    NS_NONNULL_ASSERT(poolPtr != NULL);
+    NS_NONNULL_ASSERT(sockPtr != NULL);
+    NS_NONNULL_ASSERT(buffer != NULL);
+
+    if (poolPtr->wqueue.fair.peer) {
+        const struct sockaddr *saPtr = (const struct sockaddr *)&(sockPtr->sa);
+
+        if (nsconf.reverseproxymode
+            && ((const struct sockaddr *)&sockPtr->clientsa)->sa_family != 0) {
+            saPtr = (const struct sockaddr *)&(sockPtr->clientsa);
+        }
+        key = ns_inet_ntop(saPtr, buffer, size);
+
+    } else if (sockPtr->reqPtr != NULL) {
+        key = Ns_SetIGet(sockPtr->reqPtr->headers, poolPtr->wqueue.fair.key);
+    }
+
+    return (key != NULL) ? key : NS_EMPTY_STRING;
+}
+
+static int
+FairQueueWeight(const ConnPool *poolPtr, const char *key)
+{
+    int i, weight = 1;
+
+    NS_NONNULL_ASSERT(poolPtr != NULL);
+    NS_NONNULL_ASSERT(key != NULL);
+
+    for (i = 0; i < poolPtr->wqueue.fair.nWeights; i++) {
+        if (Tcl_StringMatch(key, poolPtr->wqueue.fair.weights[i].pattern) != 0) {
+            weight = poolPtr->wqueue.fair.weights[i].weight;
+            break;
+        }
+    }
+    return weight;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * WaitQueuePush, WaitQueuePop --
+ *
+ *      Add a connection to the waiting connections of a pool, or get the
+ *      next waiting connection. Without fair queuing, the connections are
+ *      served FIFO via the lock-free ring. With fair queuing, every key has
+ *      its own FIFO queue; the queues are served round-robin, giving each
+ *      key "weight" consecutive turns. New keys are added at the end of
+ *      the current round, and empty queues are removed.
+ *
+ * Results:
+ *      WaitQueuePop() returns the connection or NULL, when nothing is
+ *      waiting.
+ *
+ * Side effects:
+ *      Updates the number of waiting connections.
+ *
+ *----------------------------------------------------------------------
+ */
+static void
+WaitQueuePush(ConnPool *poolPtr, Conn *connPtr, const Sock *sockPtr)
+{
+    NS_NONNULL_ASSERT(poolPtr != NULL);
+    NS_NONNULL_ASSERT(connPtr != NULL);
+    NS_NONNULL_ASSERT(sockPtr != NULL);
+
+    /*
+     * The counter is incremented before the connection is pushed,
+     * therefore the queue might still be empty when the counter is
+     * positive. The ring can hold all connections of the pool, so pushing
+     * cannot fail.
+     */
+    WaitNumAdd(poolPtr, 1);
+
+    if (poolPtr->wqueue.fair.key == NULL) {
+        (void) NsConnRingPush(&poolPtr->wqueue.wait.ring, connPtr);
+
+    } else {
+        char           buffer[NS_IPADDR_SIZE];
+        const char    *key;
+        FairQueue     *queuePtr;
+        Tcl_HashEntry *hPtr;
+        int            isNew;
+
+        key = FairQueueKey(poolPtr, sockPtr, buffer, sizeof(buffer));
+        connPtr->nextPtr = NULL;
+
+        Ns_MutexLock(&poolPtr->wqueue.lock);
+        hPtr = Tcl_CreateHashEntry(&poolPtr->wqueue.fair.queues, key, &isNew);
+        if (isNew != 0) {
+            queuePtr = ns_calloc(1u, sizeof(FairQueue));
+            queuePtr->hPtr = hPtr;
+            queuePtr->weight = FairQueueWeight(poolPtr, key);
+            queuePtr->turns = queuePtr->weight;
+            Tcl_SetHashValue(hPtr, queuePtr);
+
+            if (poolPtr->wqueue.fair.currentPtr == NULL) {
+                queuePtr->nextPtr = queuePtr;
+                queuePtr->prevPtr = queuePtr;
+                poolPtr->wqueue.fair.currentPtr = queuePtr;
+            } else {
+                FairQueue *currentPtr = poolPtr->wqueue.fair.currentPtr;
+
+                queuePtr->nextPtr = currentPtr;
+                queuePtr->prevPtr = currentPtr->prevPtr;
+                currentPtr->prevPtr->nextPtr = queuePtr;
+                currentPtr->prevPtr = queuePtr;
+            }
+        } else {
+            queuePtr = Tcl_GetHashValue(hPtr);
+        }
+        if (queuePtr->lastPtr == NULL) {
+            queuePtr->firstPtr = connPtr;
+        } else {
+            queuePtr->lastPtr->nextPtr = connPtr;
+        }
+        queuePtr->lastPtr = connPtr;
+        queuePtr->num++;
+        Ns_MutexUnlock(&poolPtr->wqueue.lock);
+    }
+}
+
+static Conn *
+WaitQueuePop(ConnPool *poolPtr)
+{
+    Conn *connPtr = NULL;
+
+    NS_NONNULL_ASSERT(poolPtr != NULL);
+
+    if (poolPtr->wqueue.fair.key == NULL) {
+        connPtr = NsConnRingPop(&poolPtr->wqueue.wait.ring);
+
+    } else {
+        FairQueue *queuePtr;
+
+        Ns_MutexLock(&poolPtr->wqueue.lock);
+        queuePtr = poolPtr->wqueue.fair.currentPtr;
+        if (queuePtr != NULL) {
+            FairQueue *nextPtr = queuePtr->nextPtr;
 
-    return (int)totalRate;
-}
+            connPtr = queuePtr->firstPtr;
+            queuePtr->firstPtr = connPtr->nextPtr;
+            if (queuePtr->firstPtr == NULL) {
+                queuePtr->lastPtr = NULL;
+            }
+            connPtr->nextPtr = NULL;
+            queuePtr->num--;
+            queuePtr->turns--;
 
-void
-NsPoolAddBytesSent(ConnPool *poolPtr, Tcl_WideInt bytesSent)
-{
-    Ns_MutexLock(&poolPtr->rate.lock);
-    poolPtr->rate.bytesSent += bytesSent;
-    Ns_MutexUnlock(&poolPtr->rate.lock);
-}
+            if (queuePtr->num == 0) {
+                /*
+                 * The queue is empty, remove it.
+                 */
+                if (nextPtr == queuePtr) {
+                    nextPtr = NULL;
+                } else {
+                    queuePtr->prevPtr->nextPtr = nextPtr;
+                    nextPtr->prevPtr = queuePtr->prevPtr;
+                }
+                Tcl_DeleteHashEntry(queuePtr->hPtr);
+                ns_free(queuePtr);
+                queuePtr = NULL;
+            }
+            if (queuePtr == NULL || queuePtr->turns == 0) {
+                /*
+                 * Next key's turn.
+                 */
+                if (nextPtr != NULL) {
+                    nextPtr->turns = nextPtr->weight;
+                }
+                poolPtr->wqueue.fair.currentPtr = nextPtr;
+            }
+        }
+        Ns_MutexUnlock(&poolPtr->wqueue.lock);
+    }
 
+    if (connPtr != NULL) {
+        WaitNumAdd(poolPtr, -1);
+    }
+    return connPtr;
+}
 
 
 /*
  *----------------------------------------------------------------------
  *
- * neededAdditionalConnectionThreads --
+ * NsConnRingPush, NsConnRingPop --
  *
- *      Compute the number additional connection threads we should
- *      create. This function has to be called under a lock for the
- *      provided queue (such as &poolPtr->wqueue.lock).
+ *      Enqueue a connection at the tail of the ring, or dequeue the
+ *      connection at the head of the ring. Multiple threads can push and
+ *      pop concurrently: a thread claims a position by advancing "tail"
+ *      (resp. "head") with a compare-and-swap, when the sequence number of
+ *      the slot shows that the slot is free (resp. filled) for this
+ *      position. Since the positions are not reused before the ring has
+ *      wrapped around, the ring does not suffer from the ABA problem of
+ *      lock-free lists.
  *
  * Results:
- *      Number of needed additional connection threads.
+ *      NsConnRingPush() returns NS_FALSE when the ring is full,
+ *      NsConnRingPop() returns NULL when the ring is empty.
  *
  * Side effects:
- *      None
+ *      None.
  *
  *----------------------------------------------------------------------
  */
-static bool
-neededAdditionalConnectionThreads(const ConnPool *poolPtr) {
-    bool wantCreate;
-
-    NS_NONNULL_ASSERT(poolPtr != NULL);
+bool
+NsConnRingPush(ConnRing *ringPtr, Conn *connPtr)
+{
+    ConnRingSlot *slotPtr;
+    size_t        pos;
+    bool          success = NS_TRUE;
 
-    /*
-     * Create new connection threads, if
-     *
-     * - there is currently no connection thread being created, or
-     *   parallel creates are allowed and there are more than
-     *   highwatermark requests queued,
-     *
-     * - AND there are less idle-threads than min threads (the server
-     *   tries to keep min-threads idle to be ready for short peaks),
-     *
-     * - AND there are not yet max-threads running.
-     *
-     */
-    if ( (poolPtr->threads.creating == 0
-          || poolPtr->wqueue.wait.num > poolPtr->wqueue.highwatermark
-          )
-         && (poolPtr->threads.current < poolPtr->threads.min
-             || (poolPtr->wqueue.wait.num > poolPtr->wqueue.lowwatermark)
-             )
-         && poolPtr->threads.current < poolPtr->threads.max
-         ) {
+    NS_NONNULL_ASSERT(ringPtr != NULL);
+    NS_NONNULL_ASSERT(connPtr != NULL);
 
-        Ns_MutexLock(&poolPtr->servPtr->pools.lock);
-        wantCreate = (!poolPtr->servPtr->pools.shutdown);
-        Ns_MutexUnlock(&poolPtr->servPtr->pools.lock);
+#ifdef CONN_RING_ATOMIC
+    pos = __atomic_load_n(&ringPtr->tail, __ATOMIC_RELAXED);
+    for (;;) {
+        ptrdiff_t diff;
 
-        /*Ns_Log(Notice, "[%s] wantCreate %d (creating %d current %d idle %d waiting %d)",
-             poolPtr->servPtr->server,
-             wantCreate,
-             poolPtr->threads.creating,
-             poolPtr->threads.current,
-             poolPtr->threads.idle,
-             poolPtr->wqueue.wait.num
-             );*/
+        slotPtr = &ringPtr->slots[pos & ringPtr->mask];
+        diff = (ptrdiff_t)__atomic_load_n(&slotPtr->seq, __ATOMIC_ACQUIRE) - (ptrdiff_t)pos;
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&ringPtr->tail, &pos, pos + 1u, NS_TRUE,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                break;
+            }
+        } else if (diff < 0) {
+            success = NS_FALSE;
+            break;
+        } else {
+            pos = __atomic_load_n(&ringPtr->tail, __ATOMIC_RELAXED);
+        }
+    }
+    if (success) {
+        slotPtr->connPtr = connPtr;
+        __atomic_store_n(&slotPtr->seq, pos + 1u, __ATOMIC_RELEASE);
+    }
+#else
+    Ns_MutexLock(&ringPtr->lock);
+    pos = ringPtr->tail;
+    slotPtr = &ringPtr->slots[pos & ringPtr->mask];
+    if (slotPtr->seq == pos) {
+        ringPtr->tail = pos + 1u;
+        slotPtr->connPtr = connPtr;
+        slotPtr->seq = pos + 1u;
     } else {
-        wantCreate = NS_FALSE;
+        success = NS_FALSE;
+    }
+    Ns_MutexUnlock(&ringPtr->lock);
+#endif
 
-        /*Ns_Log(Notice, "[%s] do not wantCreate creating %d, idle %d < min %d, current %d < max %d, waiting %d)",
-               poolPtr->servPtr->server,
-               poolPtr->threads.creating,
-               poolPtr->threads.idle,
-               poolPtr->threads.min,
-               poolPtr->threads.current,
-               poolPtr->threads.max,
-               poolPtr->wqueue.wait.num);*/
+    return success;
+}
+
+Conn *
+NsConnRingPop(ConnRing *ringPtr)
+{
+    ConnRingSlot *slotPtr;
+    Conn         *connPtr = NULL;
+    size_t        pos;
+
+    NS_NONNULL_ASSERT(ringPtr != NULL);
 
+#ifdef CONN_RING_ATOMIC
+    pos = __atomic_load_n(&ringPtr->head, __ATOMIC_RELAXED);
+    for (;;) {
+        ptrdiff_t diff;
+
+        slotPtr = &ringPtr->slots[pos & ringPtr->mask];
+        diff = (ptrdiff_t)__atomic_load_n(&slotPtr->seq, __ATOMIC_ACQUIRE) - (ptrdiff_t)(pos + 1u);
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&ringPtr->head, &pos, pos + 1u, NS_TRUE,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                connPtr = slotPtr->connPtr;
+                __atomic_store_n(&slotPtr->seq, pos + ringPtr->mask + 1u, __ATOMIC_RELEASE);
+                break;
+            }
+        } else if (diff < 0) {
+            break;
+        } else {
+            pos = __atomic_load_n(&ringPtr->head, __ATOMIC_RELAXED);
+        }
+    }
+#else
+    Ns_MutexLock(&ringPtr->lock);
+    pos = ringPtr->head;
+    slotPtr = &ringPtr->slots[pos & ringPtr->mask];
+    if (slotPtr->seq == pos + 1u) {
+        ringPtr->head = pos + 1u;
+        connPtr = slotPtr->connPtr;
+        slotPtr->seq = pos + ringPtr->mask + 1u;
     }
+    Ns_MutexUnlock(&ringPtr->lock);
+#endif
 
-    return wantCreate;
+    return connPtr;
 }
 
 
@@ -470,7 +1510,6 @@ NsEnsureRunningConnectionThreads(const NsServer *servPtr, ConnPool *poolPtr) {
         poolPtr = servPtr->pools.defaultPtr;
     }
 
-    Ns_MutexLock(&poolPtr->wqueue.lock);
     Ns_MutexLock(&poolPtr->threads.lock);
     create = neededAdditionalConnectionThreads(poolPtr);
 
@@ -478,10 +1517,9 @@ NsEnsureRunningConnectionThreads(const NsServer *servPtr, ConnPool *poolPtr) {
         poolPtr->threads.current ++;
         poolPtr->threads.creating ++;
     }
-    waitnum = poolPtr->wqueue.wait.num;
+    waitnum = WaitNum(poolPtr);
 
     Ns_MutexUnlock(&poolPtr->threads.lock);
-    Ns_MutexUnlock(&poolPtr->wqueue.lock);
 
     if (create) {
         Ns_Log(Notice, "NsEnsureRunningConnectionThreads wantCreate %d waiting %d idle %d current %d",
@@ -519,7 +1557,7 @@ NsQueueConn(Sock *sockPtr, const Ns_Time *nowPtr)
     NsServer      *servPtr;
     ConnPool      *poolPtr = NULL;
     Conn          *connPtr = NULL;
-    bool           create = NS_FALSE;
+    bool           create = NS_FALSE, shed = NS_FALSE;
     int            queued = NS_OK;
 
     NS_NONNULL_ASSERT(sockPtr != NULL);
@@ -576,14 +1614,18 @@ NsQueueConn(Sock *sockPtr, const Ns_Time *nowPtr)
     * We know the pool. Try to add connection into the queue of this pool
     * (either into a free slot or into its waiting list, or, when everything
     * fails signal an error or timeout (for retry attempts) to the caller.
+    *
+    * When the queue delay of the pool is above the target (see
+    * QueueDelayUpdate()), shed the request as long as other requests are
+    * waiting, such that the queue cannot build up and increase the latency
+    * of all requests.
     */
-    Ns_MutexLock(&poolPtr->wqueue.lock);
-    if (poolPtr->wqueue.freePtr != NULL) {
-        connPtr = poolPtr->wqueue.freePtr;
-        poolPtr->wqueue.freePtr = connPtr->nextPtr;
-        connPtr->nextPtr = NULL;
+    if (unlikely(poolPtr->wqueue.delay.overloaded)
+        && WaitNum(poolPtr) > 0) {
+        shed = NS_TRUE;
+    } else {
+        connPtr = NsConnRingPop(&poolPtr->wqueue.free);
     }
-    Ns_MutexUnlock(&poolPtr->wqueue.lock);
 
     if (likely(connPtr != NULL)) {
         /*
@@ -593,10 +1635,15 @@ NsQueueConn(Sock *sockPtr, const Ns_Time *nowPtr)
 
         /* ConnThreadQueuePrint(poolPtr, "driver");*/
 
+#ifdef CONN_RING_ATOMIC
+        connPtr->id = __atomic_fetch_add(&servPtr->pools.nextconnid, 1u, __ATOMIC_RELAXED);
+        (void)__atomic_add_fetch(&poolPtr->stats.processed, 1u, __ATOMIC_RELAXED);
+#else
         Ns_MutexLock(&servPtr->pools.lock);
         connPtr->id = servPtr->pools.nextconnid++;
         poolPtr->stats.processed++;
         Ns_MutexUnlock(&servPtr->pools.lock);
+#endif
 
         connPtr->requestQueueTime     = *nowPtr;
         connPtr->sockPtr              = sockPtr;
@@ -642,34 +1689,38 @@ NsQueueConn(Sock *sockPtr, const Ns_Time *nowPtr)
             assert(argPtr->state == connThread_idle);
             argPtr->connPtr = connPtr;
 
-            Ns_MutexLock(&poolPtr->wqueue.lock);
             Ns_MutexLock(&poolPtr->threads.lock);
             create = neededAdditionalConnectionThreads(poolPtr);
             Ns_MutexUnlock(&poolPtr->threads.lock);
-            Ns_MutexUnlock(&poolPtr->wqueue.lock);
 
         } else {
             /*
              * There is no connection thread ready, so we add the
              * connection to the waiting queue.
              */
-            Ns_MutexLock(&poolPtr->wqueue.lock);
-            if (poolPtr->wqueue.wait.firstPtr == NULL) {
-                poolPtr->wqueue.wait.firstPtr = connPtr;
-            } else {
-                poolPtr->wqueue.wait.lastPtr->nextPtr = connPtr;
-            }
-            poolPtr->wqueue.wait.lastPtr = connPtr;
-            poolPtr->wqueue.wait.num ++;
+            WaitQueuePush(poolPtr, connPtr, sockPtr);
             Ns_MutexLock(&poolPtr->threads.lock);
             poolPtr->stats.queued++;
             create = neededAdditionalConnectionThreads(poolPtr);
             Ns_MutexUnlock(&poolPtr->threads.lock);
-            Ns_MutexUnlock(&poolPtr->wqueue.lock);
         }
     }
 
-    if (unlikely(connPtr == NULL)) {
+    if (unlikely(shed)) {
+        /*
+         * Reject the request with a 503. The driver adds the "Retry-After"
+         * header field when configured.
+         */
+        Ns_Log(Debug, "[%s pool %s] queue delay above target, shed request, waiting %d",
+               poolPtr->servPtr->server,
+               poolPtr->pool,
+               WaitNum(poolPtr));
+        Ns_MutexLock(&poolPtr->threads.lock);
+        poolPtr->stats.shed++;
+        Ns_MutexUnlock(&poolPtr->threads.lock);
+        queued = NS_ERROR;
+
+    } else if (unlikely(connPtr == NULL)) {
         /*
          * The connection thread pool queue is full.  We can either keep the
          * sockPtr in a waiting state, or we can reject the queue overrun with
@@ -688,7 +1739,7 @@ NsQueueConn(Sock *sockPtr, const Ns_Time *nowPtr)
             Ns_Log(Notice, "[%s pool %s] All available connections are used, waiting %d idle %d current %d",
                    poolPtr->servPtr->server,
                    poolPtr->pool,
-                   poolPtr->wqueue.wait.num,
+                   WaitNum(poolPtr),
                    poolPtr->threads.idle,
                    poolPtr->threads.current);
 
@@ -727,7 +1778,7 @@ NsQueueConn(Sock *sockPtr, const Ns_Time *nowPtr)
     } else {
         if (Ns_LogSeverityEnabled(Debug)) {
             Ns_Log(Debug, "add waiting connPtr %p => waiting %d create %d",
-                   (void *)connPtr, poolPtr->wqueue.wait.num, (int)create);
+                   (void *)connPtr, WaitNum(poolPtr), (int)create);
         }
     }
 
@@ -743,7 +1794,7 @@ NsQueueConn(Sock *sockPtr, const Ns_Time *nowPtr)
 
         Ns_Log(Notice, "NsQueueConn wantCreate %d waiting %d idle %d current %d",
                (int)create,
-               poolPtr->wqueue.wait.num,
+               WaitNum(poolPtr),
                idle,
                current);
 
@@ -1334,9 +2385,61 @@ ServerListQueued(Tcl_DString *dsPtr, ConnPool *poolPtr)
     NS_NONNULL_ASSERT(dsPtr != NULL);
     NS_NONNULL_ASSERT(poolPtr != NULL);
 
-    Ns_MutexLock(&poolPtr->wqueue.lock);
-    AppendConnList(dsPtr, poolPtr->wqueue.wait.firstPtr, "queued", NS_FALSE);
-    Ns_MutexUnlock(&poolPtr->wqueue.lock);
+    /*
+     * As for the running connections, the tqueue lock protects the
+     * connection data against being reset.
+     */
+    Ns_MutexLock(&poolPtr->tqueue.lock);
+
+    if (poolPtr->wqueue.fair.key != NULL) {
+        /*
+         * With fair queuing, list the per-key queues in the order, in
+         * which they are served.
+         */
+        const FairQueue *queuePtr;
+
+        Ns_MutexLock(&poolPtr->wqueue.lock);
+        queuePtr = poolPtr->wqueue.fair.currentPtr;
+        if (queuePtr != NULL) {
+            do {
+                AppendConnList(dsPtr, queuePtr->firstPtr, "queued", NS_FALSE);
+                queuePtr = queuePtr->nextPtr;
+            } while (queuePtr != poolPtr->wqueue.fair.currentPtr);
+        }
+        Ns_MutexUnlock(&poolPtr->wqueue.lock);
+
+    } else {
+        /*
+         * Walk the filled slots of the ring in queue order. Entries
+         * dequeued in the meantime are skipped based on their sequence
+         * number.
+         */
+        ConnRing *ringPtr = &poolPtr->wqueue.wait.ring;
+        size_t    pos, tail;
+
+#ifdef CONN_RING_ATOMIC
+        pos = __atomic_load_n(&ringPtr->head, __ATOMIC_ACQUIRE);
+        tail = __atomic_load_n(&ringPtr->tail, __ATOMIC_ACQUIRE);
+#else
+        Ns_MutexLock(&ringPtr->lock);
+        pos = ringPtr->head;
+        tail = ringPtr->tail;
+#endif
+        for (; pos != tail; pos++) {
+            const ConnRingSlot *slotPtr = &ringPtr->slots[pos & ringPtr->mask];
+
+#ifdef CONN_RING_ATOMIC
+            if (__atomic_load_n(&slotPtr->seq, __ATOMIC_ACQUIRE) != pos + 1u) {
+                continue;
+            }
+#endif
+            AppendConn(dsPtr, slotPtr->connPtr, "queued", NS_FALSE);
+        }
+#ifndef CONN_RING_ATOMIC
+        Ns_MutexUnlock(&ringPtr->lock);
+#endif
+    }
+    Ns_MutexUnlock(&poolPtr->tqueue.lock);
 }
 
 
@@ -1380,6 +2483,102 @@ ServerListActiveCmd(Tcl_DString *dsPtr, Tcl_Interp *interp, int objc, Tcl_Obj *c
     return result;
 }
 
+static int
+ServerStatsCmd(Tcl_DString *dsPtr, Tcl_Interp *interp, int objc, Tcl_Obj *const* objv,
+               ConnPool *poolPtr, int nargs)
+{
+    int         result = TCL_OK, histogram = (int)NS_FALSE, reset = (int)NS_FALSE;
+    Ns_ObjvSpec opts[] = {
+        {"-histogram", Ns_ObjvBool, &histogram, INT2PTR(NS_TRUE)},
+        {"-reset",     Ns_ObjvBool, &reset,     INT2PTR(NS_TRUE)},
+        {NULL, NULL,  NULL, NULL}
+    };
+
+    NS_NONNULL_ASSERT(dsPtr != NULL);
+    NS_NONNULL_ASSERT(interp != NULL);
+    NS_NONNULL_ASSERT(objv != NULL);
+    NS_NONNULL_ASSERT(poolPtr != NULL);
+
+    if (Ns_ParseObjv(opts, NULL, interp, objc-nargs, objc, objv) != NS_OK) {
+        result = TCL_ERROR;
+
+    } else if (histogram == (int)NS_TRUE) {
+        /*
+         * Percentiles of the latency histograms of the request phases.
+         */
+        Ns_DStringAppend(dsPtr, "accept");
+        Tcl_DStringStartSublist(dsPtr);
+        HistogramAppend(dsPtr, &poolPtr->histogram.accept);
+        Tcl_DStringEndSublist(dsPtr);
+        Ns_DStringAppend(dsPtr, " queue");
+        Tcl_DStringStartSublist(dsPtr);
+        HistogramAppend(dsPtr, &poolPtr->histogram.queue);
+        Tcl_DStringEndSublist(dsPtr);
+        Ns_DStringAppend(dsPtr, " filter");
+        Tcl_DStringStartSublist(dsPtr);
+        HistogramAppend(dsPtr, &poolPtr->histogram.filter);
+        Tcl_DStringEndSublist(dsPtr);
+        Ns_DStringAppend(dsPtr, " run");
+        Tcl_DStringStartSublist(dsPtr);
+        HistogramAppend(dsPtr, &poolPtr->histogram.run);
+        Tcl_DStringEndSublist(dsPtr);
+
+    } else {
+        Ns_DStringPrintf(dsPtr, "requests %lu ", poolPtr->stats.processed);
+        Ns_DStringPrintf(dsPtr, "spools %lu ", poolPtr->stats.spool);
+        Ns_DStringPrintf(dsPtr, "queued %lu ", poolPtr->stats.queued);
+        Ns_DStringPrintf(dsPtr, "dropped %lu ", poolPtr->stats.dropped);
+        Ns_DStringPrintf(dsPtr, "shed %lu ", poolPtr->stats.shed);
+        Ns_DStringPrintf(dsPtr, "sent %" TCL_LL_MODIFIER "d ", poolPtr->rate.bytesSent);
+        Ns_DStringPrintf(dsPtr, "connthreads %lu", poolPtr->stats.connthreads);
+
+        Ns_DStringAppend(dsPtr, " accepttime ");
+        Ns_DStringAppendTime(dsPtr, &poolPtr->stats.acceptTime);
+
+        Ns_DStringAppend(dsPtr, " queuetime ");
+        Ns_DStringAppendTime(dsPtr, &poolPtr->stats.queueTime);
+
+        Ns_DStringAppend(dsPtr, " filtertime ");
+        Ns_DStringAppendTime(dsPtr, &poolPtr->stats.filterTime);
+
+        Ns_DStringAppend(dsPtr, " runtime ");
+        Ns_DStringAppendTime(dsPtr, &poolPtr->stats.runTime);
+
+        Ns_DStringAppend(dsPtr, " tracetime ");
+        Ns_DStringAppendTime(dsPtr, &poolPtr->stats.traceTime);
+
+        /*
+         * Number of waiting requests per fair queuing key.
+         */
+        Ns_DStringAppend(dsPtr, " fairqueues");
+        Tcl_DStringStartSublist(dsPtr);
+        if (poolPtr->wqueue.fair.key != NULL) {
+            const FairQueue *queuePtr;
+
+            Ns_MutexLock(&poolPtr->wqueue.lock);
+            queuePtr = poolPtr->wqueue.fair.currentPtr;
+            if (queuePtr != NULL) {
+                do {
+                    Tcl_DStringAppendElement(dsPtr, Tcl_GetHashKey(&poolPtr->wqueue.fair.queues,
+                                                                   queuePtr->hPtr));
+                    Ns_DStringPrintf(dsPtr, " %d", queuePtr->num);
+                    queuePtr = queuePtr->nextPtr;
+                } while (queuePtr != poolPtr->wqueue.fair.currentPtr);
+            }
+            Ns_MutexUnlock(&poolPtr->wqueue.lock);
+        }
+        Tcl_DStringEndSublist(dsPtr);
+    }
+
+    if (result == TCL_OK && reset == (int)NS_TRUE) {
+        HistogramReset(&poolPtr->histogram.accept);
+        HistogramReset(&poolPtr->histogram.queue);
+        HistogramReset(&poolPtr->histogram.filter);
+        HistogramReset(&poolPtr->histogram.run);
+    }
+    return result;
+}
+
 static int
 ServerListQueuedCmd(Tcl_DString *dsPtr, Tcl_Interp *interp, int objc, Tcl_Obj *const* objv,
                  ConnPool *poolPtr, int nargs)
@@ -1529,6 +2728,7 @@ NsTclServerObjCmd(ClientData clientData, Tcl_Interp *interp, int objc, Tcl_Obj *
         && subcmd != SAllIdx
         && subcmd != SPoolRateLimitIdx
         && subcmd != SConnectionRateLimitIdx
+        && (subcmd != SStatsIdx || nargs == 0 || *Tcl_GetString(objv[objc-1]) != '-')
         ) {
         /*
          * Just for backwards compatibility
@@ -1620,7 +2820,7 @@ NsTclServerObjCmd(ClientData clientData, Tcl_Interp *interp, int objc, Tcl_Obj *
          */
 
     case SWaitingIdx:
-        Tcl_SetObjResult(interp, Tcl_NewIntObj(poolPtr->wqueue.wait.num));
+        Tcl_SetObjResult(interp, Tcl_NewIntObj(WaitNum(poolPtr)));
         break;
 
     case SKeepaliveIdx:
@@ -1662,38 +2862,22 @@ NsTclServerObjCmd(ClientData clientData, Tcl_Interp *interp, int objc, Tcl_Obj *
 
     case SStatsIdx:
         Tcl_DStringInit(dsPtr);
-
-        Ns_DStringPrintf(dsPtr, "requests %lu ", poolPtr->stats.processed);
-        Ns_DStringPrintf(dsPtr, "spools %lu ", poolPtr->stats.spool);
-        Ns_DStringPrintf(dsPtr, "queued %lu ", poolPtr->stats.queued);
-        Ns_DStringPrintf(dsPtr, "dropped %lu ", poolPtr->stats.dropped);
-        Ns_DStringPrintf(dsPtr, "sent %" TCL_LL_MODIFIER "d ", poolPtr->rate.bytesSent);
-        Ns_DStringPrintf(dsPtr, "connthreads %lu", poolPtr->stats.connthreads);
-
-        Ns_DStringAppend(dsPtr, " accepttime ");
-        Ns_DStringAppendTime(dsPtr, &poolPtr->stats.acceptTime);
-
-        Ns_DStringAppend(dsPtr, " queuetime ");
-        Ns_DStringAppendTime(dsPtr, &poolPtr->stats.queueTime);
-
-        Ns_DStringAppend(dsPtr, " filtertime ");
-        Ns_DStringAppendTime(dsPtr, &poolPtr->stats.filterTime);
-
-        Ns_DStringAppend(dsPtr, " runtime ");
-        Ns_DStringAppendTime(dsPtr, &poolPtr->stats.runTime);
-
-        Ns_DStringAppend(dsPtr, " tracetime ");
-        Ns_DStringAppendTime(dsPtr, &poolPtr->stats.traceTime);
-
-        Tcl_DStringResult(interp, dsPtr);
+        result = ServerStatsCmd(dsPtr, interp, objc, objv, poolPtr, nargs);
+        if (likely(result == NS_OK)) {
+            Tcl_DStringResult(interp, dsPtr);
+        } else {
+            Tcl_DStringFree(dsPtr);
+        }
         break;
 
     case SThreadsIdx:
         Ns_MutexLock(&poolPtr->threads.lock);
         Ns_TclPrintfResult(interp,
-                           "min %d max %d current %d idle %d stopping 0",
+                           "min %d max %d current %d idle %d stopping %d wanted %d",
                            poolPtr->threads.min, poolPtr->threads.max,
-                           poolPtr->threads.current, poolPtr->threads.idle);
+                           poolPtr->threads.current, poolPtr->threads.idle,
+                           poolPtr->threads.stopping,
+                           MAX(poolPtr->threads.min, poolPtr->threads.autoscale.wanted));
         Ns_MutexUnlock(&poolPtr->threads.lock);
         break;
 
@@ -1858,7 +3042,7 @@ NsWaitServer(NsServer *servPtr, const Ns_Time *toPtr)
     Ns_MutexLock(&servPtr->pools.lock);
     while (poolPtr != NULL && status == NS_OK) {
         while (status == NS_OK &&
-               (poolPtr->wqueue.wait.firstPtr != NULL
+               (WaitNum(poolPtr) > 0
                 || poolPtr->threads.current > 0)) {
             status = Ns_CondTimedWait(&poolPtr->wqueue.cond,
                                       &servPtr->pools.lock, toPtr);
@@ -1968,13 +3152,14 @@ NsConnThread(void *arg)
     Conn          *connPtr = NULL;
     Ns_Time        wait, *timePtr = &wait;
     uintptr_t      threadId;
-    bool           duringShutdown, fromQueue;
+    bool           duringShutdown, fromQueue, followDriver, idleExit = NS_FALSE;
     int            cpt, ncons, current;
+    const char    *cpus = NULL;
     Ns_ReturnCode  status = NS_OK;
     Ns_Time        timeout;
     const char    *exitMsg;
     Ns_Thread      joinThread;
-    Ns_Mutex      *threadsLockPtr, *tqueueLockPtr, *wqueueLockPtr;
+    Ns_Mutex      *threadsLockPtr, *tqueueLockPtr;
 
     NS_NONNULL_ASSERT(arg != NULL);
 
@@ -2003,8 +3188,20 @@ NsConnThread(void *arg)
     Ns_MutexUnlock(threadsLockPtr);
 
     servPtr = poolPtr->servPtr;
+    followDriver = (poolPtr->threads.cpus != NULL && STREQ(poolPtr->threads.cpus, "driver"));
     ConnThreadSetName(servPtr->server, poolPtr->pool, threadId, 0);
 
+    /*
+     * Apply the CPU affinity of the pool. With "driver", the thread
+     * takes the CPU affinity of the driver thread, which has queued its
+     * first request (see below), such that it runs on the same CPUs (or
+     * NUMA node) as the driver thread.
+     */
+    if (poolPtr->threads.cpus != NULL && !followDriver
+        && Ns_ThreadSetAffinity(poolPtr->threads.cpus) != NS_OK) {
+        Ns_Log(Warning, "could not set CPU affinity '%s'", poolPtr->threads.cpus);
+    }
+
     Ns_ThreadSelf(&joinThread);
 
     cpt     = poolPtr->threads.connsperthread;
@@ -2029,8 +3226,6 @@ NsConnThread(void *arg)
         argPtr->state = connThread_ready;
     }
 
-    wqueueLockPtr  = &poolPtr->wqueue.lock;
-
     /*
      * Start handling connections.
      */
@@ -2045,24 +3240,12 @@ NsConnThread(void *arg)
         assert(argPtr->connPtr == NULL);
         assert(argPtr->state == connThread_ready);
 
-        if (poolPtr->wqueue.wait.firstPtr != NULL) {
-            connPtr = NULL;
-            Ns_MutexLock(wqueueLockPtr);
-            if (poolPtr->wqueue.wait.firstPtr != NULL) {
-                /*
-                 * There are waiting requests.  Pull the first connection of
-                 * the waiting list and assign it to the ConnThreadArg.
-                 */
-                connPtr = poolPtr->wqueue.wait.firstPtr;
-                poolPtr->wqueue.wait.firstPtr = connPtr->nextPtr;
-                if (poolPtr->wqueue.wait.lastPtr == connPtr) {
-                    poolPtr->wqueue.wait.lastPtr = NULL;
-                }
-                connPtr->nextPtr = NULL;
-                poolPtr->wqueue.wait.num --;
-            }
-            Ns_MutexUnlock(wqueueLockPtr);
-
+        if (WaitNum(poolPtr) > 0) {
+            /*
+             * There are waiting requests.  Pull the next connection of
+             * the waiting queue and assign it to the ConnThreadArg.
+             */
+            connPtr = WaitQueuePop(poolPtr);
             argPtr->connPtr = connPtr;
             fromQueue = NS_TRUE;
         } else {
@@ -2114,10 +3297,13 @@ NsConnThread(void *arg)
                         Ns_Log(Warning, "signal lost, resuming after timeout");
                         status = NS_OK;
 
-                    } else if (poolPtr->threads.current <= poolPtr->threads.min) {
+                    } else if (!ConnThreadIdleExit(poolPtr)) {
                         /*
                          * We have a timeout, but we should not reduce the
-                         * number of threads below min-threads.
+                         * number of threads below min-threads (or the
+                         * number of threads wanted by autoscaling).
+                         * Note that ConnThreadIdleExit() takes
+                         * threads.lock while argPtr->lock is held.
                          */
                         NsIdleCallback(servPtr);
                         continue;
@@ -2126,6 +3312,7 @@ NsConnThread(void *arg)
                         /*
                          * We have a timeout, and the thread can exit.
                          */
+                        idleExit = NS_TRUE;
                         break;
                     }
                 }
@@ -2188,7 +3375,26 @@ NsConnThread(void *arg)
         connPtr = argPtr->connPtr;
         assert(connPtr != NULL);
 
+        /*
+         * With "driver", the thread is bound once to the CPUs of the driver
+         * thread of its first request. It is not moved for requests of
+         * other driver threads, which would cost a system call and likely
+         * a migration per request.
+         */
+        if (followDriver
+            && cpus == NULL
+            && connPtr->drvPtr != NULL
+            && connPtr->drvPtr->cpus != NULL) {
+            cpus = connPtr->drvPtr->cpus;
+            if (Ns_ThreadSetAffinity(cpus) != NS_OK) {
+                Ns_Log(Warning, "could not set CPU affinity '%s'", cpus);
+            }
+        }
+
         Ns_GetTime(&connPtr->requestDequeueTime);
+        if (poolPtr->wqueue.delay.target.sec > 0 || poolPtr->wqueue.delay.target.usec > 0) {
+            QueueDelayUpdate(poolPtr, connPtr);
+        }
 
         /*
          * Run the connection if possible (requires a valid sockPtr and a
@@ -2253,10 +3459,8 @@ NsConnThread(void *arg)
         }
         connPtr->prevPtr = NULL;
 
-        Ns_MutexLock(wqueueLockPtr);
-        connPtr->nextPtr = poolPtr->wqueue.freePtr;
-        poolPtr->wqueue.freePtr = connPtr;
-        Ns_MutexUnlock(wqueueLockPtr);
+        connPtr->nextPtr = NULL;
+        (void) NsConnRingPush(&poolPtr->wqueue.free, connPtr);
 
         if (cpt != 0) {
             int waiting, idle, lowwater;
@@ -2266,14 +3470,12 @@ NsConnThread(void *arg)
             /*
              * Get a consistent snapshot of the controlling variables.
              */
-            Ns_MutexLock(wqueueLockPtr);
             Ns_MutexLock(threadsLockPtr);
-            waiting  = poolPtr->wqueue.wait.num;
+            waiting  = WaitNum(poolPtr);
             lowwater = poolPtr->wqueue.lowwatermark;
             idle     = poolPtr->threads.idle;
             current  = poolPtr->threads.current;
             Ns_MutexUnlock(threadsLockPtr);
-            Ns_MutexUnlock(wqueueLockPtr);
 
             if (Ns_LogSeverityEnabled(Debug)) {
                 Ns_Time now, acceptTime, queueTime, filterTime, netRunTime, runTime, fullTime;
@@ -2348,7 +3550,11 @@ NsConnThread(void *arg)
          */
         Ns_MutexLock(threadsLockPtr);
         poolPtr->threads.current--;
-        wakeup = (poolPtr->threads.current < poolPtr->threads.min);
+        if (idleExit) {
+            poolPtr->threads.stopping--;
+        }
+        wakeup = (poolPtr->threads.current < MAX(poolPtr->threads.min,
+                                                  poolPtr->threads.autoscale.wanted));
         Ns_MutexUnlock(threadsLockPtr);
 
         /*
@@ -2510,6 +3716,7 @@ ConnRun(Conn *connPtr)
     servPtr = connPtr->poolPtr->servPtr;
     Ns_ConnSetCompression(conn, servPtr->compress.enable ? servPtr->compress.level : 0);
     connPtr->compress = -1;
+    connPtr->streamViaWriter = NS_FALSE;
 
     connPtr->outputEncoding = servPtr->encoding.outputEncoding;
     connPtr->urlEncoding = servPtr->encoding.urlEncoding;
@@ -2670,6 +3877,15 @@ ConnRun(Conn *connPtr)
         }
     }
 
+    /*
+     * We are done with the headers. Since the header fields might be slices
+     * of the request buffer, clear these before the request is freed to
+     * avoid copying.
+     */
+    Ns_MutexLock(&connPtr->poolPtr->tqueue.lock);
+    Ns_SetTrunc(connPtr->headers, 0);
+    Ns_MutexUnlock(&connPtr->poolPtr->tqueue.lock);
+
     /*
      * Close the connection. This might free as well the content of
      * connPtr->reqPtr, so set it to NULL to avoid surprises, if someone might
@@ -2682,6 +3898,12 @@ ConnRun(Conn *connPtr)
     connPtr->reqPtr = NULL;
     Ns_MutexUnlock(&connPtr->poolPtr->tqueue.lock);
 
+    /*
+     * The header fields do not refer to the request buffer anymore, so a
+     * request kept after an early close can be released now.
+     */
+    NsConnReleaseRequest(connPtr);
+
     /*
      * Deactivate stream writer, if defined
      */
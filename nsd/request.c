@@ -636,9 +636,59 @@ SetUrl(Ns_Request *request, char *url)
 Ns_ReturnCode
 Ns_ParseHeader(Ns_Set *set, const char *line, const char *prefix, Ns_HeaderCaseDisposition disp,
                size_t *fieldNumberPtr)
+{
+    Ns_ReturnCode status;
+
+    NS_NONNULL_ASSERT(set != NULL);
+    NS_NONNULL_ASSERT(line != NULL);
+
+    if (prefix != NULL && CHARTYPE(space, *line) == 0) {
+        Tcl_DString ds, *dsPtr = &ds;
+
+        Tcl_DStringInit(dsPtr);
+        Tcl_DStringAppend(dsPtr, prefix, -1);
+        Tcl_DStringAppend(dsPtr, line, -1);
+        status = NsParseHeaderLine(set, dsPtr->string, (size_t)dsPtr->length, disp, NS_FALSE, fieldNumberPtr);
+        Tcl_DStringFree(dsPtr);
+    } else {
+        status = NsParseHeaderLine(set, (char *)line, strlen(line), disp, NS_FALSE, fieldNumberPtr);
+    }
+    return status;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * NsParseHeaderLine --
+ *
+ *    Consume a header line of the given length, handling header
+ *    continuation, placing results in given set. In contrast to
+ *    Ns_ParseHeader(), the line is not scanned for its end again, which
+ *    is already known e.g. by the driver. The line has to be NUL
+ *    terminated at lineLength.
+ *
+ *    When "slice" is true, the key and value are not copied but added as
+ *    slices of the line to the set (see NsSetPutSlice()). In this case,
+ *    the line is modified and has to be located in the slice region of
+ *    the set.
+ *
+ * Results:
+ *    NS_OK/NS_ERROR
+ *
+ * Side effects:
+ *    None
+ *
+ *----------------------------------------------------------------------
+ */
+
+Ns_ReturnCode
+NsParseHeaderLine(Ns_Set *set, char *line, size_t lineLength, Ns_HeaderCaseDisposition disp,
+                  bool slice, size_t *fieldNumberPtr)
 {
     Ns_ReturnCode status = NS_OK;
     size_t        idx = 0u;
+    const char   *end;
 
     /*
      * Header lines are first checked if they continue a previous
@@ -649,6 +699,8 @@ Ns_ParseHeader(Ns_Set *set, const char *line, const char *prefix, Ns_HeaderCaseD
     NS_NONNULL_ASSERT(set != NULL);
     NS_NONNULL_ASSERT(line != NULL);
 
+    end = line + lineLength;
+
     if (CHARTYPE(space, *line) != 0) {
         if (Ns_SetSize(set) == 0u) {
             /*
@@ -661,31 +713,23 @@ Ns_ParseHeader(Ns_Set *set, const char *line, const char *prefix, Ns_HeaderCaseD
             /*
              * Append to the last entry.
              */
-            while (CHARTYPE(space, *line) != 0) {
+            while (line < end && CHARTYPE(space, *line) != 0) {
                 ++line;
             }
-            if (*line != '\0') {
+            if (line < end) {
                 Ns_DString ds;
                 char      *value = Ns_SetValue(set, idx);
 
                 Ns_DStringInit(&ds);
-                Ns_DStringVarAppend(&ds, value, " ", line, (char *)0L);
+                Ns_DStringVarAppend(&ds, value, " ", (char *)0L);
+                Tcl_DStringAppend(&ds, line, (int)(end - line));
                 Ns_SetPutValueSz(set, idx, ds.string, ds.length);
                 Ns_DStringFree(&ds);
             }
         }
     } else {
-        char *sep;
-        Tcl_DString ds, *dsPtr = &ds;
+        char *sep = memchr(line, INTCHAR(':'), lineLength);
 
-        if (prefix != NULL) {
-            Tcl_DStringInit(dsPtr);
-            Tcl_DStringAppend(dsPtr, prefix, -1);
-            Tcl_DStringAppend(dsPtr, line, -1);
-            line = dsPtr->string;
-        }
-
-        sep = strchr(line, INTCHAR(':'));
         if (sep == NULL) {
             /*
              * Malformed header.
@@ -696,11 +740,15 @@ Ns_ParseHeader(Ns_Set *set, const char *line, const char *prefix, Ns_HeaderCaseD
             const char *value;
             char       *key;
 
-            *sep = '\0';
-            for (value = sep + 1; (*value != '\0') && CHARTYPE(space, *value) != 0; value++) {
+            for (value = sep + 1; (value < end) && CHARTYPE(space, *value) != 0; value++) {
                 ;
             }
-            idx = Ns_SetPutSz(set, line, sep-line, value, -1);
+            *sep = '\0';
+            if (slice) {
+                idx = NsSetPutSlice(set, line, (char *)value);
+            } else {
+                idx = Ns_SetPutSz(set, line, sep-line, value, end - value);
+            }
             key = Ns_SetKey(set, idx);
             if (disp == ToLower) {
                 while (*key != '\0') {
@@ -717,11 +765,9 @@ Ns_ParseHeader(Ns_Set *set, const char *line, const char *prefix, Ns_HeaderCaseD
                     ++key;
                 }
             }
-            *sep = ':';
-        }
-
-        if (prefix != NULL) {
-            Tcl_DStringFree(dsPtr);
+            if (!slice) {
+                *sep = ':';
+            }
         }
     }
 
@@ -731,7 +777,7 @@ Ns_ParseHeader(Ns_Set *set, const char *line, const char *prefix, Ns_HeaderCaseD
     return status;
 }
 
-
+
 /*
  *----------------------------------------------------------------------
  *
@@ -1026,23 +1026,20 @@ ReturnRange(Ns_Conn *conn, const char *mimeType,
 
             }
         } else if (fd != NS_INVALID_FD && rangeCount < 2) {
-            if (rangeCount == 1) {
-                if (ns_lseek(fd, bufs[0].offset, SEEK_SET) == -1) {
-
-                    /*
-                     * TODO:
-                     * What is with error string on Windows?
-                     */
+            Ns_ReturnCode status;
 
-                    Ns_Log(Warning, "seek operation with offset %" PROTd
-                           " failed: %s", bufs[0].offset, strerror(errno));
-                    Ns_DStringFree(&ds);
-                    return NS_ERROR;
-                }
-                dataLength = bufs[0].length;
+            /*
+             * Pass a single range as Ns_FileVec rather than seeking on the
+             * fd, since the fd might be shared (e.g. fastpath fd cache).
+             */
+            if (rangeCount == 1) {
+                status = NsWriterQueue(conn, bufs[0].length, NULL, NULL, NS_INVALID_FD,
+                                       NULL, 0, bufs, 1, NS_FALSE);
+            } else {
+                status = NsWriterQueue(conn, dataLength, NULL, NULL, fd, NULL, 0, NULL, 0,
+                                       NS_FALSE);
             }
-            if (NsWriterQueue(conn, dataLength, NULL, NULL, fd, NULL, 0, NULL, 0,
-                              NS_FALSE) == NS_OK) {
+            if (status == NS_OK) {
                 Ns_DStringFree(&ds);
                 return NS_OK;
             }
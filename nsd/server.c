@@ -460,9 +460,35 @@ CreatePool(NsServer *servPtr, const char *pool)
     Ns_ConfigTimeUnitRange(section, "threadtimeout", "2m", 0, 0, INT_MAX, 0,
                            &poolPtr->threads.timeout);
 
+    /*
+     * Latency-driven autoscaling: size the pool between minthreads and
+     * maxthreads such that the p95 queue delay stays below the target.
+     */
+    Ns_ConfigTimeUnitRange(section, "autoscaletarget", "0s", 0, 0, INT_MAX, 0,
+                           &poolPtr->threads.autoscale.target);
+    Ns_ConfigTimeUnitRange(section, "autoscaleinterval", "1s", 0, 1000, INT_MAX, 0,
+                           &poolPtr->threads.autoscale.interval);
+    Ns_GetTime(&poolPtr->threads.autoscale.intervalEnd);
+    Ns_IncrTime(&poolPtr->threads.autoscale.intervalEnd,
+                poolPtr->threads.autoscale.interval.sec, poolPtr->threads.autoscale.interval.usec);
+
     poolPtr->wqueue.rejectoverrun = Ns_ConfigBool(section, "rejectoverrun", NS_FALSE);
     Ns_ConfigTimeUnitRange(section, "retryafter", "5s", 0, 0, INT_MAX, 0,
                            &poolPtr->wqueue.retryafter);
+    Ns_ConfigTimeUnitRange(section, "queuedelaytarget", "0s", 0, 0, INT_MAX, 0,
+                           &poolPtr->wqueue.delay.target);
+    Ns_ConfigTimeUnitRange(section, "queuedelayinterval", "100ms", 0, 1000, INT_MAX, 0,
+                           &poolPtr->wqueue.delay.interval);
+    NsConfigFairQueue(poolPtr, section);
+
+    /*
+     * CPU affinity of the connection threads: a CPU set (such as "0-7") or
+     * "driver" for following the driver thread queuing the request.
+     */
+    poolPtr->threads.cpus = Ns_ConfigString(section, "cpuaffinity", NULL);
+    if (poolPtr->threads.cpus != NULL && *poolPtr->threads.cpus == '\0') {
+        poolPtr->threads.cpus = NULL;
+    }
 
     poolPtr->rate.defaultConnectionLimit =
         Ns_ConfigIntRange(section, "connectionratelimit", -1, -1, INT_MAX);
@@ -472,9 +498,8 @@ CreatePool(NsServer *servPtr, const char *pool)
     if (poolPtr->rate.poolLimit != -1) {
         NsWriterBandwidthManagement = NS_TRUE;
     }
-    for (n = 0; n < maxconns - 1; ++n) {
+    for (n = 0; n < maxconns; ++n) {
         connPtr = &connBufPtr[n];
-        connPtr->nextPtr = &connBufPtr[n+1];
         if (servPtr->compress.enable
             && servPtr->compress.preinit) {
             (void) Ns_CompressInit(&connPtr->cStream);
@@ -482,9 +507,6 @@ CreatePool(NsServer *servPtr, const char *pool)
         connPtr->rateLimit = poolPtr->rate.defaultConnectionLimit;
     }
 
-    connBufPtr[n].nextPtr = NULL;
-    poolPtr->wqueue.freePtr = &connBufPtr[0];
-
     queueLength = maxconns - poolPtr->threads.max;
 
     highwatermark = Ns_ConfigIntRange(section, "highwatermark", 80, 0, 100);
@@ -534,6 +556,15 @@ CreatePool(NsServer *servPtr, const char *pool)
         Ns_MutexInit(&poolPtr->wqueue.lock);
         Ns_MutexSetName2(&poolPtr->wqueue.lock, ds.string, "wqueue");
 
+        /*
+         * Both rings can hold all connections of the pool.
+         */
+        NsConnRingInit(&poolPtr->wqueue.free, maxconns, ds.string, "free");
+        NsConnRingInit(&poolPtr->wqueue.wait.ring, maxconns, ds.string, "wait");
+        for (j = 0; j < maxconns; j++) {
+            (void) NsConnRingPush(&poolPtr->wqueue.free, &connBufPtr[j]);
+        }
+
         Ns_MutexInit(&poolPtr->threads.lock);
         Ns_MutexSetName2(&poolPtr->threads.lock, ds.string, "threads");
 
@@ -49,7 +49,7 @@ typedef int (*SetFindProc)(const Ns_Set *set, const char *key);
 static void SetMerge(Ns_Set *high, const Ns_Set *low, SetFindProc findProc)
     NS_GNUC_NONNULL(1) NS_GNUC_NONNULL(2);
 
-static void SetCopyElements(const char*msg, const Ns_Set *from, Ns_Set *const to)
+static void SetCopyElements(const char*msg, Ns_Set *from, Ns_Set *const to)
     NS_GNUC_NONNULL(1) NS_GNUC_NONNULL(2);
 
 static const char *SetGetValueCmp(const Ns_Set *set, const char *key, const char *def, StringCmpProc cmp)
@@ -57,11 +57,55 @@ static const char *SetGetValueCmp(const Ns_Set *set, const char *key, const char
 
 static Ns_Set *SetCreate(const char *name, size_t size);
 
+static unsigned int SetKeyHash(const char *key)
+    NS_GNUC_NONNULL(1) NS_GNUC_PURE;
+static void SetIndexBuild(Ns_Set *set)
+    NS_GNUC_NONNULL(1);
+static void SetIndexAdd(Ns_Set *set, size_t index)
+    NS_GNUC_NONNULL(1);
+static void SetIndexUpdate(Ns_Set *set)
+    NS_GNUC_NONNULL(1);
+static void SetIndexFree(Ns_Set *set)
+    NS_GNUC_NONNULL(1);
+static int SetIndexFind(const Ns_Set *set, const char *key, StringCmpProc cmp, bool unique)
+    NS_GNUC_NONNULL(1) NS_GNUC_NONNULL(2) NS_GNUC_NONNULL(3);
+
+/*
+ * Sets with at least NS_SET_INDEX_THRESHOLD tuples maintain a hash index over
+ * their keys. Smaller sets are searched linearly, which is faster for the
+ * typical sizes of e.g. request headers.
+ */
+#define NS_SET_INDEX_THRESHOLD 32u
+
+/*
+ * The index hashes the keys case-insensitively, such that the same index
+ * serves case-sensitive and case-insensitive lookups and stays valid when
+ * the case of a key is changed in place (e.g. via the "hdrcase"
+ * option). Every bucket contains a chain of the tuple indices in ascending
+ * order, so the first match is the same as in a linear search.
+ */
+struct Ns_SetIndex {
+    size_t nBuckets;  /* Number of buckets (power of two), at least the number of tuples */
+    int   *heads;     /* Per bucket: first tuple index or -1 */
+    int   *tails;     /* Per bucket: last tuple index or -1 */
+    int   *next;      /* Per tuple: next tuple index in the same bucket or -1 */
+};
+
 #ifdef NS_SET_DSTRING
 static void ShiftData(Ns_Set *set, const char *oldDataStart)
     NS_GNUC_NONNULL(1) NS_GNUC_NONNULL(2);
 static char *AppendData(Ns_Set *set, size_t index, const char *value, ssize_t valueSize)
     NS_GNUC_NONNULL(1);
+#else
+static void SetFreeField(const Ns_Set *set, size_t index)
+    NS_GNUC_NONNULL(1);
+
+/*
+ * Check, whether a string is owned by the set, or whether it is a slice into
+ * a memory region managed by someone else (see NsSetPutSlice()).
+ */
+# define SetOwnsString(set, string) \
+    ((uintptr_t)(string) < (uintptr_t)(set)->sliceStart || (uintptr_t)(string) >= (uintptr_t)(set)->sliceEnd)
 #endif
 
 #if defined(NS_SET_DEBUG)
@@ -270,6 +314,246 @@ AppendData(Ns_Set *set, size_t index, const char *value, ssize_t valueSize)
 }
 #endif
 
+#ifndef NS_SET_DSTRING
+/*
+ *----------------------------------------------------------------------
+ *
+ * SetFreeField --
+ *
+ *      Free the key and value of a tuple, unless these are slices of a
+ *      memory region not owned by the set.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------
+ */
+static void
+SetFreeField(const Ns_Set *set, size_t index)
+{
+    if (SetOwnsString(set, set->fields[index].name)) {
+        ns_free(set->fields[index].name);
+    }
+    if (SetOwnsString(set, set->fields[index].value)) {
+        ns_free(set->fields[index].value);
+    }
+}
+#endif
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * SetKeyHash --
+ *
+ *      Compute a case-insensitive hash value for a key.
+ *
+ * Results:
+ *      Hash value.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------
+ */
+static unsigned int
+SetKeyHash(const char *key)
+{
+    unsigned int hash = 2166136261u;
+
+    for (; *key != '\0'; key++) {
+        hash ^= (unsigned int)tolower(UCHAR(*key));
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * SetIndexBuild --
+ *
+ *      (Re)build the hash index of a set from scratch. The number of
+ *      buckets is chosen such that the index can grow by the same number
+ *      of tuples without being rebuilt.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      Memory for the index is (re)allocated.
+ *
+ *----------------------------------------------------------------------
+ */
+static void
+SetIndexBuild(Ns_Set *set)
+{
+    struct Ns_SetIndex *indexPtr = set->index;
+    size_t              i, nBuckets = 64u;
+
+    while (nBuckets < set->size * 2u) {
+        nBuckets *= 2u;
+    }
+    if (indexPtr == NULL || indexPtr->nBuckets != nBuckets) {
+        ns_free(indexPtr);
+        indexPtr = ns_malloc(sizeof(struct Ns_SetIndex) + 3u * nBuckets * sizeof(int));
+        indexPtr->nBuckets = nBuckets;
+        indexPtr->heads = (int *)(indexPtr + 1);
+        indexPtr->tails = indexPtr->heads + nBuckets;
+        indexPtr->next = indexPtr->tails + nBuckets;
+        set->index = indexPtr;
+    }
+    memset(indexPtr->heads, 0xff, 2u * nBuckets * sizeof(int));
+
+    for (i = 0u; i < set->size; i++) {
+        SetIndexAdd(set, i);
+    }
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * SetIndexAdd --
+ *
+ *      Add the tuple with the given index, which has to be the last tuple
+ *      of the set, to the hash index. When the set has no index yet, the
+ *      index is created as soon as the set reaches the size threshold.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      Potentially (re)allocation of the index.
+ *
+ *----------------------------------------------------------------------
+ */
+static void
+SetIndexAdd(Ns_Set *set, size_t index)
+{
+    struct Ns_SetIndex *indexPtr = set->index;
+
+    if (indexPtr == NULL) {
+        if (set->size >= NS_SET_INDEX_THRESHOLD) {
+            SetIndexBuild(set);
+        }
+    } else if (index >= indexPtr->nBuckets) {
+        SetIndexBuild(set);
+    } else {
+        size_t bucket = (size_t)SetKeyHash(set->fields[index].name) & (indexPtr->nBuckets - 1u);
+
+        indexPtr->next[index] = -1;
+        if (indexPtr->tails[bucket] == -1) {
+            indexPtr->heads[bucket] = (int)index;
+        } else {
+            indexPtr->next[indexPtr->tails[bucket]] = (int)index;
+        }
+        indexPtr->tails[bucket] = (int)index;
+    }
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * SetIndexUpdate --
+ *
+ *      Bring the hash index in sync with the set after tuples were
+ *      removed. Sets which became smaller than the threshold lose their
+ *      index.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      Potentially (re)allocation or freeing of the index.
+ *
+ *----------------------------------------------------------------------
+ */
+static void
+SetIndexUpdate(Ns_Set *set)
+{
+    if (set->index != NULL) {
+        if (set->size < NS_SET_INDEX_THRESHOLD) {
+            SetIndexFree(set);
+        } else {
+            SetIndexBuild(set);
+        }
+    }
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * SetIndexFree --
+ *
+ *      Free the hash index of a set, if there is one.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      Memory is freed.
+ *
+ *----------------------------------------------------------------------
+ */
+static void
+SetIndexFree(Ns_Set *set)
+{
+    if (set->index != NULL) {
+        ns_free(set->index);
+        set->index = NULL;
+    }
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * SetIndexFind --
+ *
+ *      Lookup a key via the hash index of the set. The comparison function
+ *      must be strcmp() or strcasecmp(). When "unique" is true, the search
+ *      continues after the first match to check for a second one.
+ *
+ * Results:
+ *      Index of the first matching tuple or -1 if no matches. When "unique"
+ *      is true, -2 is returned when multiple keys match.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------
+ */
+static int
+SetIndexFind(const Ns_Set *set, const char *key, StringCmpProc cmp, bool unique)
+{
+    const struct Ns_SetIndex *indexPtr = set->index;
+    int                       i, result = -1;
+
+    i = indexPtr->heads[(size_t)SetKeyHash(key) & (indexPtr->nBuckets - 1u)];
+    while (i != -1) {
+        if ((*cmp)(key, set->fields[i].name) == 0) {
+            if (result == -1) {
+                result = i;
+                if (!unique) {
+                    break;
+                }
+            } else {
+                result = -2;
+                break;
+            }
+        }
+        i = indexPtr->next[i];
+    }
+    return result;
+}
+
+
 /*
  *----------------------------------------------------------------------
  *
@@ -341,7 +625,11 @@ SetCreate(const char *name, size_t size)
     setPtr->fields = ns_malloc(sizeof(Ns_SetField) * setPtr->maxSize);
 #ifdef NS_SET_DSTRING
     Tcl_DStringInit(&setPtr->data);
+#else
+    setPtr->sliceStart = NULL;
+    setPtr->sliceEnd = NULL;
 #endif
+    setPtr->index = NULL;
 
 #ifdef NS_SET_DEBUG
     Ns_Log(Notice, "SetCreate %p '%s': size %ld/%ld (created %ld)",
@@ -404,10 +692,10 @@ Ns_SetFree(Ns_Set *set)
             Ns_Log(Ns_LogNsSetDebug, "... %ld: key <%s> value <%s>",
                    i, set->fields[i].name, set->fields[i].value);
 
-            ns_free(set->fields[i].name);
-            ns_free(set->fields[i].value);
+            SetFreeField(set, i);
         }
 #endif
+        SetIndexFree(set);
         ns_free(set->fields);
         ns_free((char *)set->name);
         ns_free(set);
@@ -460,6 +748,7 @@ Ns_SetPutSz(Ns_Set *set, const char *keyString, ssize_t keyLength, const char *v
     set->fields[idx].name = ns_strncopy(keyString, keyLength);
     set->fields[idx].value = ns_strncopy(valueString, valueLength);
 #endif
+    SetIndexAdd(set, idx);
     Ns_Log(Ns_LogNsSetDebug, "Ns_SetPut %p [%lu] key '%s' value '%s' size %ld",
            (void*)set, idx, set->fields[idx].name, set->fields[idx].value, valueLength);
     return idx;
@@ -473,6 +762,148 @@ Ns_SetPut(Ns_Set *set, const char *key, const char *value)
 
     return Ns_SetPutSz(set, key, -1, value, -1);
 }
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * NsSetSliceRegion --
+ *
+ *      Define the memory region, into which the set may point via
+ *      NsSetPutSlice(), e.g. the buffer of a request. When the buffer was
+ *      reallocated, the function has to be called again with the new
+ *      address to adjust the slices.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      Potentially updated addresses of keys and values.
+ *
+ *----------------------------------------------------------------------
+ */
+
+void
+NsSetSliceRegion(Ns_Set *set, const char *start, size_t length)
+{
+    NS_NONNULL_ASSERT(set != NULL);
+    NS_NONNULL_ASSERT(start != NULL);
+
+#ifdef NS_SET_DSTRING
+    (void)length;
+#else
+    if (set->sliceStart != NULL && set->sliceStart != start) {
+        ptrdiff_t shift = start - set->sliceStart;
+        size_t    i;
+
+        Ns_Log(Ns_LogNsSetDebug, "NsSetSliceRegion %p '%s': shift %lu elements",
+               (void*)set, set->name, set->size);
+
+        for (i = 0u; i < set->size; i++) {
+            if (!SetOwnsString(set, set->fields[i].name)) {
+                set->fields[i].name += shift;
+            }
+            if (set->fields[i].value != NULL && !SetOwnsString(set, set->fields[i].value)) {
+                set->fields[i].value += shift;
+            }
+        }
+    }
+    set->sliceStart = start;
+    set->sliceEnd = start + length;
+#endif
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * NsSetPutSlice --
+ *
+ *      Insert (add) a tuple into an existing set without copying the key
+ *      and the value. Both strings have to be NUL terminated and located in
+ *      the memory region registered via NsSetSliceRegion(). The strings are
+ *      only copied when the value is modified or when the region is released
+ *      via NsSetSlicesMaterialize().
+ *
+ * Results:
+ *      The index number of the new tuple.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+size_t
+NsSetPutSlice(Ns_Set *set, char *key, char *value)
+{
+    size_t idx;
+
+    NS_NONNULL_ASSERT(set != NULL);
+    NS_NONNULL_ASSERT(key != NULL);
+    NS_NONNULL_ASSERT(value != NULL);
+
+#ifdef NS_SET_DSTRING
+    idx = Ns_SetPutSz(set, key, -1, value, -1);
+#else
+    assert(!SetOwnsString(set, key));
+    assert(!SetOwnsString(set, value));
+
+    idx = set->size;
+    set->size++;
+    if (set->size >= set->maxSize) {
+        set->maxSize = set->size * 2u;
+        set->fields = ns_realloc(set->fields, sizeof(Ns_SetField) * set->maxSize);
+    }
+    set->fields[idx].name = key;
+    set->fields[idx].value = value;
+    SetIndexAdd(set, idx);
+#endif
+    return idx;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * NsSetSlicesMaterialize --
+ *
+ *      Copy all keys and values pointing to the memory region registered
+ *      via NsSetSliceRegion() and release the region. This function has to
+ *      be called, before the region is freed or reused while the set is
+ *      still in use.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      Memory is allocated for the copied strings.
+ *
+ *----------------------------------------------------------------------
+ */
+
+void
+NsSetSlicesMaterialize(Ns_Set *set)
+{
+    NS_NONNULL_ASSERT(set != NULL);
+
+#ifndef NS_SET_DSTRING
+    if (set->sliceStart != NULL) {
+        size_t i;
+
+        for (i = 0u; i < set->size; i++) {
+            if (!SetOwnsString(set, set->fields[i].name)) {
+                set->fields[i].name = ns_strdup(set->fields[i].name);
+            }
+            if (set->fields[i].value != NULL && !SetOwnsString(set, set->fields[i].value)) {
+                set->fields[i].value = ns_strdup(set->fields[i].value);
+            }
+        }
+        set->sliceStart = NULL;
+        set->sliceEnd = NULL;
+    }
+#endif
+}
 
 /*
  *----------------------------------------------------------------------
@@ -502,17 +933,22 @@ Ns_SetUniqueCmp(const Ns_Set *set, const char *key, StringCmpProc cmp)
     NS_NONNULL_ASSERT(key != NULL);
     NS_NONNULL_ASSERT(cmp != NULL);
 
-    found = NS_FALSE;
-    for (i = 0u; i < set->size; ++i) {
-        const char *name = set->fields[i].name;
+    if (set->index != NULL && (cmp == strcmp || cmp == strcasecmp)) {
+        result = (SetIndexFind(set, key, cmp, NS_TRUE) != -2);
+
+    } else {
+        found = NS_FALSE;
+        for (i = 0u; i < set->size; ++i) {
+            const char *name = set->fields[i].name;
 
-        if ((name == NULL) || (((*cmp) (key, name)) == 0)) {
+            if ((name == NULL) || (((*cmp) (key, name)) == 0)) {
 
-            if (found) {
-                result = NS_FALSE;
-                break;
+                if (found) {
+                    result = NS_FALSE;
+                    break;
+                }
+                found = NS_TRUE;
             }
-            found = NS_TRUE;
         }
     }
 
@@ -547,13 +983,18 @@ Ns_SetFindCmp(const Ns_Set *set, const char *key, StringCmpProc cmp)
     NS_NONNULL_ASSERT(key != NULL);
     NS_NONNULL_ASSERT(cmp != NULL);
 
-    for (i = 0u; i < set->size; i++) {
-        const char *name = set->fields[i].name;
+    if (set->index != NULL && (cmp == strcmp || cmp == strcasecmp)) {
+        result = SetIndexFind(set, key, cmp, NS_FALSE);
 
-        assert(name != NULL);
-        if (((*cmp) (key, name)) == 0) {
-            result = (int)i;
-            break;
+    } else {
+        for (i = 0u; i < set->size; i++) {
+            const char *name = set->fields[i].name;
+
+            assert(name != NULL);
+            if (((*cmp) (key, name)) == 0) {
+                result = (int)i;
+                break;
+            }
         }
     }
 
@@ -867,12 +1308,18 @@ Ns_SetTrunc(Ns_Set *set, size_t size)
 #else
         size_t idx;
         for (idx = size; idx < set->size; idx++) {
-            ns_free(set->fields[idx].name);
-            ns_free(set->fields[idx].value);
+            SetFreeField(set, idx);
         }
 #endif
         set->size = size;
+        SetIndexUpdate(set);
     }
+#ifndef NS_SET_DSTRING
+    if (size == 0u) {
+        set->sliceStart = NULL;
+        set->sliceEnd = NULL;
+    }
+#endif
 }
 
 
@@ -911,14 +1358,17 @@ Ns_SetDelete(Ns_Set *set, int index)
          * Tcl_DString.
          */
 #else
-        ns_free(set->fields[index].name);
-        ns_free(set->fields[index].value);
+        SetFreeField(set, (size_t)index);
 #endif
         --set->size;
         for (i = (size_t)index; i < set->size; ++i) {
             set->fields[i].name = set->fields[i + 1u].name;
             set->fields[i].value = set->fields[i + 1u].value;
         }
+        /*
+         * The positions of the following tuples have changed.
+         */
+        SetIndexUpdate(set);
     }
 }
 
@@ -997,7 +1447,9 @@ Ns_SetPutValueSz(Ns_Set *set, size_t index, const char *value, ssize_t size)
         }
 #else
         if (set->fields[index].value != value) {
-            ns_free(set->fields[index].value);
+            if (SetOwnsString(set, set->fields[index].value)) {
+                ns_free(set->fields[index].value);
+            }
             set->fields[index].value = ns_strncopy(value, size);
         } else {
             Ns_Log(Notice, "Ns_SetPutValueSz %p: old value is the same as the new value: '%s'", (void*)set, value);
@@ -1091,7 +1543,9 @@ void Ns_SetClearValues(Ns_Set *set, int maxAlloc)
 #else
     (void)maxAlloc;
     for (i = 0u; i < set->size; ++i) {
-        ns_free(set->fields[i].value);
+        if (SetOwnsString(set, set->fields[i].value)) {
+            ns_free(set->fields[i].value);
+        }
         set->fields[i].value = NULL;
     }
 #endif
@@ -1515,7 +1969,11 @@ Ns_SetRecreate(Ns_Set *set)
     newSet->fields = ns_malloc(sizeof(Ns_SetField) * newSet->maxSize);
 #ifdef NS_SET_DSTRING
     Tcl_DStringInit(&newSet->data);
+#else
+    newSet->sliceStart = NULL;
+    newSet->sliceEnd = NULL;
 #endif
+    newSet->index = NULL;
     SetCopyElements("recreate", set, newSet);
     set->size = 0u;
 #ifdef NS_SET_DSTRING
@@ -1543,7 +2001,7 @@ Ns_SetRecreate(Ns_Set *set)
  *----------------------------------------------------------------------
  */
 static void
-SetCopyElements(const char* msg, const Ns_Set *from, Ns_Set *const to)
+SetCopyElements(const char* msg, Ns_Set *from, Ns_Set *const to)
 {
     size_t i;
 
@@ -1552,15 +2010,30 @@ SetCopyElements(const char* msg, const Ns_Set *from, Ns_Set *const to)
            msg, (void*)from, from->name, from->size, (void*)from, (void*)to);
 
     to->size = 0u;
+    SetIndexFree(to);
     for (i = 0u; i < from->size; i++) {
         Ns_SetPutSz(to, from->fields[i].name, -1, from->fields[i].value, -1);
     }
+    SetIndexFree(from);
 #else
     (void)msg;
     for (i = 0u; i < from->size; i++) {
         to->fields[i].name  = from->fields[i].name;
         to->fields[i].value = from->fields[i].value;
     }
+    /*
+     * The slices are handed over together with the fields.
+     */
+    to->sliceStart = from->sliceStart;
+    to->sliceEnd = from->sliceEnd;
+    from->sliceStart = NULL;
+    from->sliceEnd = NULL;
+    /*
+     * The same holds for the index.
+     */
+    SetIndexFree(to);
+    to->index = from->index;
+    from->index = NULL;
 #endif
 }
 
@@ -1610,7 +2083,11 @@ Ns_SetRecreate2(Ns_Set **toPtr, Ns_Set *from)
         newSet->fields = ns_malloc(sizeof(Ns_SetField) * newSet->maxSize);
 #ifdef NS_SET_DSTRING
         Tcl_DStringInit(&newSet->data);
+#else
+        newSet->sliceStart = NULL;
+        newSet->sliceEnd = NULL;
 #endif
+        newSet->index = NULL;
     } else {
         newSet = *toPtr;
         /*
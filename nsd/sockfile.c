@@ -46,11 +46,6 @@
 #include <sys/sendfile.h>
 #endif
 
-#ifdef _WIN32
-#include <io.h>
-static ssize_t pread(int fd, char *buf, size_t count, off_t offset);
-#endif
-
 /*
  * Local functions defined in this file
  */
@@ -431,7 +426,7 @@ ns_sendfile(Ns_Sock *sock, int fd, off_t offset, size_t length)
     while (toread > 0) {
         ssize_t nread, sent;
 
-        nread = pread(fd, buf, MIN((size_t)toread, sizeof(buf)), offset);
+        nread = ns_pread(fd, buf, MIN((size_t)toread, sizeof(buf)), offset);
 
         if (nread <= 0) {
             nwrote = -1;
@@ -464,48 +459,6 @@ ns_sendfile(Ns_Sock *sock, int fd, off_t offset, size_t length)
 
 
 
-/*
- *----------------------------------------------------------------------
- *
- * pread --
- *
- *      The pread() syscall emulation for Windows.
- *
- * Results:
- *      Number of bytes read, -1 on error
- *
- * Side effects:
- *      Advancing the file pointer.
- *
- *----------------------------------------------------------------------
- */
-#ifdef _WIN32
-static ssize_t
-pread(int fd, char *buf, size_t count, off_t offset)
-{
-    HANDLE   fh = (HANDLE)_get_osfhandle(fd);
-    ssize_t  result;
-
-    if (fh == INVALID_HANDLE_VALUE) {
-        errno = EBADF;
-        result = -1;
-    } else {
-        DWORD      ret, c = (DWORD)count;
-        OVERLAPPED overlapped = { 0u };
-
-        overlapped.Offset = (DWORD)offset;
-        overlapped.OffsetHigh = (DWORD)(((uint64_t)offset) >> 32);
-
-        if (ReadFile(fh, buf, c, &ret, &overlapped) == FALSE) {
-            result = -1;
-        } else {
-            result = (ssize_t)ret;
-        }
-    }
-
-    return result;
-}
-#endif /* _WIN32 */
 
 /*
  * Local Variables:
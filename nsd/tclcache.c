@@ -48,6 +48,74 @@ typedef struct TclCache {
     size_t      maxSize;  /* Maximum size of the entire cache. */
 } TclCache;
 
+/*
+ * The following defines a refresh of a stale cache entry running in a
+ * scheduler event thread.
+ */
+
+typedef struct CacheRefresh {
+    TclCache   *cPtr;
+    const char *server;   /* Server of the interpreter for the script. */
+    char       *script;   /* Script computing the new value. */
+    Ns_Time     expires;  /* Value of "-expires", if provided. */
+    bool        haveExpires;
+    char        key[1];
+} CacheRefresh;
+
+/*
+ * The following defines the layout of a cache snapshot file. The file
+ * starts with a SnapshotHeader, followed by one section per cache
+ * consisting of a SnapshotCache header, the NUL-terminated cache name
+ * and the entries. Every entry is a SnapshotEntry followed by the
+ * NUL-terminated key and value. Sections and entries are padded to
+ * SNAPSHOT_ALIGNMENT bytes. Snapshots are written in host byte order
+ * and are only loaded on hosts with the same byte order.
+ */
+
+#define SNAPSHOT_MAGIC      "nscache\0"
+#define SNAPSHOT_VERSION    1u
+#define SNAPSHOT_BYTE_ORDER 0x01020304u
+#define SNAPSHOT_ALIGNMENT  8u
+#define SNAPSHOT_ALIGN(n)   ((((size_t)(n)) + (SNAPSHOT_ALIGNMENT - 1u)) & ~((size_t)SNAPSHOT_ALIGNMENT - 1u))
+
+typedef struct SnapshotHeader {
+    char     magic[8];
+    uint32_t version;
+    uint32_t byteOrder;
+    uint32_t ncaches;
+    uint32_t reserved;
+} SnapshotHeader;
+
+typedef struct SnapshotCache {
+    uint32_t nameLength;
+    uint32_t nentries;
+    uint64_t size;        /* Size of the entries in bytes. */
+} SnapshotCache;
+
+typedef struct SnapshotEntry {
+    int64_t  expiresSec;  /* 0 when the entry does not expire. */
+    int32_t  expiresUsec;
+    int32_t  cost;
+    uint32_t keyLength;
+    uint32_t valueLength;
+} SnapshotEntry;
+
+/*
+ * The following structure is used for writing a snapshot file. Data is
+ * collected in a buffer of SNAPSHOT_BUFSIZE bytes before it is written
+ * to the file, so the memory for saving a snapshot is bounded.
+ */
+
+#define SNAPSHOT_BUFSIZE    (1024 * 1024)
+
+typedef struct SnapshotWriter {
+    int          fd;
+    const char  *fileName;    /* Name of the file, for error messages. */
+    off_t        offset;      /* Number of bytes written to the file. */
+    Tcl_DString  buffer;      /* Data not written so far. */
+    Tcl_DString *errorDsPtr;  /* Error message, non-empty after a failure. */
+} SnapshotWriter;
+
 
 /*
  * Local functions defined in this file
@@ -55,9 +123,17 @@ typedef struct TclCache {
 
 static int CacheAppendObjCmd(ClientData clientData, Tcl_Interp *interp, int objc, Tcl_Obj *const* objv, bool append);
 
-static Ns_Entry *CreateEntry(const NsInterp *itPtr, TclCache *cPtr, const char *key,
-                             int *newPtr, Ns_Time *timeoutPtr, const Ns_CacheTransactionStack *transactionStackPtr)
-    NS_GNUC_NONNULL(1) NS_GNUC_NONNULL(2) NS_GNUC_NONNULL(3) NS_GNUC_NONNULL(4);
+static Ns_Entry *CreateEntry(const NsInterp *itPtr, TclCache *cPtr, Ns_Cache *cache, const char *key,
+                             int *newPtr, Ns_Time *timeoutPtr, const Ns_Time *staleTimePtr,
+                             const Ns_CacheTransactionStack *transactionStackPtr)
+    NS_GNUC_NONNULL(1) NS_GNUC_NONNULL(2) NS_GNUC_NONNULL(3) NS_GNUC_NONNULL(4) NS_GNUC_NONNULL(5);
+
+static bool ScheduleRefresh(const NsInterp *itPtr, TclCache *cPtr, const char *key, const Ns_Time *expPtr,
+                            int nargs, int objc, Tcl_Obj *const* objv)
+    NS_GNUC_NONNULL(1) NS_GNUC_NONNULL(2) NS_GNUC_NONNULL(3) NS_GNUC_NONNULL(7);
+
+static Ns_SchedProc RefreshProc;
+static Ns_SchedProc FreeRefresh;
 
 static void SetEntry(NsInterp *itPtr, TclCache *cPtr, Ns_Entry *entry, Tcl_Obj *valObj, Ns_Time *expPtr, int cost)
     NS_GNUC_NONNULL(1) NS_GNUC_NONNULL(2) NS_GNUC_NONNULL(3) NS_GNUC_NONNULL(4);
@@ -66,7 +142,7 @@ static bool noGlobChars(const char *pattern)
     NS_GNUC_NONNULL(1) NS_GNUC_PURE;
 
 static TclCache *TclCacheCreate(const char *name, size_t maxEntry, size_t maxSize,
-                                const Ns_Time *timeoutPtr, const Ns_Time *expPtr)
+                                const Ns_Time *timeoutPtr, const Ns_Time *expPtr, int nshards)
     NS_GNUC_NONNULL(1) NS_GNUC_RETURNS_NONNULL;
 
 static Tcl_Obj*GetCacheNames(NsServer *servPtr, bool withUncommittedEntries)
@@ -85,8 +161,59 @@ CacheTransactionFinishPop(NsInterp *itPtr, Tcl_Obj *listObj, bool commit, unsign
 
 static int CacheEval(Tcl_Interp *interp, int nargs, int objc, Tcl_Obj *const* objv);
 
+static Ns_Cache **GetKeyShards(Ns_Cache *cache, int nkeys, Tcl_Obj *const* keyv)
+    NS_GNUC_NONNULL(1) NS_GNUC_RETURNS_NONNULL;
+
+static Tcl_Obj *UniqueKeysObj(int nkeys, Tcl_Obj *const* keyv)
+    NS_GNUC_RETURNS_NONNULL;
+
+static void CacheMEvalStore(NsInterp *itPtr, TclCache *cPtr, int nkeys, Tcl_Obj *const* keyv, Tcl_Obj **values,
+                            const bool *reserved, Tcl_Obj *dictObj, Ns_Time *expPtr, int cost)
+    NS_GNUC_NONNULL(1) NS_GNUC_NONNULL(2) NS_GNUC_NONNULL(5) NS_GNUC_NONNULL(6);
+
+static int CacheSnapshotObjCmd(ClientData clientData, Tcl_Interp *interp, int objc, Tcl_Obj *const* objv, bool save);
+static Tcl_ObjCmdProc CacheSnapshotSaveObjCmd;
+static Tcl_ObjCmdProc CacheSnapshotLoadObjCmd;
+static Ns_ShutdownProc CacheSnapshotShutdown;
+
+static bool CacheSnapshotMatch(const char *name, const char **patterns)
+    NS_GNUC_NONNULL(1) NS_GNUC_NONNULL(2) NS_GNUC_PURE;
+
+static bool SnapshotWrite(SnapshotWriter *writerPtr, const void *bytes, size_t length)
+    NS_GNUC_NONNULL(1) NS_GNUC_NONNULL(2);
+
+static bool SnapshotWriteAt(SnapshotWriter *writerPtr, off_t offset, const void *bytes, size_t length)
+    NS_GNUC_NONNULL(1) NS_GNUC_NONNULL(3);
+
+static bool SnapshotWriteFile(SnapshotWriter *writerPtr, const void *bytes, size_t length)
+    NS_GNUC_NONNULL(1) NS_GNUC_NONNULL(2);
+
+static bool SnapshotFlush(SnapshotWriter *writerPtr)
+    NS_GNUC_NONNULL(1);
+
+static bool SnapshotAppendPadding(SnapshotWriter *writerPtr)
+    NS_GNUC_NONNULL(1);
+
+static Ns_ReturnCode CacheSnapshotSave(NsServer *servPtr, const char *fileName, const char **patterns,
+                                       unsigned long *countPtr, Tcl_DString *errorDsPtr)
+    NS_GNUC_NONNULL(1) NS_GNUC_NONNULL(2) NS_GNUC_NONNULL(3) NS_GNUC_NONNULL(4) NS_GNUC_NONNULL(5);
+
+static Ns_ReturnCode CacheSnapshotLoad(NsServer *servPtr, const char *fileName, const char **patterns,
+                                       unsigned long *countPtr, Tcl_DString *errorDsPtr)
+    NS_GNUC_NONNULL(1) NS_GNUC_NONNULL(2) NS_GNUC_NONNULL(3) NS_GNUC_NONNULL(4) NS_GNUC_NONNULL(5);
+
 static Ns_ObjvProc ObjvCache;
 
+/*
+ * Static variables defined in this file.
+ */
+
+static Ns_ObjvTable cachePolicies[] = {
+    {"lru",     (unsigned int)NS_CACHE_POLICY_LRU},
+    {"tinylfu", (unsigned int)NS_CACHE_POLICY_TINYLFU},
+    {NULL,      0u}
+};
+
 
 
 /*
@@ -154,14 +281,14 @@ GetCacheNames(NsServer *servPtr, bool withUncommittedEntries) {
 
 static TclCache *
 TclCacheCreate(const char *name, size_t maxEntry, size_t maxSize,
-               const Ns_Time *timeoutPtr, const Ns_Time *expPtr)
+               const Ns_Time *timeoutPtr, const Ns_Time *expPtr, int nshards)
 {
     TclCache *cPtr;
 
     NS_NONNULL_ASSERT(name != NULL);
 
     cPtr = ns_calloc(1u, sizeof(TclCache));
-    cPtr->cache = Ns_CacheCreateSz(name, TCL_STRING_KEYS, maxSize, ns_free);
+    cPtr->cache = Ns_CacheCreateSharded(name, TCL_STRING_KEYS, maxSize, ns_free, nshards);
     cPtr->maxEntry = maxEntry;
     cPtr->maxSize  = maxSize;
     if (timeoutPtr != NULL) {
@@ -195,14 +322,17 @@ int
 NsTclCacheCreateObjCmd(ClientData clientData, Tcl_Interp *interp, int objc, Tcl_Obj *const* objv)
 {
     char        *name = NULL;
-    int         result = TCL_OK;
+    int         result = TCL_OK, nshards = 1, policy = (int)NS_CACHE_POLICY_LRU;
     Tcl_WideInt maxSize = 0, maxEntry = 0;
     Ns_Time    *timeoutPtr = NULL, *expPtr = NULL;
+    Ns_ObjvValueRange shardsRange = {1, 1024};
 
     Ns_ObjvSpec opts[] = {
         {"-timeout",  Ns_ObjvTime,    &timeoutPtr, NULL},
         {"-expires",  Ns_ObjvTime,    &expPtr,     NULL},
         {"-maxentry", Ns_ObjvMemUnit, &maxEntry,   NULL},
+        {"-shards",   Ns_ObjvInt,     &nshards,    &shardsRange},
+        {"-policy",   Ns_ObjvIndex,   &policy,     cachePolicies},
         {"--",        Ns_ObjvBreak,   NULL,        NULL},
         {NULL, NULL,  NULL, NULL}
     };
@@ -227,7 +357,9 @@ NsTclCacheCreateObjCmd(ClientData clientData, Tcl_Interp *interp, int objc, Tcl_
         Ns_RWLockWrLock(&servPtr->tcl.cachelock);
         hPtr = Tcl_CreateHashEntry(&servPtr->tcl.caches, name, &isNew);
         if (isNew != 0) {
-            TclCache *cPtr = TclCacheCreate(name, (size_t)maxEntry, (size_t)maxSize, timeoutPtr, expPtr);
+            TclCache *cPtr = TclCacheCreate(name, (size_t)maxEntry, (size_t)maxSize,
+                                            timeoutPtr, expPtr, nshards);
+            Ns_CacheSetPolicy(cPtr->cache, (Ns_CachePolicy)policy);
             Tcl_SetHashValue(hPtr, cPtr);
         }
         Ns_RWLockUnlock(&servPtr->tcl.cachelock);
@@ -454,6 +586,12 @@ CacheEval(Tcl_Interp *interp, int nargs, int objc, Tcl_Obj *const* objv)
  *
  *      The -force switch causes an existing valid entry to replaced.
  *
+ *      With -stale, an entry that expired less than the given time ago
+ *      is refreshed by a single caller, while concurrent callers get
+ *      the stale value instead of waiting. With -background, the
+ *      refresh runs in a scheduler event thread and all callers get the
+ *      stale value.
+ *
  * Results:
  *      Tcl result.
  *
@@ -468,14 +606,16 @@ NsTclCacheEvalObjCmd(ClientData clientData, Tcl_Interp *interp, int objc, Tcl_Ob
 {
     TclCache   *cPtr = NULL;
     char       *key = NULL;
-    Ns_Time    *timeoutPtr = NULL, *expPtr = NULL;
-    int         nargs = 0, force = (int)NS_FALSE, status;
+    Ns_Time    *timeoutPtr = NULL, *expPtr = NULL, *stalePtr = NULL;
+    int         nargs = 0, force = (int)NS_FALSE, background = (int)NS_FALSE, status;
 
     Ns_ObjvSpec opts[] = {
-        {"-timeout", Ns_ObjvTime,  &timeoutPtr, NULL},
-        {"-expires", Ns_ObjvTime,  &expPtr,     NULL},
-        {"-force",   Ns_ObjvBool,  &force,      INT2PTR(NS_TRUE)},
-        {"--",       Ns_ObjvBreak, NULL,        NULL},
+        {"-timeout",    Ns_ObjvTime,  &timeoutPtr, NULL},
+        {"-expires",    Ns_ObjvTime,  &expPtr,     NULL},
+        {"-stale",      Ns_ObjvTime,  &stalePtr,   NULL},
+        {"-background", Ns_ObjvBool,  &background, INT2PTR(NS_TRUE)},
+        {"-force",      Ns_ObjvBool,  &force,      INT2PTR(NS_TRUE)},
+        {"--",          Ns_ObjvBreak, NULL,        NULL},
         {NULL, NULL, NULL, NULL}
     };
     Ns_ObjvSpec args[] = {
@@ -496,6 +636,7 @@ NsTclCacheEvalObjCmd(ClientData clientData, Tcl_Interp *interp, int objc, Tcl_Ob
         Ns_Entry                 *entry;
         NsInterp                 *itPtr;
         Ns_CacheTransactionStack *transactionStackPtr;
+        Ns_Cache                 *cache;
         int                       isNew;
 
         assert(clientData != NULL);
@@ -504,6 +645,7 @@ NsTclCacheEvalObjCmd(ClientData clientData, Tcl_Interp *interp, int objc, Tcl_Ob
 
         itPtr = clientData;
         transactionStackPtr = &itPtr->cacheTransactionStack;
+        cache = Ns_CacheGetShard(cPtr->cache, key);
 
         /*
          * CreateEntry waits for ongoing transactions. If it succeeds, it
@@ -511,19 +653,42 @@ NsTclCacheEvalObjCmd(ClientData clientData, Tcl_Interp *interp, int objc, Tcl_Ob
          * provided cache value (isNew == 0) ... which might be from the
          * current transaction.
          */
-        entry = CreateEntry(itPtr, cPtr, key, &isNew, timeoutPtr, transactionStackPtr);
+        entry = CreateEntry(itPtr, cPtr, cache, key, &isNew, timeoutPtr, stalePtr, transactionStackPtr);
 
         if (unlikely(entry == NULL)) {
             status = TCL_ERROR;
 
         } else if (likely(isNew == 0 && force == (int)NS_FALSE)) {
             char    *value = Ns_CacheGetValueT(entry, transactionStackPtr);
-            Tcl_Obj *resultObj = Tcl_NewStringObj(value, (int)Ns_CacheGetSize(entry));
+            Tcl_Obj *resultObj;
+
+            if (unlikely(value == NULL)) {
+                /*
+                 * The entry is being refreshed, return the stale value.
+                 */
+                value = Ns_CacheGetStaleValue(entry);
+            }
+            resultObj = Tcl_NewStringObj(value, (int)Ns_CacheGetSize(entry));
 
             /*
              * We have a value for the cache entry, return it.
              */
-            Ns_CacheUnlock(cPtr->cache);
+            Ns_CacheUnlock(cache);
+            Tcl_SetObjResult(interp, resultObj);
+            status = TCL_OK;
+
+        } else if (isNew != 0
+                   && background == (int)NS_TRUE
+                   && Ns_CacheGetStaleValue(entry) != NULL
+                   && ScheduleRefresh(itPtr, cPtr, key, expPtr, nargs, objc, objv)) {
+            Tcl_Obj *resultObj = Tcl_NewStringObj(Ns_CacheGetStaleValue(entry),
+                                                  (int)Ns_CacheGetSize(entry));
+
+            /*
+             * The entry is refreshed in the background, return the stale
+             * value.
+             */
+            Ns_CacheUnlock(cache);
             Tcl_SetObjResult(interp, resultObj);
             status = TCL_OK;
 
@@ -543,7 +708,7 @@ NsTclCacheEvalObjCmd(ClientData clientData, Tcl_Interp *interp, int objc, Tcl_Ob
             /*
              * Evaluate the cmd to obtain the cache value.
              */
-            Ns_CacheUnlock(cPtr->cache);
+            Ns_CacheUnlock(cache);
 
             Ns_GetTime(&start);
             status = CacheEval(interp, nargs, objc, objv);
@@ -551,7 +716,7 @@ NsTclCacheEvalObjCmd(ClientData clientData, Tcl_Interp *interp, int objc, Tcl_Ob
 
             (void)Ns_DiffTime(&end, &start, &diff);
 
-            Ns_CacheLock(cPtr->cache);
+            Ns_CacheLock(cache);
             {
                 /*
                  * This is just a sanity check, hopefully transitional code.
@@ -559,7 +724,7 @@ NsTclCacheEvalObjCmd(ClientData clientData, Tcl_Interp *interp, int objc, Tcl_Ob
                 Ns_Entry *entry2;
                 int isNew2 = 0;
 
-                entry2 = Ns_CacheCreateEntry(cPtr->cache, key, &isNew2);
+                entry2 = Ns_CacheCreateEntry(cache, key, &isNew2);
                 if (isNew2 != 0) {
                     Ns_Log(Warning, "==== cache %s key %s old entry %p"
                            " different from re-fetched entry %p",
@@ -601,13 +766,182 @@ NsTclCacheEvalObjCmd(ClientData clientData, Tcl_Interp *interp, int objc, Tcl_Ob
                 SetEntry(itPtr, cPtr, entry, resultObj, expPtr,
                          (int)(diff.sec * 1000000 + diff.usec));
             }
-            Ns_CacheBroadcast(cPtr->cache);
-            Ns_CacheUnlock(cPtr->cache);
+            Ns_CacheBroadcast(cache);
+            Ns_CacheUnlock(cache);
         }
     }
     return status;
 }
 
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * ScheduleRefresh --
+ *
+ *      Schedule the refresh of a stale cache entry in a scheduler event
+ *      thread. The refresh evaluates the script of ns_cache_eval in an
+ *      interpreter of the same server.
+ *
+ * Results:
+ *      NS_TRUE, when the refresh was scheduled.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static bool
+ScheduleRefresh(const NsInterp *itPtr, TclCache *cPtr, const char *key, const Ns_Time *expPtr,
+                int nargs, int objc, Tcl_Obj *const* objv)
+{
+    CacheRefresh *refreshPtr;
+    Tcl_Obj      *scriptObj;
+    const char   *script;
+    int           scriptLength, id;
+    size_t        keyLength;
+    Ns_Time       interval = {0, 1000};
+
+    NS_NONNULL_ASSERT(itPtr != NULL);
+    NS_NONNULL_ASSERT(cPtr != NULL);
+    NS_NONNULL_ASSERT(key != NULL);
+    NS_NONNULL_ASSERT(objv != NULL);
+
+    if (nargs == 1) {
+        scriptObj = objv[objc-1];
+    } else {
+        scriptObj = Tcl_NewListObj(nargs, objv + (objc-nargs));
+    }
+    Tcl_IncrRefCount(scriptObj);
+    script = Tcl_GetStringFromObj(scriptObj, &scriptLength);
+
+    keyLength = strlen(key);
+    refreshPtr = ns_malloc(sizeof(CacheRefresh) + keyLength);
+    memcpy(refreshPtr->key, key, keyLength + 1u);
+    refreshPtr->cPtr = cPtr;
+    refreshPtr->server = itPtr->servPtr->server;
+    refreshPtr->script = ns_strncopy(script, (ssize_t)scriptLength);
+    refreshPtr->haveExpires = (expPtr != NULL);
+    if (expPtr != NULL) {
+        refreshPtr->expires = *expPtr;
+    } else {
+        refreshPtr->expires.sec = refreshPtr->expires.usec = 0;
+    }
+    Tcl_DecrRefCount(scriptObj);
+
+    id = Ns_ScheduleProcEx(RefreshProc, refreshPtr, NS_SCHED_ONCE|NS_SCHED_THREAD,
+                           &interval, FreeRefresh);
+    if (id < 0) {
+        /*
+         * The scheduler is shutting down, let the caller refresh.
+         */
+        FreeRefresh(refreshPtr, id);
+    }
+
+    return (id >= 0);
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * RefreshProc --
+ *
+ *      Scheduler callback refreshing a stale cache entry. When the
+ *      script fails, the entry is deleted like in ns_cache_eval.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      Waiting threads are woken up.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+RefreshProc(void *arg, int UNUSED(id))
+{
+    const CacheRefresh *refreshPtr = arg;
+    Ns_Cache           *cache;
+    Ns_Entry           *entry;
+    Tcl_Interp         *interp;
+    Ns_Time             start, end, diff;
+    int                 status = TCL_ERROR;
+
+    cache = Ns_CacheGetShard(refreshPtr->cPtr->cache, refreshPtr->key);
+    interp = Ns_TclAllocateInterp(refreshPtr->server);
+
+    Ns_GetTime(&start);
+    if (interp != NULL) {
+        status = Tcl_EvalEx(interp, refreshPtr->script, -1, 0);
+        if (status == TCL_RETURN) {
+            status = TCL_OK;
+        }
+    } else {
+        Ns_Log(Warning, "ns_cache %s: no interpreter for refreshing key '%s'",
+               Ns_CacheName(refreshPtr->cPtr->cache), refreshPtr->key);
+    }
+    Ns_GetTime(&end);
+    (void)Ns_DiffTime(&end, &start, &diff);
+
+    Ns_CacheLock(cache);
+    /*
+     * The refresh must neither count as hit or miss nor raise the
+     * frequency of the key. When the entry was flushed in the
+     * meantime, the result is dropped.
+     */
+    entry = Ns_CacheLookupEntry(cache, refreshPtr->key);
+    if (entry == NULL) {
+        Ns_Log(Debug, "ns_cache %s: entry '%s' was flushed during refresh",
+               Ns_CacheName(refreshPtr->cPtr->cache), refreshPtr->key);
+    } else if (status == TCL_OK) {
+        Ns_Time expires = refreshPtr->expires;
+
+        SetEntry(NsGetInterpData(interp), refreshPtr->cPtr, entry, Tcl_GetObjResult(interp),
+                 refreshPtr->haveExpires ? &expires : NULL,
+                 (int)(diff.sec * 1000000 + diff.usec));
+    } else {
+        Ns_CacheDeleteEntry(entry);
+    }
+    Ns_CacheBroadcast(cache);
+    Ns_CacheUnlock(cache);
+
+    if (interp != NULL) {
+        if (status != TCL_OK && status != TCL_BREAK && status != TCL_CONTINUE) {
+            (void) Ns_TclLogErrorInfo(interp, "\n(context: ns_cache_eval background refresh)");
+        }
+        Ns_TclDeAllocateInterp(interp);
+    }
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * FreeRefresh --
+ *
+ *      Free the data of a background refresh.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+FreeRefresh(void *arg, int UNUSED(id))
+{
+    CacheRefresh *refreshPtr = arg;
+
+    ns_free(refreshPtr->script);
+    ns_free(refreshPtr);
+}
+
 
 /*
  *----------------------------------------------------------------------
@@ -655,21 +989,22 @@ NsTclCacheIncrObjCmd(ClientData clientData, Tcl_Interp *interp, int objc, Tcl_Ob
         result = TCL_ERROR;
     } else {
         Ns_CacheTransactionStack *transactionStackPtr = &itPtr->cacheTransactionStack;
-        Ns_Entry   *entry = CreateEntry(itPtr, cPtr, key, &isNew, timeoutPtr, transactionStackPtr);
+        Ns_Cache   *cache = Ns_CacheGetShard(cPtr->cache, key);
+        Ns_Entry   *entry = CreateEntry(itPtr, cPtr, cache, key, &isNew, timeoutPtr, NULL, transactionStackPtr);
         int         cur = 0;
 
         if (entry == NULL) {
             result = TCL_ERROR;
         } else if ((isNew == 0)
                    && (Tcl_GetInt(interp, Ns_CacheGetValueT(entry, transactionStackPtr), &cur) != TCL_OK)) {
-            Ns_CacheUnlock(cPtr->cache);
+            Ns_CacheUnlock(cache);
             result = TCL_ERROR;
         } else {
             Tcl_Obj *valObj = Tcl_NewIntObj(cur + incr);
 
             SetEntry(itPtr, cPtr, entry, valObj, expPtr, 0);
             Tcl_SetObjResult(interp, valObj);
-            Ns_CacheUnlock(cPtr->cache);
+            Ns_CacheUnlock(cache);
             result = TCL_OK;
         }
     }
@@ -736,12 +1071,14 @@ CacheAppendObjCmd(ClientData clientData, Tcl_Interp *interp, int objc, Tcl_Obj *
     } else {
         int                             isNew;
         Ns_Entry                       *entry;
+        Ns_Cache                       *cache;
         const Ns_CacheTransactionStack *transactionStackPtr = &itPtr->cacheTransactionStack;
 
         assert(cPtr != NULL);
         assert(key != NULL);
 
-        entry = CreateEntry(itPtr, cPtr, key, &isNew, timeoutPtr, transactionStackPtr);
+        cache = Ns_CacheGetShard(cPtr->cache, key);
+        entry = CreateEntry(itPtr, cPtr, cache, key, &isNew, timeoutPtr, NULL, transactionStackPtr);
         if (entry == NULL) {
             result = TCL_ERROR;
         } else {
@@ -764,7 +1101,7 @@ CacheAppendObjCmd(ClientData clientData, Tcl_Interp *interp, int objc, Tcl_Obj *
                 SetEntry(itPtr, cPtr, entry, valObj, expPtr, 0);
                 Tcl_SetObjResult(interp, valObj);
             }
-            Ns_CacheUnlock(cPtr->cache);
+            Ns_CacheUnlock(cache);
         }
     }
     return result;
@@ -868,13 +1205,16 @@ NsTclCacheKeysObjCmd(ClientData clientData, Tcl_Interp *interp, int objc, Tcl_Ob
          * cases, or when the option "-exact" is specified, a single hash
          * lookup is sufficient.
          */
+        Ns_Cache *cache;
+
         assert(cPtr != NULL);
-        Ns_CacheLock(cPtr->cache);
-        entry = Ns_CacheFindEntryT(cPtr->cache, pattern, transactionStackPtr);
+        cache = Ns_CacheGetShard(cPtr->cache, pattern);
+        Ns_CacheLock(cache);
+        entry = Ns_CacheFindEntryT(cache, pattern, transactionStackPtr);
         if (entry != NULL && Ns_CacheGetValueT(entry, transactionStackPtr) != NULL) {
             Tcl_ListObjAppendElement(interp, listObj, Tcl_NewStringObj(pattern, -1));
         }
-        Ns_CacheUnlock(cPtr->cache);
+        Ns_CacheUnlock(cache);
         Tcl_SetObjResult(interp, listObj);
 
     } else {
@@ -955,8 +1295,8 @@ NsTclCacheFlushObjCmd(ClientData clientData, Tcl_Interp *interp, int objc, Tcl_O
         assert(cPtr != NULL);
         cache = cPtr->cache;
 
-        Ns_CacheLock(cache);
         if (npatterns == 0) {
+            Ns_CacheLock(cache);
             /*
              * Flush all cache entries.
              */
@@ -978,18 +1318,25 @@ NsTclCacheFlushObjCmd(ClientData clientData, Tcl_Interp *interp, int objc, Tcl_O
                     entry = Ns_CacheNextEntryT(&search, transactionStackPtr);
                 }
             }
+            Ns_CacheUnlock(cache);
 
         } else if (glob == (int)NS_FALSE) {
             /*
-             * Flush the provided entries without glob matching.
+             * Flush the provided entries without glob matching. Only the
+             * shard of the key has to be locked.
              */
 
             for (i = npatterns; i > 0; i--) {
-                entry = Ns_CacheFindEntryT(cache, Tcl_GetString(objv[objc-i]), transactionStackPtr);
+                const char *key = Tcl_GetString(objv[objc-i]);
+                Ns_Cache   *shard = Ns_CacheGetShard(cache, key);
+
+                Ns_CacheLock(shard);
+                entry = Ns_CacheFindEntryT(shard, key, transactionStackPtr);
                 if (entry != NULL && Ns_CacheGetValueT(entry, transactionStackPtr) != NULL) {
                     Ns_CacheFlushEntry(entry);
                     nflushed++;
                 }
+                Ns_CacheUnlock(shard);
             }
 
         } else {
@@ -998,6 +1345,7 @@ NsTclCacheFlushObjCmd(ClientData clientData, Tcl_Interp *interp, int objc, Tcl_O
             /*
              * Flush the provided entries with glob matching.
              */
+            Ns_CacheLock(cache);
             entry = Ns_CacheFirstEntryT(cache, &search, transactionStackPtr);
             while (entry != NULL) {
                 const char *key = Ns_CacheKey(entry);
@@ -1013,8 +1361,8 @@ NsTclCacheFlushObjCmd(ClientData clientData, Tcl_Interp *interp, int objc, Tcl_O
                 }
                 entry = Ns_CacheNextEntryT(&search, transactionStackPtr);
             }
+            Ns_CacheUnlock(cache);
         }
-        Ns_CacheUnlock(cache);
         Tcl_SetObjResult(interp, Tcl_NewIntObj(nflushed));
     }
     return result;
@@ -1061,13 +1409,15 @@ NsTclCacheGetObjCmd(ClientData clientData, Tcl_Interp *interp, int objc, Tcl_Obj
     } else {
         const Ns_Entry  *entry;
         Tcl_Obj         *resultObj;
+        Ns_Cache        *cache;
         const NsInterp  *itPtr = clientData;
         const Ns_CacheTransactionStack *transactionStackPtr = &itPtr->cacheTransactionStack;
 
         assert(cPtr != NULL);
 
-        Ns_CacheLock(cPtr->cache);
-        entry = Ns_CacheFindEntryT(cPtr->cache, key, transactionStackPtr);
+        cache = Ns_CacheGetShard(cPtr->cache, key);
+        Ns_CacheLock(cache);
+        entry = Ns_CacheFindEntryT(cache, key, transactionStackPtr);
         if (entry != NULL) {
             void  *value = Ns_CacheGetValueT(entry, transactionStackPtr);
 
@@ -1079,7 +1429,7 @@ NsTclCacheGetObjCmd(ClientData clientData, Tcl_Interp *interp, int objc, Tcl_Obj
         } else {
             resultObj = NULL;
         }
-        Ns_CacheUnlock(cPtr->cache);
+        Ns_CacheUnlock(cache);
 
         if (unlikely(varNameObj != NULL)) {
             Tcl_SetObjResult(interp, Tcl_NewBooleanObj(resultObj != NULL));
@@ -1104,13 +1454,86 @@ NsTclCacheGetObjCmd(ClientData clientData, Tcl_Interp *interp, int objc, Tcl_Obj
 /*
  *----------------------------------------------------------------------
  *
- * NsTclCacheStatsObjCmd --
+ * GetKeyShards --
  *
- *      Implements "ns_ cache stats".  Returns statistics in form of a
- *      dict from the specified cache. When the switch "-contents" is
- *      provided, entries for all cache entries are returned, containing the
- *      key, size, hits and expire time for each entry in the cache. The
- *      switch "-reset" can be used to reset the cache statistics.
+ *      Determine for every key the shard of the cache holding it. For
+ *      caches without shards, this is the cache itself. The multi-key
+ *      commands process the keys grouped by shard, such that every
+ *      shard is locked only once.
+ *
+ * Results:
+ *      Array of shards, to be freed by the caller.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static Ns_Cache **
+GetKeyShards(Ns_Cache *cache, int nkeys, Tcl_Obj *const* keyv)
+{
+    Ns_Cache **shards;
+    int        i;
+
+    NS_NONNULL_ASSERT(cache != NULL);
+
+    shards = ns_malloc(sizeof(Ns_Cache *) * ((size_t)nkeys + 1u));
+    for (i = 0; i < nkeys; i++) {
+        shards[i] = Ns_CacheGetShard(cache, Tcl_GetString(keyv[i]));
+    }
+    return shards;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * UniqueKeysObj --
+ *
+ *      Build a list of the provided keys without duplicates, keeping
+ *      the order of the first occurrences.
+ *
+ * Results:
+ *      Tcl list object with a reference count of 0.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static Tcl_Obj *
+UniqueKeysObj(int nkeys, Tcl_Obj *const* keyv)
+{
+    Tcl_Obj       *listObj = Tcl_NewListObj(0, NULL);
+    Tcl_HashTable  keys;
+    int            i;
+
+    Tcl_InitHashTable(&keys, TCL_STRING_KEYS);
+    for (i = 0; i < nkeys; i++) {
+        int isNew;
+
+        (void) Tcl_CreateHashEntry(&keys, Tcl_GetString(keyv[i]), &isNew);
+        if (isNew != 0) {
+            (void) Tcl_ListObjAppendElement(NULL, listObj, keyv[i]);
+        }
+    }
+    Tcl_DeleteHashTable(&keys);
+
+    return listObj;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * NsTclCacheMGetObjCmd --
+ *
+ *      Implements "ns_cache_mget". Return a dict with the values of the
+ *      provided keys found in the cache. The keys are looked up under a
+ *      single lock per shard. When the option "-missing" is provided,
+ *      the keys not found are returned in the named variable.
  *
  * Results:
  *      Tcl result.
@@ -1122,74 +1545,92 @@ NsTclCacheGetObjCmd(ClientData clientData, Tcl_Interp *interp, int objc, Tcl_Obj
  */
 
 int
-NsTclCacheStatsObjCmd(ClientData clientData, Tcl_Interp *interp, int objc, Tcl_Obj *const* objv)
+NsTclCacheMGetObjCmd(ClientData clientData, Tcl_Interp *interp, int objc, Tcl_Obj *const* objv)
 {
     TclCache   *cPtr = NULL;
-    int         contents = (int)NS_FALSE, reset = (int)NS_FALSE, result = TCL_OK;
+    Tcl_Obj    *keysObj = NULL, *missingVarObj = NULL;
+    Tcl_Obj   **keyv;
+    int         nkeys, result = TCL_OK;
     Ns_ObjvSpec opts[] = {
-        {"-contents", Ns_ObjvBool,  &contents, INT2PTR(NS_TRUE)},
-        {"-reset",    Ns_ObjvBool,  &reset,    INT2PTR(NS_TRUE)},
-        {"--",        Ns_ObjvBreak, NULL,      NULL},
+        {"-missing", Ns_ObjvObj,   &missingVarObj, NULL},
+        {"--",       Ns_ObjvBreak, NULL,           NULL},
         {NULL, NULL, NULL, NULL}
     };
     Ns_ObjvSpec args[] = {
-        {"cache", ObjvCache, &cPtr, clientData},
+        {"cache", ObjvCache,  &cPtr,    clientData},
+        {"keys",  Ns_ObjvObj, &keysObj, NULL},
         {NULL, NULL, NULL, NULL}
     };
-    args[0].arg = clientData; /* pass non-constant clientData for "cache" */
 
     if (Ns_ParseObjv(opts, args, interp, 1, objc, objv) != NS_OK) {
         result = TCL_ERROR;
 
+    } else if (Tcl_ListObjGetElements(interp, keysObj, &nkeys, &keyv) != TCL_OK) {
+        result = TCL_ERROR;
+
     } else {
-        Ns_DString      ds;
-        Ns_Cache       *cache;
+        const NsInterp *itPtr = clientData;
+        const Ns_CacheTransactionStack *transactionStackPtr = &itPtr->cacheTransactionStack;
+        Ns_Cache      **shards;
+        Tcl_Obj       **values, *dictObj, *missingObj;
+        int             i, j;
 
         assert(cPtr != NULL);
 
-        cache = cPtr->cache;
-        Ns_DStringInit(&ds);
-
-        Ns_CacheLock(cache);
-        if (contents != 0) {
-            Ns_CacheSearch  search;
-            const Ns_Entry *entry;
-
-            entry = Ns_CacheFirstEntry(cache, &search);
-            while (entry != NULL) {
-                Tcl_DString    entryDs;
-                const char    *key     = Ns_CacheKey(entry);
-                size_t         size    = Ns_CacheGetSize(entry);
-                size_t         reuse   = Ns_CacheGetReuse(entry);
-                const Ns_Time *timePtr = Ns_CacheGetExpirey(entry);
+        values = ns_calloc((size_t)nkeys + 1u, sizeof(Tcl_Obj *));
+        shards = GetKeyShards(cPtr->cache, nkeys, keyv);
 
-                Ns_DStringInit(&entryDs);
+        for (i = 0; i < nkeys; i++) {
+            Ns_Cache *cache = shards[i];
 
-                Tcl_DStringAppendElement(&entryDs, key);
-                if (timePtr->usec == 0) {
-                    Ns_DStringPrintf(&entryDs, " %" PRIdz " %" PRIdz " %" PRId64,
-                                     size, reuse, (int64_t) timePtr->sec);
-                } else {
-                    Ns_DStringPrintf(&entryDs, " %" PRIdz " %" PRIdz " %" PRId64 ":%ld",
-                                     size, reuse, (int64_t) timePtr->sec, timePtr->usec);
+            if (cache == NULL) {
+                /*
+                 * Key was already processed together with its shard.
+                 */
+                continue;
+            }
+            Ns_CacheLock(cache);
+            for (j = i; j < nkeys; j++) {
+                if (shards[j] == cache) {
+                    const Ns_Entry *entry;
+
+                    entry = Ns_CacheFindEntryT(cache, Tcl_GetString(keyv[j]), transactionStackPtr);
+                    if (entry != NULL) {
+                        const char *value = Ns_CacheGetValueT(entry, transactionStackPtr);
+
+                        if (value != NULL) {
+                            values[j] = Tcl_NewStringObj(value, -1);
+                        }
+                    }
+                    shards[j] = NULL;
                 }
-                Tcl_DStringAppendElement(&ds, entryDs.string);
-                Ns_DStringFree(&entryDs);
+            }
+            Ns_CacheUnlock(cache);
+        }
+        ns_free((void *)shards);
 
-                entry = Ns_CacheNextEntry(&search);
+        dictObj = Tcl_NewDictObj();
+        missingObj = Tcl_NewListObj(0, NULL);
+        for (i = 0; i < nkeys; i++) {
+            if (values[i] != NULL) {
+                (void) Tcl_DictObjPut(NULL, dictObj, keyv[i], values[i]);
+            } else {
+                (void) Tcl_ListObjAppendElement(NULL, missingObj, keyv[i]);
             }
+        }
+        ns_free((void *)values);
 
+        if (missingVarObj != NULL
+            && Tcl_ObjSetVar2(interp, missingVarObj, NULL, missingObj, TCL_LEAVE_ERR_MSG) == NULL) {
+            Tcl_DecrRefCount(dictObj);
+            result = TCL_ERROR;
         } else {
-            (void) Ns_CacheStats(cache, &ds);
-        }
-        if (reset != 0) {
-            Ns_CacheResetStats(cache);
+            if (missingVarObj == NULL) {
+                Tcl_DecrRefCount(missingObj);
+            }
+            Tcl_SetObjResult(interp, dictObj);
         }
-        Ns_CacheUnlock(cache);
-
-        Tcl_DStringResult(interp, &ds);
     }
-
     return result;
 }
 
@@ -1197,14 +1638,1262 @@ NsTclCacheStatsObjCmd(ClientData clientData, Tcl_Interp *interp, int objc, Tcl_O
 /*
  *----------------------------------------------------------------------
  *
- * CreateEntry --
+ * NsTclCacheMSetObjCmd --
  *
- *      Lock the cache and create a new entry or return existing entry,
- *      waiting up to timeout seconds for another thread to complete
- *      an update.
+ *      Implements "ns_cache_mset". Set the values of all keys of the
+ *      provided dict under a single lock per shard. Concurrent updates
+ *      of the same keys are waited for up to the timeout.
  *
  * Results:
- *      Pointer to entry, or NULL on timeout.
+ *      Tcl result, the number of set keys.
+ *
+ * Side effects:
+ *      Threads waiting for the update of one of the keys are woken up.
+ *
+ *----------------------------------------------------------------------
+ */
+
+int
+NsTclCacheMSetObjCmd(ClientData clientData, Tcl_Interp *interp, int objc, Tcl_Obj *const* objv)
+{
+    NsInterp   *itPtr = clientData;
+    TclCache   *cPtr = NULL;
+    Tcl_Obj    *dictObj = NULL;
+    Tcl_Obj   **elemv;
+    Ns_Time    *timeoutPtr = NULL, *expPtr = NULL;
+    int         nelem, result = TCL_OK;
+    Ns_ObjvSpec opts[] = {
+        {"-timeout", Ns_ObjvTime,  &timeoutPtr, NULL},
+        {"-expires", Ns_ObjvTime,  &expPtr,     NULL},
+        {"--",       Ns_ObjvBreak, NULL,        NULL},
+        {NULL, NULL, NULL, NULL}
+    };
+    Ns_ObjvSpec args[] = {
+        {"cache", ObjvCache,  &cPtr,    clientData},
+        {"dict",  Ns_ObjvObj, &dictObj, NULL},
+        {NULL, NULL, NULL, NULL}
+    };
+
+    NS_NONNULL_ASSERT(clientData != NULL);
+
+    if (Ns_ParseObjv(opts, args, interp, 1, objc, objv) != NS_OK) {
+        result = TCL_ERROR;
+
+    } else if (Tcl_ListObjGetElements(interp, dictObj, &nelem, &elemv) != TCL_OK) {
+        result = TCL_ERROR;
+
+    } else if (nelem % 2 != 0) {
+        Ns_TclPrintfResult(interp, "missing value to go with key");
+        result = TCL_ERROR;
+
+    } else {
+        Ns_CacheTransactionStack *transactionStackPtr = &itPtr->cacheTransactionStack;
+        Ns_Cache                **shards;
+        Tcl_Obj                 **keyv;
+        Ns_Time                   t;
+        int                       nkeys = nelem / 2, i, j, count = 0;
+
+        assert(cPtr != NULL);
+
+        if (timeoutPtr == NULL
+            && (cPtr->timeout.sec > 0 || cPtr->timeout.usec > 0)) {
+            timeoutPtr = Ns_AbsoluteTime(&t, &cPtr->timeout);
+        } else {
+            timeoutPtr = Ns_AbsoluteTime(&t, timeoutPtr);
+        }
+
+        keyv = ns_malloc(sizeof(Tcl_Obj *) * ((size_t)nkeys + 1u));
+        for (i = 0; i < nkeys; i++) {
+            keyv[i] = elemv[i * 2];
+        }
+        shards = GetKeyShards(cPtr->cache, nkeys, keyv);
+
+        for (i = 0; i < nkeys && result == TCL_OK; i++) {
+            Ns_Cache *cache = shards[i];
+
+            if (cache == NULL) {
+                continue;
+            }
+            Ns_CacheLock(cache);
+            for (j = i; j < nkeys; j++) {
+                if (shards[j] == cache) {
+                    const char *key = Tcl_GetString(keyv[j]);
+                    Ns_Entry   *entry;
+                    int         isNew;
+
+                    entry = Ns_CacheWaitCreateEntryT(cache, key, &isNew, timeoutPtr, transactionStackPtr);
+                    if (unlikely(entry == NULL)) {
+                        Tcl_SetErrorCode(interp, "NS_TIMEOUT", (char *)0L);
+                        Ns_TclPrintfResult(interp, "timeout waiting for concurrent update: %s", key);
+                        result = TCL_ERROR;
+                        break;
+                    }
+                    SetEntry(itPtr, cPtr, entry, elemv[j * 2 + 1], expPtr, 0);
+                    shards[j] = NULL;
+                    count++;
+                }
+            }
+            Ns_CacheBroadcast(cache);
+            Ns_CacheUnlock(cache);
+        }
+        ns_free((void *)shards);
+        ns_free((void *)keyv);
+
+        if (result == TCL_OK) {
+            Tcl_SetObjResult(interp, Tcl_NewIntObj(count));
+        }
+    }
+    return result;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * NsTclCacheMEvalObjCmd --
+ *
+ *      Implements "ns_cache_meval". Look up the provided keys in the
+ *      cache under a single lock per shard. When some keys are missing,
+ *      the list of missing keys is stored in the named variable and the
+ *      script is evaluated once for all of them. The script has to
+ *      return a dict with the values of the missing keys, which are
+ *      stored in the cache. Entries for missing keys are created before
+ *      the script is evaluated, such that concurrent ns_cache_eval
+ *      calls for these keys wait for the result.
+ *
+ * Results:
+ *      Tcl result, a dict with the values of all keys for which a value
+ *      is available. Script errors are propagated.
+ *
+ * Side effects:
+ *      Other threads may block waiting for this update to complete.
+ *
+ *----------------------------------------------------------------------
+ */
+
+int
+NsTclCacheMEvalObjCmd(ClientData clientData, Tcl_Interp *interp, int objc, Tcl_Obj *const* objv)
+{
+    NsInterp   *itPtr = clientData;
+    TclCache   *cPtr = NULL;
+    Tcl_Obj    *keysObj = NULL, *varNameObj = NULL, *scriptObj = NULL;
+    Ns_Time    *expPtr = NULL;
+    int         result = TCL_OK;
+    Ns_ObjvSpec opts[] = {
+        {"-expires", Ns_ObjvTime,  &expPtr, NULL},
+        {"--",       Ns_ObjvBreak, NULL,    NULL},
+        {NULL, NULL, NULL, NULL}
+    };
+    Ns_ObjvSpec args[] = {
+        {"cache",   ObjvCache,  &cPtr,       clientData},
+        {"keys",    Ns_ObjvObj, &keysObj,    NULL},
+        {"varName", Ns_ObjvObj, &varNameObj, NULL},
+        {"script",  Ns_ObjvObj, &scriptObj,  NULL},
+        {NULL, NULL, NULL, NULL}
+    };
+
+    NS_NONNULL_ASSERT(clientData != NULL);
+
+    if (Ns_ParseObjv(opts, args, interp, 1, objc, objv) != NS_OK) {
+        result = TCL_ERROR;
+
+    } else {
+        Tcl_Obj **keyv;
+        int       nkeys;
+
+        /*
+         * Operate on a private copy of the keys, since the script might
+         * change the representation of the provided object.
+         */
+        keysObj = Tcl_DuplicateObj(keysObj);
+        Tcl_IncrRefCount(keysObj);
+
+        if (Tcl_ListObjGetElements(interp, keysObj, &nkeys, &keyv) != TCL_OK) {
+            result = TCL_ERROR;
+
+        } else {
+            Ns_CacheTransactionStack *transactionStackPtr = &itPtr->cacheTransactionStack;
+            Tcl_Obj                 **values, *missingObj;
+            bool                     *reserved;
+            int                       nmissing = 0, i, j;
+
+            assert(cPtr != NULL);
+
+            /*
+             * Drop duplicate keys, such that every key is reserved, passed
+             * to the script and counted for the cost only once.
+             */
+            if (nkeys > 1) {
+                Tcl_Obj *uniqueObj = UniqueKeysObj(nkeys, keyv);
+
+                Tcl_IncrRefCount(uniqueObj);
+                Tcl_DecrRefCount(keysObj);
+                keysObj = uniqueObj;
+                (void) Tcl_ListObjGetElements(NULL, keysObj, &nkeys, &keyv);
+            }
+
+            values = ns_calloc((size_t)nkeys + 1u, sizeof(Tcl_Obj *));
+            reserved = ns_calloc((size_t)nkeys + 1u, sizeof(bool));
+
+            if (likely(nsconf.nocache == NS_FALSE)) {
+                Ns_Cache **shards = GetKeyShards(cPtr->cache, nkeys, keyv);
+
+                for (i = 0; i < nkeys; i++) {
+                    Ns_Cache *cache = shards[i];
+
+                    if (cache == NULL) {
+                        continue;
+                    }
+                    Ns_CacheLock(cache);
+                    for (j = i; j < nkeys; j++) {
+                        if (shards[j] == cache) {
+                            const Ns_Entry *entry;
+                            int             isNew;
+
+                            /*
+                             * Don't wait for entries being updated by
+                             * other threads, but compute their values as
+                             * well. Waiting could deadlock with a
+                             * concurrent ns_cache_meval holding entries
+                             * of our keys.
+                             */
+                            entry = Ns_CacheCreateEntry(cache, Tcl_GetString(keyv[j]), &isNew);
+                            if (isNew != 0) {
+                                reserved[j] = NS_TRUE;
+                            } else {
+                                const char *value = Ns_CacheGetValueT(entry, transactionStackPtr);
+
+                                if (value != NULL) {
+                                    values[j] = Tcl_NewStringObj(value, -1);
+                                    Tcl_IncrRefCount(values[j]);
+                                }
+                            }
+                            shards[j] = NULL;
+                        }
+                    }
+                    Ns_CacheUnlock(cache);
+                }
+                ns_free((void *)shards);
+            }
+
+            missingObj = Tcl_NewListObj(0, NULL);
+            Tcl_IncrRefCount(missingObj);
+            for (i = 0; i < nkeys; i++) {
+                if (values[i] == NULL) {
+                    (void) Tcl_ListObjAppendElement(NULL, missingObj, keyv[i]);
+                    nmissing++;
+                }
+            }
+
+            if (nmissing > 0) {
+                Tcl_Obj *resultObj = NULL;
+                int      cost = 0;
+
+                if (Tcl_ObjSetVar2(interp, varNameObj, NULL, missingObj, TCL_LEAVE_ERR_MSG) == NULL) {
+                    result = TCL_ERROR;
+                } else {
+                    Ns_Time start, end, diff;
+                    int     size;
+
+                    Ns_GetTime(&start);
+                    result = Tcl_EvalObjEx(interp, scriptObj, 0);
+                    Ns_GetTime(&end);
+                    (void)Ns_DiffTime(&end, &start, &diff);
+                    cost = (int)((diff.sec * 1000000 + diff.usec) / nmissing);
+
+                    if (result == TCL_RETURN) {
+                        result = TCL_OK;
+                    }
+                    if (result == TCL_OK) {
+                        resultObj = Tcl_GetObjResult(interp);
+                        if (Tcl_DictObjSize(interp, resultObj, &size) != TCL_OK) {
+                            result = TCL_ERROR;
+                            resultObj = NULL;
+                        }
+                    }
+                }
+                CacheMEvalStore(itPtr, cPtr, nkeys, keyv, values, reserved, resultObj, expPtr, cost);
+            }
+
+            if (result == TCL_OK) {
+                Tcl_Obj *dictObj = Tcl_NewDictObj();
+
+                for (i = 0; i < nkeys; i++) {
+                    if (values[i] != NULL) {
+                        (void) Tcl_DictObjPut(NULL, dictObj, keyv[i], values[i]);
+                    }
+                }
+                Tcl_SetObjResult(interp, dictObj);
+            }
+
+            for (i = 0; i < nkeys; i++) {
+                if (values[i] != NULL) {
+                    Tcl_DecrRefCount(values[i]);
+                }
+            }
+            ns_free((void *)values);
+            ns_free((void *)reserved);
+            Tcl_DecrRefCount(missingObj);
+        }
+        Tcl_DecrRefCount(keysObj);
+    }
+    return result;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * CacheMEvalStore --
+ *
+ *      Helper of "ns_cache_meval". Take the values of the missing keys
+ *      from the dict returned by the script and store them in the
+ *      entries reserved for these keys. Reserved entries without a
+ *      value are deleted. When no dict is provided (the script failed),
+ *      all reserved entries are deleted.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      Updates the values array, wakes up threads waiting for the
+ *      reserved entries.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+CacheMEvalStore(NsInterp *itPtr, TclCache *cPtr, int nkeys, Tcl_Obj *const* keyv, Tcl_Obj **values,
+                const bool *reserved, Tcl_Obj *dictObj, Ns_Time *expPtr, int cost)
+{
+    Ns_CacheTransactionStack *transactionStackPtr;
+    Ns_Cache                **shards;
+    int                       i, j;
+
+    NS_NONNULL_ASSERT(itPtr != NULL);
+    NS_NONNULL_ASSERT(cPtr != NULL);
+    NS_NONNULL_ASSERT(values != NULL);
+    NS_NONNULL_ASSERT(reserved != NULL);
+
+    transactionStackPtr = &itPtr->cacheTransactionStack;
+    shards = GetKeyShards(cPtr->cache, nkeys, keyv);
+
+    for (i = 0; i < nkeys; i++) {
+        Ns_Cache *cache = shards[i];
+
+        if (cache == NULL || values[i] != NULL) {
+            /*
+             * Key was already processed, or it was found in the cache.
+             */
+            continue;
+        }
+        Ns_CacheLock(cache);
+        for (j = i; j < nkeys; j++) {
+            if (shards[j] == cache && values[j] == NULL) {
+                Tcl_Obj *valueObj = NULL;
+
+                if (dictObj != NULL) {
+                    (void) Tcl_DictObjGet(NULL, dictObj, keyv[j], &valueObj);
+                }
+                if (reserved[j]) {
+                    Ns_Entry *entry;
+                    int       isNew;
+
+                    entry = Ns_CacheCreateEntry(cache, Tcl_GetString(keyv[j]), &isNew);
+                    if (valueObj != NULL) {
+                        SetEntry(itPtr, cPtr, entry, valueObj, expPtr, cost);
+                    } else if (Ns_CacheGetValueT(entry, transactionStackPtr) == NULL) {
+                        Ns_CacheDeleteEntry(entry);
+                    }
+                }
+                if (valueObj != NULL) {
+                    values[j] = valueObj;
+                    Tcl_IncrRefCount(valueObj);
+                }
+                shards[j] = NULL;
+            }
+        }
+        Ns_CacheBroadcast(cache);
+        Ns_CacheUnlock(cache);
+    }
+    ns_free((void *)shards);
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * NsTclCacheStatsObjCmd --
+ *
+ *      Implements "ns_ cache stats".  Returns statistics in form of a
+ *      dict from the specified cache. When the switch "-contents" is
+ *      provided, entries for all cache entries are returned, containing the
+ *      key, size, hits and expire time for each entry in the cache. The
+ *      switch "-reset" can be used to reset the cache statistics.
+ *
+ * Results:
+ *      Tcl result.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+int
+NsTclCacheStatsObjCmd(ClientData clientData, Tcl_Interp *interp, int objc, Tcl_Obj *const* objv)
+{
+    TclCache   *cPtr = NULL;
+    int         contents = (int)NS_FALSE, reset = (int)NS_FALSE, result = TCL_OK;
+    Ns_ObjvSpec opts[] = {
+        {"-contents", Ns_ObjvBool,  &contents, INT2PTR(NS_TRUE)},
+        {"-reset",    Ns_ObjvBool,  &reset,    INT2PTR(NS_TRUE)},
+        {"--",        Ns_ObjvBreak, NULL,      NULL},
+        {NULL, NULL, NULL, NULL}
+    };
+    Ns_ObjvSpec args[] = {
+        {"cache", ObjvCache, &cPtr, clientData},
+        {NULL, NULL, NULL, NULL}
+    };
+    args[0].arg = clientData; /* pass non-constant clientData for "cache" */
+
+    if (Ns_ParseObjv(opts, args, interp, 1, objc, objv) != NS_OK) {
+        result = TCL_ERROR;
+
+    } else {
+        Ns_DString      ds;
+        Ns_Cache       *cache;
+
+        assert(cPtr != NULL);
+
+        cache = cPtr->cache;
+        Ns_DStringInit(&ds);
+
+        Ns_CacheLock(cache);
+        if (contents != 0) {
+            Ns_CacheSearch  search;
+            const Ns_Entry *entry;
+
+            entry = Ns_CacheFirstEntry(cache, &search);
+            while (entry != NULL) {
+                Tcl_DString    entryDs;
+                const char    *key     = Ns_CacheKey(entry);
+                size_t         size    = Ns_CacheGetSize(entry);
+                size_t         reuse   = Ns_CacheGetReuse(entry);
+                const Ns_Time *timePtr = Ns_CacheGetExpirey(entry);
+
+                Ns_DStringInit(&entryDs);
+
+                Tcl_DStringAppendElement(&entryDs, key);
+                if (timePtr->usec == 0) {
+                    Ns_DStringPrintf(&entryDs, " %" PRIdz " %" PRIdz " %" PRId64,
+                                     size, reuse, (int64_t) timePtr->sec);
+                } else {
+                    Ns_DStringPrintf(&entryDs, " %" PRIdz " %" PRIdz " %" PRId64 ":%ld",
+                                     size, reuse, (int64_t) timePtr->sec, timePtr->usec);
+                }
+                Tcl_DStringAppendElement(&ds, entryDs.string);
+                Ns_DStringFree(&entryDs);
+
+                entry = Ns_CacheNextEntry(&search);
+            }
+
+        } else {
+            (void) Ns_CacheStats(cache, &ds);
+        }
+        if (reset != 0) {
+            Ns_CacheResetStats(cache);
+        }
+        Ns_CacheUnlock(cache);
+
+        Tcl_DStringResult(interp, &ds);
+    }
+
+    return result;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * NsTclCacheSnapshotObjCmd --
+ *
+ *      Implements "ns_cache_snapshot". Save the contents of the caches
+ *      of the server to a snapshot file or load them from it.
+ *
+ * Results:
+ *      Tcl result.
+ *
+ * Side effects:
+ *      Depends on the subcommand.
+ *
+ *----------------------------------------------------------------------
+ */
+
+int
+NsTclCacheSnapshotObjCmd(ClientData clientData, Tcl_Interp *interp, int objc, Tcl_Obj *const* objv)
+{
+    const Ns_SubCmdSpec subcmds[] = {
+        {"load", CacheSnapshotLoadObjCmd},
+        {"save", CacheSnapshotSaveObjCmd},
+        {NULL,   NULL}
+    };
+
+    return Ns_SubcmdObjv(subcmds, clientData, interp, objc, objv);
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * CacheSnapshotSaveObjCmd, CacheSnapshotLoadObjCmd --
+ *
+ *      Implements "ns_cache_snapshot save" and "ns_cache_snapshot
+ *      load". The optional patterns select the caches by name.
+ *
+ * Results:
+ *      Tcl result, the number of saved or loaded entries.
+ *
+ * Side effects:
+ *      Snapshot file is written, or cache entries are added.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+CacheSnapshotSaveObjCmd(ClientData clientData, Tcl_Interp *interp, int objc, Tcl_Obj *const* objv)
+{
+    return CacheSnapshotObjCmd(clientData, interp, objc, objv, NS_TRUE);
+}
+
+static int
+CacheSnapshotLoadObjCmd(ClientData clientData, Tcl_Interp *interp, int objc, Tcl_Obj *const* objv)
+{
+    return CacheSnapshotObjCmd(clientData, interp, objc, objv, NS_FALSE);
+}
+
+static int
+CacheSnapshotObjCmd(ClientData clientData, Tcl_Interp *interp, int objc, Tcl_Obj *const* objv, bool save)
+{
+    char        *fileName = NULL;
+    int          nargs = 0, result = TCL_OK;
+    Ns_ObjvSpec  args[] = {
+        {"filename", Ns_ObjvString, &fileName, NULL},
+        {"?pattern", Ns_ObjvArgs,   &nargs,    NULL},
+        {NULL, NULL, NULL, NULL}
+    };
+
+    if (Ns_ParseObjv(NULL, args, interp, 2, objc, objv) != NS_OK) {
+        result = TCL_ERROR;
+
+    } else {
+        const NsInterp *itPtr = clientData;
+        const char    **patterns;
+        Tcl_DString     errorDs;
+        unsigned long   count = 0u;
+        Ns_ReturnCode   status;
+        int             i;
+
+        /*
+         * Without patterns, all caches are selected.
+         */
+        patterns = ns_calloc((size_t)nargs + 2u, sizeof(char *));
+        if (nargs == 0) {
+            patterns[0] = "*";
+        } else {
+            for (i = 0; i < nargs; i++) {
+                patterns[i] = Tcl_GetString(objv[objc - nargs + i]);
+            }
+        }
+
+        Tcl_DStringInit(&errorDs);
+        if (save) {
+            status = CacheSnapshotSave(itPtr->servPtr, fileName, patterns, &count, &errorDs);
+        } else {
+            status = CacheSnapshotLoad(itPtr->servPtr, fileName, patterns, &count, &errorDs);
+        }
+        if (status == NS_OK) {
+            Tcl_SetObjResult(interp, Tcl_NewWideIntObj((Tcl_WideInt)count));
+        } else {
+            Tcl_DStringResult(interp, &errorDs);
+            result = TCL_ERROR;
+        }
+        Tcl_DStringFree(&errorDs);
+        ns_free((void *)patterns);
+    }
+
+    return result;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * NsTclInitCacheSnapshot --
+ *
+ *      Load the contents of the caches from the configured snapshot
+ *      file (if it exists) and register a callback saving the caches at
+ *      shutdown.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      Cache entries are added.
+ *
+ *----------------------------------------------------------------------
+ */
+
+void
+NsTclInitCacheSnapshot(NsServer *servPtr)
+{
+    NS_NONNULL_ASSERT(servPtr != NULL);
+
+    if (servPtr->tcl.cachesnapshot != NULL && servPtr->tcl.cachesnapshotcaches != NULL) {
+        struct stat st;
+
+        if (stat(servPtr->tcl.cachesnapshot, &st) == 0) {
+            Tcl_DString   errorDs;
+            unsigned long count = 0u;
+
+            Tcl_DStringInit(&errorDs);
+            if (CacheSnapshotLoad(servPtr, servPtr->tcl.cachesnapshot,
+                                  servPtr->tcl.cachesnapshotcaches,
+                                  &count, &errorDs) == NS_OK) {
+                Ns_Log(Notice, "cache snapshot: loaded %lu entries from %s",
+                       count, servPtr->tcl.cachesnapshot);
+            } else {
+                Ns_Log(Warning, "cache snapshot: %s", errorDs.string);
+            }
+            Tcl_DStringFree(&errorDs);
+        }
+        (void) Ns_RegisterAtShutdown(CacheSnapshotShutdown, servPtr);
+    }
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * CacheSnapshotShutdown --
+ *
+ *      Shutdown callback saving the configured caches to the snapshot
+ *      file.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      Snapshot file is written.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+CacheSnapshotShutdown(const Ns_Time *toPtr, void *arg)
+{
+    /*
+     * Save the caches in the first call of the callback, the second
+     * call (with the timeout) has nothing to wait for.
+     */
+    if (toPtr == NULL) {
+        NsServer      *servPtr = arg;
+        Tcl_DString    errorDs;
+        unsigned long  count = 0u;
+
+        Tcl_DStringInit(&errorDs);
+        if (CacheSnapshotSave(servPtr, servPtr->tcl.cachesnapshot,
+                              servPtr->tcl.cachesnapshotcaches,
+                              &count, &errorDs) == NS_OK) {
+            Ns_Log(Notice, "cache snapshot: saved %lu entries to %s",
+                   count, servPtr->tcl.cachesnapshot);
+        } else {
+            Ns_Log(Warning, "cache snapshot: %s", errorDs.string);
+        }
+        Tcl_DStringFree(&errorDs);
+    }
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * CacheSnapshotMatch --
+ *
+ *      Check, whether the name of a cache matches one of the provided
+ *      patterns.
+ *
+ * Results:
+ *      Boolean value.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static bool
+CacheSnapshotMatch(const char *name, const char **patterns)
+{
+    bool success = NS_FALSE;
+
+    NS_NONNULL_ASSERT(name != NULL);
+    NS_NONNULL_ASSERT(patterns != NULL);
+
+    for (; *patterns != NULL; patterns++) {
+        if (Tcl_StringMatch(name, *patterns) != 0) {
+            success = NS_TRUE;
+            break;
+        }
+    }
+    return success;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * SnapshotWriteFile --
+ *
+ *      Write the provided bytes to the snapshot file at the current
+ *      position.
+ *
+ * Results:
+ *      NS_TRUE on success. On failure, an error message is set.
+ *
+ * Side effects:
+ *      Data is written to the file.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static bool
+SnapshotWriteFile(SnapshotWriter *writerPtr, const void *bytes, size_t length)
+{
+    ssize_t written;
+    bool    success = NS_TRUE;
+
+    NS_NONNULL_ASSERT(writerPtr != NULL);
+    NS_NONNULL_ASSERT(bytes != NULL);
+
+    written = ns_write(writerPtr->fd, bytes, length);
+    if (written < 0) {
+        Ns_DStringPrintf(writerPtr->errorDsPtr, "could not write snapshot file \"%s\": %s",
+                         writerPtr->fileName, strerror(errno));
+        success = NS_FALSE;
+    } else if ((size_t)written != length) {
+        /*
+         * Short write, errno is not set in this case.
+         */
+        Ns_DStringPrintf(writerPtr->errorDsPtr, "could not write snapshot file \"%s\": "
+                         "short write (%" PRIdz " of %" PRIuz " bytes)",
+                         writerPtr->fileName, written, length);
+        success = NS_FALSE;
+    }
+    return success;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * SnapshotFlush --
+ *
+ *      Write the buffered data of a snapshot to the file.
+ *
+ * Results:
+ *      NS_TRUE on success. On failure, an error message is set.
+ *
+ * Side effects:
+ *      Data is written to the file, buffer is emptied.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static bool
+SnapshotFlush(SnapshotWriter *writerPtr)
+{
+    bool success = NS_TRUE;
+
+    NS_NONNULL_ASSERT(writerPtr != NULL);
+
+    if (writerPtr->buffer.length > 0) {
+        success = SnapshotWriteFile(writerPtr, writerPtr->buffer.string,
+                                    (size_t)writerPtr->buffer.length);
+        writerPtr->offset += (off_t)writerPtr->buffer.length;
+        Tcl_DStringSetLength(&writerPtr->buffer, 0);
+    }
+    return success;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * SnapshotWrite --
+ *
+ *      Append the provided bytes to a snapshot. Data is written to the
+ *      file, when the buffer is full. Large data is written directly.
+ *
+ * Results:
+ *      NS_TRUE on success, NS_FALSE when the snapshot has failed.
+ *
+ * Side effects:
+ *      Data might be written to the file.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static bool
+SnapshotWrite(SnapshotWriter *writerPtr, const void *bytes, size_t length)
+{
+    bool success;
+
+    NS_NONNULL_ASSERT(writerPtr != NULL);
+    NS_NONNULL_ASSERT(bytes != NULL);
+
+    success = (writerPtr->errorDsPtr->length == 0);
+
+    if (success) {
+        if (length >= (size_t)SNAPSHOT_BUFSIZE) {
+            success = SnapshotFlush(writerPtr)
+                && SnapshotWriteFile(writerPtr, bytes, length);
+            writerPtr->offset += (off_t)length;
+        } else {
+            Tcl_DStringAppend(&writerPtr->buffer, bytes, (int)length);
+            if (writerPtr->buffer.length >= SNAPSHOT_BUFSIZE) {
+                success = SnapshotFlush(writerPtr);
+            }
+        }
+    }
+    return success;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * SnapshotWriteAt --
+ *
+ *      Overwrite data of a snapshot at the given offset, which has to
+ *      be written already (e.g. a header with the size of the
+ *      following data).
+ *
+ * Results:
+ *      NS_TRUE on success, NS_FALSE when the snapshot has failed.
+ *
+ * Side effects:
+ *      Data might be written to the file.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static bool
+SnapshotWriteAt(SnapshotWriter *writerPtr, off_t offset, const void *bytes, size_t length)
+{
+    bool success;
+
+    NS_NONNULL_ASSERT(writerPtr != NULL);
+    NS_NONNULL_ASSERT(bytes != NULL);
+
+    success = (writerPtr->errorDsPtr->length == 0);
+
+    if (!success) {
+        /*
+         * Snapshot has failed already.
+         */
+    } else if (offset >= writerPtr->offset) {
+        /*
+         * Data is still in the buffer.
+         */
+        memcpy(writerPtr->buffer.string + (offset - writerPtr->offset), bytes, length);
+
+    } else if (ns_lseek(writerPtr->fd, offset, SEEK_SET) == -1) {
+        Ns_DStringPrintf(writerPtr->errorDsPtr, "could not seek in snapshot file \"%s\": %s",
+                         writerPtr->fileName, strerror(errno));
+        success = NS_FALSE;
+
+    } else {
+        success = SnapshotWriteFile(writerPtr, bytes, length);
+        if (success && ns_lseek(writerPtr->fd, writerPtr->offset, SEEK_SET) == -1) {
+            Ns_DStringPrintf(writerPtr->errorDsPtr, "could not seek in snapshot file \"%s\": %s",
+                             writerPtr->fileName, strerror(errno));
+            success = NS_FALSE;
+        }
+    }
+    return success;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * SnapshotAppendPadding --
+ *
+ *      Append zero bytes to a snapshot, such that the next record is
+ *      aligned.
+ *
+ * Results:
+ *      NS_TRUE on success, NS_FALSE when the snapshot has failed.
+ *
+ * Side effects:
+ *      See SnapshotWrite().
+ *
+ *----------------------------------------------------------------------
+ */
+
+static bool
+SnapshotAppendPadding(SnapshotWriter *writerPtr)
+{
+    static const char zeros[SNAPSHOT_ALIGNMENT] = {0};
+    uint64_t          position;
+
+    NS_NONNULL_ASSERT(writerPtr != NULL);
+
+    position = (uint64_t)writerPtr->offset + (uint64_t)writerPtr->buffer.length;
+    return SnapshotWrite(writerPtr, zeros, (size_t)(SNAPSHOT_ALIGN(position) - position));
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * CacheSnapshotSave --
+ *
+ *      Save the committed and not expired entries of the selected
+ *      caches to a snapshot file. The file is written under a
+ *      temporary name and renamed. The entries of a cache are copied
+ *      while the cache is locked into a buffer of bounded size, which
+ *      is written to the file whenever it is full.
+ *
+ * Results:
+ *      NS_OK or NS_ERROR, the number of saved entries is returned in
+ *      countPtr, an error message in errorDsPtr.
+ *
+ * Side effects:
+ *      Snapshot file is written.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static Ns_ReturnCode
+CacheSnapshotSave(NsServer *servPtr, const char *fileName, const char **patterns,
+                  unsigned long *countPtr, Tcl_DString *errorDsPtr)
+{
+    SnapshotHeader       header;
+    SnapshotWriter       writer;
+    Tcl_DString          tmp;
+    const Tcl_HashEntry *hPtr;
+    Tcl_HashSearch       search;
+    TclCache           **caches;
+    int                  ncaches = 0, i;
+    unsigned long        count = 0u;
+    Ns_ReturnCode        status = NS_OK;
+
+    NS_NONNULL_ASSERT(servPtr != NULL);
+    NS_NONNULL_ASSERT(fileName != NULL);
+    NS_NONNULL_ASSERT(patterns != NULL);
+    NS_NONNULL_ASSERT(countPtr != NULL);
+    NS_NONNULL_ASSERT(errorDsPtr != NULL);
+
+    Tcl_DStringInit(&tmp);
+    Tcl_DStringAppend(&tmp, fileName, -1);
+    Tcl_DStringAppend(&tmp, ".XXXXXX", 7);
+
+    writer.fd = ns_mkstemp(tmp.string);
+    if (writer.fd < 0) {
+        Ns_DStringPrintf(errorDsPtr, "could not create snapshot file \"%s\": %s",
+                         tmp.string, strerror(errno));
+        Tcl_DStringFree(&tmp);
+        *countPtr = 0u;
+        return NS_ERROR;
+    }
+    writer.fileName = tmp.string;
+    writer.offset = 0;
+    writer.errorDsPtr = errorDsPtr;
+    Tcl_DStringInit(&writer.buffer);
+
+    /*
+     * Collect the selected caches. Caches are never deleted, so the
+     * pointers remain valid after releasing the lock.
+     */
+    Ns_RWLockRdLock(&servPtr->tcl.cachelock);
+    caches = ns_calloc((size_t)servPtr->tcl.caches.numEntries + 1u, sizeof(TclCache *));
+    for (hPtr = Tcl_FirstHashEntry(&servPtr->tcl.caches, &search);
+         hPtr != NULL;
+         hPtr = Tcl_NextHashEntry(&search)) {
+        if (CacheSnapshotMatch(Tcl_GetHashKey(&servPtr->tcl.caches, hPtr), patterns)) {
+            caches[ncaches++] = Tcl_GetHashValue(hPtr);
+        }
+    }
+    Ns_RWLockUnlock(&servPtr->tcl.cachelock);
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.version = SNAPSHOT_VERSION;
+    header.byteOrder = SNAPSHOT_BYTE_ORDER;
+    header.ncaches = (uint32_t)ncaches;
+    (void) SnapshotWrite(&writer, &header, sizeof(header));
+
+    for (i = 0; i < ncaches && errorDsPtr->length == 0; i++) {
+        Ns_Cache       *cache = caches[i]->cache;
+        const char     *name = Ns_CacheName(cache);
+        SnapshotCache   cacheHeader;
+        Ns_CacheSearch  cacheSearch;
+        const Ns_Entry *entry;
+        off_t           cacheOffset, entriesOffset;
+
+        memset(&cacheHeader, 0, sizeof(cacheHeader));
+        cacheHeader.nameLength = (uint32_t)strlen(name);
+        cacheOffset = writer.offset + (off_t)writer.buffer.length;
+        (void) (SnapshotWrite(&writer, &cacheHeader, sizeof(cacheHeader))
+                && SnapshotWrite(&writer, name, (size_t)cacheHeader.nameLength + 1u)
+                && SnapshotAppendPadding(&writer));
+        entriesOffset = writer.offset + (off_t)writer.buffer.length;
+
+        Ns_CacheLock(cache);
+        for (entry = Ns_CacheFirstEntry(cache, &cacheSearch);
+             entry != NULL && errorDsPtr->length == 0;
+             entry = Ns_CacheNextEntry(&cacheSearch)) {
+            SnapshotEntry  record;
+            const Ns_Time *expiresPtr = Ns_CacheGetExpirey(entry);
+            const char    *key = Ns_CacheKey(entry);
+
+            record.expiresSec = (int64_t)expiresPtr->sec;
+            record.expiresUsec = (int32_t)expiresPtr->usec;
+            record.cost = (int32_t)Ns_CacheGetCost(entry);
+            record.keyLength = (uint32_t)strlen(key);
+            record.valueLength = (uint32_t)Ns_CacheGetSize(entry);
+
+            if (SnapshotWrite(&writer, &record, sizeof(record))
+                && SnapshotWrite(&writer, key, (size_t)record.keyLength + 1u)
+                && SnapshotWrite(&writer, Ns_CacheGetValue(entry), (size_t)record.valueLength)
+                && SnapshotWrite(&writer, "", 1u)
+                && SnapshotAppendPadding(&writer)) {
+                cacheHeader.nentries++;
+            }
+        }
+        Ns_CacheUnlock(cache);
+
+        cacheHeader.size = (uint64_t)(writer.offset + (off_t)writer.buffer.length - entriesOffset);
+        (void) SnapshotWriteAt(&writer, cacheOffset, &cacheHeader, sizeof(cacheHeader));
+        count += cacheHeader.nentries;
+    }
+    ns_free((void *)caches);
+
+    if (errorDsPtr->length == 0) {
+        (void) SnapshotFlush(&writer);
+    }
+    Tcl_DStringFree(&writer.buffer);
+    (void) ns_close(writer.fd);
+
+    if (errorDsPtr->length == 0) {
+#ifdef _WIN32
+        /*
+         * rename() does not replace an existing file on Windows.
+         */
+        (void) unlink(fileName);
+#endif
+        if (rename(tmp.string, fileName) != 0) {
+            Ns_DStringPrintf(errorDsPtr, "could not rename snapshot file \"%s\": %s",
+                             fileName, strerror(errno));
+        }
+    }
+    if (errorDsPtr->length > 0) {
+        (void) unlink(tmp.string);
+        status = NS_ERROR;
+        count = 0u;
+    }
+    Tcl_DStringFree(&tmp);
+
+    *countPtr = count;
+    return status;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * CacheSnapshotLoad --
+ *
+ *      Load the entries of the selected caches from a memory mapped
+ *      snapshot file. Only caches, which exist already, are loaded.
+ *      Expired entries, entries exceeding the maximum entry size of a
+ *      cache and entries with keys already in the cache are skipped.
+ *
+ * Results:
+ *      NS_OK or NS_ERROR, the number of loaded entries is returned in
+ *      countPtr, an error message in errorDsPtr.
+ *
+ * Side effects:
+ *      Cache entries are added, which might cause pruning.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static Ns_ReturnCode
+CacheSnapshotLoad(NsServer *servPtr, const char *fileName, const char **patterns,
+                  unsigned long *countPtr, Tcl_DString *errorDsPtr)
+{
+    struct stat   st;
+    FileMap       map;
+    unsigned long count = 0u;
+    Ns_ReturnCode status = NS_OK;
+
+    NS_NONNULL_ASSERT(servPtr != NULL);
+    NS_NONNULL_ASSERT(fileName != NULL);
+    NS_NONNULL_ASSERT(patterns != NULL);
+    NS_NONNULL_ASSERT(countPtr != NULL);
+    NS_NONNULL_ASSERT(errorDsPtr != NULL);
+
+    if (stat(fileName, &st) != 0) {
+        Ns_DStringPrintf(errorDsPtr, "could not stat snapshot file \"%s\": %s",
+                         fileName, strerror(errno));
+        status = NS_ERROR;
+
+    } else if ((size_t)st.st_size < sizeof(SnapshotHeader)
+               || NsMemMap(fileName, (size_t)st.st_size, NS_MMAP_READ, &map) != NS_OK) {
+        Ns_DStringPrintf(errorDsPtr, "invalid snapshot file \"%s\"", fileName);
+        status = NS_ERROR;
+
+    } else {
+        const char     *p = map.addr, *end = p + map.size;
+        SnapshotHeader  header;
+        Ns_Time         now;
+        uint32_t        i;
+
+        memcpy(&header, p, sizeof(header));
+        if (memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic)) != 0
+            || header.version != SNAPSHOT_VERSION
+            || header.byteOrder != SNAPSHOT_BYTE_ORDER) {
+            Ns_DStringPrintf(errorDsPtr, "invalid snapshot file \"%s\"", fileName);
+            status = NS_ERROR;
+            header.ncaches = 0u;
+        }
+        p += sizeof(header);
+        Ns_GetTime(&now);
+
+        for (i = 0u; i < header.ncaches && status == NS_OK; i++) {
+            SnapshotCache        cacheHeader;
+            const char          *name, *entries;
+            const Tcl_HashEntry *hPtr;
+            TclCache            *cPtr = NULL;
+            size_t               headerSize;
+
+            if ((size_t)(end - p) < sizeof(cacheHeader)) {
+                status = NS_ERROR;
+                break;
+            }
+            memcpy(&cacheHeader, p, sizeof(cacheHeader));
+            name = p + sizeof(cacheHeader);
+            headerSize = SNAPSHOT_ALIGN(sizeof(cacheHeader) + (size_t)cacheHeader.nameLength + 1u);
+            if ((size_t)(end - p) < headerSize
+                || (uint64_t)(end - p - headerSize) < cacheHeader.size
+                || name[cacheHeader.nameLength] != '\0') {
+                status = NS_ERROR;
+                break;
+            }
+            entries = p + headerSize;
+            p = entries + cacheHeader.size;
+
+            if (CacheSnapshotMatch(name, patterns)) {
+                Ns_RWLockRdLock(&servPtr->tcl.cachelock);
+                hPtr = Tcl_FindHashEntry(&servPtr->tcl.caches, name);
+                if (hPtr != NULL) {
+                    cPtr = Tcl_GetHashValue(hPtr);
+                }
+                Ns_RWLockUnlock(&servPtr->tcl.cachelock);
+            }
+            if (cPtr == NULL) {
+                Ns_Log(Notice, "cache snapshot: skip cache %s", name);
+
+            } else {
+                const char *q = entries;
+                uint32_t    j;
+
+                /*
+                 * Add the entries under a single lock of the cache.
+                 */
+                Ns_CacheLock(cPtr->cache);
+                for (j = 0u; j < cacheHeader.nentries; j++) {
+                    SnapshotEntry  record;
+                    const char    *key, *value;
+                    size_t         recordSize;
+                    Ns_Time        expires;
+
+                    if ((size_t)(p - q) < sizeof(record)) {
+                        status = NS_ERROR;
+                        break;
+                    }
+                    memcpy(&record, q, sizeof(record));
+                    recordSize = SNAPSHOT_ALIGN(sizeof(record) + (size_t)record.keyLength
+                                                + (size_t)record.valueLength + 2u);
+                    key = q + sizeof(record);
+                    value = key + record.keyLength + 1u;
+                    if ((size_t)(p - q) < recordSize
+                        || key[record.keyLength] != '\0'
+                        || value[record.valueLength] != '\0') {
+                        status = NS_ERROR;
+                        break;
+                    }
+                    q += recordSize;
+
+                    expires.sec = (time_t)record.expiresSec;
+                    expires.usec = (long)record.expiresUsec;
+
+                    if (record.expiresSec > 0 && Ns_DiffTime(&expires, &now, NULL) < 0) {
+                        /*
+                         * Entry has expired.
+                         */
+                    } else if (cPtr->maxEntry > 0u && (size_t)record.valueLength > cPtr->maxEntry) {
+                        /*
+                         * Entry is too large for this cache.
+                         */
+                    } else {
+                        Ns_Entry *entry;
+                        int       isNew;
+
+                        entry = Ns_CacheCreateEntry(cPtr->cache, key, &isNew);
+                        if (isNew != 0) {
+                            char *copy = ns_malloc((size_t)record.valueLength + 1u);
+
+                            memcpy(copy, value, (size_t)record.valueLength + 1u);
+                            (void) Ns_CacheSetValueExpires(entry, copy, (size_t)record.valueLength,
+                                                           record.expiresSec > 0 ? &expires : NULL,
+                                                           (int)record.cost, 0u, 0u);
+                            count++;
+                        }
+                    }
+                }
+                Ns_CacheUnlock(cPtr->cache);
+            }
+        }
+        NsMemUmap(&map);
+
+        if (status != NS_OK && errorDsPtr->length == 0) {
+            Ns_DStringPrintf(errorDsPtr, "snapshot file \"%s\" is truncated", fileName);
+        }
+    }
+
+    *countPtr = count;
+    return status;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * CreateEntry --
+ *
+ *      Lock the cache (i.e. the shard of the key) and create a new entry
+ *      or return existing entry, waiting up to timeout seconds for
+ *      another thread to complete an update. When staleTimePtr is
+ *      provided, an expired value is kept as stale value for this time
+ *      span while the entry is refreshed (see
+ *      Ns_CacheWaitCreateEntryStaleT()).
+ *
+ * Results:
+ *      Pointer to entry, or NULL on timeout.
  *
  * Side effects:
  *      Cache will be left locked if function returns non-NULL entry.
@@ -1213,20 +2902,19 @@ NsTclCacheStatsObjCmd(ClientData clientData, Tcl_Interp *interp, int objc, Tcl_O
  */
 
 static Ns_Entry *
-CreateEntry(const NsInterp *itPtr, TclCache *cPtr, const char *key, int *newPtr,
-            Ns_Time *timeoutPtr, const Ns_CacheTransactionStack *transactionStackPtr)
+CreateEntry(const NsInterp *itPtr, TclCache *cPtr, Ns_Cache *cache, const char *key, int *newPtr,
+            Ns_Time *timeoutPtr, const Ns_Time *staleTimePtr,
+            const Ns_CacheTransactionStack *transactionStackPtr)
 {
-    Ns_Cache *cache;
     Ns_Entry *entry;
     Ns_Time   t;
 
     NS_NONNULL_ASSERT(itPtr != NULL);
     NS_NONNULL_ASSERT(cPtr != NULL);
+    NS_NONNULL_ASSERT(cache != NULL);
     NS_NONNULL_ASSERT(key != NULL);
     NS_NONNULL_ASSERT(newPtr != NULL);
 
-    cache = cPtr->cache;
-
     if (timeoutPtr == NULL
         && (cPtr->timeout.sec > 0 || cPtr->timeout.usec > 0)) {
         timeoutPtr = Ns_AbsoluteTime(&t, &cPtr->timeout);
@@ -1234,7 +2922,7 @@ CreateEntry(const NsInterp *itPtr, TclCache *cPtr, const char *key, int *newPtr,
         timeoutPtr = Ns_AbsoluteTime(&t, timeoutPtr);
     }
     Ns_CacheLock(cache);
-    entry = Ns_CacheWaitCreateEntryT(cache, key, newPtr, timeoutPtr, transactionStackPtr);
+    entry = Ns_CacheWaitCreateEntryStaleT(cache, key, newPtr, timeoutPtr, staleTimePtr, transactionStackPtr);
     if (unlikely(entry == NULL)) {
         Ns_CacheUnlock(cache);
         Tcl_SetErrorCode(itPtr->interp, "NS_TIMEOUT", (char *)0L);
@@ -213,7 +213,11 @@ static const Cmd servCmds[] = {
     {"ns_cache_incr",            NULL, NsTclCacheIncrObjCmd},
     {"ns_cache_keys",            NULL, NsTclCacheKeysObjCmd},
     {"ns_cache_lappend",         NULL, NsTclCacheLappendObjCmd},
+    {"ns_cache_meval",           NULL, NsTclCacheMEvalObjCmd},
+    {"ns_cache_mget",            NULL, NsTclCacheMGetObjCmd},
+    {"ns_cache_mset",            NULL, NsTclCacheMSetObjCmd},
     {"ns_cache_names",           NULL, NsTclCacheNamesObjCmd},
+    {"ns_cache_snapshot",        NULL, NsTclCacheSnapshotObjCmd},
     {"ns_cache_stats",           NULL, NsTclCacheStatsObjCmd},
     {"ns_cache_transaction_begin", NULL, NsTclCacheTransactionBeginObjCmd},
     {"ns_cache_transaction_commit", NULL, NsTclCacheTransactionCommitObjCmd},
@@ -73,6 +73,20 @@ typedef struct AtClose {
     Tcl_Obj        *objPtr;
 } AtClose;
 
+/*
+ * The following structure maintains the changes of the blueprint from one
+ * epoch to the next, which are the top-level commands of the new
+ * blueprint not contained in the previous one. An interpreter with an
+ * outdated epoch evaluates just the missing deltas, unless these are no
+ * longer in the delta log.
+ */
+
+typedef struct BlueprintDelta {
+    int   epoch;          /* Epoch reached by applying this delta */
+    char *script;         /* Changed top-level commands */
+    int   length;
+} BlueprintDelta;
+
 static Ns_ObjvTable traceWhen[] = {
     {"allocate",   (unsigned int)NS_TCL_TRACE_ALLOCATE},
     {"create",     (unsigned int)NS_TCL_TRACE_CREATE},
@@ -108,6 +122,13 @@ static NsInterp *NewInterpData(Tcl_Interp *interp, NsServer *servPtr)
 static int UpdateInterp(NsInterp *itPtr)
     NS_GNUC_NONNULL(1);
 
+static char *BlueprintDeltaScript(const char *oldScript, const char *newScript, int newLength, int *lengthPtr)
+    NS_GNUC_NONNULL(1) NS_GNUC_NONNULL(2) NS_GNUC_NONNULL(4);
+
+static bool BlueprintCommands(const char *script, int length, Tcl_DString *prefixPtr,
+                              Tcl_HashTable *commandsPtr, Tcl_DString *deltaPtr)
+    NS_GNUC_NONNULL(1) NS_GNUC_NONNULL(3) NS_GNUC_NONNULL(4);
+
 static void RunTraces(NsInterp *itPtr, Ns_TclTraceType why)
     NS_GNUC_NONNULL(1);
 
@@ -331,6 +352,15 @@ ConfigServerTcl(const char *server)
         Tcl_InitHashTable(&servPtr->tcl.synch.condTable, TCL_STRING_KEYS);
         Tcl_InitHashTable(&servPtr->tcl.synch.rwTable, TCL_STRING_KEYS);
 
+        /*
+         * Number of blueprint deltas kept for incremental interpreter
+         * updates on epoch changes.
+         */
+        servPtr->tcl.deltalogsize = Ns_ConfigIntRange(path, "deltalogsize", 100, 0, INT_MAX);
+        if (servPtr->tcl.deltalogsize > 0) {
+            servPtr->tcl.deltas = ns_calloc((size_t)servPtr->tcl.deltalogsize, sizeof(BlueprintDelta));
+        }
+
         servPtr->nsv.rwlocks = Ns_ConfigBool(path, "nsvrwlocks", NS_TRUE);
         servPtr->nsv.nbuckets = Ns_ConfigIntRange(path, "nsvbuckets", 8, 1, INT_MAX);
         servPtr->nsv.buckets = NsTclCreateBuckets(servPtr, servPtr->nsv.nbuckets);
@@ -345,6 +375,25 @@ ConfigServerTcl(const char *server)
             Ns_Log(Error, "config: errorlogheaders is not a list: %s", p);
         }
 
+        /*
+         * Snapshot file for saving the contents of the caches at shutdown
+         * and loading them at startup.
+         */
+        p = Ns_ConfigString(path, "cachesnapshot", NULL);
+        if (p != NULL) {
+            if (Ns_PathIsAbsolute(p) == NS_FALSE) {
+                Ns_HomePath(&ds, p, (char *)0L);
+                servPtr->tcl.cachesnapshot = Ns_DStringExport(&ds);
+            } else {
+                servPtr->tcl.cachesnapshot = ns_strcopy(p);
+            }
+            p = Ns_ConfigString(path, "cachesnapshotcaches", "*");
+            if (Tcl_SplitList(NULL, p, &n, &servPtr->tcl.cachesnapshotcaches) != TCL_OK) {
+                Ns_Log(Error, "config: cachesnapshotcaches is not a list: %s", p);
+                servPtr->tcl.cachesnapshotcaches = NULL;
+            }
+        }
+
         /*
          * Initialize the Tcl detached channel support.
          */
@@ -1380,8 +1429,25 @@ ICtlSaveObjCmd(ClientData clientData, Tcl_Interp *interp, int objc, Tcl_Obj *con
     } else {
         const NsInterp *itPtr = (const NsInterp *)clientData;
         NsServer       *servPtr = itPtr->servPtr;
-        int             length;
+        int             length, epoch, deltaLength = 0;
         const char     *script = ns_strdup(Tcl_GetStringFromObj(scriptObj, &length));
+        char           *oldScript = NULL, *delta = NULL;
+
+        /*
+         * Compute the delta to the previous blueprint outside the write
+         * lock on a copy of the previous blueprint.
+         */
+        Ns_RWLockRdLock(&servPtr->tcl.lock);
+        epoch = servPtr->tcl.epoch;
+        if (servPtr->tcl.deltalogsize > 0 && servPtr->tcl.script != NULL) {
+            oldScript = ns_strdup(servPtr->tcl.script);
+        }
+        Ns_RWLockUnlock(&servPtr->tcl.lock);
+
+        if (oldScript != NULL) {
+            delta = BlueprintDeltaScript(oldScript, script, length, &deltaLength);
+            ns_free(oldScript);
+        }
 
         Ns_RWLockWrLock(&servPtr->tcl.lock);
         ns_free((char *)servPtr->tcl.script);
@@ -1393,6 +1459,25 @@ ICtlSaveObjCmd(ClientData clientData, Tcl_Interp *interp, int objc, Tcl_Obj *con
              */
             ++itPtr->servPtr->tcl.epoch;
         }
+        if (delta != NULL && servPtr->tcl.epoch == epoch + 1) {
+            BlueprintDelta *deltaPtr = &servPtr->tcl.deltas[servPtr->tcl.epoch % servPtr->tcl.deltalogsize];
+
+            ns_free(deltaPtr->script);
+            deltaPtr->epoch = servPtr->tcl.epoch;
+            deltaPtr->script = delta;
+            deltaPtr->length = deltaLength;
+            if (servPtr->tcl.ndeltas < servPtr->tcl.deltalogsize) {
+                servPtr->tcl.ndeltas++;
+            }
+        } else {
+            /*
+             * No delta (first blueprint, parse error, concurrent save or
+             * epoch wrap); interpreters with an older epoch have to
+             * perform a full update.
+             */
+            ns_free(delta);
+            servPtr->tcl.ndeltas = 0;
+        }
         Ns_RWLockUnlock(&servPtr->tcl.lock);
     }
     return result;
@@ -1785,6 +1870,14 @@ NsTclInitServer(const char *server)
             (void) Ns_TclLogErrorInfo(interp, "\n(context: init server)");
         }
         Ns_TclDeAllocateInterp(interp);
+
+        /*
+         * The caches are created by the init scripts, load their
+         * contents from the snapshot file (if configured).
+         */
+        if (servPtr->tcl.cachesnapshot != NULL) {
+            NsTclInitCacheSnapshot(servPtr);
+        }
     }
     Ns_ThreadSetName("-main:%s-", server);
 }
@@ -2250,7 +2343,9 @@ NewInterpData(Tcl_Interp *interp, NsServer *servPtr)
  * UpdateInterp --
  *
  *      Update the state of an interp by evaluating the saved script
- *      whenever the epoch changes.
+ *      whenever the epoch changes. When the deltas from the epoch of the
+ *      interp to the current epoch are still in the delta log, only these
+ *      are evaluated.
  *
  * Results:
  *      Tcl result.
@@ -2267,7 +2362,7 @@ UpdateInterp(NsInterp *itPtr)
     NsServer   *servPtr;
     int         result = TCL_OK, epoch, scriptLength = 0;
     const char *script = NULL;
-    bool        doUpdateNow = NS_FALSE;
+    bool        doUpdateNow = NS_FALSE, incremental = NS_FALSE;
 
     NS_NONNULL_ASSERT(itPtr != NULL);
     servPtr = itPtr->servPtr;
@@ -2284,13 +2379,31 @@ UpdateInterp(NsInterp *itPtr)
     Ns_RWLockRdLock(&servPtr->tcl.lock);
     if (itPtr->epoch != servPtr->tcl.epoch) {
         epoch = servPtr->tcl.epoch;
+        incremental = (itPtr->epoch > 0
+                       && epoch > itPtr->epoch
+                       && epoch - itPtr->epoch <= servPtr->tcl.ndeltas);
         /*
          * The epoch has changed. Perform the interpreter update now, when
-         * either (a) the interpreter is fresh, or (b) when the concurrently
-         * running updates are below "maxConcurrentUpdates".
+         * either (a) the interpreter is fresh, or (b) the missing deltas
+         * are available, or (c) when the concurrently running full updates
+         * are below "maxConcurrentUpdates".
          */
-        doUpdateNow = (itPtr->epoch < 1) || (concurrentUpdates < maxConcurrentUpdates);
-        if (doUpdateNow) {
+        doUpdateNow = (itPtr->epoch < 1) || incremental || (concurrentUpdates < maxConcurrentUpdates);
+        if (incremental) {
+            Tcl_DString ds;
+            int         e;
+
+            Tcl_DStringInit(&ds);
+            for (e = itPtr->epoch + 1; e <= epoch; e++) {
+                const BlueprintDelta *deltaPtr = &servPtr->tcl.deltas[e % servPtr->tcl.deltalogsize];
+
+                assert(deltaPtr->epoch == e);
+                Tcl_DStringAppend(&ds, deltaPtr->script, deltaPtr->length);
+            }
+            scriptLength = ds.length;
+            script = Ns_DStringExport(&ds);
+
+        } else if (doUpdateNow) {
             concurrentUpdates++;
             script = ns_strdup(servPtr->tcl.script);
             scriptLength = servPtr->tcl.length;
@@ -2304,15 +2417,17 @@ UpdateInterp(NsInterp *itPtr)
         if (doUpdateNow) {
             Ns_Time startTime, now, diffTime;
 
-            Ns_Log(Notice, "start update interpreter %s to epoch %d, concurrent %d",
+            Ns_Log(Notice, "start %s update interpreter %s to epoch %d, concurrent %d",
+                   incremental ? "incremental" : "full",
                    servPtr->server, epoch, concurrentUpdates);
             Ns_GetTime(&startTime);
             result = Tcl_EvalEx(itPtr->interp, script,
                                 scriptLength, TCL_EVAL_GLOBAL);
             Ns_GetTime(&now);
             Ns_DiffTime(&now, &startTime, &diffTime);
-            Ns_Log(Notice, "update interpreter %s to epoch %d done, trace %s, time "
+            Ns_Log(Notice, "%s update interpreter %s to epoch %d done, trace %s, time "
                    NS_TIME_FMT " secs concurrent %d",
+                   incremental ? "incremental" : "full",
                    servPtr->server, epoch,
                    GetTraceLabel(itPtr->currentTrace),
                    (int64_t) diffTime.sec, diffTime.usec,
@@ -2321,9 +2436,11 @@ UpdateInterp(NsInterp *itPtr)
             itPtr->epoch = epoch;
             ns_free((char *)script);
 
-            Ns_MutexLock(&updateLock);
-            concurrentUpdates--;
-            Ns_MutexUnlock(&updateLock);
+            if (!incremental) {
+                Ns_MutexLock(&updateLock);
+                concurrentUpdates--;
+                Ns_MutexUnlock(&updateLock);
+            }
         } else {
             Ns_Log(Notice, "postponed update, %s epoch %d interpreter (concurrent %d max %d)",
                    servPtr->server, epoch, concurrentUpdates, maxConcurrentUpdates);
@@ -2333,6 +2450,174 @@ UpdateInterp(NsInterp *itPtr)
     return result;
 }
 
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * BlueprintCommands --
+ *
+ *      Helper of BlueprintDeltaScript() processing the commands of a
+ *      blueprint script. The bodies of top-level "namespace eval"
+ *      commands are processed command by command, such that the order of
+ *      the procs and variables within a namespace does not matter. The
+ *      keys of the commands are prefixed by the namespace name.
+ *
+ *      When deltaPtr is NULL, the keys of the commands are added to the
+ *      hash table. Otherwise, the commands with keys not in the hash
+ *      table are appended to deltaPtr (wrapped into "namespace eval" when
+ *      necessary).
+ *
+ * Results:
+ *      NS_FALSE, when the script cannot be parsed.
+ *
+ * Side effects:
+ *      Updates the hash table or the delta.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static bool
+BlueprintCommands(const char *script, int length, Tcl_DString *prefixPtr,
+                  Tcl_HashTable *commandsPtr, Tcl_DString *deltaPtr)
+{
+    Tcl_Parse   parse;
+    Tcl_DString keyDs;
+    const char *p = script, *end = script + length;
+    bool        success = NS_TRUE;
+    int         prefixLength = prefixPtr->length, isNew;
+
+    Tcl_DStringInit(&keyDs);
+
+    while (success && p < end) {
+        if (Tcl_ParseCommand(NULL, p, (int)(end - p), 0, &parse) != TCL_OK) {
+            success = NS_FALSE;
+
+        } else {
+            const char *cmdEnd = parse.commandStart + parse.commandSize;
+            int         cmdLength = parse.commandSize;
+
+            if (cmdLength > 0 && (*(cmdEnd - 1) == '\n' || *(cmdEnd - 1) == ';')) {
+                cmdLength--;
+            }
+
+            if (parse.numWords == 0) {
+                /*
+                 * Nothing to do.
+                 */
+            } else if (prefixLength == 0
+                       && parse.numWords == 4
+                       && parse.tokenPtr[0].type == TCL_TOKEN_SIMPLE_WORD
+                       && parse.tokenPtr[2].type == TCL_TOKEN_SIMPLE_WORD
+                       && parse.tokenPtr[4].type == TCL_TOKEN_SIMPLE_WORD
+                       && parse.tokenPtr[6].type == TCL_TOKEN_SIMPLE_WORD
+                       && parse.tokenPtr[1].size == 9
+                       && strncmp(parse.tokenPtr[1].start, "namespace", 9u) == 0
+                       && parse.tokenPtr[3].size == 4
+                       && strncmp(parse.tokenPtr[3].start, "eval", 4u) == 0) {
+                /*
+                 * Top-level "namespace eval name body": process the
+                 * commands of the body with the namespace as prefix.
+                 */
+                const Tcl_Token *nameTokenPtr = &parse.tokenPtr[4], *bodyTokenPtr = &parse.tokenPtr[7];
+                Tcl_DString      bodyDs;
+
+                Tcl_DStringAppend(prefixPtr, nameTokenPtr->start, nameTokenPtr->size);
+                Tcl_DStringAppend(prefixPtr, "\n", 1);
+
+                if (deltaPtr == NULL) {
+                    (void) Tcl_CreateHashEntry(commandsPtr, prefixPtr->string, &isNew);
+                    success = BlueprintCommands(bodyTokenPtr->start, bodyTokenPtr->size,
+                                                prefixPtr, commandsPtr, NULL);
+                } else {
+                    Tcl_DStringInit(&bodyDs);
+                    success = BlueprintCommands(bodyTokenPtr->start, bodyTokenPtr->size,
+                                                prefixPtr, commandsPtr, &bodyDs);
+                    if (bodyDs.length > 0
+                        || Tcl_FindHashEntry(commandsPtr, prefixPtr->string) == NULL) {
+                        Tcl_DStringAppend(deltaPtr, "namespace eval ", 15);
+                        Tcl_DStringAppend(deltaPtr, nameTokenPtr->start, nameTokenPtr->size);
+                        Tcl_DStringAppend(deltaPtr, " {\n", 3);
+                        Tcl_DStringAppend(deltaPtr, bodyDs.string, bodyDs.length);
+                        Tcl_DStringAppend(deltaPtr, "}\n", 2);
+                    }
+                    Tcl_DStringFree(&bodyDs);
+                }
+                Tcl_DStringSetLength(prefixPtr, prefixLength);
+
+            } else {
+                Tcl_DStringSetLength(&keyDs, 0);
+                Tcl_DStringAppend(&keyDs, prefixPtr->string, prefixLength);
+                Tcl_DStringAppend(&keyDs, parse.commandStart, cmdLength);
+
+                if (deltaPtr == NULL) {
+                    (void) Tcl_CreateHashEntry(commandsPtr, keyDs.string, &isNew);
+                } else if (Tcl_FindHashEntry(commandsPtr, keyDs.string) == NULL) {
+                    Tcl_DStringAppend(deltaPtr, parse.commandStart, cmdLength);
+                    Tcl_DStringAppend(deltaPtr, "\n", 1);
+                }
+            }
+            p = cmdEnd;
+            Tcl_FreeParse(&parse);
+        }
+    }
+    Tcl_DStringFree(&keyDs);
+
+    return success;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * BlueprintDeltaScript --
+ *
+ *      Compute the delta between two blueprint scripts, consisting of the
+ *      commands of the new script not contained in the old script. The
+ *      commands in the bodies of top-level "namespace eval" commands
+ *      (containing the procs and variables of a namespace) are compared
+ *      individually. The commands are kept in the order of the new
+ *      script.
+ *
+ * Results:
+ *      Delta script to be freed with ns_free(), or NULL when one of the
+ *      scripts cannot be parsed.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static char *
+BlueprintDeltaScript(const char *oldScript, const char *newScript, int newLength, int *lengthPtr)
+{
+    Tcl_HashTable commands;
+    Tcl_DString   ds, prefixDs;
+    char         *result = NULL;
+
+    NS_NONNULL_ASSERT(oldScript != NULL);
+    NS_NONNULL_ASSERT(newScript != NULL);
+    NS_NONNULL_ASSERT(lengthPtr != NULL);
+
+    Tcl_InitHashTable(&commands, TCL_STRING_KEYS);
+    Tcl_DStringInit(&ds);
+    Tcl_DStringInit(&prefixDs);
+
+    if (BlueprintCommands(oldScript, (int)strlen(oldScript), &prefixDs, &commands, NULL)
+        && BlueprintCommands(newScript, newLength, &prefixDs, &commands, &ds)) {
+        *lengthPtr = ds.length;
+        result = Ns_DStringExport(&ds);
+    } else {
+        Ns_Log(Warning, "blueprint delta could not be computed, perform full updates");
+        Tcl_DStringFree(&ds);
+    }
+    Tcl_DStringFree(&prefixDs);
+    Tcl_DeleteHashTable(&commands);
+
+    return result;
+}
+
+
 
 /*
  *----------------------------------------------------------------------
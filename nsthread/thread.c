@@ -40,6 +40,10 @@
 # include <sys/syscall.h>
 #endif
 
+#ifdef __linux__
+# include <sched.h>
+#endif
+
 /*
  * The following structure maintains all state for a thread
  * including thread local storage slots.
@@ -56,6 +60,7 @@ typedef struct Thread {
     unsigned char  *bottomOfStack;   /* for estimating currentStackSize */
     char            name[NS_THREAD_NAMESIZE+1];   /* Thread name. */
     char            parent[NS_THREAD_NAMESIZE+1]; /* Parent name. */
+    char            cpus[NS_THREAD_NAMESIZE+1];   /* CPU affinity (if set). */
 } Thread;
 
 static Thread *NewThread(void) NS_GNUC_RETURNS_NONNULL;
@@ -379,6 +384,7 @@ Ns_ThreadList(Tcl_DString *dsPtr, Ns_ThreadArgProc *proc)
 
             written = ns_uint32toa(buf, (uint32_t)thrPtr->ostid);
             Tcl_DStringAppend(dsPtr, buf, written);
+            Tcl_DStringAppendElement(dsPtr, thrPtr->cpus);
 
             Tcl_DStringEndSublist(dsPtr);
         }
@@ -386,6 +392,81 @@ Ns_ThreadList(Tcl_DString *dsPtr, Ns_ThreadArgProc *proc)
     Ns_MasterUnlock();
 }
 
+/*
+ *----------------------------------------------------------------------
+ *
+ * Ns_ThreadSetAffinity --
+ *
+ *      Restrict the calling thread to the specified CPUs. The CPUs are
+ *      specified as a comma separated list of CPU numbers and ranges,
+ *      such as "0-3,8". The CPU set is kept for Ns_ThreadList().
+ *
+ * Results:
+ *      NS_OK on success, NS_ERROR when the specification is invalid,
+ *      the operating system rejected it, or thread affinity is not
+ *      supported on this platform.
+ *
+ * Side effects:
+ *      The thread will run only on the specified CPUs.
+ *
+ *----------------------------------------------------------------------
+ */
+
+Ns_ReturnCode
+Ns_ThreadSetAffinity(const char *cpus)
+{
+    Ns_ReturnCode status = NS_ERROR;
+
+    NS_NONNULL_ASSERT(cpus != NULL);
+
+#if defined(__linux__) && defined(CPU_SET)
+    {
+        cpu_set_t   set;
+        const char *p = cpus;
+        bool        valid = NS_TRUE;
+
+        CPU_ZERO(&set);
+        while (valid && *p != '\0') {
+            char *end;
+            long  first, last;
+
+            first = strtol(p, &end, 10);
+            last = first;
+            if (end == p) {
+                valid = NS_FALSE;
+            } else if (*end == '-') {
+                p = end + 1;
+                last = strtol(p, &end, 10);
+                valid = (end != p);
+            }
+            if (valid && first >= 0 && first <= last && last < CPU_SETSIZE) {
+                long cpu;
+
+                for (cpu = first; cpu <= last; cpu++) {
+                    CPU_SET((int)cpu, &set);
+                }
+                p = (*end == ',') ? end + 1 : end;
+                valid = (*end == ',' || *end == '\0');
+            } else {
+                valid = NS_FALSE;
+            }
+        }
+
+        if (valid && CPU_COUNT(&set) > 0
+            && sched_setaffinity(0, sizeof(set), &set) == 0) {
+            Thread *thisPtr = GetThread();
+
+            Ns_MasterLock();
+            snprintf(thisPtr->cpus, sizeof(thisPtr->cpus), "%s", cpus);
+            Ns_MasterUnlock();
+            status = NS_OK;
+        }
+    }
+#endif
+
+    return status;
+}
+
 /*
  *----------------------------------------------------------------------
  *
@@ -119,6 +119,7 @@ ns_runonce {
         variable exclnsp   ""     ; # List of namespaces to exclude
         variable enabled    0     ; # True if trace is enabled
         variable config           ; # Array with config options
+        variable lazyseen         ; # Array of lazy procs in the blueprint
         variable epoch     -1     ; # The initialization epoch
 
         # Private namespaces
@@ -138,6 +139,9 @@ ns_runonce {
         # Allow creation of interp initialization epochs
         set config(-doepochs)  1
 
+        # Serialize procs as stubs materialized on first call
+        set config(-lazyprocs) 0
+
         #
         # Used to set/get nstrace options.
         #
@@ -338,9 +342,11 @@ ns_runonce {
 
         proc statescript {{file ""}} {
             variable scripts
+            variable lazyseen
 
             set script {}
             set import {}
+            array unset lazyseen
 
             #
             # Invoke [load] script generator first
@@ -464,6 +470,12 @@ ns_runonce {
                 append script $import \n
             }
 
+            #
+            # Drop the shared definitions of deleted procs
+            #
+
+            _lazysweep
+
             #
             # Invoke [rename] script generators last
             # ... deactivated by GN
@@ -797,17 +809,109 @@ ns_runonce {
         #
 
         proc _procscript {cmd} {
-            set pargs {}
-            foreach arg [info args $cmd] {
-                if {![info default $cmd $arg def]} {
-                    lappend pargs $arg
+            variable config
+            set pname [::namespace tail $cmd]
+            set fqcmd [::namespace which -command $cmd]
+            set pbody [info body $cmd]
+            if {[string match "tailcall ::nstrace::_materialize *" $pbody]} {
+                #
+                # A stub not called so far in this interp, get the
+                # definition from the shared store.
+                #
+                lassign [_lazydef $fqcmd [lindex $pbody 3]] pargs pbody
+            } else {
+                set pargs {}
+                foreach arg [info args $cmd] {
+                    if {![info default $cmd $arg def]} {
+                        lappend pargs $arg
+                    } else {
+                        lappend pargs [list $arg $def]
+                    }
+                }
+            }
+            if {!$config(-lazyprocs) || [string match ::nstrace::* $fqcmd]} {
+                append script "proc [list $pname] [list $pargs] [list $pbody]" \n
+            } else {
+                #
+                # Keep the definition in the shared store and emit a
+                # stub. The generation of the definition is part of
+                # the stub, such that a changed definition leads to a
+                # changed blueprint.
+                #
+                # The store keeps the current and the previous
+                # generation of a definition, such that stubs of
+                # interps still running with the previous blueprint
+                # materialize the definition they were created with.
+                #
+                variable lazyseen
+                set def [list $pargs $pbody]
+                set entries {}
+                if {[nsv_exists nstrace-lazyprocs $fqcmd]} {
+                    set entries [nsv_get nstrace-lazyprocs $fqcmd]
+                }
+                if {[llength $entries] == 0} {
+                    set gen 0
+                    nsv_set nstrace-lazyprocs $fqcmd [list [list $gen {*}$def]]
+                } elseif {[lrange [lindex $entries 0] 1 end] ne $def} {
+                    set gen [expr {[lindex $entries 0 0] + 1}]
+                    nsv_set nstrace-lazyprocs $fqcmd \
+                        [list [list $gen {*}$def] [lindex $entries 0]]
                 } else {
-                    lappend pargs [list $arg $def]
+                    set gen [lindex $entries 0 0]
                 }
+                set lazyseen($fqcmd) 1
+                set stub "tailcall ::nstrace::_materialize [list $fqcmd] $gen {*}\$args"
+                append script "proc [list $pname] args [list $stub]" \n
             }
-            set pname [::namespace tail $cmd]
-            set pbody [info body $cmd]
-            append script "proc [list $pname] [list $pargs] [list $pbody]" \n
+        }
+
+        #
+        # Returns the arguments and the body of the given generation
+        # of a proc from the shared store. When this generation is not
+        # available anymore, the most recent definition is returned.
+        #
+
+        proc _lazydef {cmd gen} {
+            if {![nsv_exists nstrace-lazyprocs $cmd]} {
+                error "no definition of lazy proc $cmd"
+            }
+            set entries [nsv_get nstrace-lazyprocs $cmd]
+            foreach entry $entries {
+                if {[lindex $entry 0] == $gen} {
+                    return [lrange $entry 1 end]
+                }
+            }
+            ns_log notice "nstrace: generation $gen of lazy proc $cmd is not\
+                available, using generation [lindex $entries 0 0]"
+            return [lrange [lindex $entries 0] 1 end]
+        }
+
+        #
+        # Removes the definitions of procs from the shared store,
+        # which were not serialized in the last blueprint, since
+        # these were deleted or renamed.
+        #
+
+        proc _lazysweep {} {
+            variable lazyseen
+            foreach cmd [nsv_array names nstrace-lazyprocs] {
+                if {![info exists lazyseen($cmd)]} {
+                    nsv_unset -nocomplain nstrace-lazyprocs $cmd
+                }
+            }
+            array unset lazyseen
+        }
+
+        #
+        # Replaces a proc stub by the proc definition from the shared
+        # store and calls it. Called on the first invocation of the
+        # stub, which is replaced by the tailcall.
+        #
+
+        proc _materialize {cmd gen args} {
+            lassign [_lazydef $cmd $gen] pargs pbody
+            uplevel #0 [list ::proc $cmd $pargs $pbody]
+            tailcall $cmd {*}$args
         }
 
         #